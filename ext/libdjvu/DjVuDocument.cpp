@@ -507,6 +507,17 @@ DjVuDocument::get_int_prefix(void) const
    return retval.format("document_%p%d?", this, hash(init_url));
 }
 
+/* SumatraPDF: only share decoded files between documents using the same cache
+   (instead of publishing them under their plain URL for all documents, which
+   handed out files decoded from an outdated copy of a modified document and
+   made documents in different contexts share files without sharing a lock) */
+static GUTF8String
+cache_alias(const DjVuFileCache * cache, const GUTF8String &name)
+{
+   GUTF8String retval;
+   return retval.format("cache_%p?", cache)+name;
+}
+
 void
 DjVuDocument::set_file_aliases(const DjVuFile * file)
 {
@@ -524,20 +535,20 @@ DjVuDocument::set_file_aliases(const DjVuFile * file)
 	 // assign a global alias to this file, so that any other
 	 // DjVuDocument will be able to use it.
       
-      pcaster->add_alias(file, file->get_url().get_string());
+      pcaster->add_alias(file, cache_alias(cache, file->get_url().get_string()));
       if (flags & (DOC_NDIR_KNOWN | DOC_DIR_KNOWN))
       {
 	 int page_num=url_to_page(file->get_url());
 	 if (page_num>=0)
 	 {
-	    if (page_num==0) pcaster->add_alias(file, init_url.get_string()+"#-1");
-	    pcaster->add_alias(file, init_url.get_string()+"#"+GUTF8String(page_num));
+	    if (page_num==0) pcaster->add_alias(file, cache_alias(cache, init_url.get_string()+"#-1"));
+	    pcaster->add_alias(file, cache_alias(cache, init_url.get_string()+"#"+GUTF8String(page_num)));
 	 }
       }
 	 // The following line MUST stay here. For OLD_INDEXED documents
 	 // a page may finish decoding before DIR or NDIR becomes known
 	 // (multithreading, remember), so the code above would not execute
-      pcaster->add_alias(file, file->get_url().get_string()+"#-1");
+      pcaster->add_alias(file, cache_alias(cache, file->get_url().get_string()+"#-1"));
    } else pcaster->add_alias(file, get_int_prefix()+file->get_url());
 }
 
@@ -866,7 +877,7 @@ DjVuDocument::url_to_file(const GURL & url, bool dont_create) const
    if (cache)
    {
 	 // First - fully decoded files
-      port=pcaster->alias_to_port(url.get_string());
+      port=pcaster->alias_to_port(cache_alias(cache, url.get_string()));
       if (port && port->inherits("DjVuFile"))
       {
 	 DEBUG_MSG("found fully decoded file using DjVuPortcaster\n");
@@ -921,7 +932,7 @@ DjVuDocument::get_djvu_file(int page_num, bool dont_create) const
 	 DEBUG_MSG("Structure is not known => check <doc_url>#<page_num> alias...\n");
 	 GP<DjVuPort> port;
 	 if (cache)
-	    port=pcaster->alias_to_port(init_url.get_string()+"#"+GUTF8String(page_num));
+	    port=pcaster->alias_to_port(cache_alias(cache, init_url.get_string()+"#"+GUTF8String(page_num)));
 	 if (!port || !port->inherits("DjVuFile"))
 	 {
 	    DEBUG_MSG("failed => invent dummy URL and proceed\n");
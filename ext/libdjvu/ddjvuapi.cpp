@@ -358,7 +358,9 @@ ddjvu_context_create(const char *programname)
   ddjvu_context_t *ctx = 0;
   G_TRY
     {
-#ifdef LC_ALL
+/* SumatraPDF: don't change the locale whenever a context is created,
+   as other threads might currently depend on it */
+#if defined(LC_ALL) && (!defined(DO_CHANGELOCALE) || DO_CHANGELOCALE)
       setlocale(LC_ALL,"");
 # ifdef LC_NUMERIC
       setlocale(LC_NUMERIC, "C");
@@ -232,11 +232,15 @@ struct fz_locks_context_s
 	void (*unlock)(void *user, int lock);
 };
 
+/* SumatraPDF: one lock per glyph cache shard (FZ_LOCK_GLYPHCACHE + n) */
+#define FZ_GLYPH_CACHE_SHARDS 4
+
 enum {
 	FZ_LOCK_ALLOC = 0,
 	FZ_LOCK_FILE, /* Unused now */
 	FZ_LOCK_FREETYPE,
 	FZ_LOCK_GLYPHCACHE,
+	FZ_LOCK_GLYPHCACHE_LAST = FZ_LOCK_GLYPHCACHE + FZ_GLYPH_CACHE_SHARDS - 1,
 	FZ_LOCK_MAX
 };
 
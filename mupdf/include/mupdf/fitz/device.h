@@ -318,6 +318,24 @@ fz_device *fz_new_draw_device_with_bbox(fz_context *ctx, fz_pixmap *dest, const
 
 fz_device *fz_new_draw_device_type3(fz_context *ctx, fz_pixmap *dest);
 
+/* SumatraPDF: allow comparing SIMD and scalar painting functions */
+/*
+	fz_enable_simd_painters: Enable or disable the SIMD versions of
+	the draw device's most frequently used painting and image scaling
+	functions (they are enabled by default wherever the CPU supports
+	them). These produce exactly the same pixels as the scalar versions.
+
+	Returns whether SIMD versions are used from now on.
+*/
+int fz_enable_simd_painters(int enable);
+
+/*
+	fz_enable_fast_paths: Enable or disable the box filter used for
+	downscaling images by exactly 2x or 4x (enabled by default). Its
+	results slightly differ from those of the general image scaler.
+*/
+void fz_enable_fast_paths(int enable);
+
 /* SumatraPDF: GDI+ draw device */
 #ifdef _WIN32
 fz_device *fz_new_gdiplus_device(fz_context *ctx, void *dc, const fz_rect *base_clip);
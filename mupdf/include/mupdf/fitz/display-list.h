@@ -88,4 +88,14 @@ fz_display_list *fz_keep_display_list(fz_context *ctx, fz_display_list *list);
 */
 void fz_drop_display_list(fz_context *ctx, fz_display_list *list);
 
+/* SumatraPDF: allow to account for the memory used by display lists */
+/*
+	fz_display_list_size: Return the number of bytes allocated for
+	the nodes, paths and texts of a display list. Images, shades and
+	fonts are shared with the store and thus not included.
+
+	Does not throw exceptions.
+*/
+size_t fz_display_list_size(fz_display_list *list);
+
 #endif
@@ -33,6 +33,30 @@ fz_pixmap *fz_render_stroked_glyph_pixmap(fz_context *ctx, fz_font*, int, fz_mat
 void fz_render_t3_glyph_direct(fz_context *ctx, fz_device *dev, fz_font *font, int gid, const fz_matrix *trm, void *gstate, int nestedDepth);
 void fz_prepare_t3_glyph(fz_context *ctx, fz_font *font, int gid, int nestedDepth);
 void fz_dump_glyph_cache_stats(fz_context *ctx);
+
+/* SumatraPDF: glyph cache statistics for benchmarking */
+typedef struct fz_glyph_cache_stats_s fz_glyph_cache_stats;
+
+struct fz_glyph_cache_stats_s
+{
+	int count;
+	int total;
+	int max;
+	int lookups;
+	int hits;
+	int num_evictions;
+	int evicted;
+};
+
+/*
+	fz_get_glyph_cache_stats: Retrieve the size and limit of a glyph
+	cache shard as well as its number of lookups, hits and evictions.
+
+	shard: 0 to FZ_GLYPH_CACHE_SHARDS - 1 or -1 for the totals of all shards.
+
+	Does not throw exceptions.
+*/
+void fz_get_glyph_cache_stats(fz_context *ctx, int shard, fz_glyph_cache_stats *stats);
 float fz_subpixel_adjust(fz_matrix *ctm, fz_matrix *subpix_ctm, unsigned char *qe, unsigned char *qf);
 
 #endif
@@ -81,6 +81,8 @@ struct fz_image_s
 };
 
 fz_pixmap *fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *cs, int indexed);
+/* SumatraPDF: decode JPX images at 1/2^l2factor of their size (l2factor returns the factor actually applied) */
+fz_pixmap *fz_load_jpx_reduced(fz_context *ctx, unsigned char *data, int size, fz_colorspace *cs, int indexed, int *l2factor);
 fz_pixmap *fz_load_png(fz_context *ctx, unsigned char *data, int size);
 fz_pixmap *fz_load_tiff(fz_context *ctx, unsigned char *data, int size);
 fz_pixmap *fz_load_jxr(fz_context *ctx, unsigned char *data, int size);
@@ -89,6 +91,8 @@ void fz_load_jpeg_info(fz_context *ctx, unsigned char *data, int size, int *w, i
 void fz_load_png_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_tiff_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_jxr_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
+/* SumatraPDF: cspace is set to NULL for images which can't be decoded through fz_load_jpx_reduced */
+void fz_load_jpx_info(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 
 int fz_load_tiff_subimage_count(fz_context *ctx, unsigned char *buf, int len);
 fz_pixmap *fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage);
@@ -84,6 +84,20 @@ struct fz_store_hash_s
 	} u;
 };
 
+/*
+	SumatraPDF: Every item in the store is of one of the following
+	kinds, so that e.g. decoded images can't evict all fonts and
+	resources (cf. fz_set_store_kind_max).
+*/
+enum
+{
+	FZ_STORE_OTHER = 0,
+	FZ_STORE_IMAGE, /* compressed and decoded images, cached tiles */
+	FZ_STORE_FONT, /* fonts and cmaps */
+	FZ_STORE_RESOURCE, /* colorspaces, functions, shadings, patterns, forms */
+	FZ_STORE_KINDS
+};
+
 typedef struct fz_store_type_s fz_store_type;
 
 struct fz_store_type_s
@@ -92,6 +106,9 @@ struct fz_store_type_s
 	void *(*keep_key)(fz_context *,void *);
 	void (*drop_key)(fz_context *,void *);
 	int (*cmp_key)(void *, void *);
+	/* SumatraPDF: returns one of FZ_STORE_* for a key (NULL for
+	 * FZ_STORE_OTHER). Called without any locks held. */
+	int (*kind)(void *);
 #ifndef NDEBUG
 	void (*debug)(FILE *, void *);
 #endif
@@ -183,6 +200,46 @@ void fz_empty_store(fz_context *ctx);
 */
 int fz_store_scavenge(fz_context *ctx, unsigned int size, int *phase);
 
+/* SumatraPDF: per-kind budgets and statistics */
+typedef struct fz_store_stats_s fz_store_stats;
+
+struct fz_store_stats_s
+{
+	unsigned int size;
+	unsigned int max;
+	unsigned int items;
+	unsigned int lookups;
+	unsigned int hits;
+	unsigned int evictions;
+	unsigned int evicted;
+};
+
+/*
+	fz_set_store_kind_max: Limit the size of all items of the given
+	kind within the store (in addition to the store's overall limit).
+	Items of other kinds are never evicted for making space for an
+	item of a kind which has reached its limit.
+
+	kind: One of FZ_STORE_*.
+
+	max: The maximum size (in bytes) of all items of that kind.
+	FZ_STORE_UNLIMITED (the default) means no further limit.
+*/
+void fz_set_store_kind_max(fz_context *ctx, int kind, unsigned int max);
+
+/*
+	fz_get_store_stats: Retrieve the size and limit of all items of
+	a kind within the store as well as the number of lookups, hits
+	and evictions (and evicted bytes) for that kind so far.
+
+	kind: One of FZ_STORE_* or -1 for the totals of the whole store.
+	The lookups of a kind are its hits plus the items stored after a
+	miss (as the kind of a key is only determined once it's stored).
+
+	Does not throw exceptions.
+*/
+void fz_get_store_stats(fz_context *ctx, int kind, fz_store_stats *stats);
+
 /*
 	fz_print_store: Dump the contents of the store for debugging.
 */
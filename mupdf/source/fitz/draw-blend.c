@@ -316,8 +316,35 @@ fz_blend_separable(byte * restrict bp, byte * restrict sp, int n, int w, int ble
 	}
 }
 
+/* SumatraPDF: blend pixmaps in BGR order with the same luminosity weights as RGB */
+static void
+fz_blend_nonseparable_rgb(unsigned char *rr, unsigned char *rg, unsigned char *rb, int br, int bg, int bb, int sr, int sg, int sb, int blendmode, int bgr)
+{
+	if (bgr)
+	{
+		fz_blend_nonseparable_rgb(rb, rg, rr, bb, bg, br, sb, sg, sr, blendmode, 0);
+		return;
+	}
+	switch (blendmode)
+	{
+	default:
+	case FZ_BLEND_HUE:
+		fz_hue_rgb(rr, rg, rb, br, bg, bb, sr, sg, sb);
+		break;
+	case FZ_BLEND_SATURATION:
+		fz_saturation_rgb(rr, rg, rb, br, bg, bb, sr, sg, sb);
+		break;
+	case FZ_BLEND_COLOR:
+		fz_color_rgb(rr, rg, rb, br, bg, bb, sr, sg, sb);
+		break;
+	case FZ_BLEND_LUMINOSITY:
+		fz_luminosity_rgb(rr, rg, rb, br, bg, bb, sr, sg, sb);
+		break;
+	}
+}
+
 void
-fz_blend_nonseparable(byte * restrict bp, byte * restrict sp, int w, int blendmode)
+fz_blend_nonseparable(byte * restrict bp, byte * restrict sp, int w, int blendmode, int bgr)
 {
 	while (w--)
 	{
@@ -339,22 +366,7 @@ fz_blend_nonseparable(byte * restrict bp, byte * restrict sp, int w, int blendmo
 		int bg = (bp[1] * invba) >> 8;
 		int bb = (bp[2] * invba) >> 8;
 
-		switch (blendmode)
-		{
-		default:
-		case FZ_BLEND_HUE:
-			fz_hue_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-			break;
-		case FZ_BLEND_SATURATION:
-			fz_saturation_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-			break;
-		case FZ_BLEND_COLOR:
-			fz_color_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-			break;
-		case FZ_BLEND_LUMINOSITY:
-			fz_luminosity_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-			break;
-		}
+		fz_blend_nonseparable_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb, blendmode, bgr);
 
 		bp[0] = fz_mul255(255 - sa, bp[0]) + fz_mul255(255 - ba, sp[0]) + fz_mul255(saba, rr);
 		bp[1] = fz_mul255(255 - sa, bp[1]) + fz_mul255(255 - ba, sp[1]) + fz_mul255(saba, rg);
@@ -494,7 +506,7 @@ fz_blend_separable_nonisolated(byte * restrict bp, byte * restrict sp, int n, in
 }
 
 static void
-fz_blend_nonseparable_nonisolated(byte * restrict bp, byte * restrict sp, int w, int blendmode, byte * restrict hp, int alpha)
+fz_blend_nonseparable_nonisolated(byte * restrict bp, byte * restrict sp, int w, int blendmode, byte * restrict hp, int alpha, int bgr)
 {
 	while (w--)
 	{
@@ -540,22 +552,7 @@ fz_blend_nonseparable_nonisolated(byte * restrict bp, byte * restrict sp, int w,
 				sg = (((sg-bg)*invha)>>8) + bg;
 				sb = (((sb-bb)*invha)>>8) + bb;
 
-				switch (blendmode)
-				{
-				default:
-				case FZ_BLEND_HUE:
-					fz_hue_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-					break;
-				case FZ_BLEND_SATURATION:
-					fz_saturation_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-					break;
-				case FZ_BLEND_COLOR:
-					fz_color_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-					break;
-				case FZ_BLEND_LUMINOSITY:
-					fz_luminosity_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb);
-					break;
-				}
+				fz_blend_nonseparable_rgb(&rr, &rg, &rb, br, bg, bb, sr, sg, sb, blendmode, bgr);
 
 				rr = fz_mul255(255 - haa, bp[0]) + fz_mul255(fz_mul255(255 - ba, sr), haa) + fz_mul255(baha, rr);
 				rg = fz_mul255(255 - haa, bp[1]) + fz_mul255(fz_mul255(255 - ba, sg), haa) + fz_mul255(baha, rg);
@@ -578,6 +575,8 @@ fz_blend_pixmap(fz_pixmap *dst, fz_pixmap *src, int alpha, int blendmode, int is
 	fz_irect bbox;
 	fz_irect bbox2;
 	int x, y, w, h, n;
+	/* SumatraPDF: the non-separable blend modes depend on the component order */
+	int bgr = dst->colorspace && !strcmp(dst->colorspace->name, "DeviceBGR");
 
 	/* TODO: fix this hack! */
 	if (isolated && alpha < 255)
@@ -613,7 +612,7 @@ fz_blend_pixmap(fz_pixmap *dst, fz_pixmap *src, int alpha, int blendmode, int is
 		while (h--)
 		{
 			if (n == 4 && blendmode >= FZ_BLEND_HUE)
-				fz_blend_nonseparable_nonisolated(dp, sp, w, blendmode, hp, alpha);
+				fz_blend_nonseparable_nonisolated(dp, sp, w, blendmode, hp, alpha, bgr);
 			else
 				fz_blend_separable_nonisolated(dp, sp, n, w, blendmode, hp, alpha);
 			sp += src->w * n;
@@ -626,7 +625,7 @@ fz_blend_pixmap(fz_pixmap *dst, fz_pixmap *src, int alpha, int blendmode, int is
 		while (h--)
 		{
 			if (n == 4 && blendmode >= FZ_BLEND_HUE)
-				fz_blend_nonseparable(dp, sp, w, blendmode);
+				fz_blend_nonseparable(dp, sp, w, blendmode, bgr);
 			else
 				fz_blend_separable(dp, sp, n, w, blendmode);
 			sp += src->w * n;
@@ -1105,6 +1105,9 @@ fz_draw_fill_image(fz_device *devp, fz_image *image, const fz_matrix *ctm, float
 		after = 0;
 		if (pixmap->colorspace == fz_device_gray(ctx))
 			after = 1;
+		/* SumatraPDF: swapping components is cheaper after downscaling */
+		else if (pixmap->colorspace == fz_device_rgb(ctx) && model == fz_device_bgr(ctx))
+			after = 1;
 
 		if (pixmap->colorspace != model && !after)
 		{
@@ -1691,6 +1694,12 @@ fz_cmp_tile_key(void *k0_, void *k1_)
 	return k0->id == k1->id && k0->ctm[0] == k1->ctm[0] && k0->ctm[1] == k1->ctm[1] && k0->ctm[2] == k1->ctm[2] && k0->ctm[3] == k1->ctm[3];
 }
 
+static int
+fz_tile_store_kind(void *key)
+{
+	return FZ_STORE_IMAGE;
+}
+
 #ifndef NDEBUG
 static void
 fz_debug_tile(FILE *out, void *key_)
@@ -1707,6 +1716,7 @@ static fz_store_type fz_tile_store_type =
 	fz_keep_tile_key,
 	fz_drop_tile_key,
 	fz_cmp_tile_key,
+	fz_tile_store_kind,
 #ifndef NDEBUG
 	fz_debug_tile
 #endif
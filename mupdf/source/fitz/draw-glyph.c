@@ -6,8 +6,15 @@
 
 #define GLYPH_HASH_LEN 509
 
+/* SumatraPDF: the glyph cache is split into FZ_GLYPH_CACHE_SHARDS shards
+ * (selected by the key's hash) with a lock, hash table, LRU list and byte
+ * budget each, so that threads rendering in parallel rarely contend for
+ * the same lock */
+#define MAX_SHARD_SIZE (MAX_CACHE_SIZE / FZ_GLYPH_CACHE_SHARDS)
+
 typedef struct fz_glyph_cache_entry_s fz_glyph_cache_entry;
 typedef struct fz_glyph_key_s fz_glyph_key;
+typedef struct fz_glyph_cache_shard_s fz_glyph_cache_shard;
 
 struct fz_glyph_key_s
 {
@@ -30,95 +37,109 @@ struct fz_glyph_cache_entry_s
 	fz_glyph *val;
 };
 
-struct fz_glyph_cache_s
+struct fz_glyph_cache_shard_s
 {
-	int refs;
 	int total;
-#ifndef NDEBUG
+	int count;
+	int lookups;
+	int hits;
 	int num_evictions;
 	int evicted;
-#endif
 	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
 };
 
+/* refs is protected by the first shard's lock (FZ_LOCK_GLYPHCACHE) */
+struct fz_glyph_cache_s
+{
+	int refs;
+	fz_glyph_cache_shard shard[FZ_GLYPH_CACHE_SHARDS];
+};
+
 void
 fz_new_glyph_cache_context(fz_context *ctx)
 {
 	fz_glyph_cache *cache;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
-	cache->total = 0;
 	cache->refs = 1;
 
 	ctx->glyph_cache = cache;
 }
 
 static void
-drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
+drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_shard *shard, fz_glyph_cache_entry *entry)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		shard->lru_tail = entry->lru_prev;
 	if (entry->lru_prev)
 		entry->lru_prev->lru_next = entry->lru_next;
 	else
-		cache->lru_head = entry->lru_next;
-	cache->total -= fz_glyph_size(ctx, entry->val);
+		shard->lru_head = entry->lru_next;
+	shard->total -= fz_glyph_size(ctx, entry->val);
+	shard->count--;
 	if (entry->bucket_next)
 		entry->bucket_next->bucket_prev = entry->bucket_prev;
 	if (entry->bucket_prev)
 		entry->bucket_prev->bucket_next = entry->bucket_next;
 	else
-		cache->entry[entry->hash] = entry->bucket_next;
+		shard->entry[entry->hash] = entry->bucket_next;
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
 }
 
-/* The glyph cache lock is always held when this function is called. */
+/* The shard's lock is always held when this function is called
+ * (unless no other context can access the glyph cache anymore). */
 static void
-do_purge(fz_context *ctx)
+do_purge(fz_context *ctx, fz_glyph_cache_shard *shard)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
 	int i;
 
 	for (i = 0; i < GLYPH_HASH_LEN; i++)
 	{
-		while (cache->entry[i])
-			drop_glyph_cache_entry(ctx, cache->entry[i]);
+		while (shard->entry[i])
+			drop_glyph_cache_entry(ctx, shard, shard->entry[i]);
 	}
 
-	cache->total = 0;
+	shard->total = 0;
 }
 
 void
 fz_purge_glyph_cache(fz_context *ctx)
 {
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	do_purge(ctx);
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	int i;
+
+	/* Never hold more than one shard lock at a time */
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		do_purge(ctx, &ctx->glyph_cache->shard[i]);
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
 }
 
 void
 fz_drop_glyph_cache_context(fz_context *ctx)
 {
+	int i, refs;
+
 	if (!ctx->glyph_cache)
 		return;
 
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	ctx->glyph_cache->refs--;
-	if (ctx->glyph_cache->refs == 0)
+	refs = --ctx->glyph_cache->refs;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	if (refs == 0)
 	{
-		do_purge(ctx);
+		for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+			do_purge(ctx, &ctx->glyph_cache->shard[i]);
 		fz_free(ctx, ctx->glyph_cache);
-		ctx->glyph_cache = NULL;
 	}
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	ctx->glyph_cache = NULL;
 }
 
 fz_glyph_cache *
@@ -221,7 +242,7 @@ static unsigned do_hash(unsigned char *s, int len)
 }
 
 static inline void
-move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
+move_to_front(fz_glyph_cache_shard *cache, fz_glyph_cache_entry *entry)
 {
 	if (entry->lru_prev == NULL)
 		return; /* At front already */
@@ -243,7 +264,7 @@ move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
 fz_glyph *
 fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colorspace *model, const fz_irect *scissor)
 {
-	fz_glyph_cache *cache;
+	fz_glyph_cache_shard *cache;
 	fz_glyph_key key;
 	fz_matrix subpix_ctm;
 	fz_irect subpix_scissor;
@@ -252,6 +273,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	int do_cache, locked, caching;
 	fz_glyph_cache_entry *entry;
 	unsigned hash;
+	int lock;
 
 	fz_var(locked);
 	fz_var(caching);
@@ -277,8 +299,6 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		do_cache = 0;
 	}
 
-	cache = ctx->glyph_cache;
-
 	key.font = font;
 	key.gid = gid;
 	key.a = subpix_ctm.a * 65536;
@@ -287,16 +307,22 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.d = subpix_ctm.d * 65536;
 	key.aa = fz_aa_level(ctx);
 
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
+	hash = do_hash((unsigned char *)&key, sizeof(key));
+	cache = &ctx->glyph_cache->shard[hash % FZ_GLYPH_CACHE_SHARDS];
+	lock = FZ_LOCK_GLYPHCACHE + hash % FZ_GLYPH_CACHE_SHARDS;
+	hash = (hash / FZ_GLYPH_CACHE_SHARDS) % GLYPH_HASH_LEN;
+
+	fz_lock(ctx, lock);
+	cache->lookups++;
 	entry = cache->entry[hash];
 	while (entry)
 	{
 		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
 		{
 			move_to_front(cache, entry);
+			cache->hits++;
 			val = fz_keep_glyph(ctx, entry->val);
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_unlock(ctx, lock);
 			return val;
 		}
 		entry = entry->bucket_next;
@@ -323,10 +349,10 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 			 * we insert ours to find one already there, we
 			 * abandon ours, and use the one there already.
 			 */
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_unlock(ctx, lock);
 			locked = 0;
 			val = fz_render_t3_glyph(ctx, font, gid, &subpix_ctm, model, scissor);
-			fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_lock(ctx, lock);
 			locked = 1;
 		}
 		else
@@ -376,13 +402,12 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				cache->lru_head = entry;
 
 				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
+				cache->count++;
+				while (cache->total > MAX_SHARD_SIZE)
 				{
-#ifndef NDEBUG
 					cache->num_evictions++;
 					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
+					drop_glyph_cache_entry(ctx, cache, cache->lru_tail);
 				}
 
 			}
@@ -394,7 +419,7 @@ unlock_and_return_val:
 	fz_always(ctx)
 	{
 		if (locked)
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_unlock(ctx, lock);
 	}
 	fz_catch(ctx)
 	{
@@ -449,13 +474,50 @@ fz_render_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm,
 	return val;
 }
 
+void
+fz_get_glyph_cache_stats(fz_context *ctx, int shard, fz_glyph_cache_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	if (ctx == NULL || ctx->glyph_cache == NULL || shard >= FZ_GLYPH_CACHE_SHARDS)
+		return;
+
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_glyph_cache_shard *cache = &ctx->glyph_cache->shard[i];
+
+		if (shard >= 0 && i != shard)
+			continue;
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		stats->count += cache->count;
+		stats->total += cache->total;
+		stats->lookups += cache->lookups;
+		stats->hits += cache->hits;
+		stats->num_evictions += cache->num_evictions;
+		stats->evicted += cache->evicted;
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
+	stats->max = shard >= 0 ? MAX_SHARD_SIZE : MAX_CACHE_SIZE;
+}
+
 void
 fz_dump_glyph_cache_stats(fz_context *ctx)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
+	fz_glyph_cache_stats stats;
+	int i;
+
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_get_glyph_cache_stats(ctx, i, &stats);
+		printf("Glyph Cache Shard %d: %d glyphs (%d bytes), hits: %d/%d (%.1f%%), evictions: %d (%d bytes)\n",
+			i, stats.count, stats.total, stats.hits, stats.lookups,
+			stats.lookups ? 100.0 * stats.hits / stats.lookups : 0.0,
+			stats.num_evictions, stats.evicted);
+	}
 
-	printf("Glyph Cache Size: %d\n", cache->total);
-#ifndef NDEBUG
-	printf("Glyph Cache Evictions: %d (%d bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	fz_get_glyph_cache_stats(ctx, -1, &stats);
+	printf("Glyph Cache Size: %d (max. %d)\n", stats.total, stats.max);
+	printf("Glyph Cache Hits: %d/%d (%.1f%%)\n", stats.hits, stats.lookups, stats.lookups ? 100.0 * stats.hits / stats.lookups : 0.0);
+	printf("Glyph Cache Evictions: %d (%d bytes)\n", stats.num_evictions, stats.evicted);
 }
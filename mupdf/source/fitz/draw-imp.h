@@ -24,6 +24,21 @@ void fz_flatten_dash_path(fz_gel *gel, fz_path *path, const fz_stroke_state *str
 
 fz_irect *fz_bound_path_accurate(fz_context *ctx, fz_irect *bbox, const fz_irect *scissor, fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth);
 
+/*
+ * SumatraPDF: SIMD support (cf. fz_enable_simd_painters)
+ */
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || defined(_MSC_VER) && defined(_M_IX86)
+#define HAVE_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER) && defined(_M_IX86)
+#include <intrin.h>
+#endif
+#endif
+
+int fz_use_sse2(void);
+int fz_use_fast_paths(void);
+
 /*
  * Plotting functions.
  */
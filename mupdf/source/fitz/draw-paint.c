@@ -73,6 +73,237 @@ and stick to using the premultiplied form.
 
 typedef unsigned char byte;
 
+/* SumatraPDF: SSE2 versions of the most frequently used span painters.
+They're bit-exact with the scalar versions below (which they fall back to
+for the last few pixels of a span) and are only used if the CPU supports
+SSE2 (always the case for x64). */
+
+static int fz_simd_disabled = 0;
+static int fz_fast_paths_disabled = 0;
+
+int
+fz_enable_simd_painters(int enable)
+{
+	fz_simd_disabled = !enable;
+	return fz_use_sse2();
+}
+
+void
+fz_enable_fast_paths(int enable)
+{
+	fz_fast_paths_disabled = !enable;
+}
+
+int
+fz_use_fast_paths(void)
+{
+	return !fz_fast_paths_disabled;
+}
+
+#ifndef HAVE_SSE2
+
+int
+fz_use_sse2(void)
+{
+	return 0;
+}
+
+#else
+
+static int fz_has_sse2 = -1;
+
+int
+fz_use_sse2(void)
+{
+	/* racing threads would all store the same value */
+	if (fz_has_sse2 < 0)
+	{
+#if defined(_MSC_VER) && defined(_M_IX86) && !defined(__SSE2__)
+		int info[4];
+		__cpuid(info, 1);
+		fz_has_sse2 = (info[3] & (1 << 26)) != 0;
+#else
+		fz_has_sse2 = 1;
+#endif
+	}
+	return fz_has_sse2 && !fz_simd_disabled;
+}
+
+/* the scalar versions (defined below) handle the remaining pixels */
+static inline void fz_paint_span_with_color_4(byte * restrict dp, byte * restrict mp, int w, byte *color);
+static inline void fz_paint_span_with_mask_4(byte * restrict dp, byte * restrict sp, byte * restrict mp, int w);
+static inline void fz_paint_span_4_with_alpha(byte * restrict dp, byte * restrict sp, int w, int alpha);
+static inline void fz_paint_span_4(byte * restrict dp, byte * restrict sp, int w);
+
+/* FZ_EXPAND for 16-bit lanes */
+static inline __m128i
+fz_expand_sse2(__m128i a)
+{
+	return _mm_add_epi16(a, _mm_srli_epi16(a, 7));
+}
+
+/* copies each pixel's alpha value (for n = 4) to all of its 16-bit lanes */
+static inline __m128i
+fz_alpha_sse2(__m128i p)
+{
+	p = _mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm_shufflehi_epi16(p, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+/* FZ_BLEND(src, dst, amount) as (src * amount + dst * (256 - amount)) >> 8,
+which doesn't overflow 16-bit lanes */
+static inline __m128i
+fz_blend_sse2(__m128i s, __m128i d, __m128i amount)
+{
+	__m128i inv = _mm_sub_epi16(_mm_set1_epi16(256), amount);
+	return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(s, amount), _mm_mullo_epi16(d, inv)), 8);
+}
+
+/* widens four mask bytes to one 16-bit lane per color component */
+static inline void
+fz_load_mask_sse2(const byte *mp, __m128i *lo, __m128i *hi)
+{
+	__m128i m = _mm_cvtsi32_si128(mp[0] | (mp[1] << 8) | (mp[2] << 16) | (mp[3] << 24));
+	m = _mm_unpacklo_epi8(m, _mm_setzero_si128());
+	m = _mm_unpacklo_epi16(m, m);
+	*lo = _mm_unpacklo_epi32(m, m);
+	*hi = _mm_unpackhi_epi32(m, m);
+}
+
+static void
+fz_paint_span_with_color_4_sse2(byte * restrict dp, byte * restrict mp, int w, byte *color)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int sa = FZ_EXPAND(color[3]);
+	__m128i c, sa16;
+	if (sa == 0)
+		return;
+	/* the scalar version paints with full alpha as well */
+	c = _mm_set_epi16(255, color[2], color[1], color[0], 255, color[2], color[1], color[0]);
+	sa16 = _mm_set1_epi16(sa);
+	for (; w >= 4; w -= 4, dp += 16, mp += 4)
+	{
+		__m128i d, d_lo, d_hi, ma_lo, ma_hi;
+		if ((mp[0] | mp[1] | mp[2] | mp[3]) == 0)
+			continue;
+		fz_load_mask_sse2(mp, &ma_lo, &ma_hi);
+		ma_lo = fz_expand_sse2(ma_lo);
+		ma_hi = fz_expand_sse2(ma_hi);
+		if (sa != 256)
+		{
+			ma_lo = _mm_srli_epi16(_mm_mullo_epi16(ma_lo, sa16), 8);
+			ma_hi = _mm_srli_epi16(_mm_mullo_epi16(ma_hi, sa16), 8);
+		}
+		d = _mm_loadu_si128((__m128i *)dp);
+		d_lo = _mm_unpacklo_epi8(d, zero);
+		d_hi = _mm_unpackhi_epi8(d, zero);
+		d_lo = fz_blend_sse2(c, d_lo, ma_lo);
+		d_hi = fz_blend_sse2(c, d_hi, ma_hi);
+		_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(d_lo, d_hi));
+	}
+	if (w > 0)
+		fz_paint_span_with_color_4(dp, mp, w, color);
+}
+
+static void
+fz_paint_span_with_mask_4_sse2(byte * restrict dp, byte * restrict sp, byte * restrict mp, int w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c255 = _mm_set1_epi16(255);
+	for (; w >= 4; w -= 4, dp += 16, sp += 16, mp += 4)
+	{
+		__m128i s, d, s_lo, s_hi, d_lo, d_hi, ma_lo, ma_hi, masa_lo, masa_hi;
+		if ((mp[0] | mp[1] | mp[2] | mp[3]) == 0)
+			continue;
+		fz_load_mask_sse2(mp, &ma_lo, &ma_hi);
+		ma_lo = fz_expand_sse2(ma_lo);
+		ma_hi = fz_expand_sse2(ma_hi);
+		s = _mm_loadu_si128((__m128i *)sp);
+		d = _mm_loadu_si128((__m128i *)dp);
+		s_lo = _mm_unpacklo_epi8(s, zero);
+		s_hi = _mm_unpackhi_epi8(s, zero);
+		d_lo = _mm_unpacklo_epi8(d, zero);
+		d_hi = _mm_unpackhi_epi8(d, zero);
+		/* masa = FZ_EXPAND(255 - FZ_COMBINE(sa, ma)) */
+		masa_lo = _mm_srli_epi16(_mm_mullo_epi16(fz_alpha_sse2(s_lo), ma_lo), 8);
+		masa_hi = _mm_srli_epi16(_mm_mullo_epi16(fz_alpha_sse2(s_hi), ma_hi), 8);
+		masa_lo = fz_expand_sse2(_mm_sub_epi16(c255, masa_lo));
+		masa_hi = fz_expand_sse2(_mm_sub_epi16(c255, masa_hi));
+		/* FZ_COMBINE2(s, ma, d, masa), truncated to a byte like in the scalar version */
+		d_lo = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(s_lo, ma_lo), 8), _mm_srli_epi16(_mm_mullo_epi16(d_lo, masa_lo), 8));
+		d_hi = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(s_hi, ma_hi), 8), _mm_srli_epi16(_mm_mullo_epi16(d_hi, masa_hi), 8));
+		d_lo = _mm_and_si128(d_lo, c255);
+		d_hi = _mm_and_si128(d_hi, c255);
+		_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(d_lo, d_hi));
+	}
+	if (w > 0)
+		fz_paint_span_with_mask_4(dp, sp, mp, w);
+}
+
+static void
+fz_paint_span_4_with_alpha_sse2(byte * restrict dp, byte * restrict sp, int w, int alpha)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i alpha16 = _mm_set1_epi16(FZ_EXPAND(alpha));
+	for (; w >= 4; w -= 4, dp += 16, sp += 16)
+	{
+		__m128i s = _mm_loadu_si128((__m128i *)sp);
+		__m128i d = _mm_loadu_si128((__m128i *)dp);
+		__m128i s_lo = _mm_unpacklo_epi8(s, zero);
+		__m128i s_hi = _mm_unpackhi_epi8(s, zero);
+		__m128i d_lo = _mm_unpacklo_epi8(d, zero);
+		__m128i d_hi = _mm_unpackhi_epi8(d, zero);
+		__m128i masa_lo = _mm_srli_epi16(_mm_mullo_epi16(fz_alpha_sse2(s_lo), alpha16), 8);
+		__m128i masa_hi = _mm_srli_epi16(_mm_mullo_epi16(fz_alpha_sse2(s_hi), alpha16), 8);
+		d_lo = fz_blend_sse2(s_lo, d_lo, masa_lo);
+		d_hi = fz_blend_sse2(s_hi, d_hi, masa_hi);
+		_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(d_lo, d_hi));
+	}
+	if (w > 0)
+		fz_paint_span_4_with_alpha(dp, sp, w, alpha);
+}
+
+static void
+fz_paint_span_4_sse2(byte * restrict dp, byte * restrict sp, int w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c255 = _mm_set1_epi16(255);
+	const __m128i c256 = _mm_set1_epi16(256);
+	const __m128i amask = _mm_set1_epi32(0xFF000000);
+	for (; w >= 4; w -= 4, dp += 16, sp += 16)
+	{
+		__m128i s = _mm_loadu_si128((__m128i *)sp);
+		__m128i d, s_lo, s_hi, d_lo, d_hi, t_lo, t_hi;
+		/* pixels with alpha 0 are skipped, opaque ones are copied */
+		__m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(s, amask), zero);
+		int opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, amask), amask));
+		if (_mm_movemask_epi8(transparent) == 0xFFFF)
+			continue;
+		if (opaque == 0xFFFF)
+		{
+			_mm_storeu_si128((__m128i *)dp, s);
+			continue;
+		}
+		d = _mm_loadu_si128((__m128i *)dp);
+		s_lo = _mm_unpacklo_epi8(s, zero);
+		s_hi = _mm_unpackhi_epi8(s, zero);
+		d_lo = _mm_unpacklo_epi8(d, zero);
+		d_hi = _mm_unpackhi_epi8(d, zero);
+		t_lo = _mm_sub_epi16(c256, fz_expand_sse2(fz_alpha_sse2(s_lo)));
+		t_hi = _mm_sub_epi16(c256, fz_expand_sse2(fz_alpha_sse2(s_hi)));
+		/* sp + FZ_COMBINE(dp, t), truncated to a byte like in the scalar version */
+		s_lo = _mm_and_si128(_mm_add_epi16(s_lo, _mm_srli_epi16(_mm_mullo_epi16(d_lo, t_lo), 8)), c255);
+		s_hi = _mm_and_si128(_mm_add_epi16(s_hi, _mm_srli_epi16(_mm_mullo_epi16(d_hi, t_hi), 8)), c255);
+		s = _mm_packus_epi16(s_lo, s_hi);
+		s = _mm_or_si128(_mm_and_si128(transparent, d), _mm_andnot_si128(transparent, s));
+		_mm_storeu_si128((__m128i *)dp, s);
+	}
+	if (w > 0)
+		fz_paint_span_4(dp, sp, w);
+}
+
+#endif /* HAVE_SSE2 */
+
 /* These are used by the non-aa scan converter */
 
 void
@@ -363,7 +594,16 @@ fz_paint_span_with_color(byte * restrict dp, byte * restrict mp, int n, int w, b
 	switch (n)
 	{
 	case 2: fz_paint_span_with_color_2(dp, mp, w, color); break;
-	case 4: fz_paint_span_with_color_4(dp, mp, w, color); break;
+	case 4:
+#ifdef HAVE_SSE2
+		if (fz_use_sse2())
+		{
+			fz_paint_span_with_color_4_sse2(dp, mp, w, color);
+			break;
+		}
+#endif
+		fz_paint_span_with_color_4(dp, mp, w, color);
+		break;
 	default: fz_paint_span_with_color_N(dp, mp, n, w, color); break;
 	}
 }
@@ -521,7 +761,16 @@ fz_paint_span_with_mask(byte * restrict dp, byte * restrict sp, byte * restrict
 	switch (n)
 	{
 	case 2: fz_paint_span_with_mask_2(dp, sp, mp, w); break;
-	case 4: fz_paint_span_with_mask_4(dp, sp, mp, w); break;
+	case 4:
+#ifdef HAVE_SSE2
+		if (fz_use_sse2())
+		{
+			fz_paint_span_with_mask_4_sse2(dp, sp, mp, w);
+			break;
+		}
+#endif
+		fz_paint_span_with_mask_4(dp, sp, mp, w);
+		break;
 	default: fz_paint_span_with_mask_N(dp, sp, mp, n, w); break;
 	}
 }
@@ -694,7 +943,16 @@ fz_paint_span(byte * restrict dp, byte * restrict sp, int n, int w, int alpha)
 		{
 		case 1: fz_paint_span_1(dp, sp, w); break;
 		case 2: fz_paint_span_2(dp, sp, w); break;
-		case 4: fz_paint_span_4(dp, sp, w); break;
+		case 4:
+#ifdef HAVE_SSE2
+			if (fz_use_sse2())
+			{
+				fz_paint_span_4_sse2(dp, sp, w);
+				break;
+			}
+#endif
+			fz_paint_span_4(dp, sp, w);
+			break;
 		default: fz_paint_span_N(dp, sp, n, w); break;
 		}
 	}
@@ -703,7 +961,16 @@ fz_paint_span(byte * restrict dp, byte * restrict sp, int n, int w, int alpha)
 		switch (n)
 		{
 		case 2: fz_paint_span_2_with_alpha(dp, sp, w, alpha); break;
-		case 4: fz_paint_span_4_with_alpha(dp, sp, w, alpha); break;
+		case 4:
+#ifdef HAVE_SSE2
+			if (fz_use_sse2())
+			{
+				fz_paint_span_4_with_alpha_sse2(dp, sp, w, alpha);
+				break;
+			}
+#endif
+			fz_paint_span_4_with_alpha(dp, sp, w, alpha);
+			break;
 		default: fz_paint_span_N_with_alpha(dp, sp, n, w, alpha); break;
 		}
 	}
@@ -1059,6 +1059,218 @@ scale_row_from_temp(unsigned char *dst, unsigned char *src, fz_weights *weights,
 }
 #endif
 
+/* SumatraPDF: SSE2 versions of the row scaling functions (bit-exact with
+the scalar versions above, accumulating two weighted samples at once) */
+#ifdef HAVE_SSE2
+
+/* packs the low byte of (acc >> 8) for each of four 32-bit lanes */
+static inline __m128i
+pack_acc_sse2(__m128i acc0, __m128i acc1)
+{
+	const __m128i c255 = _mm_set1_epi32(255);
+	acc0 = _mm_and_si128(_mm_srai_epi32(acc0, 8), c255);
+	acc1 = _mm_and_si128(_mm_srai_epi32(acc1, 8), c255);
+	return _mm_packs_epi32(acc0, acc1);
+}
+
+/* two 16-bit weights for _mm_madd_epi16 */
+static inline __m128i
+weight_pair_sse2(int w0, int w1)
+{
+	return _mm_set1_epi32((int)(((unsigned int)w1 << 16) | ((unsigned int)w0 & 0xFFFF)));
+}
+
+static void
+scale_row_to_temp2_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	const __m128i zero = _mm_setzero_si128();
+	int len, i, px;
+	unsigned char *min;
+
+	assert(weights->n == 2);
+	if (weights->flip)
+		dst += 2*weights->count;
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = _mm_set_epi32(0, 0, 128, 128);
+		min = &src[2 * *contrib++];
+		len = *contrib++;
+		for (; len >= 4; len -= 4, min += 8, contrib += 4)
+		{
+			/* g0 g1 a0 a1 g2 g3 a2 a3 */
+			__m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+			p = _mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 1, 2, 0));
+			p = _mm_shufflehi_epi16(p, _MM_SHUFFLE(3, 1, 2, 0));
+			p = _mm_madd_epi16(p, _mm_unpacklo_epi64(weight_pair_sse2(contrib[0], contrib[1]), weight_pair_sse2(contrib[2], contrib[3])));
+			acc = _mm_add_epi32(acc, p);
+		}
+		for (; len > 0; len--, min += 2, contrib++)
+		{
+			__m128i p = _mm_unpacklo_epi8(_mm_cvtsi32_si128(min[0] | (min[1] << 8)), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi16(p, zero), weight_pair_sse2(contrib[0], 0)));
+		}
+		acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+		acc = pack_acc_sse2(acc, acc);
+		px = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+		if (weights->flip)
+		{
+			*--dst = (unsigned char)(px >> 8);
+			*--dst = (unsigned char)px;
+		}
+		else
+		{
+			*dst++ = (unsigned char)px;
+			*dst++ = (unsigned char)(px >> 8);
+		}
+	}
+}
+
+static void
+scale_row_to_temp4_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	const __m128i zero = _mm_setzero_si128();
+	int len, i, px;
+	unsigned char *min;
+
+	assert(weights->n == 4);
+	if (weights->flip)
+		dst += 4*weights->count;
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = _mm_set1_epi32(128);
+		min = &src[4 * *contrib++];
+		len = *contrib++;
+		for (; len >= 2; len -= 2, min += 8, contrib += 2)
+		{
+			/* r0 r1 g0 g1 b0 b1 a0 a1 */
+			__m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+			p = _mm_unpacklo_epi16(p, _mm_srli_si128(p, 8));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, weight_pair_sse2(contrib[0], contrib[1])));
+		}
+		if (len > 0)
+		{
+			__m128i p = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(int *)min), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi16(p, zero), weight_pair_sse2(contrib[0], 0)));
+			contrib++;
+		}
+		acc = pack_acc_sse2(acc, acc);
+		px = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+		if (weights->flip)
+			dst -= 4;
+		*(int *)dst = px;
+		if (!weights->flip)
+			dst += 4;
+	}
+}
+
+static void
+scale_row_from_temp_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights, int width, int row)
+{
+	int *contrib = &weights->index[weights->index[row]];
+	const __m128i zero = _mm_setzero_si128();
+	int len, x, k;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = width; x >= 16; x -= 16, src += 16, dst += 16)
+	{
+		__m128i acc0 = _mm_set1_epi32(128), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+		unsigned char *min = src;
+		for (k = 0; k < len; k += 2, min += 2 * width)
+		{
+			/* interleave the samples of two temp rows */
+			__m128i a = _mm_loadu_si128((__m128i *)min);
+			__m128i b = k + 1 < len ? _mm_loadu_si128((__m128i *)(min + width)) : zero;
+			__m128i w = weight_pair_sse2(contrib[k], k + 1 < len ? contrib[k + 1] : 0);
+			__m128i ab = _mm_unpacklo_epi8(a, b);
+			acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(ab, zero), w));
+			acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(ab, zero), w));
+			ab = _mm_unpackhi_epi8(a, b);
+			acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(ab, zero), w));
+			acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(ab, zero), w));
+		}
+		_mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(pack_acc_sse2(acc0, acc1), pack_acc_sse2(acc2, acc3)));
+	}
+	for (; x > 0; x--)
+	{
+		unsigned char *min = src;
+		int val = 128;
+		for (k = 0; k < len; k++)
+		{
+			val += *min * contrib[k];
+			min += width;
+		}
+		*dst++ = (unsigned char)(val>>8);
+		src++;
+	}
+}
+
+/* averages two 2x2 blocks of four pixels each */
+static void
+scale_box_2x2_4_sse2(unsigned char *dst, unsigned char *src0, unsigned char *src1, int w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c2 = _mm_set1_epi16(2);
+	for (; w >= 2; w -= 2, src0 += 16, src1 += 16, dst += 8)
+	{
+		__m128i a = _mm_loadu_si128((__m128i *)src0);
+		__m128i b = _mm_loadu_si128((__m128i *)src1);
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+		__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+		sum = _mm_srli_epi16(_mm_add_epi16(sum, c2), 2);
+		_mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(sum, sum));
+	}
+	if (w > 0)
+	{
+		int c;
+		for (c = 0; c < 4; c++)
+			dst[c] = (unsigned char)((src0[c] + src0[c + 4] + src1[c] + src1[c + 4] + 2) >> 2);
+	}
+}
+
+#endif /* HAVE_SSE2 */
+
+/* SumatraPDF: downscaling by exactly 2x or 4x (a frequent case for scanned
+documents) averages blocks of source pixels instead of applying the filter */
+static void
+scale_box(unsigned char *dst, fz_pixmap *src, int kx, int ky, const fz_rect *patch)
+{
+	int n = src->n;
+	int stride = src->w * n;
+	int shift = (kx >> 1) + (ky >> 1);
+	int x0 = (int)patch->x0, x1 = (int)patch->x1;
+	int y0 = (int)patch->y0, y1 = (int)patch->y1;
+	int x, y, i, j, c;
+
+	for (y = y0; y < y1; y++)
+	{
+		unsigned char *row = src->samples + y * ky * stride;
+#ifdef HAVE_SSE2
+		if (kx == 2 && ky == 2 && n == 4 && fz_use_sse2())
+		{
+			scale_box_2x2_4_sse2(dst, row + x0 * 8, row + stride + x0 * 8, x1 - x0);
+			dst += (x1 - x0) * 4;
+			continue;
+		}
+#endif
+		for (x = x0; x < x1; x++)
+		{
+			for (c = 0; c < n; c++)
+			{
+				unsigned char *s = row + x * kx * n + c;
+				int sum = 1 << (shift - 1);
+				for (i = 0; i < ky; i++)
+					for (j = 0; j < kx; j++)
+						sum += s[i * stride + j * n];
+				*dst++ = (unsigned char)(sum >> shift);
+			}
+		}
+	}
+}
+
 #ifdef SINGLE_PIXEL_SPECIALS
 static void
 duplicate_single_pixel(unsigned char *dst, unsigned char *src, int n, int w, int h)
@@ -1376,6 +1588,21 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 	if (patch.x0 >= patch.x1 || patch.y0 >= patch.y1)
 		return NULL;
 
+	/* SumatraPDF: box filter for downscaling by exactly 2x or 4x */
+	if (!flip_x && !flip_y && x == 0 && y == 0 && fz_use_fast_paths())
+	{
+		int kx = src->w == 2 * dst_w_int && w == dst_w_int ? 2 : src->w == 4 * dst_w_int && w == dst_w_int ? 4 : 0;
+		int ky = src->h == 2 * dst_h_int && h == dst_h_int ? 2 : src->h == 4 * dst_h_int && h == dst_h_int ? 4 : 0;
+		if (kx && ky)
+		{
+			output = fz_new_pixmap(ctx, src->colorspace, patch.x1 - patch.x0, patch.y1 - patch.y0);
+			output->x = dst_x_int;
+			output->y = dst_y_int;
+			scale_box(output->samples, src, kx, ky, &patch);
+			return output;
+		}
+	}
+
 	fz_try(ctx)
 	{
 		/* Step 1: Calculate the weights for columns and rows */
@@ -1430,6 +1657,7 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 #endif /* SINGLE_PIXEL_SPECIALS */
 	{
 		void (*row_scale)(unsigned char *dst, unsigned char *src, fz_weights *weights);
+		void (*col_scale)(unsigned char *dst, unsigned char *src, fz_weights *weights, int width, int row) = scale_row_from_temp;
 
 		temp_span = contrib_cols->count * src->n;
 		temp_rows = contrib_rows->max_len;
@@ -1463,6 +1691,16 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 			row_scale = scale_row_to_temp4;
 			break;
 		}
+#ifdef HAVE_SSE2
+		if (fz_use_sse2())
+		{
+			if (src->n == 2)
+				row_scale = scale_row_to_temp2_sse2;
+			else if (src->n == 4)
+				row_scale = scale_row_to_temp4_sse2;
+			col_scale = scale_row_from_temp_sse2;
+		}
+#endif
 		max_row = contrib_rows->index[contrib_rows->index[0]];
 		for (row = 0; row < contrib_rows->count; row++)
 		{
@@ -1484,7 +1722,7 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 			}
 
 			DBUG(("scaling row %d from temp\n", row));
-			scale_row_from_temp(&output->samples[row*output->w*output->n], temp, contrib_rows, temp_span, row);
+			(*col_scale)(&output->samples[row*output->w*output->n], temp, contrib_rows, temp_span, row);
 		}
 		fz_free(ctx, temp);
 	}
@@ -83,6 +83,12 @@ fz_cmp_image_key(void *k0_, void *k1_)
 	return k0->image == k1->image && k0->l2factor == k1->l2factor;
 }
 
+static int
+fz_image_store_kind(void *key)
+{
+	return FZ_STORE_IMAGE;
+}
+
 #ifndef NDEBUG
 static void
 fz_debug_image(FILE *out, void *key_)
@@ -99,6 +105,7 @@ static fz_store_type fz_image_store_type =
 	fz_keep_image_key,
 	fz_drop_image_key,
 	fz_cmp_image_key,
+	fz_image_store_kind,
 #ifndef NDEBUG
 	fz_debug_image
 #endif
@@ -380,6 +387,16 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 	case FZ_IMAGE_JXR:
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
+	/* SumatraPDF: decode JPX images only at the resolution needed */
+	case FZ_IMAGE_JPX:
+		native_l2factor = l2factor;
+		indexed = fz_colorspace_is_indexed(image->colorspace);
+		tile = fz_load_jpx_reduced(ctx, image->buffer->buffer->data, image->buffer->buffer->len, image->colorspace, indexed, &native_l2factor);
+		if (!indexed)
+			fz_decode_tile(tile, image->decode);
+		if (l2factor - native_l2factor > 0)
+			fz_subsample_pixmap(ctx, tile, l2factor - native_l2factor);
+		break;
 	default:
 		native_l2factor = l2factor;
 		stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, &native_l2factor);
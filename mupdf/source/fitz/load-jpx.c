@@ -79,12 +79,55 @@ static inline unsigned int read_value(const unsigned char *data, int bytes)
 	return value;
 }
 
-fz_pixmap *
-fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed)
+/* SumatraPDF: the highest reduce levels are discarded while decoding (if available) */
+static opj_codec_t *
+jpx_open(fz_context *ctx, stream_block *sb, OPJ_CODEC_FORMAT format, int indexed, int reduce, opj_stream_t **stream, opj_image_t **jpx)
+{
+	opj_dparameters_t params;
+	opj_codec_t *codec;
+
+	opj_set_default_decoder_parameters(&params);
+	if (indexed)
+		params.flags |= OPJ_DPARAMETERS_IGNORE_PCLR_CMAP_CDEF_FLAG;
+	params.cp_reduce = reduce;
+
+	codec = opj_create_decompress(format);
+	opj_set_info_handler(codec, fz_opj_info_callback, ctx);
+	opj_set_warning_handler(codec, fz_opj_warning_callback, ctx);
+	/* failures due to too few resolution levels are expected (and retried) */
+	opj_set_error_handler(codec, reduce > 0 ? fz_opj_info_callback : fz_opj_error_callback, ctx);
+	if (!opj_setup_decoder(codec, &params))
+	{
+		opj_destroy_codec(codec);
+		return NULL;
+	}
+
+	*stream = opj_stream_default_create(OPJ_TRUE);
+	sb->pos = 0;
+
+	opj_stream_set_read_function(*stream, fz_opj_stream_read);
+	opj_stream_set_skip_function(*stream, fz_opj_stream_skip);
+	opj_stream_set_seek_function(*stream, fz_opj_stream_seek);
+	opj_stream_set_user_data(*stream, sb);
+	/* Set the length to avoid an assert */
+	opj_stream_set_user_data_length(*stream, sb->size);
+
+	if (!opj_read_header(*stream, codec, jpx))
+	{
+		opj_stream_destroy(*stream);
+		opj_destroy_codec(codec);
+		return NULL;
+	}
+
+	return codec;
+}
+
+/* SumatraPDF: decode at 1/2^l2factor of the full resolution (as far as possible) */
+static fz_pixmap *
+jpx_read_image(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed, int *l2factor, int *full_w, int *full_h, int *converted)
 {
 	fz_pixmap *img;
 	fz_colorspace *origcs;
-	opj_dparameters_t params;
 	opj_codec_t *codec;
 	opj_image_t *jpx;
 	opj_stream_t *stream;
@@ -93,6 +136,7 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 	OPJ_CODEC_FORMAT format;
 	int a, n, w, h, depth, sgnd;
 	int x, y, k, v;
+	int reduce = fz_clampi(*l2factor, 0, 8);
 	stream_block sb;
 
 	if (size < 2)
@@ -104,37 +148,22 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 	else
 		format = OPJ_CODEC_JP2;
 
-	opj_set_default_decoder_parameters(&params);
-	if (indexed)
-		params.flags |= OPJ_DPARAMETERS_IGNORE_PCLR_CMAP_CDEF_FLAG;
-
-	codec = opj_create_decompress(format);
-	opj_set_info_handler(codec, fz_opj_info_callback, ctx);
-	opj_set_warning_handler(codec, fz_opj_warning_callback, ctx);
-	opj_set_error_handler(codec, fz_opj_error_callback, ctx);
-	if (!opj_setup_decoder(codec, &params))
-	{
-		opj_destroy_codec(codec);
-		fz_throw(ctx, FZ_ERROR_GENERIC, "j2k decode failed");
-	}
-
-	stream = opj_stream_default_create(OPJ_TRUE);
 	sb.data = data;
 	sb.pos = 0;
 	sb.size = size;
 
-	opj_stream_set_read_function(stream, fz_opj_stream_read);
-	opj_stream_set_skip_function(stream, fz_opj_stream_skip);
-	opj_stream_set_seek_function(stream, fz_opj_stream_seek);
-	opj_stream_set_user_data(stream, &sb);
-	/* Set the length to avoid an assert */
-	opj_stream_set_user_data_length(stream, size);
+	/* reading the header fails if there are fewer resolution levels than to be discarded */
+	while (!(codec = jpx_open(ctx, &sb, format, indexed, reduce, &stream, &jpx)))
+	{
+		if (reduce == 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
+		reduce--;
+	}
 
-	if (!opj_read_header(stream, codec, &jpx))
+	if (full_w && full_h && jpx->numcomps > 0)
 	{
-		opj_stream_destroy(stream);
-		opj_destroy_codec(codec);
-		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
+		*full_w = (jpx->x1 + jpx->comps[0].dx - 1) / jpx->comps[0].dx - (jpx->x0 + jpx->comps[0].dx - 1) / jpx->comps[0].dx;
+		*full_h = (jpx->y1 + jpx->comps[0].dy - 1) / jpx->comps[0].dy - (jpx->y0 + jpx->comps[0].dy - 1) / jpx->comps[0].dy;
 	}
 
 	if (!opj_decode(codec, stream, jpx))
@@ -142,8 +171,15 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 		opj_stream_destroy(stream);
 		opj_destroy_codec(codec);
 		opj_image_destroy(jpx);
+		/* some tiles might have fewer resolution levels than the main header */
+		if (reduce > 0)
+		{
+			*l2factor = 0;
+			return jpx_read_image(ctx, data, size, defcs, indexed, l2factor, full_w, full_h, converted);
+		}
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to decode JPX image");
 	}
+	*l2factor = reduce;
 
 	opj_stream_destroy(stream);
 	opj_destroy_codec(codec);
@@ -251,6 +287,8 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 			fz_convert_pixmap(ctx, tmp, img);
 			fz_drop_pixmap(ctx, img);
 			img = tmp;
+			if (converted)
+				*converted = 1;
 		}
 		fz_premultiply_pixmap(ctx, img);
 	}
@@ -301,3 +339,30 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 
 	return img;
 }
+
+fz_pixmap *
+fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed)
+{
+	int l2factor = 0;
+	return jpx_read_image(ctx, data, size, defcs, indexed, &l2factor, NULL, NULL, NULL);
+}
+
+/* SumatraPDF: allow decoding JPX images at a reduced resolution on demand */
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed, int *l2factor)
+{
+	return jpx_read_image(ctx, data, size, defcs, indexed, l2factor, NULL, NULL, NULL);
+}
+
+void
+fz_load_jpx_info(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace)
+{
+	/* the output colorspace is only known after decoding, so decode at the lowest resolution */
+	int l2factor = 8, converted = 0;
+	fz_pixmap *img = jpx_read_image(ctx, data, size, defcs, indexed, &l2factor, w, h, &converted);
+
+	*xres = img->xres;
+	*yres = img->yres;
+	*cspace = converted ? NULL : img->colorspace;
+	fz_drop_pixmap(ctx, img);
+}
@@ -11,6 +11,7 @@ struct fz_item_s
 	fz_item *prev;
 	fz_store *store;
 	fz_store_type *type;
+	int kind;
 };
 
 struct fz_store_s
@@ -29,12 +30,27 @@ struct fz_store_s
 	/* We keep track of the size of the store, and keep it below max. */
 	unsigned int max;
 	unsigned int size;
+
+	/* SumatraPDF: size, limit and statistics per kind of item */
+	fz_store_stats kinds[FZ_STORE_KINDS];
+	/* SumatraPDF: the kind of a key is only determined when storing an
+	 * item, so misses are attributed to the kind of the item which is
+	 * stored afterwards; this counts all lookups instead */
+	unsigned int lookups;
 };
 
+static int
+item_kind(fz_store_type *type, void *key)
+{
+	int kind = type->kind ? type->kind(key) : FZ_STORE_OTHER;
+	return kind >= 0 && kind < FZ_STORE_KINDS ? kind : FZ_STORE_OTHER;
+}
+
 void
 fz_new_store_context(fz_context *ctx, unsigned int max)
 {
 	fz_store *store;
+	int i;
 	store = fz_malloc_struct(ctx, fz_store);
 	fz_try(ctx)
 	{
@@ -50,6 +66,8 @@ fz_new_store_context(fz_context *ctx, unsigned int max)
 	store->tail = NULL;
 	store->size = 0;
 	store->max = max;
+	for (i = 0; i < FZ_STORE_KINDS; i++)
+		store->kinds[i].max = FZ_STORE_UNLIMITED;
 	ctx->store = store;
 }
 
@@ -98,6 +116,8 @@ evict(fz_context *ctx, fz_item *item)
 	int drop;
 
 	store->size -= item->size;
+	store->kinds[item->kind].size -= item->size;
+	store->kinds[item->kind].items--;
 	/* Unlink from the linked list */
 	if (item->next)
 		item->next->prev = item->prev;
@@ -126,8 +146,9 @@ evict(fz_context *ctx, fz_item *item)
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 }
 
+/* SumatraPDF: only evicts items of the given kind (unless kind is -1) */
 static int
-ensure_space(fz_context *ctx, unsigned int tofree)
+ensure_space(fz_context *ctx, unsigned int tofree, int kind)
 {
 	fz_item *item, *prev;
 	unsigned int count;
@@ -140,7 +161,7 @@ ensure_space(fz_context *ctx, unsigned int tofree)
 	count = 0;
 	for (item = store->tail; item; item = item->prev)
 	{
-		if (item->val->refs == 1)
+		if (item->val->refs == 1 && (kind < 0 || item->kind == kind))
 		{
 			count += item->size;
 			if (count >= tofree)
@@ -159,7 +180,7 @@ ensure_space(fz_context *ctx, unsigned int tofree)
 	for (item = store->tail; item; item = prev)
 	{
 		prev = item->prev;
-		if (item->val->refs == 1)
+		if (item->val->refs == 1 && (kind < 0 || item->kind == kind))
 		{
 			/* Free this item. Evict has to drop the lock to
 			 * manage that, which could cause prev to be removed
@@ -170,6 +191,8 @@ ensure_space(fz_context *ctx, unsigned int tofree)
 			 * the limit anyway, and it will only cause something to
 			 * not be cached. */
 			count += item->size;
+			store->kinds[item->kind].evictions++;
+			store->kinds[item->kind].evicted += item->size;
 			if (prev)
 				prev->val->refs++;
 			evict(ctx, item); /* Drops then retakes lock */
@@ -223,13 +246,16 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 	fz_store_hash hash = { NULL };
 	int use_hash = 0;
 	unsigned pos;
+	int kind, pass;
 
 	if (!store)
 		return NULL;
 
 	fz_var(item);
 
-	if (store->max != FZ_STORE_UNLIMITED && store->max < itemsize)
+	kind = item_kind(type, key);
+	if ((store->max != FZ_STORE_UNLIMITED && store->max < itemsize) ||
+		(store->kinds[kind].max != FZ_STORE_UNLIMITED && store->kinds[kind].max < itemsize))
 	{
 		/* Our item would take up more room than we can ever
 		 * possibly have in the store. Just give up now. */
@@ -267,6 +293,9 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 	item->next = item;
 	item->prev = item;
 	item->type = type;
+	item->kind = kind;
+	/* SumatraPDF: count the preceding miss (cf. fz_store::lookups) */
+	store->kinds[kind].lookups++;
 
 	/* If we can index it fast, put it into the hash table. This serves
 	 * to check whether we have one there already. */
@@ -304,14 +333,18 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 	/* Now bump the ref */
 	if (val->refs > 0)
 		val->refs++;
-	/* If we haven't got an infinite store, check for space within it */
-	if (store->max != FZ_STORE_UNLIMITED)
+	/* If we haven't got an infinite store, check for space within it
+	 * (SumatraPDF: first within the budget for this kind of item) */
+	for (pass = 0; pass < 2; pass++)
 	{
-		size = store->size + itemsize;
-		while (size > store->max)
+		unsigned int max = pass == 0 ? store->kinds[kind].max : store->max;
+		if (max == FZ_STORE_UNLIMITED)
+			continue;
+		size = (pass == 0 ? store->kinds[kind].size : store->size) + itemsize;
+		while (size > max)
 		{
 			/* ensure_space may drop, then retake the lock */
-			int saved = ensure_space(ctx, size - store->max);
+			int saved = ensure_space(ctx, size - max, pass == 0 ? kind : -1);
 			if (saved == 0)
 			{
 				/* Failed to free any space. */
@@ -338,6 +371,8 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 		}
 	}
 	store->size += itemsize;
+	store->kinds[kind].size += itemsize;
+	store->kinds[kind].items++;
 
 	/* Regardless of whether it's indexed, it goes into the linked list */
 	touch(store, item);
@@ -367,6 +402,7 @@ fz_find_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type *
 	}
 
 	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->lookups++;
 	if (use_hash)
 	{
 		/* We can find objects keyed on indirected objects quickly */
@@ -391,6 +427,8 @@ fz_find_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type *
 		/* And bump the refcount before returning */
 		if (item->val->refs > 0)
 			item->val->refs++;
+		store->kinds[item->kind].lookups++;
+		store->kinds[item->kind].hits++;
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		return (void *)item->val;
 	}
@@ -444,6 +482,10 @@ fz_remove_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type
 				item->prev->next = item->next;
 			else
 				store->head = item->next;
+			/* SumatraPDF: only items in the list count towards the size */
+			store->size -= item->size;
+			store->kinds[item->kind].size -= item->size;
+			store->kinds[item->kind].items--;
 		}
 		drop = (item->val->refs > 0 && --item->val->refs == 0);
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
@@ -502,6 +544,46 @@ fz_drop_store_context(fz_context *ctx)
 	ctx->store = NULL;
 }
 
+void
+fz_set_store_kind_max(fz_context *ctx, int kind, unsigned int max)
+{
+	if (ctx == NULL || ctx->store == NULL || kind < 0 || kind >= FZ_STORE_KINDS)
+		return;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	ctx->store->kinds[kind].max = max;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_get_store_stats(fz_context *ctx, int kind, fz_store_stats *stats)
+{
+	fz_store *store;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	if (ctx == NULL || ctx->store == NULL || kind >= FZ_STORE_KINDS)
+		return;
+	store = ctx->store;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (kind >= 0)
+		*stats = store->kinds[kind];
+	else
+	{
+		for (i = 0; i < FZ_STORE_KINDS; i++)
+		{
+			stats->items += store->kinds[i].items;
+			stats->hits += store->kinds[i].hits;
+			stats->evictions += store->kinds[i].evictions;
+			stats->evicted += store->kinds[i].evicted;
+		}
+		stats->lookups = store->lookups;
+		stats->size = store->size;
+		stats->max = store->max;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 #ifndef NDEBUG
 static void
 print_item(FILE *out, void *item_)
@@ -566,6 +648,8 @@ scavenge(fz_context *ctx, unsigned int tofree)
 		{
 			/* Free this item */
 			count += item->size;
+			store->kinds[item->kind].evictions++;
+			store->kinds[item->kind].evicted += item->size;
 			evict(ctx, item); /* Drops then retakes lock */
 
 			if (count >= tofree)
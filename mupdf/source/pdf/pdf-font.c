@@ -892,6 +892,12 @@ hail_mary_cmp_key(void *k0, void *k1)
 	return k0 == k1;
 }
 
+static int
+hail_mary_store_kind(void *key)
+{
+	return FZ_STORE_FONT;
+}
+
 #ifndef NDEBUG
 static void
 hail_mary_debug_key(FILE *out, void *key_)
@@ -906,6 +912,7 @@ static fz_store_type hail_mary_store_type =
 	hail_mary_keep_key,
 	hail_mary_drop_key,
 	hail_mary_cmp_key,
+	hail_mary_store_kind,
 #ifndef NDEBUG
 	hail_mary_debug_key
 #endif
@@ -220,6 +220,11 @@ pdf_load_jpx(pdf_document *doc, pdf_obj *dict, int forcemask)
 	fz_context *ctx = doc->ctx;
 	int indexed = 0;
 	fz_image *mask = NULL;
+	/* SumatraPDF: decode JPX images on demand (cf. fz_image_get_pixmap) */
+	fz_image *image = NULL;
+	fz_compressed_buffer *cbuf = NULL;
+	fz_colorspace *cs = NULL;
+	int w, h, xres, yres;
 
 	fz_var(img);
 	fz_var(buf);
@@ -238,6 +243,35 @@ pdf_load_jpx(pdf_document *doc, pdf_obj *dict, int forcemask)
 			indexed = fz_colorspace_is_indexed(colorspace);
 		}
 
+		/* SumatraPDF: soft masks and images which have to be converted are still decoded right away */
+		if (!forcemask)
+			fz_load_jpx_info(ctx, buf->data, buf->len, colorspace, indexed, &w, &h, &xres, &yres, &cs);
+		if (cs)
+		{
+			float decode[FZ_MAX_COLORS * 2];
+			int i;
+
+			obj = pdf_dict_getsa(dict, "SMask", "Mask");
+			if (pdf_is_dict(obj))
+				mask = pdf_load_image_imp(doc, NULL, obj, NULL, 1);
+
+			obj = pdf_dict_getsa(dict, "Decode", "D");
+			if (obj && !indexed)
+			{
+				for (i = 0; i < cs->n * 2; i++)
+					decode[i] = pdf_to_real(pdf_array_get(obj, i));
+			}
+
+			cbuf = fz_malloc_struct(ctx, fz_compressed_buffer);
+			cbuf->params.type = FZ_IMAGE_JPX;
+			cbuf->params.u.jpx.smask_in_data = pdf_to_int(pdf_dict_gets(dict, "SMaskInData"));
+			cbuf->buffer = buf;
+			buf = NULL;
+			image = fz_new_image(ctx, w, h, 8, fz_keep_colorspace(ctx, cs), xres, yres, 0, 0, obj && !indexed ? decode : NULL, NULL, cbuf, mask);
+			mask = NULL;
+			break;
+		}
+
 		img = fz_load_jpx(ctx, buf->data, buf->len, colorspace, indexed);
 
 		obj = pdf_dict_getsa(dict, "SMask", "Mask");
@@ -268,10 +302,13 @@ pdf_load_jpx(pdf_document *doc, pdf_obj *dict, int forcemask)
 	}
 	fz_catch(ctx)
 	{
+		fz_drop_image(ctx, mask);
 		fz_drop_pixmap(ctx, img);
 		fz_rethrow(ctx);
 	}
 
+	if (image)
+		return image;
 	return fz_new_image_from_pixmap(ctx, img, mask);
 }
 
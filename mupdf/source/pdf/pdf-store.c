@@ -31,6 +31,25 @@ pdf_cmp_key(void *k0, void *k1)
 	return pdf_objcmp((pdf_obj *)k0, (pdf_obj *)k1);
 }
 
+/* SumatraPDF: fonts, cmaps and images are dictionaries/streams of
+ * the corresponding /Type or /Subtype (everything else stored for
+ * a pdf_obj key is a resource such as a colorspace or a function) */
+static int
+pdf_store_kind(void *key_)
+{
+	pdf_obj *key = (pdf_obj *)key_;
+	char *type;
+
+	if (!pdf_is_dict(key))
+		return FZ_STORE_RESOURCE;
+	type = pdf_to_name(pdf_dict_gets(key, "Type"));
+	if (!strcmp(type, "Font") || !strcmp(type, "CMap"))
+		return FZ_STORE_FONT;
+	if (!strcmp(pdf_to_name(pdf_dict_gets(key, "Subtype")), "Image"))
+		return FZ_STORE_IMAGE;
+	return FZ_STORE_RESOURCE;
+}
+
 #ifndef NDEBUG
 static void
 pdf_debug_key(FILE *out, void *key_)
@@ -51,6 +70,7 @@ static fz_store_type pdf_obj_store_type =
 	pdf_keep_key,
 	pdf_drop_key,
 	pdf_cmp_key,
+	pdf_store_kind,
 #ifndef NDEBUG
 	pdf_debug_key
 #endif
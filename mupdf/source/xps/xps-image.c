@@ -117,6 +117,12 @@ xps_cmp_image_key(void *k1, void *k2)
 	return strcmp(((xps_image_key *)k1)->part_name, ((xps_image_key *)k2)->part_name);
 }
 
+static int
+xps_image_store_kind(void *key)
+{
+	return FZ_STORE_IMAGE;
+}
+
 #ifndef NDEBUG
 static void
 xps_debug_image(FILE *out, void *key)
@@ -131,6 +137,7 @@ static fz_store_type xps_image_store_type =
 	fz_keep_storable,
 	fz_drop_storable,
 	xps_cmp_image_key,
+	xps_image_store_kind,
 #ifndef NDEBUG
 	xps_debug_image
 #endif
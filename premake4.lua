@@ -102,11 +102,14 @@ solution "all_tests"
       "src/utils/HtmlPrettyPrint*",
       "src/utils/HtmlPullParser*",
       "src/utils/JsonParser*",
+      "src/utils/PageLayout*",
+      "src/utils/PixelConvert*",
       "src/utils/SettingsUtil*",
       "src/utils/SimpleLog*",
       "src/utils/StrFormat*",
       "src/utils/StrUtil*",
       "src/utils/SquareTreeParser*",
+      "src/utils/TextMatch*",
       "src/utils/TrivialHtmlParser*",
       "src/utils/UtAssert*",
       "src/utils/VarintGob*",
@@ -118,8 +121,25 @@ solution "all_tests"
       "src/AppUtil*",
       "src/UnitTests.cpp",
       "src/mui/SvgPath*",
+      -- SIMD vs. scalar span painters and image scalers
+      "src/DrawPaint_ut.cpp",
+      "src/DrawScale_ut.cpp",
+      "mupdf/source/fitz/draw-paint.c",
+      "mupdf/source/fitz/draw-scale-simple.c",
+      "mupdf/source/fitz/geometry.c",
       "tools/tests/UnitMain.cpp"
     }
-    includedirs { "src/utils", "src/utils/msvc" }
+    includedirs { "src/utils", "src/utils/msvc", "mupdf/include" }
     links { "gdiplus", "comctl32", "shlwapi", "Version" }
 
+  -- synthetic benchmarks for the utils which only depend on the C runtime
+  project "bench_util"
+    kind "ConsoleApp"
+    language "C++"
+    files {
+      "src/utils/PixelConvert*",
+      "src/utils/TextMatch*",
+      "tools/tests/BenchMain.cpp"
+    }
+    includedirs { "src/utils", "src/utils/msvc" }
+
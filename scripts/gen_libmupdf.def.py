@@ -52,7 +52,7 @@ EXPORTS
 	jpeg_destroy_decompress
 	jpeg_std_error
 
-; zlib exports (required for ZipUtil, PsEngine, LzmaSimpleArchive)
+; zlib exports (required for ZipUtil, PsEngine, LzmaSimpleArchive, DiskTileCache)
 
 	gzerror
 	gzprintf
@@ -71,6 +71,7 @@ EXPORTS
 	deflate
 	deflateEnd
 	compress
+	compress2
 	compressBound
 	crc32
 """
@@ -379,6 +379,22 @@ GlobalPrefs = [
 		"actual resolution of the main screen in DPI (if this value " +
 		" isn't positive, the system's UI setting is used)",
 		expert=True, version="2.5"),
+	Field("BitmapCacheSize", Int, 0,
+		"maximum amount of memory (in MB) used for caching rendered pages (if this " +
+		"value isn't positive, a default depending on the screen size is used)",
+		expert=True, version="2.5"),
+	Field("DisplayListCacheSize", Int, 0,
+		"maximum amount of memory (in MB) used per document for caching parsed page " +
+		"contents (if this value isn't positive, a default of 40 MB is used)",
+		expert=True, version="2.5"),
+	Field("TileCacheSize", Int, 0,
+		"maximum amount of disk space (in MB) used for keeping rendered pages " +
+		"across sessions (if this value isn't positive, rendered pages aren't saved)",
+		expert=True, version="2.5"),
+	Field("TextCacheSize", Int, 0,
+		"maximum amount of memory (in MB) used per document for caching extracted " +
+		"text (if this value isn't positive, a default of 64 MB is used)",
+		expert=True, version="2.5"),
 	Struct("AnnotationDefaults", AnnotationDefaults,
 		"default values for user added annotations in FixedPageUI documents " +
 		"(preliminary and still subject to change)",
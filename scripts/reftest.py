@@ -7,6 +7,13 @@ Use for regression testing:
 
 reftest.py /dir/to/test -refdir /dir/for/references
 reftest.py /dir/one /dir/two /dir/three
+
+Use -threads <n> for additionally rendering, extracting text from and
+getting links for all pages of every file from n threads at once and
+comparing the results against a single-threaded pass (a smoke test for
+engines rendering in parallel such as DjVuEngine):
+
+reftest.py /dir/with/djvu/files -threads 4
 """
 
 import os, sys, struct, fnmatch
@@ -18,6 +25,17 @@ def EngineDump(EngineDumpExe, file, tgaPath):
 	xmlDump, _ = proc.communicate()
 	return xmlDump
 
+def StressTestFile(EngineDumpExe, file, threads):
+	# EngineDump fails if any page renders differently with several threads
+	proc = Popen([EngineDumpExe, file, "-bench", "stress", "-threads", str(threads)], stdout=PIPE)
+	output, _ = proc.communicate()
+	if proc.returncode == 0:
+		return True
+	for line in output.splitlines():
+		if line.startswith("stress:"):
+			print "  FAIL!", line
+	return False
+
 def TgaRleUnpack(data):
 	# unpacks data from a type 2 TGA file (24-bit uncompressed)
 	# or a type 10 TGA file (24-bit run-length encoded)
@@ -129,17 +147,20 @@ def RefTestFile(EngineDumpExe, file, refdir):
 		if not os.path.isfile(tgaRefPath):
 			os.rename(tgaCmpPath, tgaRefPath)
 
-def RefTestDir(EngineDumpExe, dir, refdir):
+def RefTestDir(EngineDumpExe, dir, refdir, threads=0):
 	# create reference directory, if it doesn't exists yet
 	if not os.path.isdir(refdir):
 		os.makedirs(refdir)
 	
 	# test all files in the directory to test
+	stressFails = 0
 	for file in os.listdir(dir):
 		file = pjoin(dir, file)
 		if os.path.isfile(file):
 			print "Testing", file
 			RefTestFile(EngineDumpExe, file, refdir)
+			if threads > 0 and not StressTestFile(EngineDumpExe, file, threads):
+				stressFails += 1
 	
 	# list all differences (again)
 	diffs = fnmatch.filter(os.listdir(refdir), "*.cmp.*")
@@ -149,7 +170,7 @@ def RefTestDir(EngineDumpExe, dir, refdir):
 			print pjoin(refdir, file)
 		print
 	
-	return len(diffs)
+	return len(diffs) + stressFails
 
 def main(args):
 	# find a path to EngineDump.exe (defaults to ../obj-dbg/EngineDump.exe)
@@ -158,9 +179,16 @@ def main(args):
 	else:
 		EngineDumpExe = pjoin(os.path.dirname(__file__), "..", "obj-dbg", "EngineDump.exe")
 	
+	# stress test with several threads (if requested)
+	threads = 0
+	if "-threads" in args[:-1]:
+		ix = args.index("-threads")
+		threads = int(args[ix + 1])
+		del args[ix:ix + 2]
+	
 	# minimal sanity check of arguments
 	if not args[1:] or not os.path.isdir(args[1]):
-		print "Usage: %s [EngineDump.exe] <dir> [-refdir <dir>] [<dir> ...]" % (os.path.split(args[0])[1])
+		print "Usage: %s [EngineDump.exe] <dir> [-refdir <dir>] [<dir> ...] [-threads <n>]" % (os.path.split(args[0])[1])
 		return
 	
 	# collect all directories to test (and the corresonding reference directories)
@@ -176,7 +204,7 @@ def main(args):
 	# run the test
 	fails = 0
 	for (dir, refdir) in dirs:
-		fails += RefTestDir(EngineDumpExe, dir, refdir)
+		fails += RefTestDir(EngineDumpExe, dir, refdir, threads)
 	sys.exit(fails)
 
 if __name__ == "__main__":
@@ -215,6 +215,19 @@ public:
     virtual void Abort() = 0;
 };
 
+// statistics about one of an engine's internal caches (for benchmarking)
+struct EngineCacheStats {
+    char    name[32];
+    size_t  items;
+    size_t  bytes;
+    // 0 if the cache isn't limited
+    size_t  maxBytes;
+    size_t  lookups;
+    size_t  hits;
+    size_t  evictions;
+    size_t  evictedBytes;
+};
+
 class BaseEngine {
 public:
     virtual ~BaseEngine() { }
@@ -323,9 +336,20 @@ public:
     // caller must free() the result
     virtual char *GetDecryptionKey() const { return NULL; }
 
+    // computes a digest of the document's content (including user annotations)
+    // which changes whenever pages might render differently (e.g. for caching
+    // rendered pages across sessions) and returns false if that isn't supported
+    // (or if *cancel has been set while reading through the document)
+    virtual bool GetContentFingerprint(unsigned char digest[16], bool *cancel=NULL) { return false; }
+
     // loads the given page so that the time required can be measured
     // without also measuring rendering times
     virtual bool BenchLoadPage(int pageNo) = 0;
+    // builds the page's display list (for engines which cache one) so that
+    // parsing and rasterization times can be measured separately
+    virtual bool BenchBuildPageRun(int pageNo) { return false; }
+    // appends statistics about internal caches (e.g. hit rates)
+    virtual void BenchGetCacheStats(Vec<EngineCacheStats>& stats) { }
 };
 
 #endif
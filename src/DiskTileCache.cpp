@@ -0,0 +1,330 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "BaseUtil.h"
+#include "DiskTileCache.h"
+
+#include "BaseEngine.h"
+#include "FileUtil.h"
+#include "PdfEngine.h"
+
+#include <zlib.h>
+
+/*
+Each tile is stored in its own file named after a digest of its DiskTileKey:
+
+"STC1" | width (uint32) | height (uint32) | deflate compressed top-down BGRA data
+
+The files' modification times are updated on every access, so that the
+least recently used tiles can also be determined in a later session.
+Tiles are written to a temporary file first and then renamed, so that
+a crash (or another instance reading the same tile) never sees a
+partially written tile.
+*/
+
+#define TILE_MAGIC      "STC1"
+#define TILE_HEADER_LEN 12
+#define TILE_EXT        L".tile"
+#define TEMP_EXT        L".tmp"
+
+DiskTileCache::DiskTileCache(const WCHAR *dir, size_t maxBytes) :
+    dir(str::Dup(dir)), maxBytes(maxBytes), oldest(NULL), newest(NULL),
+    scanned(false), totalBytes(0)
+{
+    InitializeCriticalSection(&access);
+    ZeroMemory(&stats, sizeof(stats));
+    ZeroMemory(buckets, sizeof(buckets));
+}
+
+DiskTileCache::~DiskTileCache()
+{
+    while (oldest) {
+        DiskTile *tile = oldest;
+        oldest = tile->newer;
+        free(tile->name);
+        delete tile;
+    }
+    DeleteCriticalSection(&access);
+}
+
+WCHAR *DiskTileCache::GetTileName(const DiskTileKey& key)
+{
+    ScopedMem<char> fingerprint(str::MemToHex(key.fingerprint, 16));
+    ScopedMem<char> keyStr(str::Format("%s:%d:%d:%.4f:%.2f:%.2f:%.2f:%.2f", fingerprint.Get(),
+        key.pageNo, key.rotation, key.zoom, key.pageRect.x, key.pageRect.y,
+        key.pageRect.dx, key.pageRect.dy));
+    unsigned char digest[16];
+    CalcMD5Digest((unsigned char *)keyStr.Get(), str::Len(keyStr), digest);
+    ScopedMem<char> name(str::MemToHex(digest, 16));
+    ScopedMem<WCHAR> nameW(str::conv::FromAnsi(name));
+    return str::Join(nameW, TILE_EXT);
+}
+
+static int cmpLastUsed(const void *a, const void *b)
+{
+    return CompareFileTime(&(*(DiskTile **)a)->lastUsed, &(*(DiskTile **)b)->lastUsed);
+}
+
+// must be called within the access critical section
+void DiskTileCache::ScanDir()
+{
+    if (scanned)
+        return;
+    scanned = true;
+
+    ScopedMem<WCHAR> pattern(path::Join(dir, L"*" TILE_EXT));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind)
+        return;
+    Vec<DiskTile *> found;
+    do {
+        if ((fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            continue;
+        DiskTile *tile = new DiskTile();
+        tile->name = str::Dup(fdata.cFileName);
+        tile->size = (size_t)fdata.nFileSizeLow;
+        tile->lastUsed = fdata.ftLastWriteTime;
+        found.Append(tile);
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    // sorted once, tiles only ever move to the newest end afterwards
+    found.Sort(cmpLastUsed);
+    for (size_t i = 0; i < found.Count(); i++) {
+        AddTile(found.At(i));
+    }
+}
+
+// tile names are case-insensitive (as are file names)
+static size_t GetBucketIdx(const WCHAR *name)
+{
+    size_t hash = 0;
+    for (const WCHAR *c = name; *c; c++) {
+        hash = hash * 31 + towlower(*c);
+    }
+    return hash % DISK_TILE_BUCKETS;
+}
+
+DiskTile *DiskTileCache::FindTile(const WCHAR *name)
+{
+    for (DiskTile *tile = buckets[GetBucketIdx(name)]; tile; tile = tile->next) {
+        if (str::EqI(tile->name, name))
+            return tile;
+    }
+    return NULL;
+}
+
+void DiskTileCache::LinkNewest(DiskTile *tile)
+{
+    tile->older = newest;
+    tile->newer = NULL;
+    if (newest)
+        newest->newer = tile;
+    else
+        oldest = tile;
+    newest = tile;
+}
+
+void DiskTileCache::Unlink(DiskTile *tile)
+{
+    if (tile->older)
+        tile->older->newer = tile->newer;
+    else
+        oldest = tile->newer;
+    if (tile->newer)
+        tile->newer->older = tile->older;
+    else
+        newest = tile->older;
+}
+
+void DiskTileCache::MarkUsed(DiskTile *tile, FILETIME now)
+{
+    tile->lastUsed = now;
+    Unlink(tile);
+    LinkNewest(tile);
+}
+
+void DiskTileCache::AddTile(DiskTile *tile)
+{
+    ListInsert(&buckets[GetBucketIdx(tile->name)], tile);
+    LinkNewest(tile);
+    totalBytes += tile->size;
+}
+
+void DiskTileCache::RemoveTile(DiskTile *tile)
+{
+    ScopedMem<WCHAR> tilePath(path::Join(dir, tile->name));
+    file::Delete(tilePath);
+    CrashIf(totalBytes < tile->size);
+    totalBytes -= tile->size;
+    bool found = ListRemove(&buckets[GetBucketIdx(tile->name)], tile);
+    CrashIf(!found);
+    Unlink(tile);
+    free(tile->name);
+    delete tile;
+}
+
+static bool InflateData(const char *data, size_t len, unsigned char *out, size_t outLen)
+{
+    z_stream stream = { 0 };
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = (uInt)len;
+    stream.next_out = out;
+    stream.avail_out = (uInt)outLen;
+
+    if (inflateInit(&stream) != Z_OK)
+        return false;
+    int err = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    return Z_STREAM_END == err && stream.total_out == outLen;
+}
+
+RenderedBitmap *DiskTileCache::Load(const DiskTileKey& key)
+{
+    ScopedMem<WCHAR> name(GetTileName(key));
+
+    EnterCriticalSection(&access);
+    ScanDir();
+    bool found = FindTile(name) != NULL;
+    if (!found)
+        stats.misses++;
+    LeaveCriticalSection(&access);
+    if (!found)
+        return NULL;
+
+    ScopedMem<WCHAR> tilePath(path::Join(dir, name));
+    size_t len;
+    ScopedMem<char> data(file::ReadAll(tilePath, &len));
+    RenderedBitmap *bmp = NULL;
+    if (data && len > TILE_HEADER_LEN && str::StartsWith(data.Get(), TILE_MAGIC)) {
+        uint32_t w = *(uint32_t *)(data + 4), h = *(uint32_t *)(data + 8);
+        // tiles are at most screen-sized (cf. RenderCache::maxTileSize)
+        if (0 < w && w <= 0x8000 && 0 < h && h <= 0x8000) {
+            BITMAPINFO bmi = { 0 };
+            bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+            bmi.bmiHeader.biWidth = w;
+            bmi.bmiHeader.biHeight = -(LONG)h;
+            bmi.bmiHeader.biPlanes = 1;
+            bmi.bmiHeader.biBitCount = 32;
+            bmi.bmiHeader.biCompression = BI_RGB;
+
+            unsigned char *bmpData = NULL;
+            HBITMAP hbmp = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, (void **)&bmpData, NULL, 0);
+            if (hbmp && InflateData(data + TILE_HEADER_LEN, len - TILE_HEADER_LEN, bmpData, w * h * 4))
+                bmp = new RenderedBitmap(hbmp, SizeI(w, h));
+            else if (hbmp)
+                DeleteObject(hbmp);
+        }
+    }
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    if (bmp)
+        file::SetModificationTime(tilePath, now);
+
+    ScopedCritSec scope(&access);
+    DiskTile *tile = FindTile(name);
+    if (bmp) {
+        stats.hits++;
+        stats.bytesRead += len;
+        if (tile)
+            MarkUsed(tile, now);
+    }
+    else {
+        // the file is corrupted or has been deleted in the meantime
+        stats.misses++;
+        if (tile)
+            RemoveTile(tile);
+    }
+    return bmp;
+}
+
+bool DiskTileCache::Save(const DiskTileKey& key, RenderedBitmap *bmp)
+{
+    SizeI size = bmp->Size();
+    if (size.IsEmpty())
+        return false;
+
+    BITMAPINFO bmi = { 0 };
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    size_t bmpBytes = size.dx * size.dy * 4;
+    ScopedMem<unsigned char> bmpData(AllocArray<unsigned char>(bmpBytes));
+    if (!bmpData)
+        return false;
+    HDC hDC = GetDC(NULL);
+    bool ok = GetDIBits(hDC, bmp->GetBitmap(), 0, size.dy, bmpData, &bmi, DIB_RGB_COLORS) != 0;
+    ReleaseDC(NULL, hDC);
+    if (!ok)
+        return false;
+
+    uLongf compressedLen = compressBound((uLong)bmpBytes);
+    ScopedMem<unsigned char> data(AllocArray<unsigned char>(TILE_HEADER_LEN + compressedLen));
+    if (!data)
+        return false;
+    memcpy(data, TILE_MAGIC, 4);
+    *(uint32_t *)(data + 4) = size.dx;
+    *(uint32_t *)(data + 8) = size.dy;
+    // favor speed over size, as tiles are saved on the rendering threads
+    if (compress2(data + TILE_HEADER_LEN, &compressedLen, bmpData, (uLong)bmpBytes, Z_BEST_SPEED) != Z_OK)
+        return false;
+    size_t len = TILE_HEADER_LEN + compressedLen;
+
+    ScopedMem<WCHAR> name(GetTileName(key));
+    ScopedMem<WCHAR> tilePath(path::Join(dir, name));
+    // the temporary name is unique per thread, as several threads
+    // might be saving the same tile at once
+    ScopedMem<WCHAR> tempPath(str::Format(L"%s.%u" TEMP_EXT, tilePath.Get(), GetCurrentThreadId()));
+    if (!dir::CreateAll(dir) || !file::WriteAll(tempPath, data, len))
+        return false;
+    if (!MoveFileEx(tempPath, tilePath, MOVEFILE_REPLACE_EXISTING)) {
+        file::Delete(tempPath);
+        return false;
+    }
+
+    ScopedCritSec scope(&access);
+    ScanDir();
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    DiskTile *saved = FindTile(name);
+    if (saved) {
+        // another thread has saved the same tile in the meantime
+        totalBytes -= saved->size;
+        saved->size = len;
+        totalBytes += len;
+        MarkUsed(saved, now);
+    }
+    else {
+        saved = new DiskTile();
+        saved->name = name.StealData();
+        saved->size = len;
+        saved->lastUsed = now;
+        AddTile(saved);
+    }
+    stats.stores++;
+    stats.bytesWritten += len;
+
+    // evict the least recently used tiles (but never the one just saved)
+    while (totalBytes > maxBytes && oldest != saved) {
+        RemoveTile(oldest);
+        stats.evictions++;
+    }
+
+    return true;
+}
+
+DiskTileCacheStats DiskTileCache::GetStats()
+{
+    ScopedCritSec scope(&access);
+    ScanDir();
+    DiskTileCacheStats result = stats;
+    result.bytes = totalBytes;
+    result.maxBytes = maxBytes;
+    return result;
+}
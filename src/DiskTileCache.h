@@ -0,0 +1,82 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#ifndef DiskTileCache_h
+#define DiskTileCache_h
+
+class RenderedBitmap;
+
+// identifies a rendered tile across sessions
+struct DiskTileKey {
+    // cf. BaseEngine::GetContentFingerprint
+    unsigned char fingerprint[16];
+    int pageNo;
+    int rotation;
+    float zoom;
+    RectD pageRect;
+};
+
+struct DiskTileCacheStats {
+    size_t  hits;
+    size_t  misses;
+    size_t  stores;
+    size_t  evictions;
+    size_t  bytesRead;
+    size_t  bytesWritten;
+    // size of all tiles currently cached on disk
+    size_t  bytes;
+    size_t  maxBytes;
+};
+
+struct DiskTile {
+    WCHAR *     name;
+    size_t      size;
+    FILETIME    lastUsed;
+    // next tile in the same hash bucket
+    DiskTile *  next;
+    // neighbouring tiles in the order of their use
+    DiskTile *  older;
+    DiskTile *  newer;
+};
+
+// number of hash buckets for finding tiles by name
+#define DISK_TILE_BUCKETS 1024
+
+// stores rendered tiles in a directory (deflate compressed) so that pages
+// of reopened documents can be displayed without having to render them again.
+// The least recently used tiles are deleted when the cache exceeds maxBytes.
+class DiskTileCache {
+    ScopedMem<WCHAR>    dir;
+    size_t              maxBytes;
+
+    CRITICAL_SECTION    access;
+    // lazily initialized from the directory's content
+    DiskTile *          buckets[DISK_TILE_BUCKETS];
+    // all tiles from least to most recently used
+    DiskTile *          oldest;
+    DiskTile *          newest;
+    bool                scanned;
+    size_t              totalBytes;
+    DiskTileCacheStats  stats;
+
+    WCHAR * GetTileName(const DiskTileKey& key);
+    void    ScanDir();
+    DiskTile *FindTile(const WCHAR *name);
+    void    AddTile(DiskTile *tile);
+    void    RemoveTile(DiskTile *tile);
+    void    LinkNewest(DiskTile *tile);
+    void    Unlink(DiskTile *tile);
+    void    MarkUsed(DiskTile *tile, FILETIME now);
+
+public:
+    DiskTileCache(const WCHAR *dir, size_t maxBytes);
+    ~DiskTileCache();
+
+    // returns NULL if no tile has been saved for this key
+    // caller must delete the result
+    RenderedBitmap *Load(const DiskTileKey& key);
+    bool    Save(const DiskTileKey& key, RenderedBitmap *bmp);
+    DiskTileCacheStats GetStats();
+};
+
+#endif
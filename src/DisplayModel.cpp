@@ -47,8 +47,11 @@
 #include "DisplayModel.h"
 
 #include "AppPrefs.h" // needed for gGlobalPrefs
+#include "PageLayout.h"
+#include "TextIndex.h"
 #include "TextSearch.h"
 #include "TextSelection.h"
+#include "ThreadUtil.h"
 
 // Note: adding chm handling to DisplayModel is a hack, because DisplayModel
 // doesn't map to chm features well.
@@ -56,6 +59,11 @@
 // if true, we pre-render the pages right before and after the visible pages
 bool gPredictiveRender = true;
 
+// for documents with more pages, page sizes are only loaded when the pages are
+// about to be displayed (until then, pages are assumed to have the same size
+// as the previous page, which is the case for most documents)
+#define MAX_PAGE_SIZES_LOADED_UPFRONT 1000
+
 bool IsContinuous(DisplayMode displayMode)
 {
     return DM_CONTINUOUS == displayMode ||
@@ -146,13 +154,21 @@ SizeD DisplayModel::PageSizeAfterRotation(int pageNo, bool fitToContent)
 {
     PageInfo *pageInfo = GetPageInfo(pageNo);
     if (fitToContent && pageInfo->contentBox.IsEmpty()) {
+        LoadPageSize(pageNo);
         pageInfo->contentBox = engine->PageContentBox(pageNo);
         if (pageInfo->contentBox.IsEmpty())
             return PageSizeAfterRotation(pageNo);
     }
 
-    RectD box = fitToContent ? pageInfo->contentBox : pageInfo->page;
-    return engine->Transform(box, pageNo, 1.0, rotation).Size();
+    if (!fitToContent) {
+        // rotating a page just swaps its dimensions (which doesn't require
+        // engine->Transform to load the page's actual size)
+        SizeD size = pageInfo->page.Size();
+        if (rotation % 180 != 0)
+            Swap(size.dx, size.dy);
+        return size;
+    }
+    return engine->Transform(pageInfo->contentBox, pageNo, 1.0, rotation).Size();
 }
 
 /* given 'columns' and an absolute 'pageNo', return the number of the first
@@ -185,11 +201,12 @@ static int LastPageInARowNo(int pageNo, int columns, bool showCover, int pageCou
 // must call SetInitialViewSettings() after creation
 DisplayModel::DisplayModel(BaseEngine *engine, EngineType engineType, DisplayModelCallback *cb) :
     engine(engine), engineType(engineType), dmCb(cb),
-    pagesInfo(NULL), displayMode(DM_AUTOMATIC), startPage(1),
+    pagesInfo(NULL), firstShownPageNo(1), visibleFirst(1), visibleLast(0),
+    displayMode(DM_AUTOMATIC), startPage(1),
     zoomReal(INVALID_ZOOM), zoomVirtual(INVALID_ZOOM),
     rotation(0), dpiFactor(1.0f), displayR2L(false),
     presentationMode(false), presZoomVirtual(INVALID_ZOOM),
-    presDisplayMode(DM_AUTOMATIC), navHistoryIx(0),
+    presDisplayMode(DM_AUTOMATIC), navHistoryIx(0), fingerprinter(NULL),
     dontRenderFlag(false)
 {
     CrashIf(!engine || engine->PageCount() <= 0);
@@ -211,8 +228,9 @@ DisplayModel::DisplayModel(BaseEngine *engine, EngineType engineType, DisplayMod
         AsChmEngine()->SetNavigationCalback(dmCb);
 
     textCache = new PageTextCache(engine);
+    textIndex = new TextIndex(engine, textCache);
     textSelection = new TextSelection(engine, textCache);
-    textSearch = new TextSearch(engine, textCache);
+    textSearch = new TextSearch(engine, textCache, textIndex);
 }
 
 DisplayModel::~DisplayModel()
@@ -220,13 +238,63 @@ DisplayModel::~DisplayModel()
     dontRenderFlag = true;
     dmCb->CleanUp(this);
 
+    // stops reading the document before the engine is deleted
+    if (fingerprinter) {
+        fingerprinter->Stop();
+        delete fingerprinter;
+    }
     delete textSearch;
+    // stops building the index before the engine is deleted
+    delete textIndex;
     delete textSelection;
     delete textCache;
     delete engine;
     free(pagesInfo);
 }
 
+// once the engine has computed the fingerprint of the document itself,
+// it only has to combine it with the current user annotations on request
+class FingerprintThread : public ThreadBase {
+    BaseEngine *engine;
+    bool cancel;
+    // only ever changed from false to true (cf. ThreadBase::cancelRequested)
+    bool done;
+
+public:
+    explicit FingerprintThread(BaseEngine *engine) :
+        ThreadBase("FingerprintThread"), engine(engine), cancel(false), done(false) { }
+    virtual ~FingerprintThread() { }
+
+    bool IsDone() const { return done; }
+    void Stop() {
+        cancel = true;
+        Join();
+    }
+
+    virtual void Run() {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+        unsigned char digest[16];
+        engine->GetContentFingerprint(digest, &cancel);
+        done = !cancel;
+    }
+};
+
+void DisplayModel::StartFingerprinting()
+{
+    CrashIf(fingerprinter);
+    if (fingerprinter)
+        return;
+    fingerprinter = new FingerprintThread(engine);
+    fingerprinter->Start();
+}
+
+bool DisplayModel::GetContentFingerprint(unsigned char digest[16])
+{
+    if (!fingerprinter || !fingerprinter->IsDone())
+        return false;
+    return engine->GetContentFingerprint(digest);
+}
+
 PageInfo *DisplayModel::GetPageInfo(int pageNo) const
 {
     if (!ValidPageNo(pageNo) || AsChmEngine())
@@ -236,6 +304,16 @@ PageInfo *DisplayModel::GetPageInfo(int pageNo) const
     return &(pagesInfo[pageNo-1]);
 }
 
+RectI DisplayModel::GetPageOnScreen(int pageNo) const
+{
+    PageInfo *pageInfo = GetPageInfo(pageNo);
+    if (!pageInfo || !pageInfo->shown)
+        return RectI();
+    RectI pageOnScreen = pageInfo->pos;
+    pageOnScreen.Offset(-viewPort.x, -viewPort.y);
+    return pageOnScreen;
+}
+
 // Call this before the first Relayout
 void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newStartPage, SizeI viewPort, int screenDPI)
 {
@@ -273,11 +351,10 @@ void DisplayModel::BuildPagesInfo()
 
     WCHAR unitSystem[2] = { 0 };
     GetLocaleInfo(LOCALE_USER_DEFAULT, LOCALE_IMEASURE, unitSystem, dimof(unitSystem));
-    RectD defaultRect;
     if (unitSystem[0] == '0') // metric A4 size
-        defaultRect = RectD(0, 0, 21.0 / 2.54 * engine->GetFileDPI(), 29.7 / 2.54 * engine->GetFileDPI());
+        defaultPageRect = RectD(0, 0, 21.0 / 2.54 * engine->GetFileDPI(), 29.7 / 2.54 * engine->GetFileDPI());
     else // imperial letter size
-        defaultRect = RectD(0, 0, 8.5 * engine->GetFileDPI(), 11 * engine->GetFileDPI());
+        defaultPageRect = RectD(0, 0, 8.5 * engine->GetFileDPI(), 11 * engine->GetFileDPI());
 
     int columns = ColumnsFromDisplayMode(displayMode);
     int newStartPage = startPage;
@@ -285,10 +362,6 @@ void DisplayModel::BuildPagesInfo()
         newStartPage--;
     for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
-        pageInfo->page = engine->PageMediabox(pageNo);
-        // layout pages with an empty mediabox as A4 size (resp. letter size)
-        if (pageInfo->page.IsEmpty())
-            pageInfo->page = defaultRect;
         pageInfo->visibleRatio = 0.0;
         pageInfo->shown = false;
         if (IsContinuous(displayMode))
@@ -296,6 +369,46 @@ void DisplayModel::BuildPagesInfo()
         else if (newStartPage <= pageNo && pageNo < newStartPage + columns)
             pageInfo->shown = true;
     }
+
+    // the first page's size is assumed for all pages until they're loaded
+    int loadCount = pageCount <= MAX_PAGE_SIZES_LOADED_UPFRONT ? pageCount : 1;
+    for (int pageNo = 1; pageNo <= loadCount; pageNo++) {
+        LoadPageSize(pageNo);
+    }
+}
+
+// loads the actual size of a page (if it hasn't been loaded yet) and returns
+// true if it differs from the assumed size (in which case the layout is outdated)
+bool DisplayModel::LoadPageSize(int pageNo)
+{
+    PageInfo *pageInfo = GetPageInfo(pageNo);
+    if (pageInfo->pageLoaded)
+        return false;
+    pageInfo->pageLoaded = true;
+
+    RectD page = engine->PageMediabox(pageNo);
+    // layout pages with an empty mediabox as A4 size (resp. letter size)
+    if (page.IsEmpty())
+        page = defaultPageRect;
+    if (page == pageInfo->page)
+        return false;
+
+    // assume that the following pages have the same size until they're loaded
+    pageInfo->page = page;
+    for (int i = pageNo + 1; i <= PageCount() && !pagesInfo[i-1].pageLoaded; i++) {
+        pagesInfo[i-1].page = page;
+    }
+    return true;
+}
+
+bool DisplayModel::LoadPageSizes(int firstPageNo, int lastPageNo)
+{
+    bool changed = false;
+    for (int pageNo = max(firstPageNo, 1); pageNo <= min(lastPageNo, PageCount()); pageNo++) {
+        if (PageShown(pageNo) && LoadPageSize(pageNo))
+            changed = true;
+    }
+    return changed;
 }
 
 // TODO: a better name e.g. ShouldShow() to better distinguish between
@@ -378,6 +491,7 @@ float DisplayModel::ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo)
         RectD box;
         for (int i = first; i <= last; i++) {
             PageInfo *pageInfo = GetPageInfo(i);
+            LoadPageSize(i);
             if (pageInfo->contentBox.IsEmpty())
                 pageInfo->contentBox = engine->PageContentBox(i);
 
@@ -421,7 +535,7 @@ int DisplayModel::FirstVisiblePageNo() const
     assert(pagesInfo);
     if (!pagesInfo) return INVALID_PAGE_NO;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    for (int pageNo = visibleFirst; pageNo <= visibleLast; ++pageNo) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > 0.0)
             return pageNo;
@@ -447,7 +561,7 @@ int DisplayModel::CurrentPageNo() const
     int mostVisiblePage = INVALID_PAGE_NO;
     float ratio = 0;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+    for (int pageNo = visibleFirst; pageNo <= visibleLast; pageNo++) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > ratio) {
             mostVisiblePage = pageNo;
@@ -485,11 +599,14 @@ void DisplayModel::SetZoomVirtual(float newZoomVirtual)
            across the pages so that the largest page fits. In most documents
            all pages are the same size anyway */
         float minZoom = (float)HUGE_VAL;
+        RectD lastPage;
         for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-            if (PageShown(pageNo)) {
+            // the zoom only depends on the page size
+            if (PageShown(pageNo) && GetPageInfo(pageNo)->page != lastPage) {
                 float thisPageZoom = ZoomRealFromVirtualForPage(newZoomVirtual, pageNo);
                 if (minZoom > thisPageZoom)
                     minZoom = thisPageZoom;
+                lastPage = GetPageInfo(pageNo)->page;
             }
         }
         assert(minZoom != (float)HUGE_VAL);
@@ -542,12 +659,41 @@ void DisplayModel::Relayout(float newZoomVirtual, int newRotation)
 
     rotation = NormalizeRotation(newRotation);
 
+    // collect the pages to lay out (all pages in continuous mode)
+    int shownCount = 0;
+    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+        PageInfo *pageInfo = GetPageInfo(pageNo);
+        if (!pageInfo->shown) {
+            assert(0.0 == pageInfo->visibleRatio);
+            continue;
+        }
+        if (0 == shownCount++)
+            firstShownPageNo = pageNo;
+        assert(firstShownPageNo + shownCount - 1 == pageNo);
+    }
+    // pages displayed in non-continuous mode determine the zoom level
+    if (!IsContinuous(GetDisplayMode()))
+        LoadPageSizes(firstShownPageNo, firstShownPageNo + shownCount - 1);
+    shownPagesPos.Reset();
+    shownPagesPos.AppendBlanks(shownCount);
+
+    pagelayout::Options opts;
+    opts.columns = ColumnsFromDisplayMode(GetDisplayMode());
+    opts.showCover = DisplayModeShowCover(GetDisplayMode());
+    opts.continuous = IsContinuous(GetDisplayMode());
+    opts.r2l = displayR2L;
+    opts.pageCount = PageCount();
+    opts.marginTop = windowMargin.top;
+    opts.marginRight = windowMargin.right;
+    opts.marginBottom = windowMargin.bottom;
+    opts.marginLeft = windowMargin.left;
+    opts.spacing = pageSpacing;
+
     bool needHScroll = false;
     bool needVScroll = false;
     viewPort = RectI(viewPort.TL(), totalViewPortSize);
 
 RestartLayout:
-    int currPosY = windowMargin.top;
     float currZoomReal = zoomReal;
     SetZoomVirtual(newZoomVirtual);
 
@@ -555,160 +701,44 @@ RestartLayout:
     if (0 != currZoomReal && INVALID_ZOOM != currZoomReal)
         newViewPortOffsetX = (int)(viewPort.x * zoomReal / currZoomReal);
     viewPort.x = newViewPortOffsetX;
-    /* calculate the position of each page on the canvas, given current zoom,
-       rotation, columns parameters. You can think of it as a simple
-       table layout i.e. rows with a fixed number of columns. */
-    int columns = ColumnsFromDisplayMode(GetDisplayMode());
-    int columnMaxWidth[2] = { 0, 0 };
-    int pageInARow = 0;
-    int rowMaxPageDy = 0;
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            assert(0.0 == pageInfo->visibleRatio);
-            continue;
-        }
-        SizeD pageSize = PageSizeAfterRotation(pageNo);
-        RectI pos;
+
+    for (int i = 0; i < shownCount; i++) {
+        SizeD pageSize = PageSizeAfterRotation(firstShownPageNo + i);
+        RectI& pos = shownPagesPos.At(i);
         // don't add the full 0.5 for rounding to account for precision errors
         pos.dx = (int)(pageSize.dx * zoomReal + 0.499);
         pos.dy = (int)(pageSize.dy * zoomReal + 0.499);
-
-        if (rowMaxPageDy < pos.dy)
-            rowMaxPageDy = pos.dy;
-        pos.y = currPosY;
-
-        // restart the layout if we detect we need to show scrollbars
-        if (!needVScroll && viewPort.dy < currPosY + rowMaxPageDy) {
-            needVScroll = true;
-            viewPort.dx -= GetSystemMetrics(SM_CXVSCROLL);
-            goto RestartLayout;
-        }
-
-        if (DisplayModeShowCover(GetDisplayMode()) && pageNo == 1 && columns - pageInARow > 1)
-            pageInARow++;
-        CrashIf(pageInARow >= dimof(columnMaxWidth));
-        if (columnMaxWidth[pageInARow] < pos.dx)
-            columnMaxWidth[pageInARow] = pos.dx;
-
-        if (!needHScroll && viewPort.dx < windowMargin.left + columnMaxWidth[0] + (columns == 2 ? pageSpacing.dx + columnMaxWidth[1] : 0) + windowMargin.right) {
-            needHScroll = true;
-            viewPort.dy -= GetSystemMetrics(SM_CYHSCROLL);
-            goto RestartLayout;
-        }
-
-        pageInfo->pos = pos;
-
-        pageInARow++;
-        assert(pageInARow <= columns);
-        if (pageInARow == columns) {
-            /* starting next row */
-            currPosY += rowMaxPageDy + pageSpacing.dy;
-            rowMaxPageDy = 0;
-            pageInARow = 0;
-        }
     }
+    SizeI canvas = pagelayout::LayoutRows(shownPagesPos.LendData(), shownCount, firstShownPageNo, opts, viewPort.Size());
 
-    if (pageInARow != 0) {
-        /* this is a partial row */
-        currPosY += rowMaxPageDy + pageSpacing.dy;
-    }
     // restart the layout if we detect we need to show scrollbars
-    // (there are some edge cases we can't catch in the above loop)
-    const int canvasDy = currPosY + windowMargin.bottom - pageSpacing.dy;
-    if (!needVScroll && canvasDy > viewPort.dy) {
+    if (!needVScroll && canvas.dy > viewPort.dy) {
         needVScroll = true;
         viewPort.dx -= GetSystemMetrics(SM_CXVSCROLL);
         goto RestartLayout;
     }
-
-    if (columns == 2 && PageCount() == 1) {
-        /* don't center a single page over two columns */
-        if (DisplayModeShowCover(GetDisplayMode()))
-            columnMaxWidth[0] = columnMaxWidth[1];
-        else
-            columnMaxWidth[1] = columnMaxWidth[0];
-    }
-
-    // restart the layout if we detect we need to show scrollbars
-    // (there are some edge cases we can't catch in the above loop)
-    int canvasDx = windowMargin.left + columnMaxWidth[0] + (columns == 2 ? pageSpacing.dx + columnMaxWidth[1] : 0) + windowMargin.right;
-    if (!needHScroll && canvasDx > viewPort.dx) {
+    if (!needHScroll && canvas.dx > viewPort.dx) {
         needHScroll = true;
         viewPort.dy -= GetSystemMetrics(SM_CYHSCROLL);
         goto RestartLayout;
     }
 
-    /* since pages can be smaller than the drawing area, center them in x axis */
-    int offX = 0;
-    if (canvasDx < viewPort.dx) {
-        viewPort.x = 0;
-        offX = (viewPort.dx - canvasDx) / 2;
-        canvasDx = viewPort.dx;
-    }
-
-    assert(offX >= 0);
-    pageInARow = 0;
-    int pageOffX = offX + windowMargin.left;
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            assert(0.0 == pageInfo->visibleRatio);
-            continue;
-        }
-        // leave first spot empty in cover page mode
-        if (DisplayModeShowCover(GetDisplayMode()) && pageNo == 1) {
-            CrashIf(pageInARow >= dimof(columnMaxWidth));
-            pageOffX += columnMaxWidth[pageInARow] + pageSpacing.dx;
-            ++pageInARow;
-        }
-        CrashIf(pageInARow >= dimof(columnMaxWidth));
-        // center pages in a single column but right/left align them when using two columns
-        if (1 == columns)
-            pageInfo->pos.x = pageOffX + (columnMaxWidth[0] - pageInfo->pos.dx) / 2;
-        else if (0 == pageInARow)
-            pageInfo->pos.x = pageOffX + columnMaxWidth[0] - pageInfo->pos.dx;
-        else
-            pageInfo->pos.x = pageOffX;
-        // center the cover page over the first two spots in non-continuous mode
-        if (DisplayModeShowCover(GetDisplayMode()) && pageNo == 1 && !IsContinuous(GetDisplayMode())) {
-            pageInfo->pos.x = offX + windowMargin.left + (columnMaxWidth[0] + pageSpacing.dx + columnMaxWidth[1] - pageInfo->pos.dx) / 2;
-        }
-        // mirror the page layout when displaying a Right-to-Left document
-        if (displayR2L && columns > 1)
-            pageInfo->pos.x = canvasDx - pageInfo->pos.x - pageInfo->pos.dx;
-
-        CrashIf(pageInARow >= dimof(columnMaxWidth));
-        pageOffX += columnMaxWidth[pageInARow] + pageSpacing.dx;
-        ++pageInARow;
-        assert(pageOffX >= 0 && pageInfo->pos.x >= 0);
-
-        if (pageInARow == columns) {
-            pageOffX = offX + windowMargin.left;
-            pageInARow = 0;
-        }
+    for (int i = 0; i < shownCount; i++) {
+        PageInfo *pageInfo = GetPageInfo(firstShownPageNo + i);
+        pageInfo->pos = shownPagesPos.At(i);
+        assert(pageInfo->pos.x >= 0);
     }
 
+    /* pages smaller than the drawing area have been centered in x axis */
+    if (canvas.dx < viewPort.dx)
+        viewPort.x = 0;
+    int canvasDx = max(canvas.dx, viewPort.dx);
     /* if after resizing we would have blank space on the right due to x offset
        being too much, make x offset smaller so that there's no blank space */
     if (viewPort.dx - (canvasDx - newViewPortOffsetX) > 0)
         viewPort.x = canvasDx - viewPort.dx;
 
-    /* if a page is smaller than drawing area in y axis, y-center the page */
-    if (canvasDy < viewPort.dy) {
-        int offY = windowMargin.top + (viewPort.dy - canvasDy) / 2;
-        assert(offY >= 0.0);
-        for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-            PageInfo *pageInfo = GetPageInfo(pageNo);
-            if (!pageInfo->shown) {
-                assert(0.0 == pageInfo->visibleRatio);
-                continue;
-            }
-            pageInfo->pos.y += offY;
-        }
-    }
-
-    canvasSize = SizeI(max(canvasDx, viewPort.dx), max(canvasDy, viewPort.dy));
+    canvasSize = SizeI(canvasDx, max(canvas.dy, viewPort.dy));
 }
 
 void DisplayModel::ChangeStartPage(int newStartPage)
@@ -744,24 +774,43 @@ void DisplayModel::RecalcVisibleParts()
     if (!pagesInfo)
         return;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    // only the pages in the rows overlapping the view port can be visible
+    int first, last;
+    bool found = pagelayout::FindRows(shownPagesPos.LendData(), (int)shownPagesPos.Count(), viewPort.y, viewPort.dy, &first, &last);
+    // make sure that these pages (and the ones rendered predictively) have their actual size
+    int columns = ColumnsFromDisplayMode(GetDisplayMode());
+    while (found && LoadPageSizes(firstShownPageNo + first - columns, firstShownPageNo + last + columns)) {
+        // keep the first page in view at the same position
+        PageInfo *pageInfo = GetPageInfo(firstShownPageNo + first);
+        int offsetY = viewPort.y - pageInfo->pos.y;
+        Relayout(zoomVirtual, rotation);
+        viewPort.x = limitValue(viewPort.x, 0, canvasSize.dx - viewPort.dx);
+        viewPort.y = limitValue(pageInfo->pos.y + offsetY, 0, canvasSize.dy - viewPort.dy);
+        dmCb->UpdateScrollbars(canvasSize);
+        found = pagelayout::FindRows(shownPagesPos.LendData(), (int)shownPagesPos.Count(), viewPort.y, viewPort.dy, &first, &last);
+    }
+
+    for (int pageNo = visibleFirst; pageNo <= visibleLast; ++pageNo) {
+        GetPageInfo(pageNo)->visibleRatio = 0.0;
+    }
+    visibleFirst = 1;
+    visibleLast = 0;
+
+    for (int pageNo = firstShownPageNo + first; found && pageNo <= firstShownPageNo + last; ++pageNo) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            assert(0.0 == pageInfo->visibleRatio);
-            continue;
-        }
+        assert(pageInfo->shown);
 
         RectI pageRect = pageInfo->pos;
         RectI visiblePart = pageRect.Intersect(viewPort);
+        if (visiblePart.IsEmpty())
+            continue;
 
-        pageInfo->visibleRatio = 0.0;
-        if (!visiblePart.IsEmpty()) {
-            assert(pageRect.dx > 0 && pageRect.dy > 0);
-            // calculate with floating point precision to prevent an integer overflow
-            pageInfo->visibleRatio = 1.0f * visiblePart.dx * visiblePart.dy / ((float)pageRect.dx * pageRect.dy);
-        }
-        pageInfo->pageOnScreen = pageRect;
-        pageInfo->pageOnScreen.Offset(-viewPort.x, -viewPort.y);
+        assert(pageRect.dx > 0 && pageRect.dy > 0);
+        // calculate with floating point precision to prevent an integer overflow
+        pageInfo->visibleRatio = 1.0f * visiblePart.dx * visiblePart.dy / ((float)pageRect.dx * pageRect.dy);
+        if (visibleFirst > visibleLast)
+            visibleFirst = pageNo;
+        visibleLast = pageNo;
     }
 }
 
@@ -771,17 +820,12 @@ int DisplayModel::GetPageNoByPoint(PointI pt)
     if (zoomReal <= 0)
         return -1;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        assert(0.0 == pageInfo->visibleRatio || pageInfo->shown);
-        if (!pageInfo->shown)
-            continue;
-
-        if (pageInfo->pageOnScreen.Contains(pt))
-            return pageNo;
-    }
-
-    return -1;
+    // pages are laid out on the canvas, pt is relative to the view port
+    PointI ptOnCanvas(pt.x + viewPort.x, pt.y + viewPort.y);
+    int ix = pagelayout::FindPageAt(shownPagesPos.LendData(), (int)shownPagesPos.Count(), ptOnCanvas);
+    if (ix < 0)
+        return -1;
+    return firstShownPageNo + ix;
 }
 
 int DisplayModel::GetPageNextToPoint(PointI pt)
@@ -789,27 +833,11 @@ int DisplayModel::GetPageNextToPoint(PointI pt)
     if (zoomReal <= 0)
         return startPage;
 
-    unsigned int maxDist = UINT_MAX;
-    int closest = startPage;
-
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        assert(0.0 == pageInfo->visibleRatio || pageInfo->shown);
-        if (!pageInfo->shown)
-            continue;
-
-        if (pageInfo->pageOnScreen.Contains(pt))
-            return pageNo;
-
-        unsigned int dist = distSq(pt.x - pageInfo->pageOnScreen.x - pageInfo->pageOnScreen.dx / 2,
-                                   pt.y - pageInfo->pageOnScreen.y - pageInfo->pageOnScreen.dy / 2);
-        if (dist < maxDist) {
-            closest = pageNo;
-            maxDist = dist;
-        }
-    }
-
-    return closest;
+    PointI ptOnCanvas(pt.x + viewPort.x, pt.y + viewPort.y);
+    int ix = pagelayout::FindClosestPage(shownPagesPos.LendData(), (int)shownPagesPos.Count(), ptOnCanvas);
+    if (ix < 0)
+        return startPage;
+    return firstShownPageNo + ix;
 }
 
 PointI DisplayModel::CvtToScreen(int pageNo, PointD pt)
@@ -819,10 +847,11 @@ PointI DisplayModel::CvtToScreen(int pageNo, PointD pt)
     if (!pageInfo)
         return PointI();
 
+    RectI pageOnScreen = GetPageOnScreen(pageNo);
     PointD p = engine->Transform(pt, pageNo, zoomReal, rotation);
     // don't add the full 0.5 for rounding to account for precision errors
-    p.x += 0.499 + pageInfo->pageOnScreen.x;
-    p.y += 0.499 + pageInfo->pageOnScreen.y;
+    p.x += 0.499 + pageOnScreen.x;
+    p.y += 0.499 + pageOnScreen.y;
 
     return p.Convert<int>();
 }
@@ -844,9 +873,10 @@ PointD DisplayModel::CvtFromScreen(PointI pt, int pageNo)
     if (!pageInfo)
         return PointD();
 
+    RectI pageOnScreen = GetPageOnScreen(pageNo);
     // don't add the full 0.5 for rounding to account for precision errors
-    PointD p = PointD(pt.x - 0.499 - pageInfo->pageOnScreen.x,
-                      pt.y - 0.499 - pageInfo->pageOnScreen.y);
+    PointD p = PointD(pt.x - 0.499 - pageOnScreen.x,
+                      pt.y - 0.499 - pageOnScreen.y);
     return engine->Transform(p, pageNo, zoomReal, rotation, true);
 }
 
@@ -893,7 +923,7 @@ void DisplayModel::RenderVisibleParts()
     int firstVisiblePage = 0;
     int lastVisiblePage = 0;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    for (int pageNo = visibleFirst; pageNo <= visibleLast; ++pageNo) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > 0.0) {
             assert(pageInfo->shown);
@@ -1014,8 +1044,10 @@ void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX)
     } else if (ZOOM_FIT_CONTENT == zoomVirtual) {
         // make sure that setZoomVirtual uses the correct page to calculate
         // the zoom level for (visibility will be recalculated below anyway)
-        for (int i =  PageCount(); i > 0; i--)
-            GetPageInfo(i)->visibleRatio = (i == pageNo ? 1.0f : 0);
+        for (int i = visibleFirst; i <= visibleLast; i++)
+            GetPageInfo(i)->visibleRatio = 0;
+        GetPageInfo(pageNo)->visibleRatio = 1.0f;
+        visibleFirst = visibleLast = pageNo;
         Relayout(zoomVirtual, rotation);
     }
     //lf("DisplayModel::GoToPage(pageNo=%d, scrollY=%d)", pageNo, scrollY);
@@ -1154,10 +1186,10 @@ bool DisplayModel::GoToPrevPage(int scrollY)
         top = GetContentStart(currPageNo);
     }
 
-    PageInfo * pageInfo = GetPageInfo(currPageNo);
-    if (zoomVirtual == ZOOM_FIT_CONTENT && -pageInfo->pageOnScreen.y <= top.y)
+    RectI pageOnScreen = GetPageOnScreen(currPageNo);
+    if (zoomVirtual == ZOOM_FIT_CONTENT && -pageOnScreen.y <= top.y)
         scrollY = 0; // continue, even though the current page isn't fully visible
-    else if (max(-pageInfo->pageOnScreen.y, 0) > scrollY && IsContinuous(GetDisplayMode())) {
+    else if (max(-pageOnScreen.y, 0) > scrollY && IsContinuous(GetDisplayMode())) {
         /* the current page isn't fully visible, so show it first */
         GoToPage(currPageNo, scrollY);
         return true;
@@ -1170,7 +1202,7 @@ bool DisplayModel::GoToPrevPage(int scrollY)
 
     // scroll to the bottom of the page
     if (-1 == scrollY)
-        scrollY = GetPageInfo(firstPageInNewRow)->pageOnScreen.dy;
+        scrollY = GetPageOnScreen(firstPageInNewRow).dy;
 
     GoToPage(firstPageInNewRow, scrollY);
     return true;
@@ -1373,12 +1405,14 @@ float DisplayModel::NextZoomStep(float towardsLevel)
 
     float currZoom = ZoomAbsolute();
     float pageZoom = (float)HUGE_VAL, widthZoom = (float)HUGE_VAL;
+    RectD lastPage;
     for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-        if (PageShown(pageNo)) {
+        if (PageShown(pageNo) && GetPageInfo(pageNo)->page != lastPage) {
             float pagePageZoom = ZoomRealFromVirtualForPage(ZOOM_FIT_PAGE, pageNo);
             pageZoom = min(pageZoom, pagePageZoom);
             float pageWidthZoom = ZoomRealFromVirtualForPage(ZOOM_FIT_WIDTH, pageNo);
             widthZoom = min(widthZoom, pageWidthZoom);
+            lastPage = GetPageInfo(pageNo)->page;
         }
     }
     CrashIf(!AsChmEngine() && (pageZoom == (float)HUGE_VAL || widthZoom == (float)HUGE_VAL));
@@ -1432,16 +1466,19 @@ void DisplayModel::RotateBy(int newRotation)
  * into a newly allocated buffer (which the caller needs to free()). */
 WCHAR *DisplayModel::GetTextInRegion(int pageNo, RectD region)
 {
-    RectI *coords;
-    const WCHAR *pageText = textCache->GetData(pageNo, NULL, &coords);
-    if (str::IsEmpty(pageText))
+    int len;
+    ScopedMem<WCHAR> pageText(textCache->GetText(pageNo, &len));
+    if (str::IsEmpty(pageText.Get()))
+        return NULL;
+    ScopedMem<RectI> coords(textCache->GetCoords(pageNo, 0, len));
+    if (!coords)
         return NULL;
 
     str::Str<WCHAR> result;
     RectI regionI = region.Round();
     for (const WCHAR *src = pageText; *src; src++) {
         if (*src != '\n') {
-            RectI rect = coords[src - pageText];
+            RectI rect = coords[src - pageText.Get()];
             RectI isect = regionI.Intersect(rect);
             if (!isect.IsEmpty() && 1.0 * isect.dx * isect.dy / (rect.dx * rect.dy) >= 0.3)
                 result.Append(*src);
@@ -1469,7 +1506,7 @@ bool DisplayModel::ShowResultRectToScreen(TextSel *res)
     if (RectI(PointI(), viewPort.Size()).Intersect(extremes) == extremes)
         return false;
 
-    PageInfo *pageInfo = GetPageInfo(res->pages[0]);
+    RectI pageOnScreen = GetPageOnScreen(res->pages[0]);
     int sx = 0, sy = 0;
 
     // vertically, we try to position the search result between 40%
@@ -1487,10 +1524,10 @@ bool DisplayModel::ShowResultRectToScreen(TextSel *res)
     // boundaries, so that as much context as possible remains visible
     if (extremes.x < 0)
         sx = max(extremes.x + extremes.dx / 2 - viewPort.dx / 2,
-        pageInfo->pageOnScreen.x);
+        pageOnScreen.x);
     else if (extremes.x + extremes.dx >= viewPort.dx)
         sx = min(extremes.x + extremes.dx / 2 - viewPort.dx / 2,
-                 pageInfo->pageOnScreen.x + pageInfo->pageOnScreen.dx - viewPort.dx);
+                 pageOnScreen.x + pageOnScreen.dx - viewPort.dx);
 
     if (sx != 0)
         ScrollXBy(sx);
@@ -1507,20 +1544,21 @@ ScrollState DisplayModel::GetScrollState()
         state.page = CurrentPageNo();
 
     PageInfo *pageInfo = GetPageInfo(state.page);
+    RectI pageOnScreen = GetPageOnScreen(state.page);
     // Shortcut: don't calculate precise positions, if the
     // page wasn't scrolled right/down at all
-    if (!pageInfo || pageInfo->pageOnScreen.x > 0 && pageInfo->pageOnScreen.y > 0)
+    if (!pageInfo || pageOnScreen.x > 0 && pageOnScreen.y > 0)
         return state;
 
     RectI screen(PointI(), viewPort.Size());
-    RectI pageVis = pageInfo->pageOnScreen.Intersect(screen);
+    RectI pageVis = pageOnScreen.Intersect(screen);
     state.page = GetPageNextToPoint(pageVis.TL());
     PointD ptD = CvtFromScreen(pageVis.TL(), state.page);
 
     // Remember to show the margin, if it's currently visible
-    if (pageInfo->pageOnScreen.x <= 0)
+    if (pageOnScreen.x <= 0)
         state.x = ptD.x;
-    if (pageInfo->pageOnScreen.y <= 0)
+    if (pageOnScreen.y <= 0)
         state.y = ptD.y;
 
     return state;
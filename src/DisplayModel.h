@@ -17,8 +17,11 @@ extern bool gPredictiveRender;
 
 /* Describes many attributes of one page in one, convenient place */
 struct PageInfo {
-    /* data that is constant for a given page. page size in document units */
+    /* data that is constant for a given page. page size in document units
+       (assumed to be the same as for the previous page until pageLoaded is set,
+       which happens at the latest before the page is displayed) */
     RectD           page;
+    bool            pageLoaded;
 
     /* data that is calculated when needed. actual content size within a page (View target) */
     RectD           contentBox;
@@ -35,8 +38,8 @@ struct PageInfo {
 
     /* data that changes due to scrolling. Calculated in DisplayModel::RecalcVisibleParts() */
     float           visibleRatio; /* (0.0 = invisible, 1.0 = fully visible) */
-    /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y) */
-    RectI           pageOnScreen;
+    /* the position relative to the view port is derived from pos by
+       DisplayModel::GetPageOnScreen() (so that it's never out of date) */
 };
 
 /* The current scroll state (needed for saving/restoring the scroll position) */
@@ -52,7 +55,9 @@ struct ScrollState {
 };
 
 class DisplayModel;
+class FingerprintThread;
 class PageTextCache;
+class TextIndex;
 class TextSelection;
 class TextSearch;
 struct TextSel;
@@ -63,6 +68,8 @@ public:
     virtual void UpdateScrollbars(SizeI canvas) = 0;
     virtual void RequestRendering(int pageNo) = 0;
     virtual void CleanUp(DisplayModel *dm) = 0;
+    // returns false if the extraction has been canceled
+    virtual bool ExtractPagesText(int startPage, int endPage) = 0;
 };
 
 // TODO: in hindsight, zoomVirtual is not a good name since it's either
@@ -103,15 +110,26 @@ public:
     bool HasTocTree() const { return engine && engine->HasTocTree();}
     int CurrentPageNo() const;
 
+    // computes the engine's content fingerprint in the background (reading
+    // through large documents would otherwise delay rendering the first tiles)
+    void StartFingerprinting();
+    // returns false until the background computation has finished
+    // (and if the engine doesn't support fingerprinting)
+    bool GetContentFingerprint(unsigned char digest[16]);
+
     BaseEngine *    engine;
     EngineType      engineType;
 
     PageTextCache * textCache;
+    TextIndex *     textIndex;
     TextSelection * textSelection;
     // access only from Search thread
     TextSearch *    textSearch;
 
     PageInfo *      GetPageInfo(int pageNo) const;
+    // position of a shown page relative to the view port
+    // (i.e. its pos offset by -viewPort.x, -viewPort.y)
+    RectI           GetPageOnScreen(int pageNo) const;
 
     /* size and position of the viewport on the canvas (resp size of the visible
        part of the canvase available for content (totalViewPortSize minus scroll bars)
@@ -182,12 +200,16 @@ public:
 
     // called when we decide that the display needs to be redrawn
     void            RepaintDisplay() { dmCb->Repaint(); }
+    // extracts the text of several pages at once (while showing progress)
+    bool            ExtractPagesText(int startPage, int endPage) { return dmCb->ExtractPagesText(startPage, endPage); }
 
     ChmEngine *     AsChmEngine() const;
 
 protected:
 
     void            BuildPagesInfo();
+    bool            LoadPageSize(int pageNo);
+    bool            LoadPageSizes(int firstPageNo, int lastPageNo);
     float           ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo);
     SizeD           PageSizeAfterRotation(int pageNo, bool fitToContent=false);
     void            ChangeStartPage(int startPage);
@@ -203,6 +225,15 @@ protected:
 
     /* an array of PageInfo, len of array is pageCount */
     PageInfo *      pagesInfo;
+    /* size of pages with an empty mediabox */
+    RectD           defaultPageRect;
+    /* positions of the shown pages as laid out by Relayout() (the first one
+       being page firstShownPageNo), for finding pages by position */
+    Vec<RectI>      shownPagesPos;
+    int             firstShownPageNo;
+    /* range of the pages which might have a visibleRatio > 0
+       (empty if visibleFirst > visibleLast) */
+    int             visibleFirst, visibleLast;
 
     DisplayMode     displayMode;
     /* In non-continuous mode is the first page from a file that we're
@@ -242,6 +273,8 @@ protected:
        resp. number of Back history entries */
     size_t          navHistoryIx;
 
+    FingerprintThread *fingerprinter;
+
 public:
     /* allow resizing a window without triggering a new rendering (needed for window destruction) */
     bool            dontRenderFlag;
@@ -147,52 +147,34 @@ public:
     virtual void Abort() { abort = true; }
 };
 
+// libdjvu is built with thread support, so every document gets its own
+// ddjvu_context_t (i.e. its own file cache and message queue) and documents
+// and pages are decoded and rendered in parallel. Only what libdjvu shares
+// between all contexts without protecting it still needs a global lock.
 class DjVuContext {
-    bool initialized;
-    ddjvu_context_t *ctx;
-
 public:
+    // must be held while creating contexts or documents (libdjvu creates
+    // some of its global state lazily) and while creating, accessing or
+    // releasing any miniexp_t (its garbage collector isn't thread-safe)
     CRITICAL_SECTION lock;
 
-    DjVuContext() : ctx(NULL), initialized(false) { }
+    DjVuContext() { InitializeCriticalSection(&lock); }
     ~DjVuContext() {
-        if (initialized) {
-            EnterCriticalSection(&lock);
-            if (ctx)
-                ddjvu_context_release(ctx);
-            LeaveCriticalSection(&lock);
-            DeleteCriticalSection(&lock);
-        }
+        DeleteCriticalSection(&lock);
         minilisp_finish();
     }
 
-    bool Initialize() {
-        if (!initialized) {
-            initialized = true;
-            InitializeCriticalSection(&lock);
-            ctx = ddjvu_context_create("DjVuEngine");
-            // reset the locale to "C" as most other code expects
-            setlocale(LC_ALL, "C");
-        }
-
-        return ctx != NULL;
-    }
-
-    void SpinMessageLoop(bool wait=true) {
-#if THREADMODEL!=NOTHREADS
-        if (wait)
-            ddjvu_message_wait(ctx);
-#endif
-        while (ddjvu_message_peek(ctx))
-            ddjvu_message_pop(ctx);
+    ddjvu_context_t *CreateContext() {
+        ScopedCritSec scope(&lock);
+        return ddjvu_context_create("DjVuEngine");
     }
 
-    ddjvu_document_t *OpenFile(const WCHAR *fileName) {
+    ddjvu_document_t *OpenFile(ddjvu_context_t *ctx, const WCHAR *fileName) {
         ScopedCritSec scope(&lock);
         ScopedMem<char> fileNameUtf8(str::conv::ToUtf8(fileName));
-        // TODO: libdjvu sooner or later crashes inside its caching code; cf.
-        //       http://code.google.com/p/sumatrapdf/issues/detail?id=1434
-        return ddjvu_document_create_by_filename_utf8(ctx, fileNameUtf8, /* cache */ FALSE);
+        // caching is safe now that decoded files are only shared
+        // between documents of the same context (cf. DjVuDocument.cpp)
+        return ddjvu_document_create_by_filename_utf8(ctx, fileNameUtf8, /* cache */ TRUE);
     }
 };
 
@@ -270,6 +252,12 @@ protected:
 
     Vec<ddjvu_fileinfo_t> fileInfo;
 
+    ddjvu_context_t *ctx;
+    // signaled whenever libdjvu posts a message to ctx
+    HANDLE messageEvent;
+    CRITICAL_SECTION annotsAccess;
+
+    void SpinMessageLoop();
     void AddUserAnnots(RenderedBitmap *bmp, int pageNo, float zoom, int rotation, RectI screen);
     bool ExtractPageText(miniexp_t item, const WCHAR *lineSep,
                          str::Str<WCHAR>& extracted, Vec<RectI>& coords);
@@ -280,17 +268,18 @@ protected:
 };
 
 DjVuEngineImpl::DjVuEngineImpl() : fileName(NULL), pageCount(0), mediaboxes(NULL),
-    doc(NULL), outline(miniexp_nil), annos(NULL), hasPageLabels(false)
+    doc(NULL), outline(miniexp_nil), annos(NULL), hasPageLabels(false), ctx(NULL)
 {
+    messageEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    InitializeCriticalSection(&annotsAccess);
 }
 
 DjVuEngineImpl::~DjVuEngineImpl()
 {
-    ScopedCritSec scope(&gDjVuContext.lock);
-
     free(mediaboxes);
     free(fileName);
 
+    EnterCriticalSection(&gDjVuContext.lock);
     if (annos) {
         for (int i = 0; i < pageCount; i++) {
             if (annos[i])
@@ -302,6 +291,27 @@ DjVuEngineImpl::~DjVuEngineImpl()
         ddjvu_miniexp_release(doc, outline);
     if (doc)
         ddjvu_document_release(doc);
+    LeaveCriticalSection(&gDjVuContext.lock);
+
+    if (ctx)
+        ddjvu_context_release(ctx);
+    CloseHandle(messageEvent);
+    DeleteCriticalSection(&annotsAccess);
+}
+
+static void OnDjVuMessage(ddjvu_context_t *ctx, void *closure)
+{
+    SetEvent((HANDLE)closure);
+}
+
+void DjVuEngineImpl::SpinMessageLoop()
+{
+    // don't wait indefinitely, as another thread working on the same
+    // document might have popped the message we're waiting for
+    if (!ddjvu_message_peek(ctx))
+        WaitForSingleObject(messageEvent, 50);
+    while (ddjvu_message_peek(ctx))
+        ddjvu_message_pop(ctx);
 }
 
 // Most functions of the ddjvu API such as ddjvu_document_get_pageinfo
@@ -379,18 +389,18 @@ bool DjVuEngineImpl::LoadMediaboxes()
 
 bool DjVuEngineImpl::Load(const WCHAR *fileName)
 {
-    if (!gDjVuContext.Initialize())
+    ctx = gDjVuContext.CreateContext();
+    if (!ctx)
         return false;
+    ddjvu_message_set_callback(ctx, OnDjVuMessage, messageEvent);
 
     this->fileName = str::Dup(fileName);
-    doc = gDjVuContext.OpenFile(fileName);
+    doc = gDjVuContext.OpenFile(ctx, fileName);
     if (!doc)
         return false;
 
-    ScopedCritSec scope(&gDjVuContext.lock);
-
     while (!ddjvu_document_decoding_done(doc))
-        gDjVuContext.SpinMessageLoop();
+        SpinMessageLoop();
     if (ddjvu_document_decoding_error(doc))
         return false;
 
@@ -406,7 +416,7 @@ bool DjVuEngineImpl::Load(const WCHAR *fileName)
             ddjvu_status_t status;
             ddjvu_pageinfo_t info;
             while ((status = ddjvu_document_get_pageinfo(doc, i, &info)) < DDJVU_JOB_OK)
-                gDjVuContext.SpinMessageLoop();
+                SpinMessageLoop();
             if (DDJVU_JOB_OK == status)
                 mediaboxes[i] = RectD(0, 0, info.width * GetFileDPI() / info.dpi,
                                             info.height * GetFileDPI() / info.dpi);
@@ -417,19 +427,21 @@ bool DjVuEngineImpl::Load(const WCHAR *fileName)
     for (int i = 0; i < pageCount; i++)
         annos[i] = miniexp_dummy;
 
+    EnterCriticalSection(&gDjVuContext.lock);
     while ((outline = ddjvu_document_get_outline(doc)) == miniexp_dummy)
-        gDjVuContext.SpinMessageLoop();
+        SpinMessageLoop();
     if (!miniexp_consp(outline) || miniexp_car(outline) != miniexp_symbol("bookmarks")) {
         ddjvu_miniexp_release(doc, outline);
         outline = miniexp_nil;
     }
+    LeaveCriticalSection(&gDjVuContext.lock);
 
     int fileCount = ddjvu_document_get_filenum(doc);
     for (int i = 0; i < fileCount; i++) {
         ddjvu_status_t status;
         ddjvu_fileinfo_s info;
         while ((status = ddjvu_document_get_fileinfo(doc, i, &info)) < DDJVU_JOB_OK)
-            gDjVuContext.SpinMessageLoop();
+            SpinMessageLoop();
         if (DDJVU_JOB_OK == status && info.type == 'P' && info.pageno >= 0) {
             fileInfo.Append(info);
             hasPageLabels = hasPageLabels || !str::Eq(info.title, info.id);
@@ -456,6 +468,7 @@ static inline Gdiplus::Color FromColor(PageAnnotation::Color c)
 
 void DjVuEngineImpl::AddUserAnnots(RenderedBitmap *bmp, int pageNo, float zoom, int rotation, RectI screen)
 {
+    ScopedCritSec scope(&annotsAccess);
     if (!bmp || userAnnots.Count() == 0)
         return;
 
@@ -518,8 +531,6 @@ void DjVuEngineImpl::AddUserAnnots(RenderedBitmap *bmp, int pageNo, float zoom,
 
 RenderedBitmap *DjVuEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out)
 {
-    ScopedCritSec scope(&gDjVuContext.lock);
-
     RectD pageRc = pageRect ? *pageRect : PageMediabox(pageNo);
     RectI screen = Transform(pageRc, pageNo, zoom, rotation).Round();
     RectI full = Transform(PageMediabox(pageNo), pageNo, zoom, rotation).Round();
@@ -532,9 +543,11 @@ RenderedBitmap *DjVuEngineImpl::RenderBitmap(int pageNo, float zoom, int rotatio
     ddjvu_page_set_rotation(page, (ddjvu_page_rotation_t)rotation4);
 
     while (!ddjvu_page_decoding_done(page))
-        gDjVuContext.SpinMessageLoop();
-    if (ddjvu_page_decoding_error(page))
+        SpinMessageLoop();
+    if (ddjvu_page_decoding_error(page)) {
+        ddjvu_page_release(page);
         return NULL;
+    }
 
     bool isBitonal = DDJVU_PAGETYPE_BITONAL == ddjvu_page_get_type(page);
     ddjvu_format_t *fmt = ddjvu_format_create(isBitonal ? DDJVU_FORMAT_GREY8 : DDJVU_FORMAT_BGR24, 0, NULL);
@@ -606,8 +619,6 @@ bool DjVuEngineImpl::RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoo
 
 RectD DjVuEngineImpl::PageContentBox(int pageNo, RenderTarget target)
 {
-    ScopedCritSec scope(&gDjVuContext.lock);
-
     RectD pageRc = PageMediabox(pageNo);
     ddjvu_page_t *page = ddjvu_page_create_by_pageno(doc, pageNo-1);
     if (!page)
@@ -615,9 +626,11 @@ RectD DjVuEngineImpl::PageContentBox(int pageNo, RenderTarget target)
     ddjvu_page_set_rotation(page, DDJVU_ROTATE_0);
 
     while (!ddjvu_page_decoding_done(page))
-        gDjVuContext.SpinMessageLoop();
-    if (ddjvu_page_decoding_error(page))
+        SpinMessageLoop();
+    if (ddjvu_page_decoding_error(page)) {
+        ddjvu_page_release(page);
         return pageRc;
+    }
 
     // render the page in 8-bit grayscale up to 250x250 px in size
     ddjvu_format_t *fmt = ddjvu_format_create(DDJVU_FORMAT_GREY8, 0, NULL);
@@ -775,7 +788,7 @@ WCHAR *DjVuEngineImpl::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coord
 
     miniexp_t pagetext;
     while ((pagetext = ddjvu_document_get_pagetext(doc, pageNo-1, NULL)) == miniexp_dummy)
-        gDjVuContext.SpinMessageLoop();
+        SpinMessageLoop();
     if (miniexp_nil == pagetext)
         return NULL;
 
@@ -793,7 +806,7 @@ WCHAR *DjVuEngineImpl::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coord
         ddjvu_status_t status;
         ddjvu_pageinfo_t info;
         while ((status = ddjvu_document_get_pageinfo(doc, pageNo-1, &info)) < DDJVU_JOB_OK)
-            gDjVuContext.SpinMessageLoop();
+            SpinMessageLoop();
         float dpiFactor = 1.0;
         if (DDJVU_JOB_OK == status)
             dpiFactor = GetFileDPI() / info.dpi;
@@ -820,7 +833,7 @@ WCHAR *DjVuEngineImpl::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coord
 
 void DjVuEngineImpl::UpdateUserAnnotations(Vec<PageAnnotation> *list)
 {
-    ScopedCritSec scope(&gDjVuContext.lock);
+    ScopedCritSec scope(&annotsAccess);
     if (list)
         userAnnots = *list;
     else
@@ -830,15 +843,16 @@ void DjVuEngineImpl::UpdateUserAnnotations(Vec<PageAnnotation> *list)
 Vec<PageElement *> *DjVuEngineImpl::GetElements(int pageNo)
 {
     assert(1 <= pageNo && pageNo <= PageCount());
-    if (annos && miniexp_dummy == annos[pageNo-1]) {
-        ScopedCritSec scope(&gDjVuContext.lock);
-        while ((annos[pageNo-1] = ddjvu_document_get_pageanno(doc, pageNo-1)) == miniexp_dummy)
-            gDjVuContext.SpinMessageLoop();
-    }
-    if (!annos || !annos[pageNo-1])
+    if (!annos)
         return NULL;
 
     ScopedCritSec scope(&gDjVuContext.lock);
+    if (miniexp_dummy == annos[pageNo-1]) {
+        while ((annos[pageNo-1] = ddjvu_document_get_pageanno(doc, pageNo-1)) == miniexp_dummy)
+            SpinMessageLoop();
+    }
+    if (!annos[pageNo-1])
+        return NULL;
 
     Vec<PageElement *> *els = new Vec<PageElement *>();
     RectI page = PageMediabox(pageNo).Round();
@@ -846,7 +860,7 @@ Vec<PageElement *> *DjVuEngineImpl::GetElements(int pageNo)
     ddjvu_status_t status;
     ddjvu_pageinfo_t info;
     while ((status = ddjvu_document_get_pageinfo(doc, pageNo-1, &info)) < DDJVU_JOB_OK)
-        gDjVuContext.SpinMessageLoop();
+        SpinMessageLoop();
     float dpiFactor = 1.0;
     if (DDJVU_JOB_OK == status)
         dpiFactor = GetFileDPI() / info.dpi;
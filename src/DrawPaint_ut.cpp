@@ -0,0 +1,132 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// tests that mupdf's SIMD span painters (cf. fz_enable_simd_painters)
+// produce exactly the same pixels as the scalar ones
+
+extern "C" {
+#include <mupdf/fitz.h>
+#include "../mupdf/source/fitz/draw-imp.h"
+}
+
+#include "BaseUtil.h"
+
+// must be last due to assert() over-write
+#include "UtAssert.h"
+
+// test_util only links draw-paint.c and geometry.c (and not the rest
+// of fitz), so this is the only other function the painters need
+extern "C" fz_irect *fz_pixmap_bbox_no_ctx(fz_pixmap *pix, fz_irect *bbox)
+{
+    bbox->x0 = pix->x;
+    bbox->y0 = pix->y;
+    bbox->x1 = pix->x + pix->w;
+    bbox->y1 = pix->y + pix->h;
+    return bbox;
+}
+
+#define TEST_ROUNDS     500
+// long enough for covering both the SIMD loops and the scalar remainders
+#define MAX_SPAN_WIDTH  67
+
+// a deterministic generator, so that failures are reproducible
+static unsigned int gSeed = 1;
+
+static unsigned char RandByte()
+{
+    gSeed = gSeed * 1103515245 + 12345;
+    return (unsigned char)(gSeed >> 16);
+}
+
+// premultiplied RGBA pixels (with quite a few fully opaque and transparent ones)
+static void RandPixels(unsigned char *data, int w)
+{
+    for (int i = 0; i < w; i++) {
+        int a = RandByte() % 3 ? RandByte() : RandByte() % 2 ? 255 : 0;
+        for (int k = 0; k < 3; k++) {
+            data[i * 4 + k] = (unsigned char)(RandByte() % (a + 1));
+        }
+        data[i * 4 + 3] = (unsigned char)a;
+    }
+}
+
+static void RandMask(unsigned char *data, int w)
+{
+    for (int i = 0; i < w; i++) {
+        data[i] = RandByte() % 3 ? RandByte() : RandByte() % 2 ? 255 : 0;
+    }
+}
+
+static void InitPixmap(fz_pixmap *pix, unsigned char *samples, int w, int n)
+{
+    ZeroMemory(pix, sizeof(*pix));
+    pix->w = w;
+    pix->h = 1;
+    pix->n = n;
+    pix->samples = samples;
+}
+
+static void PaintSpanTest(int w)
+{
+    unsigned char src[MAX_SPAN_WIDTH * 4], dst1[MAX_SPAN_WIDTH * 4], dst2[MAX_SPAN_WIDTH * 4];
+    RandPixels(src, w);
+    RandPixels(dst1, w);
+    memcpy(dst2, dst1, w * 4);
+    int alpha = RandByte() % 2 ? 255 : RandByte();
+
+    fz_enable_simd_painters(1);
+    fz_paint_span(dst1, src, 4, w, alpha);
+    fz_enable_simd_painters(0);
+    fz_paint_span(dst2, src, 4, w, alpha);
+    utassert(memeq(dst1, dst2, w * 4));
+}
+
+static void PaintSpanWithColorTest(int w)
+{
+    unsigned char mask[MAX_SPAN_WIDTH], dst1[MAX_SPAN_WIDTH * 4], dst2[MAX_SPAN_WIDTH * 4];
+    unsigned char color[4];
+    RandMask(mask, w);
+    RandPixels(dst1, w);
+    memcpy(dst2, dst1, w * 4);
+    RandPixels(color, 1);
+
+    fz_enable_simd_painters(1);
+    fz_paint_span_with_color(dst1, mask, 4, w, color);
+    fz_enable_simd_painters(0);
+    fz_paint_span_with_color(dst2, mask, 4, w, color);
+    utassert(memeq(dst1, dst2, w * 4));
+}
+
+// fz_paint_span_with_mask is only reachable through fz_paint_pixmap_with_mask
+static void PaintSpanWithMaskTest(int w)
+{
+    unsigned char src[MAX_SPAN_WIDTH * 4], mask[MAX_SPAN_WIDTH];
+    unsigned char dst1[MAX_SPAN_WIDTH * 4], dst2[MAX_SPAN_WIDTH * 4];
+    RandPixels(src, w);
+    RandMask(mask, w);
+    RandPixels(dst1, w);
+    memcpy(dst2, dst1, w * 4);
+
+    fz_pixmap srcPix, maskPix, dstPix1, dstPix2;
+    InitPixmap(&srcPix, src, w, 4);
+    InitPixmap(&maskPix, mask, w, 1);
+    InitPixmap(&dstPix1, dst1, w, 4);
+    InitPixmap(&dstPix2, dst2, w, 4);
+
+    fz_enable_simd_painters(1);
+    fz_paint_pixmap_with_mask(&dstPix1, &srcPix, &maskPix);
+    fz_enable_simd_painters(0);
+    fz_paint_pixmap_with_mask(&dstPix2, &srcPix, &maskPix);
+    utassert(memeq(dst1, dst2, w * 4));
+}
+
+void DrawPaint_UnitTests()
+{
+    for (int i = 0; i < TEST_ROUNDS; i++) {
+        int w = 1 + RandByte() % MAX_SPAN_WIDTH;
+        PaintSpanTest(w);
+        PaintSpanWithColorTest(w);
+        PaintSpanWithMaskTest(w);
+    }
+    fz_enable_simd_painters(1);
+}
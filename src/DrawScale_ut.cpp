@@ -0,0 +1,183 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// tests that mupdf's SSE2 image scalers produce exactly the same pixels as
+// the scalar ones and that the box filter (cf. fz_enable_fast_paths) stays
+// close enough to the regular filter
+
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
+#include "BaseUtil.h"
+
+// must be last due to assert() over-write
+#include "UtAssert.h"
+
+// test_util only links draw-scale-simple.c, draw-paint.c and geometry.c
+// (and not the rest of fitz), so these are minimal versions of the other
+// functions the scaler needs (it neither throws nor uses a scale cache here)
+extern "C" {
+
+void *fz_malloc(fz_context *ctx, unsigned int size)
+{
+    UNUSED(ctx);
+    return malloc(size);
+}
+
+void *fz_calloc(fz_context *ctx, unsigned int count, unsigned int size)
+{
+    UNUSED(ctx);
+    return calloc(count, size);
+}
+
+void fz_free(fz_context *ctx, void *p)
+{
+    UNUSED(ctx);
+    free(p);
+}
+
+void fz_var_imp(void *var)
+{
+    UNUSED(var);
+}
+
+int fz_push_try(fz_error_context *ex)
+{
+    ex->top++;
+    return 1;
+}
+
+void fz_rethrow(fz_context *ctx)
+{
+    UNUSED(ctx);
+    abort();
+}
+
+fz_pixmap *fz_new_pixmap(fz_context *ctx, fz_colorspace *cs, int w, int h)
+{
+    UNUSED(ctx);
+    fz_pixmap *pix = (fz_pixmap *)calloc(1, sizeof(fz_pixmap));
+    pix->w = w;
+    pix->h = h;
+    pix->n = cs ? cs->n + 1 : 1;
+    pix->colorspace = cs;
+    pix->samples = (unsigned char *)calloc(w * h, pix->n);
+    pix->has_alpha = 1;
+    return pix;
+}
+
+void fz_drop_pixmap(fz_context *ctx, fz_pixmap *pix)
+{
+    UNUSED(ctx);
+    free(pix->samples);
+    free(pix);
+}
+
+}
+
+// the box filter averages 2x2 resp. 4x4 blocks while the regular filter
+// also weighs in neighbouring pixels, so the results only match closely
+// for smooth images (such as the gradients below)
+#define MIN_FAST_PATH_PSNR  40.0
+#define MAX_FAST_PATH_ERROR 8
+
+// a deterministic generator, so that failures are reproducible
+static unsigned int gSeed = 1;
+
+static unsigned char RandByte()
+{
+    gSeed = gSeed * 1103515245 + 12345;
+    return (unsigned char)(gSeed >> 16);
+}
+
+// smooth premultiplied gradients with a bit of noise
+static void FillPixmap(fz_pixmap *pix)
+{
+    unsigned char *s = pix->samples;
+    for (int y = 0; y < pix->h; y++) {
+        for (int x = 0; x < pix->w; x++) {
+            int a = 255 - (x + y) * 128 / (pix->w + pix->h) - RandByte() % 8;
+            for (int k = 0; k < pix->n - 1; k++) {
+                int v = (k % 2 ? x * 255 / pix->w : y * 255 / pix->h) + RandByte() % 16 - 8;
+                *s++ = (unsigned char)(limitValue(v, 0, 255) * a / 255);
+            }
+            *s++ = (unsigned char)a;
+        }
+    }
+}
+
+static fz_pixmap *Scale(fz_context *ctx, fz_pixmap *src, int w, int h, bool simd, bool fastPaths)
+{
+    fz_enable_simd_painters(simd);
+    fz_enable_fast_paths(fastPaths);
+    return fz_scale_pixmap(ctx, src, 0, 0, (float)w, (float)h, NULL);
+}
+
+static bool SamePixmaps(fz_pixmap *pix1, fz_pixmap *pix2)
+{
+    return pix1->w == pix2->w && pix1->h == pix2->h && pix1->n == pix2->n &&
+           memeq(pix1->samples, pix2->samples, pix1->w * pix1->h * pix1->n);
+}
+
+static void CompareToReference(fz_pixmap *pix, fz_pixmap *ref)
+{
+    utassert(pix->w == ref->w && pix->h == ref->h && pix->n == ref->n);
+    size_t len = pix->w * pix->h * pix->n;
+    double sum = 0;
+    int maxError = 0;
+    for (size_t i = 0; i < len; i++) {
+        int diff = abs((int)pix->samples[i] - (int)ref->samples[i]);
+        sum += diff * diff;
+        maxError = max(maxError, diff);
+    }
+    double psnr = sum > 0 ? 10 * log10(255.0 * 255.0 * len / sum) : 100.0;
+    utassert(psnr >= MIN_FAST_PATH_PSNR);
+    utassert(maxError <= MAX_FAST_PATH_ERROR);
+}
+
+static void ScaleTest(fz_context *ctx, fz_colorspace *cs, int srcW, int srcH, int dstW, int dstH)
+{
+    fz_pixmap *src = fz_new_pixmap(ctx, cs, srcW, srcH);
+    FillPixmap(src);
+
+    fz_pixmap *ref = Scale(ctx, src, dstW, dstH, false, false);
+    fz_pixmap *simd = Scale(ctx, src, dstW, dstH, true, false);
+    utassert(SamePixmaps(simd, ref));
+
+    fz_pixmap *box = Scale(ctx, src, dstW, dstH, false, true);
+    fz_pixmap *simdBox = Scale(ctx, src, dstW, dstH, true, true);
+    utassert(SamePixmaps(simdBox, box));
+    CompareToReference(box, ref);
+
+    fz_drop_pixmap(ctx, simdBox);
+    fz_drop_pixmap(ctx, box);
+    fz_drop_pixmap(ctx, simd);
+    fz_drop_pixmap(ctx, ref);
+    fz_drop_pixmap(ctx, src);
+}
+
+void DrawScale_UnitTests()
+{
+    fz_error_context error = { 0 };
+    fz_context ctx = { 0 };
+    ctx.error = &error;
+    // only fz_colorspace::n is needed by fz_new_pixmap
+    fz_colorspace grey = { 0 }, rgb = { 0 };
+    grey.n = 1;
+    rgb.n = 3;
+
+    fz_colorspace *colorspaces[] = { NULL, &grey, &rgb };
+    for (int i = 0; i < dimof(colorspaces); i++) {
+        fz_colorspace *cs = colorspaces[i];
+        // 2x and 4x downscales (box filter), odd sizes and upscales
+        ScaleTest(&ctx, cs, 128, 96, 64, 48);
+        ScaleTest(&ctx, cs, 124, 60, 31, 15);
+        ScaleTest(&ctx, cs, 66, 34, 33, 17);
+        ScaleTest(&ctx, cs, 128, 64, 32, 32);
+        ScaleTest(&ctx, cs, 101, 77, 43, 29);
+        ScaleTest(&ctx, cs, 37, 19, 120, 61);
+    }
+    fz_enable_simd_painters(1);
+    fz_enable_fast_paths(1);
+}
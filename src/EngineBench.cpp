@@ -0,0 +1,798 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "BaseUtil.h"
+#include "EngineBench.h"
+
+#include "BaseEngine.h"
+#include "DirIter.h"
+#include "DiskTileCache.h"
+#include "EngineManager.h"
+#include "FileUtil.h"
+#include "MobiDoc.h"
+#include "PdfEngine.h"
+#include "PdfSync.h"
+#include "RenderScheduler.h"
+#include "TextIndex.h"
+#include "TextSearch.h"
+#include "TextSelection.h"
+#include "ThreadUtil.h"
+#include "Timer.h"
+
+#define Out(msg, ...) printf(msg, __VA_ARGS__)
+#define ErrOut(msg, ...) fwprintf(stderr, TEXT(msg), __VA_ARGS__)
+
+// renders pages until all of them have been handed out
+class BenchRenderThread : public ThreadBase {
+    BaseEngine *engine;
+    float zoom;
+    LONG *nextPageNo;
+
+public:
+    BenchRenderThread(BaseEngine *engine, float zoom, LONG *nextPageNo) :
+        ThreadBase("BenchRenderThread"), engine(engine), zoom(zoom), nextPageNo(nextPageNo) { }
+    virtual ~BenchRenderThread() { }
+
+    virtual void Run() {
+        int pageNo;
+        while ((pageNo = InterlockedIncrement(nextPageNo)) <= engine->PageCount()) {
+            delete engine->RenderBitmap(pageNo, zoom, 0);
+        }
+    }
+};
+
+// renders all pages with 1, 2, 4, ... maxThreads threads so that
+// throughput scaling can be compared without a desktop session
+static void BenchRenderThreads(BaseEngine *engine, int maxThreads, float zoom)
+{
+    // the first pass only warms up the caches (page loading, display lists)
+    for (int threads = 0; threads <= maxThreads; threads = max(threads * 2, 1)) {
+        LONG nextPageNo = 0;
+        Vec<BenchRenderThread *> workers;
+        Timer t(true);
+        for (int i = 0; i < max(threads, 1); i++) {
+            workers.Append(new BenchRenderThread(engine, zoom, &nextPageNo));
+            workers.Last()->Start();
+        }
+        for (size_t i = 0; i < workers.Count(); i++) {
+            workers.At(i)->Join();
+            delete workers.At(i);
+        }
+        double ms = t.Stop();
+        if (0 == threads)
+            continue;
+        Out("threads: %2d, pages: %d, time: %.0f ms, pages/s: %.2f\n",
+            threads, engine->PageCount(), ms, engine->PageCount() * 1000.0 / ms);
+    }
+    // e.g. the glyph cache's per-shard hit rates
+    Vec<EngineCacheStats> stats;
+    engine->BenchGetCacheStats(stats);
+    for (size_t i = 0; i < stats.Count(); i++) {
+        EngineCacheStats& s = stats.At(i);
+        ScopedMem<char> maxSize(s.maxBytes ? str::Format("%u KB", (UINT)(s.maxBytes / 1024)) : str::Dup("unlimited"));
+        Out("cache (%s): %u items (%u KB of %s), hits: %u/%u, evictions: %u (%u KB)\n",
+            s.name, (UINT)s.items, (UINT)(s.bytes / 1024), maxSize.Get(),
+            (UINT)s.hits, (UINT)s.lookups, (UINT)s.evictions, (UINT)(s.evictedBytes / 1024));
+    }
+}
+
+class BenchRenderHandler : public RenderRequestHandler {
+    BaseEngine *engine;
+
+public:
+    explicit BenchRenderHandler(BaseEngine *engine) : engine(engine) { }
+    virtual void RenderRequest(PageRenderRequest& req) {
+        delete engine->RenderBitmap(req.pageNo, req.zoom, req.rotation, &req.pageRect, Target_View, &req.abortCookie);
+    }
+};
+
+// renders all pages through the same RenderScheduler that the UI uses
+// (only without a DisplayModel), so that its overhead can be compared
+// to the plain threads of BenchRenderThreads
+static void BenchRenderScheduler(BaseEngine *engine, int maxThreads, float zoom)
+{
+    BenchRenderHandler handler(engine);
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        RenderScheduler scheduler(&handler, threads);
+        Timer t(true);
+        for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+            PageRenderRequest req;
+            req.dm = NULL;
+            req.pageNo = pageNo;
+            req.rotation = 0;
+            req.zoom = zoom;
+            req.priority = Priority_Prefetch;
+            req.pageRect = engine->PageMediabox(pageNo);
+            req.renderCb = NULL;
+            // wait for the threads to catch up instead of having requests dropped
+            while (scheduler.IsQueueFull())
+                Sleep(1);
+            scheduler.Queue(req);
+        }
+        while (!scheduler.IsIdle())
+            Sleep(1);
+        double ms = t.Stop();
+        Out("scheduler threads: %2d, pages: %d, time: %.0f ms, pages/s: %.2f\n",
+            scheduler.ThreadCount(), engine->PageCount(), ms, engine->PageCount() * 1000.0 / ms);
+    }
+}
+
+// renders all pages twice through a DiskTileCache (once for filling it and
+// once more from the cache) so that cold and warm load times can be compared
+static void BenchDiskCache(BaseEngine *engine, const WCHAR *cacheDir, float zoom)
+{
+    DiskTileKey key;
+    if (!engine->GetContentFingerprint(key.fingerprint)) {
+        Out("disk cache: not supported for this document\n");
+        return;
+    }
+    DiskTileCache cache(cacheDir, (size_t)-1);
+    for (int pass = 1; pass <= 2; pass++) {
+        Timer t(true);
+        for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+            key.pageNo = pageNo;
+            key.rotation = 0;
+            key.zoom = zoom;
+            key.pageRect = engine->PageMediabox(pageNo);
+            RenderedBitmap *bmp = cache.Load(key);
+            if (!bmp) {
+                bmp = engine->RenderBitmap(pageNo, zoom, 0, &key.pageRect);
+                if (bmp)
+                    cache.Save(key, bmp);
+            }
+            delete bmp;
+        }
+        double ms = t.Stop();
+        DiskTileCacheStats stats = cache.GetStats();
+        Out("disk cache pass %d: time: %.0f ms, hits: %d, misses: %d, read: %d KB, written: %d KB, stored: %d KB\n",
+            pass, ms, (int)stats.hits, (int)stats.misses, (int)(stats.bytesRead / 1024),
+            (int)(stats.bytesWritten / 1024), (int)(stats.bytes / 1024));
+    }
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+    double diff = *(const double *)a - *(const double *)b;
+    return diff < 0 ? -1 : diff > 0 ? 1 : 0;
+}
+
+// nearest-rank percentile of already sorted values
+static double Percentile(Vec<double>& sorted, int percent)
+{
+    if (0 == sorted.Count())
+        return 0;
+    size_t rank = (sorted.Count() * percent + 99) / 100;
+    return sorted.At(max(rank, (size_t)1) - 1);
+}
+
+static char *BenchQuote(const WCHAR *s, bool json)
+{
+    ScopedMem<char> utf8(str::conv::ToUtf8(s));
+    str::Str<char> quoted;
+    quoted.Append('"');
+    for (const char *c = utf8; *c; c++) {
+        if ('"' == *c)
+            quoted.Append(json ? "\\\"" : "\"\"");
+        else if ('\\' == *c && json)
+            quoted.Append("\\\\");
+        else
+            quoted.Append(*c);
+    }
+    quoted.Append('"');
+    return quoted.StealData();
+}
+
+class BenchReport {
+    bool json;
+    size_t rows;
+
+public:
+    explicit BenchReport(bool json) : json(json), rows(0) {
+        if (json)
+            Out("[\n");
+        else
+            Out("file,phase,zoom,rotation,tile,count,total_ms,mean_ms,p50_ms,p90_ms,p99_ms,max_ms\n");
+    }
+    ~BenchReport() {
+        if (json)
+            Out("%s]\n", rows > 0 ? "\n" : "");
+    }
+
+    // zoom, rotation and tileSize only apply to the "render" phase
+    void AddRow(const WCHAR *filePath, const char *phase, Vec<double>& timings,
+                float zoom=0, int rotation=-1, int tileSize=-1) {
+        if (0 == timings.Count())
+            return;
+        timings.Sort(cmpDouble);
+        double total = 0;
+        for (size_t i = 0; i < timings.Count(); i++) {
+            total += timings.At(i);
+        }
+        ScopedMem<char> file(BenchQuote(filePath, json));
+        ScopedMem<char> config(rotation < 0 ? str::Dup(json ? "" : ",,") :
+            json ? str::Format("\"zoom\": %.0f, \"rotation\": %d, \"tile\": %d, ", zoom * 100, rotation, tileSize) :
+                   str::Format("%.0f,%d,%d", zoom * 100, rotation, tileSize));
+        if (json)
+            Out("%s  { \"file\": %s, \"phase\": \"%s\", %s\"count\": %d, \"total_ms\": %.2f, \"mean_ms\": %.3f, "
+                "\"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f }",
+                rows > 0 ? ",\n" : "", file.Get(), phase, config.Get(), (int)timings.Count(), total,
+                total / timings.Count(), Percentile(timings, 50), Percentile(timings, 90),
+                Percentile(timings, 99), timings.Last());
+        else
+            Out("%s,%s,%s,%d,%.2f,%.3f,%.3f,%.3f,%.3f,%.3f\n", file.Get(), phase, config.Get(),
+                (int)timings.Count(), total, total / timings.Count(), Percentile(timings, 50),
+                Percentile(timings, 90), Percentile(timings, 99), timings.Last());
+        fflush(stdout);
+        rows++;
+    }
+};
+
+// renders a page at the given zoom level in tiles of at most tileSize x tileSize pixels
+static void BenchRenderPage(BaseEngine *engine, int pageNo, float zoom, int rotation, int tileSize)
+{
+    RectD mediabox = engine->PageMediabox(pageNo);
+    if (tileSize <= 0) {
+        delete engine->RenderBitmap(pageNo, zoom, rotation, &mediabox);
+        return;
+    }
+    RectI screen = engine->Transform(mediabox, pageNo, zoom, rotation).Round();
+    for (int y = 0; y < screen.dy; y += tileSize) {
+        for (int x = 0; x < screen.dx; x += tileSize) {
+            RectI tile(screen.x + x, screen.y + y, min(tileSize, screen.dx - x), min(tileSize, screen.dy - y));
+            RectD pageRect = engine->Transform(tile.Convert<double>(), pageNo, zoom, rotation, true);
+            delete engine->RenderBitmap(pageNo, zoom, rotation, &pageRect);
+        }
+    }
+}
+
+// measures the time required for opening a document and then for loading,
+// parsing, rendering and extracting the text of all its pages
+static void BenchDocument(const WCHAR *filePath, BenchOptions& opts, BenchReport& report)
+{
+    Vec<double> timings;
+    Timer t(true);
+    BaseEngine *engine = EngineManager::CreateEngine(filePath, opts.useChm2Engine);
+    timings.Append(t.Stop());
+    if (!engine) {
+        ErrOut("Error: Couldn't create an engine for %s!\n", path::GetBaseName(filePath));
+        return;
+    }
+    report.AddRow(filePath, "open", timings);
+    int pageCount = engine->PageCount();
+
+    timings.Reset();
+    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+        t.Start();
+        if (engine->BenchLoadPage(pageNo))
+            timings.Append(t.Stop());
+    }
+    report.AddRow(filePath, "load", timings);
+
+    // engines without display lists parse pages while rendering
+    timings.Reset();
+    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+        t.Start();
+        if (engine->BenchBuildPageRun(pageNo))
+            timings.Append(t.Stop());
+    }
+    report.AddRow(filePath, "displaylist", timings);
+
+    for (size_t z = 0; z < opts.zooms.Count(); z++) {
+        for (size_t r = 0; r < opts.rotations.Count(); r++) {
+            for (size_t ts = 0; ts < opts.tileSizes.Count(); ts++) {
+                timings.Reset();
+                for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+                    // make sure that only rasterization is measured
+                    engine->BenchBuildPageRun(pageNo);
+                    t.Start();
+                    BenchRenderPage(engine, pageNo, opts.zooms.At(z), opts.rotations.At(r), opts.tileSizes.At(ts));
+                    timings.Append(t.Stop());
+                }
+                report.AddRow(filePath, "render", timings, opts.zooms.At(z), opts.rotations.At(r), opts.tileSizes.At(ts));
+            }
+        }
+    }
+
+    timings.Reset();
+    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+        t.Start();
+        free(engine->ExtractPageText(pageNo, L"\n"));
+        timings.Append(t.Stop());
+    }
+    report.AddRow(filePath, "text", timings);
+
+    delete engine;
+}
+
+// benchmarks a single document or all supported documents in a directory
+static void BenchCorpus(const WCHAR *path, BenchOptions& opts)
+{
+    BenchReport report(opts.json);
+    if (!dir::Exists(path)) {
+        BenchDocument(path, opts, report);
+        return;
+    }
+    DirIter di(path, true);
+    for (const WCHAR *filePath = di.First(); filePath; filePath = di.Next()) {
+        if (EngineManager::IsSupportedFile(filePath))
+            BenchDocument(filePath, opts, report);
+    }
+}
+
+bool ParseBenchList(const WCHAR *s, Vec<int>& list)
+{
+    WStrVec parts;
+    parts.Split(s, L",", true);
+    list.Reset();
+    for (size_t i = 0; i < parts.Count(); i++) {
+        int value;
+        if (!str::Parse(parts.At(i), L"%d%$", &value) || value < 0)
+            return false;
+        list.Append(value);
+    }
+    return list.Count() > 0;
+}
+
+static bool GetBitmapPixels(RenderedBitmap *bmp, Vec<unsigned char>& pixels)
+{
+    SizeI size = bmp->Size();
+    BITMAPINFO bmi = { 0 };
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    pixels.Reset();
+    unsigned char *data = pixels.MakeSpaceAt(0, size.dx * size.dy * 4);
+    HDC hDC = GetDC(NULL);
+    bool ok = GetDIBits(hDC, bmp->GetBitmap(), 0, size.dy, data, &bmi, DIB_RGB_COLORS) != 0;
+    ReleaseDC(NULL, hDC);
+    return ok;
+}
+
+static RenderedBitmap *RenderTimed(BaseEngine *engine, int pageNo, float zoom, double& totalMs)
+{
+    Timer t(true);
+    RenderedBitmap *bmp = engine->RenderBitmap(pageNo, zoom, 0);
+    totalMs += t.Stop();
+    return bmp;
+}
+
+// peak signal-to-noise ratio in dB (or HUGE_VAL for identical pixels)
+static double CalcPSNR(const unsigned char *data1, const unsigned char *data2, size_t len)
+{
+    double sse = 0;
+    for (size_t i = 0; i < len; i++) {
+        int diff = data1[i] - data2[i];
+        sse += diff * diff;
+    }
+    if (0 == sse || 0 == len)
+        return HUGE_VAL;
+    return 10 * log10(255.0 * 255.0 * len / sse);
+}
+
+// the box filter for downscaling images needn't be bit-exact
+// but mustn't visibly differ from the general image scaler
+#define MIN_FAST_PATH_PSNR 30.0
+
+// returns HUGE_VAL if both bitmaps are identical (or both missing)
+static double CompareBitmaps(RenderedBitmap *bmp1, RenderedBitmap *bmp2, Vec<unsigned char>& pixels1, Vec<unsigned char>& pixels2)
+{
+    if (!bmp1 && !bmp2)
+        return HUGE_VAL;
+    if (!bmp1 || !bmp2 || bmp1->Size() != bmp2->Size() ||
+        !GetBitmapPixels(bmp1, pixels1) || !GetBitmapPixels(bmp2, pixels2)) {
+        return 0;
+    }
+    return CalcPSNR(pixels1.LendData(), pixels2.LendData(), pixels1.Count());
+}
+
+// renders all pages with the scalar code paths, with the SIMD painters and
+// scalers (which must produce identical pixels) and additionally with the
+// box filter (which must produce similar enough pixels) and reports timings
+// as well as any pages which don't render as expected
+static bool CheckSimdPainters(BaseEngine *engine, float zoom)
+{
+    if (!DebugSimdPainters(true)) {
+        Out("simd: not supported on this CPU\n");
+        return true;
+    }
+    double scalarMs = 0, simdMs = 0, fastMs = 0, minPsnr = HUGE_VAL;
+    int simdFailed = 0, fastDiffering = 0, fastFailed = 0;
+    Vec<unsigned char> pixels1, pixels2;
+    for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+        // only measure rasterization
+        engine->BenchBuildPageRun(pageNo);
+        DebugFastPaths(false);
+        DebugSimdPainters(false);
+        RenderedBitmap *scalarBmp = RenderTimed(engine, pageNo, zoom, scalarMs);
+        DebugSimdPainters(true);
+        RenderedBitmap *simdBmp = RenderTimed(engine, pageNo, zoom, simdMs);
+        DebugFastPaths(true);
+        RenderedBitmap *fastBmp = RenderTimed(engine, pageNo, zoom, fastMs);
+
+        if (CompareBitmaps(scalarBmp, simdBmp, pixels1, pixels2) != HUGE_VAL) {
+            Out("simd: page %d renders differently with SIMD painters\n", pageNo);
+            simdFailed++;
+        }
+        double psnr = CompareBitmaps(simdBmp, fastBmp, pixels1, pixels2);
+        if (psnr < MIN_FAST_PATH_PSNR) {
+            Out("simd: page %d renders differently with fast paths (PSNR: %.1f dB)\n", pageNo, psnr);
+            fastFailed++;
+        }
+        if (psnr != HUGE_VAL)
+            fastDiffering++;
+        minPsnr = min(minPsnr, psnr);
+        delete scalarBmp;
+        delete simdBmp;
+        delete fastBmp;
+    }
+    Out("simd: pages: %d, not bit-exact: %d, fast paths differing: %d, failed: %d, min. PSNR: %.1f dB\n",
+        engine->PageCount(), simdFailed, fastDiffering, fastFailed, minPsnr);
+    Out("simd: scalar: %.0f ms, simd: %.0f ms, simd + fast paths: %.0f ms\n", scalarMs, simdMs, fastMs);
+    return 0 == simdFailed && 0 == fastFailed;
+}
+
+// searches the whole document once without and once with a (freshly built)
+// TextIndex, starting with an empty text cache both times
+static void BenchSearch(BaseEngine *engine, const WCHAR *text)
+{
+    for (int pass = 1; pass <= 2; pass++) {
+        PageTextCache textCache(engine);
+        ScopedPtr<TextIndex> index;
+        double indexMs = 0;
+        if (2 == pass) {
+            index = new TextIndex(engine, &textCache);
+            Timer t(true);
+            for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+                index->IndexPage(pageNo);
+            }
+            indexMs = t.Stop();
+        }
+        TextSearch search(engine, &textCache, index);
+        Timer t(true);
+        TextSel *sel = search.FindAll(text);
+        double ms = t.Stop();
+        int pages = 0;
+        for (int i = 0; sel && i < sel->len; i++) {
+            if (0 == i || sel->pages[i] != sel->pages[i - 1])
+                pages++;
+        }
+        Out("search %s index: time: %.0f ms, indexing: %.0f ms, pages with hits: %d, rects: %d\n",
+            index ? "with" : "without", ms, indexMs, pages, sel ? sel->len : 0);
+    }
+}
+
+// extracts the text of all pages with 1, 2, 4, ... maxThreads threads
+// (cf. PageTextCache::ExtractPages) starting with an empty cache each time
+// and reports how much memory the cached text takes
+static void BenchExtractText(BaseEngine *engine, int maxThreads)
+{
+    // the first pass only warms up the engine's caches
+    for (int threads = 0; threads <= maxThreads; threads = max(threads * 2, 1)) {
+        PageTextCache textCache(engine, (size_t)-1);
+        Timer t(true);
+        textCache.ExtractPages(1, engine->PageCount(), max(threads, 1));
+        double ms = t.Stop();
+        if (0 == threads) {
+            PageTextCacheStats stats = textCache.GetStats();
+            Out("text cache: pages: %d, chars: %d, size: %d KB (uncompacted: %d KB), per 1000 pages: %.0f KB\n",
+                stats.pages, stats.chars, (int)(stats.bytes / 1024), (int)(stats.uncompactedBytes / 1024),
+                stats.bytes * 1000.0 / 1024 / max(stats.pages, 1));
+            continue;
+        }
+        Out("text threads: %2d, pages: %d, time: %.0f ms, pages/s: %.2f\n",
+            threads, engine->PageCount(), ms, engine->PageCount() * 1000.0 / ms);
+    }
+}
+
+#define STRESS_ROUNDS 3
+
+// hash of a page's rendering and text (0 if either failed)
+static uint32_t HashPage(BaseEngine *engine, int pageNo, float zoom, Vec<unsigned char>& pixels)
+{
+    RenderedBitmap *bmp = engine->RenderBitmap(pageNo, zoom, 0);
+    bool ok = bmp && GetBitmapPixels(bmp, pixels);
+    delete bmp;
+    ScopedMem<WCHAR> text(engine->ExtractPageText(pageNo, L"\n"));
+    // also exercises the engine's link handling
+    Vec<PageElement *> *els = engine->GetElements(pageNo);
+    if (els)
+        DeleteVecMembers(*els);
+    delete els;
+    if (!ok)
+        return 0;
+    return MurmurHash2(pixels.LendData(), pixels.Count()) ^ (text ? MurmurHash2(text, str::Len(text) * sizeof(WCHAR)) : 0);
+}
+
+// renders all pages in a random order and compares the results
+// with those of a single-threaded reference pass
+class StressRenderThread : public ThreadBase {
+    BaseEngine *engine;
+    float zoom;
+    Vec<uint32_t> *hashes;
+    unsigned int seed;
+    LONG *mismatches;
+
+public:
+    StressRenderThread(BaseEngine *engine, float zoom, Vec<uint32_t> *hashes, unsigned int seed, LONG *mismatches) :
+        ThreadBase("StressRenderThread"), engine(engine), zoom(zoom), hashes(hashes),
+        seed(seed), mismatches(mismatches) { }
+    virtual ~StressRenderThread() { }
+
+    virtual void Run() {
+        Vec<unsigned char> pixels;
+        for (int i = 0; i < STRESS_ROUNDS * engine->PageCount(); i++) {
+            seed = seed * 1103515245 + 12345;
+            int pageNo = (seed >> 16) % engine->PageCount() + 1;
+            if (HashPage(engine, pageNo, zoom, pixels) != hashes->At(pageNo - 1))
+                InterlockedIncrement(mismatches);
+        }
+    }
+};
+
+// renders, extracts text from and gets links for all pages with n threads, half
+// of them sharing the engine and half of them using their own clone (so that both
+// shared pages and independent documents are decoded concurrently)
+static bool CheckThreadSafety(BaseEngine *engine, int threads, float zoom)
+{
+    Vec<uint32_t> hashes;
+    Vec<unsigned char> pixels;
+    for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+        hashes.Append(HashPage(engine, pageNo, zoom, pixels));
+    }
+
+    LONG mismatches = 0;
+    Vec<BaseEngine *> clones;
+    Vec<StressRenderThread *> workers;
+    Timer t(true);
+    for (int i = 0; i < threads; i++) {
+        BaseEngine *workerEngine = i % 2 == 1 ? engine->Clone() : NULL;
+        if (workerEngine)
+            clones.Append(workerEngine);
+        else
+            workerEngine = engine;
+        workers.Append(new StressRenderThread(workerEngine, zoom, &hashes, i + 1, &mismatches));
+        workers.Last()->Start();
+    }
+    for (size_t i = 0; i < workers.Count(); i++) {
+        workers.At(i)->Join();
+        delete workers.At(i);
+    }
+    double ms = t.Stop();
+    DeleteVecMembers(clones);
+
+    Out("stress: threads: %d (clones: %d), pages: %d, time: %.0f ms, mismatches: %d\n",
+        threads, (int)clones.Count(), threads * STRESS_ROUNDS * engine->PageCount(), ms, (int)mismatches);
+    return 0 == mismatches;
+}
+
+// writes a synthetic .pdfsync file with pointsPerPage records per page (in chapters of
+// ten pages each) where the points of all pages from changedPage on are moved a bit
+static bool WriteSyncBenchFile(const WCHAR *syncPath, PdfEngine *engine, int pointsPerPage, int changedPage)
+{
+    str::Str<char> data;
+    data.Append("SyncBench\nversion 1\n");
+    UINT record = 1, line = 1;
+    for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+        if (pageNo % 10 == 1) {
+            if (pageNo > 1)
+                data.Append(")\n");
+            data.AppendFmt("(chapter%d\n", pageNo / 10 + 1);
+            line = 1;
+        }
+        data.AppendFmt("s %d\n", pageNo);
+        RectD mbox = engine->PageMediabox(pageNo);
+        for (int i = 0; i < pointsPerPage; i++, record++, line += 2) {
+            double x = mbox.dx * ((i * 7) % 10 + 1) / 12;
+            double y = mbox.dy * (i + 1) / (pointsPerPage + 1) + (pageNo >= changedPage ? 2 : 0);
+            data.AppendFmt("l %u %u\np %u %u %u\n", record, line, record, (UINT)(x * 65781.76), (UINT)(y * 65781.76));
+        }
+    }
+    if (engine->PageCount() > 0)
+        data.Append(")\n");
+    // make sure that the size changes as well (in case the modification time doesn't)
+    if (changedPage <= engine->PageCount())
+        data.Append("l 0 0\n");
+    return file::WriteAll(syncPath, data.Get(), data.Size());
+}
+
+// measures the time required for parsing a synthetic .pdfsync file, for looking
+// up positions in both directions and for reparsing the file after its second
+// half has changed (compared to parsing the changed file from scratch)
+static void BenchSync(PdfEngine *engine, int pointsPerPage)
+{
+    int pageCount = engine->PageCount();
+    ScopedMem<WCHAR> tempDir(path::GetTempPath());
+    ScopedMem<WCHAR> pdfPath(path::Join(tempDir, L"SyncBench.pdf"));
+    ScopedMem<WCHAR> syncPath(path::Join(tempDir, L"SyncBench.pdfsync"));
+    if (!tempDir || !WriteSyncBenchFile(syncPath, engine, pointsPerPage, pageCount + 1)) {
+        ErrOut("Error: Couldn't write %s!\n", syncPath.Get());
+        return;
+    }
+
+    Synchronizer *sync;
+    if (Synchronizer::Create(pdfPath, engine, &sync) != PDFSYNCERR_SUCCESS) {
+        file::Delete(syncPath);
+        return;
+    }
+
+    ScopedMem<WCHAR> srcFile;
+    UINT line, col, page;
+    Vec<RectI> rects;
+    // the first lookup parses the entire file
+    Timer t(true);
+    sync->DocToSource(1, PointI(), srcFile, &line, &col);
+    double parseMs = t.Stop();
+
+    const int lookups = 1000;
+    unsigned int seed = 1;
+    int found = 0;
+    t.Start();
+    for (int i = 0; i < lookups; i++) {
+        seed = seed * 1103515245 + 12345;
+        int pageNo = (seed >> 16) % pageCount + 1;
+        SizeD size = engine->PageMediabox(pageNo).Size();
+        PointI pt((int)(size.dx * ((seed >> 4) % 100) / 100), (int)(size.dy * ((seed >> 8) % 100) / 100));
+        if (PDFSYNCERR_SUCCESS == sync->DocToSource(pageNo, pt, srcFile, &line, &col))
+            found++;
+    }
+    double inverseMs = t.Stop();
+    t.Start();
+    for (int i = 0; i < lookups; i++) {
+        seed = seed * 1103515245 + 12345;
+        int chapter = (seed >> 16) % ((pageCount + 9) / 10) + 1;
+        ScopedMem<WCHAR> chapterFile(str::Format(L"chapter%d.tex", chapter));
+        if (PDFSYNCERR_SUCCESS == sync->SourceToDoc(chapterFile, (seed >> 4) % (20 * pointsPerPage), 0, &page, rects))
+            found++;
+    }
+    double forwardMs = t.Stop();
+
+    // only the pages of the second half should have to be reparsed
+    WriteSyncBenchFile(syncPath, engine, pointsPerPage, pageCount / 2 + 1);
+    t.Start();
+    sync->DocToSource(1, PointI(), srcFile, &line, &col);
+    double reparseMs = t.Stop();
+    delete sync;
+
+    double fullMs = 0;
+    if (Synchronizer::Create(pdfPath, engine, &sync) == PDFSYNCERR_SUCCESS) {
+        t.Start();
+        sync->DocToSource(1, PointI(), srcFile, &line, &col);
+        fullMs = t.Stop();
+        delete sync;
+    }
+    file::Delete(syncPath);
+
+    Out("sync: pages: %d, records: %d, parse: %.2f ms, %d inverse searches: %.2f ms, %d forward searches: %.2f ms (%d found)\n",
+        pageCount, pageCount * pointsPerPage, parseMs, lookups, inverseMs, lookups, forwardMs, found);
+    Out("sync: reparse after change: %.2f ms (full parse: %.2f ms)\n", reparseMs, fullMs);
+}
+
+// loads and parses all pages once with larger files read through a file descriptor
+// and once with them mapped into memory (and counts the read calls for either)
+static void BenchFileIO(const WCHAR *filePath, bool useChm2Engine)
+{
+    for (int mapped = 0; mapped <= 1; mapped++) {
+        DebugFileMapping(mapped != 0);
+        IO_COUNTERS before = { 0 }, after = { 0 };
+        GetProcessIoCounters(GetCurrentProcess(), &before);
+        Timer t(true);
+        BaseEngine *engine = EngineManager::CreateEngine(filePath, useChm2Engine);
+        if (!engine) {
+            ErrOut("Error: Couldn't create an engine for %s!\n", path::GetBaseName(filePath));
+            break;
+        }
+        int pageCount = engine->PageCount();
+        for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+            engine->BenchLoadPage(pageNo);
+            engine->BenchBuildPageRun(pageNo);
+        }
+        double ms = t.Stop();
+        delete engine;
+        GetProcessIoCounters(GetCurrentProcess(), &after);
+
+        double reads = (double)(after.ReadOperationCount - before.ReadOperationCount);
+        double kb = (after.ReadTransferCount - before.ReadTransferCount) / 1024.0;
+        Out("io (%s): pages: %d, time: %.0f ms (%.3f ms/page), read calls: %.0f (%.1f/page), read: %.0f KB\n",
+            mapped ? "mapped" : "file", pageCount, ms, ms / max(pageCount, 1), reads, reads / max(pageCount, 1), kb);
+    }
+    // restore the default
+    DebugFileMapping(true);
+}
+
+// loads a Mobi document with 1, 2, 4, ... maxThreads threads decompressing
+// its text (cf. MobiDoc::LoadDocRecords) and reports the throughput
+static void BenchMobiDecompression(const WCHAR *filePath, int maxThreads)
+{
+    if (!MobiDoc::IsSupportedFile(filePath, true)) {
+        ErrOut("Error: %s isn't a Mobi document!\n", path::GetBaseName(filePath));
+        return;
+    }
+    // the first pass only warms up the file system cache
+    for (int threads = 0; threads <= maxThreads; threads = max(threads * 2, 1)) {
+        SetMobiDecompressionThreads(max(threads, 1));
+        Timer t(true);
+        MobiDoc *mobiDoc = MobiDoc::CreateFromFile(filePath);
+        double ms = t.Stop();
+        if (!mobiDoc) {
+            ErrOut("Error: Couldn't load %s!\n", path::GetBaseName(filePath));
+            break;
+        }
+        double mb = mobiDoc->GetBookHtmlSize() / (1024.0 * 1024.0);
+        delete mobiDoc;
+        if (0 == threads)
+            continue;
+        Out("mobi threads: %2d, text: %.2f MB, time: %.0f ms, MB/s: %.2f (%.2f per thread)\n",
+            threads, mb, ms, mb * 1000.0 / max(ms, 0.001), mb * 1000.0 / max(ms, 0.001) / threads);
+    }
+    SetMobiDecompressionThreads(0);
+}
+
+// the names of the BenchMode flags in the order of their bits
+static const char *gBenchModeNames = "threads\0diskcache\0timings\0simd\0search\0text\0stress\0sync\0io\0mobi\0";
+
+bool ParseBenchModes(const WCHAR *s, int *modes)
+{
+    WStrVec parts;
+    parts.Split(s, L",", true);
+    int parsed = 0;
+    for (size_t i = 0; i < parts.Count(); i++) {
+        int idx = seqstrings::StrToIdx(gBenchModeNames, parts.At(i));
+        if (-1 == idx)
+            return false;
+        parsed |= 1 << idx;
+    }
+    if (!parsed)
+        return false;
+    *modes |= parsed;
+    return true;
+}
+
+bool RunBenchmarks(const WCHAR *filePath, BenchOptions& opts, PasswordUI *pwdUI)
+{
+    // these modes create (and possibly recreate) their own engines
+    if ((opts.modes & Bench_Timings))
+        BenchCorpus(filePath, opts);
+    if ((opts.modes & Bench_FileIO))
+        BenchFileIO(filePath, opts.useChm2Engine);
+    if ((opts.modes & Bench_Mobi))
+        BenchMobiDecompression(filePath, opts.threads);
+    if (!(opts.modes & ~(Bench_Timings | Bench_FileIO | Bench_Mobi)))
+        return true;
+
+    EngineType engineType;
+    BaseEngine *engine = EngineManager::CreateEngine(filePath, pwdUI, &engineType, opts.useChm2Engine);
+    if (!engine) {
+        ErrOut("Error: Couldn't create an engine for %s!\n", path::GetBaseName(filePath));
+        return false;
+    }
+    // the other modes only use the first zoom level
+    float zoom = opts.zooms.At(0);
+    if ((opts.modes & Bench_Threads)) {
+        BenchRenderThreads(engine, opts.threads, zoom);
+        BenchRenderScheduler(engine, opts.threads, zoom);
+    }
+    if ((opts.modes & Bench_DiskCache))
+        BenchDiskCache(engine, opts.cacheDir, zoom);
+    if ((opts.modes & Bench_Search))
+        BenchSearch(engine, opts.query);
+    if ((opts.modes & Bench_Text))
+        BenchExtractText(engine, opts.threads);
+    if ((opts.modes & Bench_Sync)) {
+        if (Engine_PDF == engineType)
+            BenchSync(static_cast<PdfEngine *>(engine), opts.syncPoints);
+        else
+            Out("sync: only supported for PDF documents\n");
+    }
+    bool ok = true;
+    if ((opts.modes & Bench_Simd))
+        ok = CheckSimdPainters(engine, zoom) && ok;
+    if ((opts.modes & Bench_Stress))
+        ok = CheckThreadSafety(engine, opts.threads, zoom) && ok;
+    delete engine;
+
+    return ok;
+}
@@ -0,0 +1,59 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#ifndef EngineBench_h
+#define EngineBench_h
+
+class PasswordUI;
+
+/* The benchmarks and checks run by EngineDump's -bench option
+   (several of them can be combined, e.g. -bench threads,diskcache) */
+enum BenchMode {
+    // renders all pages with up to opts.threads threads, once with
+    // plain threads and once through a RenderScheduler
+    Bench_Threads   = 1 << 0,
+    // renders all pages through a tile cache in opts.cacheDir
+    Bench_DiskCache = 1 << 1,
+    // timing percentiles as CSV (or JSON) for a document or a directory
+    Bench_Timings   = 1 << 2,
+    // compares rendering with and without the SIMD and fast path functions
+    Bench_Simd      = 1 << 3,
+    // finds all occurrences of opts.query with and without a text index
+    Bench_Search    = 1 << 4,
+    // extracts the text of all pages with up to opts.threads threads
+    Bench_Text      = 1 << 5,
+    // renders all pages with opts.threads threads and compares the results
+    Bench_Stress    = 1 << 6,
+    // parses and searches a .pdfsync file with opts.syncPoints records per page
+    Bench_Sync      = 1 << 7,
+    // compares reading larger PDF and XPS files with and without memory mapping
+    Bench_FileIO    = 1 << 8,
+    // decompresses the text of a Mobi document with up to opts.threads threads
+    Bench_Mobi      = 1 << 9,
+};
+
+// settings for the benchmarks run by -bench (all given lists are swept)
+struct BenchOptions {
+    // combination of BenchMode flags
+    int modes;
+    Vec<float> zooms;
+    Vec<int> rotations;
+    // maximum tile width/height in pixels (0 for rendering entire pages)
+    Vec<int> tileSizes;
+    bool json;
+    bool useChm2Engine;
+    int threads;
+    const WCHAR *query;
+    const WCHAR *cacheDir;
+    int syncPoints;
+};
+
+// parses a comma separated list of numbers (e.g. "50,100,200")
+bool ParseBenchList(const WCHAR *s, Vec<int>& list);
+// parses a comma separated list of mode names (cf. BenchMode)
+// and adds the corresponding BenchMode flags to modes
+bool ParseBenchModes(const WCHAR *s, int *modes);
+// returns false if a document couldn't be loaded or a check failed
+bool RunBenchmarks(const WCHAR *filePath, BenchOptions& opts, PasswordUI *pwdUI);
+
+#endif
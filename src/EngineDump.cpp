@@ -5,6 +5,7 @@
 #include "BaseEngine.h"
 #include "ChmEngine.h"
 #include "CmdLineParser.h"
+#include "EngineBench.h"
 #include "EngineManager.h"
 #include "FileModifications.h"
 #include "FileUtil.h"
@@ -363,7 +364,11 @@ int main(int argc, char **argv)
     ParseCmdLine(GetCommandLine(), argList);
     if (argList.Count() < 2) {
 Usage:
-        ErrOut("%s <filename> [-pwd <password>][-full][-render <path-%%d.tga>]\n",
+        ErrOut("%s <filename> [-pwd <password>][-full][-render <path-%%d.tga>]\n"
+               "       [-bench [<mode>,..][-zooms <%%,..>][-rotations <deg,..>][-tiles <px,..>][-json]\n"
+               "               [-threads <n>][-query <text>][-cachedir <dir>][-syncpoints <n>]]\n"
+               "       bench modes: timings (default), threads, diskcache, simd, search, text,\n"
+               "                    stress, sync, io, mobi\n",
             path::GetBaseName(argList.At(0)));
         return 2;
     }
@@ -388,6 +393,15 @@ Usage:
     float renderZoom = 1.f;
     bool useAlternateHandlers = false;
     bool loadOnly = false, silent = false;
+    bool bench = false;
+    BenchOptions benchOpts;
+    Vec<int> benchZooms, benchRotations, benchTiles;
+    benchOpts.modes = 0;
+    benchOpts.json = false;
+    benchOpts.threads = 4;
+    benchOpts.query = NULL;
+    benchOpts.cacheDir = NULL;
+    benchOpts.syncPoints = 20;
     int breakAlloc = 0;
 
     for (size_t i = 2; i < argList.Count(); i++) {
@@ -412,6 +426,28 @@ Usage:
             loadOnly = true;
         else if (str::Eq(argList.At(i), L"-silent"))
             silent = true;
+        // -bench runs the benchmarks and checks of the given modes (cf. BenchMode)
+        else if (str::Eq(argList.At(i), L"-bench")) {
+            bench = true;
+            if (i + 1 < argList.Count() && ParseBenchModes(argList.At(i + 1), &benchOpts.modes))
+                i++;
+        }
+        else if (str::Eq(argList.At(i), L"-zooms") && i + 1 < argList.Count() && ParseBenchList(argList.At(i + 1), benchZooms))
+            i++;
+        else if (str::Eq(argList.At(i), L"-rotations") && i + 1 < argList.Count() && ParseBenchList(argList.At(i + 1), benchRotations))
+            i++;
+        else if (str::Eq(argList.At(i), L"-tiles") && i + 1 < argList.Count() && ParseBenchList(argList.At(i + 1), benchTiles))
+            i++;
+        else if (str::Eq(argList.At(i), L"-json"))
+            benchOpts.json = true;
+        else if (str::Eq(argList.At(i), L"-threads") && i + 1 < argList.Count())
+            benchOpts.threads = _wtoi(argList.At(++i));
+        else if (str::Eq(argList.At(i), L"-query") && i + 1 < argList.Count())
+            benchOpts.query = argList.At(++i);
+        else if (str::Eq(argList.At(i), L"-cachedir") && i + 1 < argList.Count())
+            benchOpts.cacheDir = argList.At(++i);
+        else if (str::Eq(argList.At(i), L"-syncpoints") && i + 1 < argList.Count())
+            benchOpts.syncPoints = _wtoi(argList.At(++i));
 #ifdef DEBUG
         else if (str::Eq(argList.At(i), L"-breakalloc") && i + 1 < argList.Count())
             breakAlloc = _wtoi(argList.At(++i));
@@ -419,6 +455,10 @@ Usage:
         else
             goto Usage;
     }
+    if ((benchOpts.modes & Bench_DiskCache) && !benchOpts.cacheDir ||
+        (benchOpts.modes & Bench_Search) && !benchOpts.query || benchOpts.threads <= 0) {
+        goto Usage;
+    }
 
 #ifdef DEBUG
     if (breakAlloc) {
@@ -440,6 +480,28 @@ Usage:
     ScopedGdiPlus gdiPlus;
     ScopedMiniMui miniMui;
 
+    if (bench) {
+        for (size_t i = 0; i < benchZooms.Count(); i++) {
+            if (benchZooms.At(i) > 0)
+                benchOpts.zooms.Append(benchZooms.At(i) / 100.f);
+        }
+        for (size_t i = 0; i < benchRotations.Count(); i++) {
+            benchOpts.rotations.Append(benchRotations.At(i) % 360);
+        }
+        benchOpts.tileSizes.Append(benchTiles.LendData(), benchTiles.Count());
+        if (0 == benchOpts.zooms.Count())
+            benchOpts.zooms.Append(renderZoom);
+        if (0 == benchOpts.rotations.Count())
+            benchOpts.rotations.Append(0);
+        if (0 == benchOpts.tileSizes.Count())
+            benchOpts.tileSizes.Append(0);
+        benchOpts.useChm2Engine = useChm2Engine;
+        if (!benchOpts.modes)
+            benchOpts.modes = Bench_Timings;
+        PasswordHolder pwdUI(password);
+        return RunBenchmarks(filePath, benchOpts, &pwdUI) ? 0 : 1;
+    }
+
     EngineType engineType;
     PasswordHolder pwdUI(password);
     BaseEngine *engine = EngineManager::CreateEngine(filePath, &pwdUI, &engineType, useChm2Engine);
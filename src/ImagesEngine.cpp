@@ -5,10 +5,12 @@
 #include "ImagesEngine.h"
 
 #include "FileUtil.h"
+#include "FzImgReader.h"
 using namespace Gdiplus;
 #include "GdiPlusUtil.h"
 #include "HtmlPullParser.h"
 #include "JsonParser.h"
+#include "ThreadUtil.h"
 #include "WinUtil.h"
 #include "ZipUtil.h"
 
@@ -20,21 +22,54 @@ using namespace Gdiplus;
 
 ///// ImagesEngine methods apply to all types of engines handling full-page images /////
 
-class ImagesEngine : public virtual BaseEngine {
+// maximum amount of memory used for decoded page images per document
+// (pages which are currently in use are never evicted)
+#define MAX_IMAGE_PAGE_MEMORY   (192 * 1024 * 1024)
+// number of pages decoded ahead in reading direction (two, so that
+// both pages of the next spread are ready for Layout_Book)
+#define PREFETCH_PAGE_COUNT     2
+// JPEG images can be decoded at 1/2, 1/4 or 1/8 of their size
+#define MAX_JPEG_L2FACTOR       3
+
+class ImagePage {
 public:
-    ImagesEngine() : fileName(NULL), fileExt(NULL) { }
-    virtual ~ImagesEngine() {
-        DeleteVecMembers(pages);
-        free(fileName);
+    int     pageNo;
+    // the image has been decoded at 1/2^l2factor of its size
+    int     l2factor;
+    Bitmap *bmp;    // NULL while the page is being decoded
+    // GDI+ objects can't be used by several threads at once (and
+    // calls from another thread fail with ObjectBusy in the meantime)
+    CRITICAL_SECTION bmpAccess;
+    // size of bmp (so that it can be read without locking bmpAccess)
+    SizeI   size;
+    // approximate size of the decoded image (0 for pinned images
+    // which can't be decoded again and thus are never evicted)
+    size_t  bytes;
+    int     refs;
+
+    explicit ImagePage(int pageNo, int l2factor=0, Bitmap *bmp=NULL) :
+        pageNo(pageNo), l2factor(l2factor), bmp(bmp), bytes(0), refs(1) {
+        InitializeCriticalSection(&bmpAccess);
+        if (bmp)
+            size = SizeI(bmp->GetWidth(), bmp->GetHeight());
     }
+    ~ImagePage() {
+        delete bmp;
+        DeleteCriticalSection(&bmpAccess);
+    }
+};
+
+class ImagePrefetcher;
+
+class ImagesEngine : public virtual BaseEngine {
+public:
+    ImagesEngine();
+    virtual ~ImagesEngine();
 
     virtual const WCHAR *FileName() const { return fileName; };
-    virtual int PageCount() const { return (int)pages.Count(); }
+    virtual int PageCount() const { return (int)mediaboxes.Count(); }
 
-    virtual RectD PageMediabox(int pageNo) {
-        assert(1 <= pageNo && pageNo <= PageCount());
-        return RectD(0, 0, pages.At(pageNo - 1)->GetWidth(), pages.At(pageNo - 1)->GetHeight());
-    }
+    virtual RectD PageMediabox(int pageNo);
 
     virtual RenderedBitmap *RenderBitmap(int pageNo, float zoom, int rotation,
                          RectD *pageRect=NULL, /* if NULL: defaults to the page's mediabox */
@@ -61,24 +96,336 @@ public:
     virtual Vec<PageElement *> *GetElements(int pageNo);
     virtual PageElement *GetElementAtPos(int pageNo, PointD pt);
 
-    virtual bool BenchLoadPage(int pageNo) { return LoadImage(pageNo) != NULL; }
+    virtual bool BenchLoadPage(int pageNo) {
+        ImagePage *page = GetPage(pageNo);
+        if (page)
+            DropPage(page);
+        return page != NULL;
+    }
+
+    // returns the page's image (decoding it, if needed) at 1/2^l2factor of its
+    // size (if supported); the result must be released with DropPage after use
+    ImagePage *GetPage(int pageNo, int l2factor=0, bool tryOnly=false);
+    void DropPage(ImagePage *page);
+    // called from ImagePrefetcher
+    void PrefetchPage(int pageNo);
+    bool IsBusy() { return renderingPages > 0; }
 
 protected:
     WCHAR *fileName;
     const WCHAR *fileExt;
     ScopedComPtr<IStream> fileStream;
 
-    Vec<Bitmap *> pages;
+    // the mediaboxes also determine the page count
+    // (only access them within cacheAccess once the document has been loaded)
+    Vec<RectD> mediaboxes;
 
     void GetTransform(Matrix& m, int pageNo, float zoom, int rotation);
 
-    // override for lazily loading images
-    virtual Bitmap *LoadImage(int pageNo) {
-        assert(1 <= pageNo && pageNo <= PageCount());
-        return pages.At(pageNo - 1);
+    // for images which are decoded when loading the document (they're never evicted)
+    void AddPinnedPage(Bitmap *bmp);
+    // stops prefetching before the derived class' state is destroyed
+    void StopPrefetching();
+
+    // override for lazily loading images (called from any thread,
+    // so that pages can be decoded in the background)
+    virtual Bitmap *LoadBitmap(int pageNo, int l2factor) { return NULL; }
+    // override for determining the size without decoding the image
+    virtual RectD LoadMediabox(int pageNo);
+    // override if LoadBitmap can decode the page at a reduced size
+    // (i.e. for JPEG images, cf. DecodePageImage)
+    virtual bool SupportsReducedDecoding(int pageNo) { return false; }
+
+private:
+    CRITICAL_SECTION cacheAccess;
+    // most recently used first
+    Vec<ImagePage *> pageCache;
+    size_t pageCacheBytes;
+    // signaled whenever a page has been decoded
+    HANDLE pageDecoded;
+
+    ImagePrefetcher *prefetcher;
+    LONG renderingPages;
+    int lastPageNo, lastPageDelta;
+    bool readForward;
+    // pages are prefetched at the same size as the last rendered one
+    int prefetchL2Factor;
+
+    ImagePage *FindCachedPage(int pageNo, int l2factor);
+    void ReducePageCache();
+    void RequestPrefetch(int pageNo, int l2factor);
+};
+
+// decodes the pages following the last rendered one in reading direction
+// (cf. PageRunPrefetcher in PdfEngine.cpp)
+class ImagePrefetcher : public ThreadBase {
+    ImagesEngine *engine;
+    HANDLE wakeUp;
+    CRITICAL_SECTION pendingAccess;
+    Vec<int> pending; // the last page is prefetched first
+
+public:
+    explicit ImagePrefetcher(ImagesEngine *engine) :
+        ThreadBase("ImagePrefetcher"), engine(engine) {
+        wakeUp = CreateEvent(NULL, FALSE, FALSE, NULL);
+        InitializeCriticalSection(&pendingAccess);
+    }
+    virtual ~ImagePrefetcher() {
+        DeleteCriticalSection(&pendingAccess);
+        CloseHandle(wakeUp);
+    }
+
+    void Request(int pageNo, bool forward) {
+        ScopedCritSec scope(&pendingAccess);
+        // older requests are obsolete
+        pending.Reset();
+        for (int i = PREFETCH_PAGE_COUNT; i > 0; i--) {
+            pending.Append(forward ? pageNo + i : pageNo - i);
+        }
+        SetEvent(wakeUp);
+    }
+    void Stop() {
+        RequestCancel();
+        SetEvent(wakeUp);
+        Join();
+    }
+
+    virtual void Run() {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+        while (!WasCancelRequested()) {
+            int pageNo = 0;
+            EnterCriticalSection(&pendingAccess);
+            bool hasPending = pending.Count() > 0;
+            if (hasPending && !engine->IsBusy())
+                pageNo = pending.Pop();
+            LeaveCriticalSection(&pendingAccess);
+            if (pageNo)
+                engine->PrefetchPage(pageNo);
+            else
+                WaitForSingleObject(wakeUp, hasPending ? 100 : INFINITE);
+        }
     }
 };
 
+ImagesEngine::ImagesEngine() : fileName(NULL), fileExt(NULL), pageCacheBytes(0),
+    prefetcher(NULL), renderingPages(0), lastPageNo(0), lastPageDelta(0), readForward(true),
+    prefetchL2Factor(0)
+{
+    InitializeCriticalSection(&cacheAccess);
+    pageDecoded = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+ImagesEngine::~ImagesEngine()
+{
+    StopPrefetching();
+    DeleteVecMembers(pageCache);
+    CloseHandle(pageDecoded);
+    DeleteCriticalSection(&cacheAccess);
+    free(fileName);
+}
+
+void ImagesEngine::StopPrefetching()
+{
+    if (prefetcher) {
+        prefetcher->Stop();
+        delete prefetcher;
+        prefetcher = NULL;
+    }
+}
+
+RectD ImagesEngine::PageMediabox(int pageNo)
+{
+    assert(1 <= pageNo && pageNo <= PageCount());
+    EnterCriticalSection(&cacheAccess);
+    RectD mediabox = mediaboxes.At(pageNo - 1);
+    LeaveCriticalSection(&cacheAccess);
+    if (!mediabox.IsEmpty())
+        return mediabox;
+
+    // load without holding cacheAccess (this might have to decode the page),
+    // so several threads may end up loading the same mediabox
+    mediabox = LoadMediabox(pageNo);
+    ScopedCritSec scope(&cacheAccess);
+    mediaboxes.At(pageNo - 1) = mediabox;
+    return mediabox;
+}
+
+RectD ImagesEngine::LoadMediabox(int pageNo)
+{
+    ImagePage *page = GetPage(pageNo);
+    if (!page)
+        return RectD();
+    RectD mediabox = RectD(0, 0, page->size.dx, page->size.dy);
+    DropPage(page);
+    return mediabox;
+}
+
+void ImagesEngine::AddPinnedPage(Bitmap *bmp)
+{
+    ScopedCritSec scope(&cacheAccess);
+    mediaboxes.Append(RectD(0, 0, bmp->GetWidth(), bmp->GetHeight()));
+    // the extra reference is never dropped
+    pageCache.Append(new ImagePage((int)mediaboxes.Count(), 0, bmp));
+}
+
+ImagePage *ImagesEngine::FindCachedPage(int pageNo, int l2factor)
+{
+    for (size_t i = 0; i < pageCache.Count(); i++) {
+        ImagePage *page = pageCache.At(i);
+        if (page->pageNo == pageNo && page->l2factor == l2factor)
+            return page;
+    }
+    return NULL;
+}
+
+ImagePage *ImagesEngine::GetPage(int pageNo, int l2factor, bool tryOnly)
+{
+    assert(1 <= pageNo && pageNo <= PageCount());
+    if (l2factor > 0 && !SupportsReducedDecoding(pageNo))
+        l2factor = 0;
+    EnterCriticalSection(&cacheAccess);
+    ImagePage *page = FindCachedPage(pageNo, l2factor);
+    // wait while another thread (usually the prefetcher) is decoding the same page
+    while (page && !page->bmp && !tryOnly) {
+        LeaveCriticalSection(&cacheAccess);
+        WaitForSingleObject(pageDecoded, 20);
+        EnterCriticalSection(&cacheAccess);
+        page = FindCachedPage(pageNo, l2factor);
+    }
+    if (page && page->bmp) {
+        if (page != pageCache.At(0)) {
+            // keep the list Most Recently Used first
+            pageCache.Remove(page);
+            pageCache.InsertAt(0, page);
+        }
+        page->refs++;
+        LeaveCriticalSection(&cacheAccess);
+        return page;
+    }
+    if (page || tryOnly) {
+        LeaveCriticalSection(&cacheAccess);
+        return NULL;
+    }
+
+    // decode without holding cacheAccess so that cached
+    // pages remain accessible in the meantime
+    page = new ImagePage(pageNo, l2factor);
+    pageCache.InsertAt(0, page);
+    LeaveCriticalSection(&cacheAccess);
+
+    Bitmap *bmp = LoadBitmap(pageNo, l2factor);
+
+    ScopedCritSec scope(&cacheAccess);
+    SetEvent(pageDecoded);
+    if (!bmp) {
+        pageCache.Remove(page);
+        delete page;
+        return NULL;
+    }
+    page->bmp = bmp;
+    page->size = SizeI(bmp->GetWidth(), bmp->GetHeight());
+    page->bytes = (size_t)page->size.dx * page->size.dy * 4;
+    pageCacheBytes += page->bytes;
+    ReducePageCache();
+    return page;
+}
+
+void ImagesEngine::DropPage(ImagePage *page)
+{
+    ScopedCritSec scope(&cacheAccess);
+    page->refs--;
+    assert(page->refs >= 0);
+    ReducePageCache();
+}
+
+void ImagesEngine::ReducePageCache()
+{
+    for (size_t i = pageCache.Count(); i > 0 && pageCacheBytes > MAX_IMAGE_PAGE_MEMORY; i--) {
+        ImagePage *page = pageCache.At(i - 1);
+        if (page->refs > 0 || 0 == page->bytes)
+            continue;
+        pageCacheBytes -= page->bytes;
+        pageCache.RemoveAt(i - 1);
+        delete page;
+    }
+}
+
+void ImagesEngine::RequestPrefetch(int pageNo, int l2factor)
+{
+    EnterCriticalSection(&cacheAccess);
+    prefetchL2Factor = l2factor;
+    int delta = pageNo - lastPageNo;
+    // in Layout_Book, the second page of a spread is rendered right after the first
+    // one (or vice versa), so a single step directly after a jump in the opposite
+    // direction doesn't reverse the reading direction
+    bool isSpreadStep = (1 == delta || -1 == delta) && abs(lastPageDelta) > 1 &&
+                        (delta > 0) != (lastPageDelta > 0);
+    if (delta != 0 && !isSpreadStep)
+        readForward = delta > 0;
+    if (delta != 0)
+        lastPageDelta = delta;
+    lastPageNo = pageNo;
+    bool forward = readForward;
+    LeaveCriticalSection(&cacheAccess);
+
+    if (!prefetcher) {
+        ImagePrefetcher *newPrefetcher = new ImagePrefetcher(this);
+        if (InterlockedCompareExchangePointer((void **)&prefetcher, newPrefetcher, NULL))
+            delete newPrefetcher;
+        else
+            newPrefetcher->Start();
+    }
+    prefetcher->Request(pageNo, forward);
+}
+
+void ImagesEngine::PrefetchPage(int pageNo)
+{
+    if (pageNo < 1 || pageNo > PageCount())
+        return;
+    int l2factor = SupportsReducedDecoding(pageNo) ? prefetchL2Factor : 0;
+    EnterCriticalSection(&cacheAccess);
+    bool isCached = FindCachedPage(pageNo, l2factor) != NULL;
+    // don't prefetch if the cache is already full (prefetched
+    // pages would just push out the ones still displayed)
+    bool isFull = pageCacheBytes > MAX_IMAGE_PAGE_MEMORY / 2;
+    LeaveCriticalSection(&cacheAccess);
+    if (isCached || isFull)
+        return;
+    ImagePage *page = GetPage(pageNo, l2factor);
+    if (page)
+        DropPage(page);
+}
+
+// decodes JPEG images through libjpeg-turbo (which is faster than GDI+, can be
+// used from several threads at once and can decode straight to 1/2^l2factor
+// of the full size) and all others through BitmapFromData
+static Bitmap *DecodePageImage(const char *data, size_t len, int l2factor=0)
+{
+    if (str::Eq(GfxFileExtFromData(data, len), L".jpg")) {
+        Bitmap *bmp = fitz::ImageFromData(data, len, l2factor);
+        if (bmp)
+            return bmp;
+    }
+    return BitmapFromData(data, len);
+}
+
+static bool IsJpegFileName(const WCHAR *fileName)
+{
+    return str::EndsWithI(fileName, L".jpg") || str::EndsWithI(fileName, L".jpeg");
+}
+
+// returns the largest DCT scale factor for which the image still isn't
+// smaller than when rendered at the given zoom (cf. fz_image_get_pixmap)
+static int GetJpegL2Factor(RectD mediabox, float zoom)
+{
+    int w = (int)ceil(mediabox.dx * zoom), h = (int)ceil(mediabox.dy * zoom);
+    int imgW = (int)mediabox.dx, imgH = (int)mediabox.dy;
+    int l2factor = 0;
+    while (l2factor < MAX_JPEG_L2FACTOR && imgW >> (l2factor + 1) >= w + 2 && imgH >> (l2factor + 1) >= h + 2)
+        l2factor++;
+    return l2factor;
+}
+
 RenderedBitmap *ImagesEngine::RenderBitmap(int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out)
 {
     RectD pageRc = pageRect ? *pageRect : PageMediabox(pageNo);
@@ -103,9 +450,15 @@ RenderedBitmap *ImagesEngine::RenderBitmap(int pageNo, float zoom, int rotation,
 
 bool ImagesEngine::RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out)
 {
-    Bitmap *bmp = LoadImage(pageNo);
-    if (!bmp)
+    // prevent prefetching from competing with rendering
+    InterlockedIncrement(&renderingPages);
+    // decode JPEG images only at the size actually needed
+    int l2factor = SupportsReducedDecoding(pageNo) ? GetJpegL2Factor(PageMediabox(pageNo), zoom) : 0;
+    ImagePage *page = GetPage(pageNo, l2factor);
+    if (!page) {
+        InterlockedDecrement(&renderingPages);
         return false;
+    }
 
     RectD pageRc = pageRect ? *pageRect : PageMediabox(pageNo);
     RectI screen = Transform(pageRc, pageNo, zoom, rotation).Round();
@@ -129,7 +482,14 @@ bool ImagesEngine::RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoom,
     RectI pageRcI = PageMediabox(pageNo).Round();
     ImageAttributes imgAttrs;
     imgAttrs.SetWrapMode(WrapModeTileFlipXY);
-    Status ok = g.DrawImage(bmp, pageRcI.ToGdipRect(), 0, 0, pageRcI.dx, pageRcI.dy, UnitPixel, &imgAttrs);
+    // the image might have been decoded at a reduced size
+    EnterCriticalSection(&page->bmpAccess);
+    Status ok = g.DrawImage(page->bmp, pageRcI.ToGdipRect(), 0, 0, page->size.dx, page->size.dy, UnitPixel, &imgAttrs);
+    LeaveCriticalSection(&page->bmpAccess);
+
+    DropPage(page);
+    InterlockedDecrement(&renderingPages);
+    RequestPrefetch(pageNo, l2factor);
     return ok == Ok;
 }
 
@@ -163,34 +523,37 @@ RectD ImagesEngine::Transform(RectD rect, int pageNo, float zoom, int rotation,
     return rect;
 }
 
+// keeps a reference to the page's image for as long as it exists
 class ImageElement : public PageElement {
-    Bitmap *bmp;
-    int pageNo;
+    ImagesEngine *engine;
+    ImagePage *page;
 
 public:
-    ImageElement(int pageNo, Bitmap *bmp) : pageNo(pageNo), bmp(bmp) { }
+    ImageElement(ImagesEngine *engine, ImagePage *page) : engine(engine), page(page) { }
+    virtual ~ImageElement() { engine->DropPage(page); }
 
     virtual PageElementType GetType() const { return Element_Image; }
-    virtual int GetPageNo() const { return pageNo; }
-    virtual RectD GetRect() const { return RectD(0, 0, bmp->GetWidth(), bmp->GetHeight()); }
+    virtual int GetPageNo() const { return page->pageNo; }
+    virtual RectD GetRect() const { return RectD(0, 0, page->size.dx, page->size.dy); }
     virtual WCHAR *GetValue() const { return NULL; }
 
     virtual RenderedBitmap *GetImage() {
         HBITMAP hbmp;
-        if (bmp->GetHBITMAP((ARGB)Color::White, &hbmp) != Ok)
+        ScopedCritSec scope(&page->bmpAccess);
+        if (page->bmp->GetHBITMAP((ARGB)Color::White, &hbmp) != Ok)
             return NULL;
-        return new RenderedBitmap(hbmp, SizeI(bmp->GetWidth(), bmp->GetHeight()));
+        return new RenderedBitmap(hbmp, page->size);
     }
 };
 
 Vec<PageElement *> *ImagesEngine::GetElements(int pageNo)
 {
-    Bitmap *bmp = LoadImage(pageNo);
-    if (!bmp)
+    ImagePage *page = GetPage(pageNo);
+    if (!page)
         return NULL;
 
     Vec<PageElement *> *els = new Vec<PageElement *>();
-    els->Append(new ImageElement(pageNo, bmp));
+    els->Append(new ImageElement(this, page));
     return els;
 }
 
@@ -198,10 +561,10 @@ PageElement *ImagesEngine::GetElementAtPos(int pageNo, PointD pt)
 {
     if (!PageMediabox(pageNo).Contains(pt))
         return NULL;
-    Bitmap *bmp = LoadImage(pageNo);
-    if (!bmp)
+    ImagePage *page = GetPage(pageNo);
+    if (!page)
         return NULL;
-    return new ImageElement(pageNo, bmp);
+    return new ImageElement(this, page);
 }
 
 unsigned char *ImagesEngine::GetFileData(size_t *cbCount)
@@ -240,20 +603,40 @@ public:
 
     virtual WCHAR *GetProperty(DocumentProperty prop);
 
-    virtual float GetFileDPI() const {
-        return pages.At(0)->GetHorizontalResolution();
-    }
+    virtual float GetFileDPI() const { return fileDPI; }
 
 protected:
     bool LoadSingleFile(const WCHAR *fileName);
     bool LoadFromStream(IStream *stream);
     bool FinishLoading(Bitmap *bmp);
+
+    // only called for reduced sizes of single JPEG images (all frames are pinned)
+    virtual Bitmap *LoadBitmap(int pageNo, int l2factor) {
+        size_t len;
+        ScopedMem<char> data((char *)GetFileData(&len));
+        return data ? DecodePageImage(data, len, l2factor) : NULL;
+    }
+    virtual bool SupportsReducedDecoding(int pageNo) {
+        return str::Eq(fileExt, L".jpg") && PageCount() == 1;
+    }
+
+    // all frames are pinned, so that they remain valid for the engine's lifetime
+    // (lock the page's bmpAccess before using its bmp)
+    ImagePage *GetFrame(int pageNo) {
+        ImagePage *page = GetPage(pageNo);
+        DropPage(page);
+        return page;
+    }
+
+    float fileDPI;
 };
 
 ImageEngine *ImageEngineImpl::Clone()
 {
-    Bitmap *bmp = pages.At(0);
-    bmp = bmp->Clone(0, 0, bmp->GetWidth(), bmp->GetHeight(), PixelFormat32bppARGB);
+    ImagePage *page = GetFrame(1);
+    EnterCriticalSection(&page->bmpAccess);
+    Bitmap *bmp = page->bmp->Clone(0, 0, page->size.dx, page->size.dy, PixelFormat32bppARGB);
+    LeaveCriticalSection(&page->bmpAccess);
     if (!bmp)
         return NULL;
 
@@ -306,10 +689,13 @@ bool ImageEngineImpl::LoadFromStream(IStream *stream)
 
 bool ImageEngineImpl::FinishLoading(Bitmap *bmp)
 {
-    if (!bmp || bmp->GetLastStatus() != Ok)
+    if (!bmp || bmp->GetLastStatus() != Ok) {
+        delete bmp;
         return false;
-    pages.Append(bmp);
-    assert(pages.Count() == 1);
+    }
+    AddPinnedPage(bmp);
+    assert(PageCount() == 1);
+    fileDPI = bmp->GetHorizontalResolution();
 
     // extract all frames from multi-page TIFFs and animated GIFs
     if (str::Eq(fileExt, L".tif") || str::Eq(fileExt, L".gif")) {
@@ -321,7 +707,7 @@ bool ImageEngineImpl::FinishLoading(Bitmap *bmp)
                 continue;
             Status ok = frame->SelectActiveFrame(frameDimension, i);
             if (Ok == ok)
-                pages.Append(frame);
+                AddPinnedPage(frame);
             else
                 delete frame;
         }
@@ -362,19 +748,21 @@ static WCHAR *GetImageProperty(Bitmap *bmp, PROPID id, PROPID altId=0)
 
 WCHAR *ImageEngineImpl::GetProperty(DocumentProperty prop)
 {
+    ImagePage *page = GetFrame(1);
+    ScopedCritSec scope(&page->bmpAccess);
     switch (prop) {
     case Prop_Title:
-        return GetImageProperty(LoadImage(1), PropertyTagImageDescription, PropertyTagXPTitle);
+        return GetImageProperty(page->bmp, PropertyTagImageDescription, PropertyTagXPTitle);
     case Prop_Subject:
-        return GetImageProperty(LoadImage(1), PropertyTagXPSubject);
+        return GetImageProperty(page->bmp, PropertyTagXPSubject);
     case Prop_Author:
-        return GetImageProperty(LoadImage(1), PropertyTagArtist, PropertyTagXPAuthor);
+        return GetImageProperty(page->bmp, PropertyTagArtist, PropertyTagXPAuthor);
     case Prop_Copyright:
-        return GetImageProperty(LoadImage(1), PropertyTagCopyright);
+        return GetImageProperty(page->bmp, PropertyTagCopyright);
     case Prop_CreationDate:
-        return GetImageProperty(LoadImage(1), PropertyTagDateTime, PropertyTagExifDTDigitized);
+        return GetImageProperty(page->bmp, PropertyTagDateTime, PropertyTagExifDTDigitized);
     case Prop_CreatorApp:
-        return GetImageProperty(LoadImage(1), PropertyTagSoftwareUsed);
+        return GetImageProperty(page->bmp, PropertyTagSoftwareUsed);
     default:
         return NULL;
     }
@@ -427,10 +815,12 @@ class ImageDirEngineImpl : public ImagesEngine, public ImageDirEngine {
     friend ImageDirEngine;
 
 public:
+    ImageDirEngineImpl() : fileDPI(96.0f) { }
+    virtual ~ImageDirEngineImpl() { StopPrefetching(); }
+
     virtual ImageDirEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : NULL;
     }
-    virtual RectD PageMediabox(int pageNo);
 
     virtual unsigned char *GetFileData(size_t *cbCount) { return NULL; }
     virtual bool SaveFileAs(const WCHAR *copyFileName);
@@ -446,17 +836,19 @@ public:
     virtual DocTocItem *GetTocTree();
 
     // TODO: better handle the case where images have different resolutions
-    virtual float GetFileDPI() const {
-        return pages.At(0) ? pages.At(0)->GetHorizontalResolution() : 96.0f;
-    }
+    virtual float GetFileDPI() const { return fileDPI; }
 
 protected:
     bool LoadImageDir(const WCHAR *dirName);
 
-    virtual Bitmap *LoadImage(int pageNo);
+    virtual Bitmap *LoadBitmap(int pageNo, int l2factor);
+    virtual RectD LoadMediabox(int pageNo);
+    virtual bool SupportsReducedDecoding(int pageNo) {
+        return IsJpegFileName(pageFileNames.At(pageNo - 1));
+    }
 
-    Vec<RectD> mediaboxes;
     WStrVec pageFileNames;
+    float fileDPI;
 };
 
 bool ImageDirEngineImpl::LoadImageDir(const WCHAR *dirName)
@@ -483,28 +875,28 @@ bool ImageDirEngineImpl::LoadImageDir(const WCHAR *dirName)
         return false;
     pageFileNames.SortNatural();
 
-    pages.AppendBlanks(pageFileNames.Count());
     mediaboxes.AppendBlanks(pageFileNames.Count());
 
     // load first image for GetFileDPI
-    LoadImage(1);
+    ImagePage *page = GetPage(1);
+    if (page) {
+        EnterCriticalSection(&page->bmpAccess);
+        fileDPI = page->bmp->GetHorizontalResolution();
+        LeaveCriticalSection(&page->bmpAccess);
+        DropPage(page);
+    }
 
     return true;
 }
 
-RectD ImageDirEngineImpl::PageMediabox(int pageNo)
+RectD ImageDirEngineImpl::LoadMediabox(int pageNo)
 {
-    assert(1 <= pageNo && pageNo <= PageCount());
-    if (!mediaboxes.At(pageNo - 1).IsEmpty())
-        return mediaboxes.At(pageNo - 1);
-
     size_t len;
     ScopedMem<char> bmpData(file::ReadAll(pageFileNames.At(pageNo - 1), &len));
-    if (bmpData) {
-        Size size = BitmapSizeFromData(bmpData, len);
-        mediaboxes.At(pageNo - 1) = RectD(0, 0, size.Width, size.Height);
-    }
-    return mediaboxes.At(pageNo - 1);
+    if (!bmpData)
+        return RectD();
+    Size size = BitmapSizeFromData(bmpData, len);
+    return RectD(0, 0, size.Width, size.Height);
 }
 
 WCHAR *ImageDirEngineImpl::GetPageLabel(int pageNo) const
@@ -529,18 +921,13 @@ int ImageDirEngineImpl::GetPageByLabel(const WCHAR *label) const
     return BaseEngine::GetPageByLabel(label);
 }
 
-Bitmap *ImageDirEngineImpl::LoadImage(int pageNo)
+Bitmap *ImageDirEngineImpl::LoadBitmap(int pageNo, int l2factor)
 {
-    assert(1 <= pageNo && pageNo <= PageCount());
-    if (pages.At(pageNo - 1))
-        return pages.At(pageNo - 1);
-
     size_t len;
     ScopedMem<char> bmpData(file::ReadAll(pageFileNames.At(pageNo - 1), &len));
-    if (bmpData)
-        pages.At(pageNo - 1) = BitmapFromData(bmpData, len);
-
-    return pages.At(pageNo - 1);
+    if (!bmpData)
+        return NULL;
+    return DecodePageImage(bmpData, len, l2factor);
 }
 
 class ImageDirTocItem : public DocTocItem {
@@ -595,11 +982,37 @@ ImageDirEngine *ImageDirEngine::CreateFromFile(const WCHAR *fileName)
 
 ///// CbxEngine handles comic book files (either .cbz or .cbr) /////
 
+// number of extracted files kept around for .cbr files (so that e.g. a page's
+// image doesn't have to be extracted again for determining its mediabox)
+#define MAX_CACHED_CBR_FILES    4
+// in solid archives, skipping a file still means decompressing it, so there
+// all pages passed by are kept as well, up to this many bytes
+#define MAX_SOLID_CBR_CACHE_SIZE (64 * 1024 * 1024)
+
+// the data of an archived file, shared between the .cbr cache and
+// the pages using it (cf. CbxEngineImpl::DropFileData)
+struct CbxFileData {
+    size_t  idx;
+    // zero-terminated (cf. LoadCurrentCbrFile)
+    char *  data;
+    size_t  len;
+    int     refs;
+    // neighbouring files in the .cbr cache in the order of their use
+    CbxFileData *older;
+    CbxFileData *newer;
+
+    CbxFileData(size_t idx, char *data, size_t len) :
+        idx(idx), data(data), len(len), refs(1), older(NULL), newer(NULL) { }
+    ~CbxFileData() { free(data); }
+};
+
 class CbxEngineImpl : public ImagesEngine, public CbxEngine, public json::ValueVisitor {
     friend CbxEngine;
 
 public:
-    CbxEngineImpl() : cbzFile(NULL) {
+    CbxEngineImpl() : cbzFile(NULL), cbrArc(NULL), cbrNextIdx(0), cbrSolid(false),
+        cbrOldest(NULL), cbrNewest(NULL), cbrCacheCount(0), cbrCacheBytes(0),
+        cbrComicInfoIdx(-1) {
         InitializeCriticalSection(&fileAccess);
     }
     virtual ~CbxEngineImpl();
@@ -615,7 +1028,6 @@ public:
             return CreateFromFile(fileName);
         return NULL;
     }
-    virtual RectD PageMediabox(int pageNo);
 
     virtual WCHAR *GetProperty(DocumentProperty prop);
 
@@ -633,11 +1045,16 @@ protected:
     bool FinishLoadingCbz();
     void ParseComicInfoXml(const char *xmlData);
     bool LoadCbrFile(const WCHAR *fileName);
+    CbxFileData *ExtractCbrFile(size_t idx);
+    void AddToCbrCache(CbxFileData *file);
+    void RemoveFromCbrCache(CbxFileData *file);
 
-    virtual Bitmap *LoadImage(int pageNo);
-    char *GetImageData(int pageNo, size_t& len);
-
-    Vec<RectD> mediaboxes;
+    virtual Bitmap *LoadBitmap(int pageNo, int l2factor);
+    virtual RectD LoadMediabox(int pageNo);
+    virtual bool SupportsReducedDecoding(int pageNo);
+    // the result must be released with DropFileData
+    CbxFileData *GetImageData(int pageNo);
+    void DropFileData(CbxFileData *file);
 
     // extracted metadata
     ScopedMem<WCHAR> propTitle;
@@ -649,52 +1066,76 @@ protected:
     // temporary state needed for extracting metadata
     ScopedMem<WCHAR> propAuthorTmp;
 
-    // used for lazily loading page images (only supported for .cbz files)
+    // used for lazily loading page images
     CRITICAL_SECTION fileAccess;
     ZipFile *cbzFile;
+    // for .cbr files, the names of all files in the archive's order
+    // and an archive handle positioned before file cbrNextIdx
+    WStrVec cbrFileNames;
+    HANDLE cbrArc;
+    size_t cbrNextIdx;
+    bool cbrSolid;
+    // whether the file at an archive index is a page image
+    Vec<bool> cbrIsPage;
+    // extracted files by archive index (NULL if not cached), also
+    // linked from the least to the most recently used one
+    Vec<CbxFileData *> cbrCache;
+    CbxFileData *cbrOldest;
+    CbxFileData *cbrNewest;
+    size_t cbrCacheCount;
+    size_t cbrCacheBytes;
+    // ComicInfo.xml is only extracted when the metadata is needed
+    int cbrComicInfoIdx;
     Vec<size_t> fileIdxs;
 };
 
 CbxEngineImpl::~CbxEngineImpl()
 {
+    StopPrefetching();
     delete cbzFile;
+    if (cbrArc)
+        RARCloseArchive(cbrArc);
+    while (cbrOldest) {
+        CbxFileData *file = cbrOldest;
+        RemoveFromCbrCache(file);
+        DropFileData(file);
+    }
 
     DeleteCriticalSection(&fileAccess);
 }
 
-RectD CbxEngineImpl::PageMediabox(int pageNo)
+RectD CbxEngineImpl::LoadMediabox(int pageNo)
 {
-    assert(1 <= pageNo && pageNo <= PageCount());
-    if (!mediaboxes.At(pageNo - 1).IsEmpty())
-        return mediaboxes.At(pageNo - 1);
-
-    if (pages.At(pageNo - 1)) {
-        Bitmap *bmp = pages.At(pageNo - 1);
-        mediaboxes.At(pageNo - 1) = RectD(0, 0, bmp->GetWidth(), bmp->GetHeight());
-        return mediaboxes.At(pageNo - 1);
+    ImagePage *page = GetPage(pageNo, 0, true);
+    if (page) {
+        RectD mediabox = RectD(0, 0, page->size.dx, page->size.dy);
+        DropPage(page);
+        return mediabox;
     }
 
-    size_t len;
-    ScopedMem<char> bmpData(GetImageData(pageNo, len));
-    if (bmpData) {
-        Size size = BitmapSizeFromData(bmpData, len);
-        mediaboxes.At(pageNo - 1) = RectD(0, 0, size.Width, size.Height);
-    }
-    return mediaboxes.At(pageNo - 1);
+    CbxFileData *file = GetImageData(pageNo);
+    if (!file)
+        return RectD();
+    Size size = BitmapSizeFromData(file->data, file->len);
+    DropFileData(file);
+    return RectD(0, 0, size.Width, size.Height);
 }
 
-Bitmap *CbxEngineImpl::LoadImage(int pageNo)
+Bitmap *CbxEngineImpl::LoadBitmap(int pageNo, int l2factor)
 {
-    assert(1 <= pageNo && pageNo <= PageCount());
-    if (pages.At(pageNo - 1))
-        return pages.At(pageNo - 1);
-
-    size_t len;
-    ScopedMem<char> bmpData(GetImageData(pageNo, len));
-    if (bmpData)
-        pages.At(pageNo - 1) = BitmapFromData(bmpData, len);
+    CbxFileData *file = GetImageData(pageNo);
+    if (!file)
+        return NULL;
+    Bitmap *bmp = DecodePageImage(file->data, file->len, l2factor);
+    DropFileData(file);
+    return bmp;
+}
 
-    return pages.At(pageNo - 1);
+bool CbxEngineImpl::SupportsReducedDecoding(int pageNo)
+{
+    ScopedCritSec scope(&fileAccess);
+    size_t idx = fileIdxs.At(pageNo - 1);
+    return IsJpegFileName(cbzFile ? cbzFile->GetFileName(idx) : cbrFileNames.At(idx));
 }
 
 bool CbxEngineImpl::LoadCbzFile(const WCHAR *file)
@@ -767,7 +1208,6 @@ bool CbxEngineImpl::FinishLoadingCbz()
     if (fileIdxs.Count() == 0)
         return false;
 
-    pages.AppendBlanks(fileIdxs.Count());
     mediaboxes.AppendBlanks(fileIdxs.Count());
 
     return true;
@@ -864,6 +1304,15 @@ bool CbxEngineImpl::Visit(const char *path, const char *value, json::DataType ty
 
 WCHAR *CbxEngineImpl::GetProperty(DocumentProperty prop)
 {
+    if (cbrComicInfoIdx != -1) {
+        CbxFileData *xmlData = ExtractCbrFile(cbrComicInfoIdx);
+        cbrComicInfoIdx = -1;
+        if (xmlData) {
+            ParseComicInfoXml(xmlData->data);
+            DropFileData(xmlData);
+        }
+    }
+
     switch (prop) {
     case Prop_Title:
         return str::Dup(propTitle);
@@ -883,22 +1332,6 @@ WCHAR *CbxEngineImpl::GetProperty(DocumentProperty prop)
     }
 }
 
-class ImagesPage {
-public:
-    ScopedMem<WCHAR>fileName; // for sorting image files
-    Bitmap *        bmp;
-
-    ImagesPage(const WCHAR *fileName, Bitmap *bmp) : bmp(bmp),
-        fileName(str::Dup(fileName)) { }
-    ~ImagesPage() { delete bmp; }
-
-    static int cmpPageByName(const void *o1, const void *o2) {
-        ImagesPage *p1 = *(ImagesPage **)o1;
-        ImagesPage *p2 = *(ImagesPage **)o2;
-        return wcscmp(p1->fileName, p2->fileName);
-    }
-};
-
 struct RarDecompressData {
     unsigned    totalSize;
     char *      buf;
@@ -939,6 +1372,7 @@ static char *LoadCurrentCbrFile(HANDLE hArc, RARHeaderDataEx& rarHeader, size_t
     rdd.currSize = 0;
     RARSetCallback(hArc, unrarCallback, (LPARAM)&rdd);
     int res = RARProcessFile(hArc, RAR_TEST, NULL, NULL);
+    RARSetCallback(hArc, NULL, 0);
     if (0 != res || rdd.totalSize != rdd.currSize)
         return NULL;
     // zero-terminate for convenience
@@ -949,18 +1383,21 @@ static char *LoadCurrentCbrFile(HANDLE hArc, RARHeaderDataEx& rarHeader, size_t
     return data.StealData();
 }
 
-static ImagesPage *LoadCurrentCbrPage(HANDLE hArc, RARHeaderDataEx& rarHeader)
+static HANDLE OpenCbrArchive(const WCHAR *file, UINT openMode, bool *isSolid=NULL)
 {
-    size_t bmpDataSize;
-    ScopedMem<char> bmpData(LoadCurrentCbrFile(hArc, rarHeader, &bmpDataSize));
-    if (!bmpData)
-        return NULL;
+    RAROpenArchiveDataEx  arcData = { 0 };
+    arcData.ArcNameW = (WCHAR *)file;
+    arcData.OpenMode = openMode;
 
-    Bitmap *bmp = BitmapFromData(bmpData, bmpDataSize);
-    if (!bmp)
+    HANDLE hArc = RAROpenArchiveEx(&arcData);
+    if (!hArc || arcData.OpenResult != 0) {
+        if (hArc)
+            RARCloseArchive(hArc);
         return NULL;
-
-    return new ImagesPage(rarHeader.FileNameW, bmp);
+    }
+    if (isSolid)
+        *isSolid = (arcData.Flags & 0x08 /* solid archive */) != 0;
+    return hArc;
 }
 
 bool CbxEngineImpl::LoadCbrFile(const WCHAR *file)
@@ -970,18 +1407,16 @@ bool CbxEngineImpl::LoadCbrFile(const WCHAR *file)
     fileName = str::Dup(file);
     fileExt = L".cbr";
 
-    RAROpenArchiveDataEx  arcData = { 0 };
-    arcData.ArcNameW = (WCHAR *)file;
-    arcData.OpenMode = RAR_OM_EXTRACT;
-
-    HANDLE hArc = RAROpenArchiveEx(&arcData);
-    if (!hArc || arcData.OpenResult != 0)
+    // only list the archive's content (which doesn't require decompressing
+    // anything), page images are extracted on demand (cf. ExtractCbrFile)
+    HANDLE hArc = OpenCbrArchive(file, RAR_OM_LIST, &cbrSolid);
+    if (!hArc)
         return false;
 
-    // UnRAR does not seem to support extracting a single file by name,
-    // so lazy image loading doesn't seem possible
-
-    Vec<ImagesPage *> found;
+    // archives may contain several files of the same name, so pages
+    // are identified by pointer (as in FinishLoadingCbz)
+    Vec<const WCHAR *> allFileNames;
+    Vec<const WCHAR *> pageFileNames;
     for (;;) {
         RARHeaderDataEx rarHeader;
         int res = RARReadHeaderEx(hArc, &rarHeader);
@@ -989,45 +1424,166 @@ bool CbxEngineImpl::LoadCbrFile(const WCHAR *file)
             break;
 
         const WCHAR *fileName = rarHeader.FileNameW;
-        if (ImageEngine::IsSupportedFile(fileName)) {
-            ImagesPage *page = LoadCurrentCbrPage(hArc, rarHeader);
-            if (page)
-                found.Append(page);
+        cbrFileNames.Append(str::Dup(fileName));
+        allFileNames.Append(NULL);
+        cbrIsPage.Append(false);
+        if ((rarHeader.Flags & RHDF_DIRECTORY) || (rarHeader.Flags & RHDF_ENCRYPTED) ||
+            rarHeader.UnpSizeHigh != 0 || rarHeader.UnpSize == 0) {
+            /* can't be a page (cf. LoadCurrentCbrFile) */;
         }
-        else if (str::EqI(fileName, L"ComicInfo.xml")) {
-            ScopedMem<char> xmlData(LoadCurrentCbrFile(hArc, rarHeader, NULL));
-            if (xmlData)
-                ParseComicInfoXml(xmlData);
+        else if (ImageEngine::IsSupportedFile(fileName)) {
+            allFileNames.Last() = cbrFileNames.Last();
+            pageFileNames.Append(cbrFileNames.Last());
+            cbrIsPage.Last() = true;
         }
-        else
-            RARProcessFile(hArc, RAR_SKIP, NULL, NULL);
+        else if (str::EqI(fileName, L"ComicInfo.xml"))
+            cbrComicInfoIdx = (int)cbrFileNames.Count() - 1;
 
+        res = RARProcessFile(hArc, RAR_SKIP, NULL, NULL);
+        if (0 != res)
+            break;
     }
     RARCloseArchive(hArc);
 
-    if (found.Count() == 0)
+    if (pageFileNames.Count() == 0)
         return false;
-    found.Sort(ImagesPage::cmpPageByName);
 
-    for (size_t i = 0; i < found.Count(); i++) {
-        pages.Append(found.At(i)->bmp);
-        found.At(i)->bmp = NULL;
+    pageFileNames.Sort(cmpAscii);
+    for (const WCHAR **fn = pageFileNames.IterStart(); fn; fn = pageFileNames.IterNext()) {
+        fileIdxs.Append(allFileNames.Find(*fn));
     }
-    mediaboxes.AppendBlanks(pages.Count());
+    mediaboxes.AppendBlanks(fileIdxs.Count());
+    cbrCache.AppendBlanks(cbrFileNames.Count());
 
-    DeleteVecMembers(found);
     return true;
 }
 
-char *CbxEngineImpl::GetImageData(int pageNo, size_t& len)
+// UnRAR doesn't support seeking, so the archive is kept open and read sequentially
+// (it only has to be reopened when going backwards). Files can be skipped cheaply,
+// except in solid archives where skipping a file still means decompressing it, so
+// there the pages passed by are cached as well (cf. MAX_SOLID_CBR_CACHE_SIZE).
+// The result must be released with DropFileData.
+CbxFileData *CbxEngineImpl::ExtractCbrFile(size_t idx)
+{
+    ScopedCritSec scope(&fileAccess);
+
+    CbxFileData *file = cbrCache.At(idx);
+    if (file) {
+        // mark as the most recently used file
+        RemoveFromCbrCache(file);
+        file->refs++;
+        AddToCbrCache(file);
+        return file;
+    }
+
+    if (cbrArc && idx < cbrNextIdx) {
+        RARCloseArchive(cbrArc);
+        cbrArc = NULL;
+    }
+    if (!cbrArc) {
+        cbrArc = OpenCbrArchive(fileName, RAR_OM_EXTRACT);
+        cbrNextIdx = 0;
+        if (!cbrArc)
+            return NULL;
+    }
+
+    bool ok = true;
+    while (ok && cbrNextIdx <= idx) {
+        RARHeaderDataEx rarHeader;
+        ok = RARReadHeaderEx(cbrArc, &rarHeader) == 0 &&
+             str::Eq(rarHeader.FileNameW, cbrFileNames.At(cbrNextIdx));
+        if (!ok)
+            break;
+        size_t currIdx = cbrNextIdx++;
+        if (currIdx == idx || cbrSolid && cbrIsPage.At(currIdx) && !cbrCache.At(currIdx)) {
+            size_t len;
+            char *data = LoadCurrentCbrFile(cbrArc, rarHeader, &len);
+            ok = data != NULL;
+            if (!ok)
+                break;
+            CbxFileData *extracted = new CbxFileData(currIdx, data, len);
+            if (currIdx == idx) {
+                file = extracted;
+                file->refs++;
+            }
+            // the cache holds the initial reference
+            AddToCbrCache(extracted);
+        }
+        else
+            ok = RARProcessFile(cbrArc, RAR_SKIP, NULL, NULL) == 0;
+    }
+    if (!ok) {
+        // the archive is in an unknown state (or has been modified in the meantime)
+        RARCloseArchive(cbrArc);
+        cbrArc = NULL;
+    }
+    return file;
+}
+
+// must be called within the fileAccess critical section
+// (file is added as the most recently used one)
+void CbxEngineImpl::AddToCbrCache(CbxFileData *file)
 {
+    CrashIf(cbrCache.At(file->idx));
+    cbrCache.At(file->idx) = file;
+    file->older = cbrNewest;
+    file->newer = NULL;
+    if (cbrNewest)
+        cbrNewest->newer = file;
+    else
+        cbrOldest = file;
+    cbrNewest = file;
+    cbrCacheCount++;
+    cbrCacheBytes += file->len;
+
+    // the most recently used file is always kept
+    while (cbrOldest != file && (cbrSolid ? cbrCacheBytes > MAX_SOLID_CBR_CACHE_SIZE
+                                          : cbrCacheCount > MAX_CACHED_CBR_FILES)) {
+        CbxFileData *oldest = cbrOldest;
+        RemoveFromCbrCache(oldest);
+        DropFileData(oldest);
+    }
+}
+
+// must be called within the fileAccess critical section
+// (the cache's reference is handed to the caller)
+void CbxEngineImpl::RemoveFromCbrCache(CbxFileData *file)
+{
+    CrashIf(cbrCache.At(file->idx) != file);
+    cbrCache.At(file->idx) = NULL;
+    if (file->older)
+        file->older->newer = file->newer;
+    else
+        cbrOldest = file->newer;
+    if (file->newer)
+        file->newer->older = file->older;
+    else
+        cbrNewest = file->older;
+    cbrCacheCount--;
+    cbrCacheBytes -= file->len;
+}
+
+CbxFileData *CbxEngineImpl::GetImageData(int pageNo)
+{
+    size_t idx = fileIdxs.At(pageNo - 1);
     if (cbzFile) {
         ScopedCritSec scope(&fileAccess);
-        return cbzFile->GetFileDataByIdx(fileIdxs.At(pageNo - 1), &len);
+        size_t len;
+        char *data = cbzFile->GetFileDataByIdx(idx, &len);
+        return data ? new CbxFileData(idx, data, len) : NULL;
     }
+    if (cbrFileNames.Count() > 0)
+        return ExtractCbrFile(idx);
     return NULL;
 }
 
+void CbxEngineImpl::DropFileData(CbxFileData *file)
+{
+    ScopedCritSec scope(&fileAccess);
+    if (--file->refs == 0)
+        delete file;
+}
+
 bool CbxEngine::IsSupportedFile(const WCHAR *fileName, bool sniff)
 {
     if (sniff) {
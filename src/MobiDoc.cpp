@@ -10,6 +10,7 @@
 using namespace Gdiplus;
 #include "GdiPlusUtil.h"
 #include "PalmDbReader.h"
+#include "ThreadUtil.h"
 #include "DebugLog.h"
 
 // Parse mobi format http://wiki.mobileread.com/wiki/MOBI
@@ -18,6 +19,18 @@ using namespace Gdiplus;
 #define PALMDOC_TYPE_CREATOR   "TEXtREAd"
 #define TEALDOC_TYPE_CREATOR   "TEXtTlDc"
 
+// text records are only decompressed in parallel for documents with at least
+// MIN_RECORDS_PER_THREAD records per thread (4096 bytes per record is typical)
+#define MAX_DECOMPRESSION_THREADS   4
+#define MIN_RECORDS_PER_THREAD      32
+
+static int gMaxDecompressionThreads = 0;
+
+void SetMobiDecompressionThreads(int maxThreads)
+{
+    gMaxDecompressionThreads = maxThreads;
+}
+
 #define COMPRESSION_NONE 1
 #define COMPRESSION_PALM 2
 #define COMPRESSION_HUFF 17480
@@ -112,6 +125,11 @@ struct MobiHeader {
 
 STATIC_ASSERT(kMobiHeaderLen == sizeof(MobiHeader), validMobiHeader);
 
+static inline bool IsPalmdocLiteral(uint8 c)
+{
+    return 0 == c || (c >= 9 && c < 128);
+}
+
 // Uncompress source data compressed with PalmDoc compression into a buffer.
 // http://wiki.mobileread.com/wiki/PalmDOC#Format
 // Returns false on decoding errors
@@ -119,32 +137,42 @@ static bool PalmdocUncompress(const char *src, size_t srcLen, str::Str<char>& ds
 {
     const char *srcEnd = src + srcLen;
     while (src < srcEnd) {
-        uint8 c = (uint8)*src++;
-        if ((c >= 1) && (c <= 8)) {
+        uint8 c = (uint8)*src;
+        if (IsPalmdocLiteral(c)) {
+            // most of the input consists of runs of plain characters
+            const char *run = src;
+            for (src++; src < srcEnd && IsPalmdocLiteral((uint8)*src); src++);
+            dst.Append(run, src - run);
+            continue;
+        }
+        src++;
+        if (c <= 8) {
             if (src + c > srcEnd)
                 return false;
             dst.Append(src, c);
             src += c;
-        } else if (c < 128) {
-            dst.Append((char)c);
-        } else if ((c >= 128) && (c < 192)) {
+        } else if (c < 192) {
             if (src + 1 > srcEnd)
                 return false;
             uint16 c2 = (c << 8) | (uint8)*src++;
-            uint16 back = (c2 >> 3) & 0x07ff;
+            size_t back = (c2 >> 3) & 0x07ff;
+            size_t len = (c2 & 7) + 3;
             if (back > dst.Size() || 0 == back)
                 return false;
-            for (uint8 n = (c2 & 7) + 3; n > 0; n--) {
-                dst.Append(dst.At(dst.Size() - back));
+            char *out = dst.AppendBlanks(len);
+            const char *from = out - back;
+            if (back >= len) {
+                memcpy(out, from, len);
+            } else {
+                // overlapping copies repeat the last back bytes
+                for (size_t i = 0; i < len; i++) {
+                    out[i] = from[i];
+                }
             }
-        } else if (c >= 192) {
+        } else {
             dst.Append(' ');
             dst.Append((char)(c ^ 0x80));
         }
-        else {
-            CrashIf(true);
-            return false;
-        }
     }
 
     return true;
@@ -199,20 +227,24 @@ class HuffDicDecompressor
 
     uint32      codeLength;
 
-    Vec<uint32> recursionGuard;
+    bool Decompress(uint8 *src, size_t octets, str::Str<char>& dst, Vec<uint32>& recursionGuard);
+    bool DecodeOne(uint32 code, str::Str<char>& dst, Vec<uint32>& recursionGuard);
 
 public:
     HuffDicDecompressor();
 
     bool SetHuffData(uint8 *huffData, size_t huffDataLen);
     bool AddCdicData(uint8 *cdicData, uint32 cdicDataLen);
-    bool Decompress(uint8 *src, size_t octets, str::Str<char>& dst);
-    bool DecodeOne(uint32 code, str::Str<char>& dst);
+    // can be called from several threads at once once all data has been set
+    bool Decompress(uint8 *src, size_t octets, str::Str<char>& dst) {
+        Vec<uint32> recursionGuard;
+        return Decompress(src, octets, dst, recursionGuard);
+    }
 };
 
 HuffDicDecompressor::HuffDicDecompressor() : codeLength(0), dictsCount(0) { }
 
-bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst)
+bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst, Vec<uint32>& recursionGuard)
 {
     uint16 dict = (uint16)(code >> codeLength);
     if (dict >= dictsCount) {
@@ -239,7 +271,7 @@ bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst)
             return false;
         }
         recursionGuard.Push(code);
-        if (!Decompress(p, symLen, dst))
+        if (!Decompress(p, symLen, dst, recursionGuard))
             return false;
         recursionGuard.Pop();
     } else {
@@ -253,7 +285,7 @@ bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst)
     return true;
 }
 
-bool HuffDicDecompressor::Decompress(uint8 *src, size_t srcSize, str::Str<char>& dst)
+bool HuffDicDecompressor::Decompress(uint8 *src, size_t srcSize, str::Str<char>& dst, Vec<uint32>& recursionGuard)
 {
     uint32    bitsConsumed = 0;
     uint32    bits = 0;
@@ -298,7 +330,7 @@ bool HuffDicDecompressor::Decompress(uint8 *src, size_t srcSize, str::Str<char>&
             code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
         }
 
-        if (!DecodeOne(code, dst))
+        if (!DecodeOne(code, dst, recursionGuard))
             return false;
         bitsConsumed = codeLen;
     }
@@ -800,6 +832,73 @@ bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut)
     return false;
 }
 
+// decompresses text records for MobiDoc::LoadDocRecords until none are left
+// (each into its own buffer, as records are compressed independently)
+class MobiRecordDecompressor : public ThreadBase {
+    MobiDoc *mobiDoc;
+    str::Str<char> *records;
+    LONG *nextRecNo;
+    LONG recCount;
+    LONG *failed;
+
+public:
+    MobiRecordDecompressor(MobiDoc *mobiDoc, str::Str<char> *records, LONG *nextRecNo, LONG recCount, LONG *failed) :
+        ThreadBase("MobiRecordDecompressor"), mobiDoc(mobiDoc), records(records),
+        nextRecNo(nextRecNo), recCount(recCount), failed(failed) { }
+    virtual ~MobiRecordDecompressor() { }
+
+    virtual void Run() {
+        LONG recNo;
+        while (!*failed && (recNo = InterlockedIncrement(nextRecNo)) <= recCount) {
+            if (!mobiDoc->LoadDocRecordIntoBuffer(recNo, records[recNo - 1]))
+                InterlockedExchange(failed, 1);
+        }
+    }
+};
+
+// Load all text records into doc, decompressing them on several
+// threads for larger documents. Returns false if error.
+bool MobiDoc::LoadDocRecords()
+{
+    int maxThreads = gMaxDecompressionThreads;
+    if (maxThreads <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        maxThreads = min((int)si.dwNumberOfProcessors, MAX_DECOMPRESSION_THREADS);
+    }
+    int threadCount = (int)min((size_t)maxThreads, docRecCount / MIN_RECORDS_PER_THREAD);
+
+    if (threadCount > 1 && compressionType != COMPRESSION_NONE) {
+        str::Str<char> *records = new str::Str<char>[docRecCount];
+        LONG nextRecNo = 0, failed = 0;
+        Vec<MobiRecordDecompressor *> workers;
+        for (int i = 0; i < threadCount; i++) {
+            workers.Append(new MobiRecordDecompressor(this, records, &nextRecNo, (LONG)docRecCount, &failed));
+            workers.Last()->Start();
+        }
+        for (size_t i = 0; i < workers.Count(); i++) {
+            workers.At(i)->Join();
+        }
+        DeleteVecMembers(workers);
+
+        for (size_t i = 0; i < docRecCount && !failed; i++) {
+            doc->Append(records[i].Get(), records[i].Size());
+        }
+        delete[] records;
+        if (!failed)
+            return true;
+        // broken documents might contain back references across
+        // records, so retry decompressing them serially
+        doc->Reset();
+    }
+
+    for (size_t i = 1; i <= docRecCount; i++) {
+        if (!LoadDocRecordIntoBuffer(i, *doc))
+            return false;
+    }
+    return true;
+}
+
 bool MobiDoc::LoadDocument()
 {
     if (!ParseHeader())
@@ -807,10 +906,8 @@ bool MobiDoc::LoadDocument()
 
     assert(!doc);
     doc = new str::Str<char>(docUncompressedSize);
-    for (size_t i = 1; i <= docRecCount; i++) {
-        if (!LoadDocRecordIntoBuffer(i, *doc))
-            return false;
-    }
+    if (!LoadDocRecords())
+        return false;
     // replace unexpected \0 with spaces
     // cf. https://code.google.com/p/sumatrapdf/issues/detail?id=2529
     char *s = doc->Get(), *end = s + doc->Size();
@@ -43,6 +43,7 @@ class MobiDoc
 
     bool    ParseHeader();
     bool    LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut);
+    bool    LoadDocRecords();
     void    LoadImages();
     bool    LoadImage(size_t imageNo);
     bool    LoadDocument();
@@ -65,8 +66,14 @@ public:
 
     static bool         IsSupportedFile(const WCHAR *fileName, bool sniff=false);
     static MobiDoc *    CreateFromFile(const WCHAR *fileName);
+
+    friend class MobiRecordDecompressor;
 };
 
+// maximum number of threads for decompressing the text of larger
+// documents (0 restores the default, 1 decompresses serially)
+void SetMobiDecompressionThreads(int maxThreads);
+
 // for testing MobiFormatter
 class MobiTestDoc {
     str::Str<char> htmlData;
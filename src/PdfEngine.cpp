@@ -13,6 +13,8 @@ extern "C" {
 
 #include "FileUtil.h"
 #include "HtmlPullParser.h"
+#include "PixelConvert.h"
+#include "ThreadUtil.h"
 #include "TrivialHtmlParser.h"
 #include "WinUtil.h"
 #include "ZipUtil.h"
@@ -21,14 +23,33 @@ extern "C" {
 // and displayed; larger files will be kept open while they're displayed
 // so that their content can be loaded on demand in order to preserve memory
 #define MAX_MEMORY_FILE_SIZE (10 * 1024 * 1024)
-
-// number of page content trees to cache for quicker rendering
-#define MAX_PAGE_RUN_CACHE  8
-// maximum estimated memory requirement allowed for the run cache of one document
+// maximum size of a larger file that's mapped into memory instead of being read
+// through a file descriptor (32-bit builds might run out of address space)
+#ifdef _WIN64
+#define MAX_MAPPED_FILE_SIZE INT_MAX
+#else
+#define MAX_MAPPED_FILE_SIZE (512 * 1024 * 1024)
+#endif
+// size of the ranges of a mapped file which are prefetched at once (at both ends
+// of the file when it's opened and wherever objects are read from afterwards)
+#define MAPPED_READAHEAD_SIZE (256 * 1024)
+// size of the chunks in which a file is read for computing its fingerprint
+#define FINGERPRINT_CHUNK_SIZE (1024 * 1024)
+
+// maximum number of page content trees to cache for quicker rendering
+// (the cache is usually rather limited by gMaxPageRunMemory)
+#define MAX_PAGE_RUN_CACHE  64
+// default for the maximum memory allowed for the run cache of one document
 #define MAX_PAGE_RUN_MEMORY (40 * 1024 * 1024)
+// number of most recently used page runs which are never dropped from the
+// run cache (the current page and the ones prefetched around it)
+#define MIN_PAGE_RUN_CACHE  3
 
 // maximum amount of memory that MuPDF should use per fz_context store
 #define MAX_CONTEXT_MEMORY  (256 * 1024 * 1024)
+// maximum amount of that memory used for (decoded) images, so that
+// image heavy pages don't evict all fonts and other resources
+#define MAX_CONTEXT_IMAGE_MEMORY (192 * 1024 * 1024)
 
 // when set, always uses GDI+ for rendering (else GDI+ is only used for
 // zoom levels above 4000% and for rendering directly into an HDC)
@@ -39,6 +60,32 @@ void DebugGdiPlusDevice(bool enable)
     gDebugGdiPlusDevice = enable;
 }
 
+bool DebugSimdPainters(bool enable)
+{
+    return fz_enable_simd_painters(enable) != 0;
+}
+
+void DebugFastPaths(bool enable)
+{
+    fz_enable_fast_paths(enable);
+}
+
+// larger files on fixed drives are mapped into memory unless mapping fails
+// (in which case they're read through a file descriptor as before)
+static bool gEnableFileMapping = true;
+
+void DebugFileMapping(bool enable)
+{
+    gEnableFileMapping = enable;
+}
+
+static size_t gMaxPageRunMemory = MAX_PAGE_RUN_MEMORY;
+
+void SetPageRunCacheSize(size_t maxBytes)
+{
+    gMaxPageRunMemory = maxBytes > 0 ? maxBytes : MAX_PAGE_RUN_MEMORY;
+}
+
 void CalcMD5Digest(const unsigned char *data, size_t byteCount, unsigned char digest[16])
 {
     fz_md5 md5;
@@ -51,6 +98,48 @@ void CalcMD5Digest(const unsigned char *data, size_t byteCount, unsigned char di
     fz_md5_final(&md5, digest);
 }
 
+static fz_context *NewFitzContext(fz_locks_context *locks)
+{
+    fz_context *ctx = fz_new_context(NULL, locks, MAX_CONTEXT_MEMORY);
+    if (ctx)
+        fz_set_store_kind_max(ctx, FZ_STORE_IMAGE, MAX_CONTEXT_IMAGE_MEMORY);
+    return ctx;
+}
+
+static void GetFitzCacheStats(fz_context *ctx, Vec<EngineCacheStats>& result)
+{
+    static const char *kindNames[FZ_STORE_KINDS] = { "other", "images", "fonts", "resources" };
+    for (int kind = -1; kind < FZ_STORE_KINDS; kind++) {
+        fz_store_stats stats;
+        fz_get_store_stats(ctx, kind, &stats);
+        EngineCacheStats& s = *result.AppendBlanks(1);
+        str::BufSet(s.name, dimof(s.name), kind < 0 ? "store" : kindNames[kind]);
+        s.items = stats.items;
+        s.bytes = stats.size;
+        s.maxBytes = stats.max != FZ_STORE_UNLIMITED ? stats.max : 0;
+        s.lookups = stats.lookups;
+        s.hits = stats.hits;
+        s.evictions = stats.evictions;
+        s.evictedBytes = stats.evicted;
+    }
+    for (int shard = -1; shard < FZ_GLYPH_CACHE_SHARDS; shard++) {
+        fz_glyph_cache_stats stats;
+        fz_get_glyph_cache_stats(ctx, shard, &stats);
+        EngineCacheStats& s = *result.AppendBlanks(1);
+        if (shard < 0)
+            str::BufSet(s.name, dimof(s.name), "glyphs");
+        else
+            str::BufSet(s.name, dimof(s.name), ScopedMem<char>(str::Format("glyphs %d", shard)));
+        s.items = stats.count;
+        s.bytes = stats.total;
+        s.maxBytes = stats.max;
+        s.lookups = stats.lookups;
+        s.hits = stats.hits;
+        s.evictions = stats.num_evictions;
+        s.evictedBytes = stats.evicted;
+    }
+}
+
 ///// extensions to Fitz that are usable for both PDF and XPS /////
 
 inline RectD fz_rect_to_RectD(fz_rect rect)
@@ -80,59 +169,15 @@ inline float fz_calc_overlap(fz_rect r1, fz_rect r2)
 
 static RenderedBitmap *new_rendered_fz_pixmap(fz_context *ctx, fz_pixmap *pixmap)
 {
-    int paletteSize = 0;
-    bool hasPalette = false;
-
     int w = pixmap->w;
     int h = pixmap->h;
     int rows8 = ((w + 3) / 4) * 4;
 
-    BITMAPINFO *bmi = (BITMAPINFO *)calloc(1, sizeof(BITMAPINFOHEADER) + 256 * sizeof(RGBQUAD));
-
-    // always try to produce an 8-bit palette for saving some memory
-    unsigned char *bmpData = (unsigned char *)calloc(rows8, h);
-    if (!bmpData) {
-        free(bmi);
-        return NULL;
-    }
+    // pages are rendered as BGRA which is a GDI compatible format, RGB
+    // only needs its components swapped and anything else is converted
+    bool isRgb = pixmap->n == 4 && pixmap->colorspace == fz_device_rgb(ctx);
     fz_pixmap *bgrPixmap = NULL;
-    if (bmpData && pixmap->n == 4 &&
-        pixmap->colorspace == fz_device_rgb(ctx)) {
-        unsigned char *dest = bmpData;
-        unsigned char *source = pixmap->samples;
-
-        for (int j = 0; j < h; j++) {
-            for (int i = 0; i < w; i++) {
-                RGBQUAD c = { 0 };
-
-                c.rgbRed = *source++;
-                c.rgbGreen = *source++;
-                c.rgbBlue = *source++;
-                source++;
-
-                /* find this color in the palette */
-                int k;
-                for (k = 0; k < paletteSize; k++)
-                    if (*(int *)&bmi->bmiColors[k] == *(int *)&c)
-                        break;
-                /* add it to the palette if it isn't in there and if there's still space left */
-                if (k == paletteSize) {
-                    if (k >= 256)
-                        goto ProducingPaletteDone;
-                    *(int *)&bmi->bmiColors[paletteSize] = *(int *)&c;
-                    paletteSize++;
-                }
-                /* 8-bit data consists of indices into the color palette */
-                *dest++ = k;
-            }
-            dest += rows8 - w;
-        }
-ProducingPaletteDone:
-        hasPalette = paletteSize < 256;
-    }
-    if (!hasPalette) {
-        free(bmpData);
-        /* BGRA is a GDI compatible format */
+    if (!isRgb && (pixmap->n != 4 || pixmap->colorspace != fz_device_bgr(ctx))) {
         fz_try(ctx) {
             fz_irect bbox;
             fz_colorspace *colorspace = fz_device_bgr(ctx);
@@ -140,11 +185,42 @@ ProducingPaletteDone:
             fz_convert_pixmap(ctx, bgrPixmap, pixmap);
         }
         fz_catch(ctx) {
-            free(bmi);
             return NULL;
         }
+        pixmap = bgrPixmap;
+    }
+
+    BITMAPINFO *bmi = (BITMAPINFO *)calloc(1, sizeof(BITMAPINFOHEADER) + 256 * sizeof(RGBQUAD));
+    if (!bmi) {
+        fz_drop_pixmap(ctx, bgrPixmap);
+        return NULL;
+    }
+    // always try to produce an 8-bit palette for saving some memory
+    // (which usually fails after the first few pixels of photographs)
+    unsigned char *bmpData = (unsigned char *)calloc(rows8, h);
+    int paletteSize = -1;
+    if (bmpData) {
+        uint32_t *palette = (uint32_t *)bmi->bmiColors;
+        paletteSize = pixelconvert::ToPalette(pixmap->samples, w, h, w * 4, bmpData, rows8, palette);
+        if (paletteSize > 0 && isRgb)
+            pixelconvert::SwapRedBlue((unsigned char *)palette, (unsigned char *)palette, paletteSize);
+    }
+    bool hasPalette = paletteSize >= 0;
+    unsigned char *bgraData = pixmap->samples;
+    if (!hasPalette) {
+        free(bmpData);
+        bmpData = NULL;
+        if (isRgb) {
+            bgraData = bmpData = (unsigned char *)malloc((size_t)w * h * 4);
+            if (bmpData)
+                pixelconvert::SwapRedBlue(pixmap->samples, bmpData, (size_t)w * h);
+        }
+    }
+    if (!bgraData) {
+        free(bmi);
+        fz_drop_pixmap(ctx, bgrPixmap);
+        return NULL;
     }
-    AssertCrash(hasPalette || bgrPixmap);
 
     bmi->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
     bmi->bmiHeader.biWidth = w;
@@ -157,18 +233,158 @@ ProducingPaletteDone:
 
     HDC hDC = GetDC(NULL);
     HBITMAP hbmp = CreateDIBitmap(hDC, &bmi->bmiHeader, CBM_INIT,
-        hasPalette ? bmpData : bgrPixmap->samples, bmi, DIB_RGB_COLORS);
+        hasPalette ? bmpData : bgraData, bmi, DIB_RGB_COLORS);
     ReleaseDC(NULL, hDC);
 
-    if (hasPalette)
-        free(bmpData);
-    else
-        fz_drop_pixmap(ctx, bgrPixmap);
+    free(bmpData);
+    fz_drop_pixmap(ctx, bgrPixmap);
     free(bmi);
 
     if (!hbmp)
         return NULL;
-    return new RenderedBitmap(hbmp, SizeI(pixmap->w, pixmap->h));
+    return new RenderedBitmap(hbmp, SizeI(w, h));
+}
+
+// a file mapping shared by a stream and all its clones
+struct mapped_file {
+    LONG refs;
+    HANDLE hMap;
+    unsigned char *data;
+    int len;
+    // the readahead range most recently prefetched (shared by all clones,
+    // so that concurrent readers at worst issue a redundant hint)
+    volatile LONG lastRange;
+};
+
+// cf. WIN32_MEMORY_RANGE_ENTRY (which older SDKs don't define)
+struct MemoryRangeEntry {
+    void *VirtualAddress;
+    SIZE_T NumberOfBytes;
+};
+
+typedef BOOL (WINAPI *PrefetchVirtualMemoryProc)(HANDLE hProcess, ULONG_PTR numberOfEntries, MemoryRangeEntry *entries, ULONG flags);
+
+// asks the system to read the given ranges of a mapped file in few large requests
+// instead of page by page on demand (PrefetchVirtualMemory requires Windows 8)
+static void PrefetchMapped(mapped_file *state, int *offsets, int count)
+{
+    static PrefetchVirtualMemoryProc _PrefetchVirtualMemory = (PrefetchVirtualMemoryProc)LoadDllFunc(L"kernel32.dll", "PrefetchVirtualMemory");
+    if (!_PrefetchVirtualMemory)
+        return;
+    MemoryRangeEntry entries[2];
+    CrashIf(count > dimof(entries));
+    for (int i = 0; i < count; i++) {
+        int start = limitValue(offsets[i], 0, state->len);
+        entries[i].VirtualAddress = state->data + start;
+        entries[i].NumberOfBytes = min(MAPPED_READAHEAD_SIZE, state->len - start);
+    }
+    _PrefetchVirtualMemory(GetCurrentProcess(), count, entries, 0);
+}
+
+extern "C" static int next_mapped(fz_stream *stm, int max)
+{
+    // all of the file's data is always available
+    return EOF;
+}
+
+extern "C" static void seek_mapped(fz_stream *stm, int offset, int whence)
+{
+    mapped_file *state = (mapped_file *)stm->state;
+    if (1 == whence)
+        offset += (int)(stm->rp - state->data);
+    else if (2 == whence)
+        offset += state->len;
+    offset = limitValue(offset, 0, state->len);
+    stm->rp = state->data + offset;
+
+    // objects are mostly read in order, so prefetch from here on whenever
+    // reading moves to a different range (instead of faulting in single pages)
+    LONG range = offset / MAPPED_READAHEAD_SIZE;
+    if (InterlockedExchange(&state->lastRange, range) != range)
+        PrefetchMapped(state, &offset, 1);
+}
+
+extern "C" static void close_mapped(fz_context *ctx, void *state_)
+{
+    mapped_file *state = (mapped_file *)state_;
+    if (InterlockedDecrement(&state->refs) > 0)
+        return;
+    UnmapViewOfFile(state->data);
+    CloseHandle(state->hMap);
+    free(state);
+}
+
+static fz_stream *fz_open_mapped(fz_context *ctx, mapped_file *state);
+
+extern "C" static fz_stream *reopen_mapped(fz_context *ctx, fz_stream *stm)
+{
+    mapped_file *state = (mapped_file *)stm->state;
+    InterlockedIncrement(&state->refs);
+    return fz_open_mapped(ctx, state);
+}
+
+static fz_stream *fz_open_mapped(fz_context *ctx, mapped_file *state)
+{
+    // same as fz_open_buffer (without copying the data)
+    fz_stream *stm = fz_new_stream(ctx, state, next_mapped, close_mapped, NULL);
+    stm->seek = seek_mapped;
+    stm->reopen = reopen_mapped;
+    stm->rp = state->data;
+    stm->wp = state->data + state->len;
+    stm->pos = state->len;
+    return stm;
+}
+
+// maps a file into memory so that reading objects doesn't require any system calls
+// (only page faults which are served from the system's file cache after the first read)
+static fz_stream *fz_open_mapped_file(fz_context *ctx, const WCHAR *filePath)
+{
+    // reading from a mapped file raises an exception instead of
+    // returning an error when the drive goes away
+    WCHAR volume[MAX_PATH];
+    if (!GetVolumePathName(filePath, volume, dimof(volume)) || GetDriveType(volume) != DRIVE_FIXED)
+        return NULL;
+
+    // allow others to write to the file as fz_open_file_w does (and to replace it)
+    HANDLE hFile = CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == hFile)
+        return NULL;
+    LARGE_INTEGER size;
+    HANDLE hMap = NULL;
+    if (GetFileSizeEx(hFile, &size) && 0 < size.QuadPart && size.QuadPart <= MAX_MAPPED_FILE_SIZE)
+        hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    // the mapping keeps the file open
+    CloseHandle(hFile);
+    if (!hMap)
+        return NULL;
+
+    unsigned char *data = (unsigned char *)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    mapped_file *state = data ? AllocStruct<mapped_file>() : NULL;
+    if (!state) {
+        if (data)
+            UnmapViewOfFile(data);
+        CloseHandle(hMap);
+        return NULL;
+    }
+    state->refs = 1;
+    state->hMap = hMap;
+    state->data = data;
+    state->len = (int)size.QuadPart;
+    state->lastRange = -1;
+    // the header and the trailer (and the xref table before it) are read first
+    int offsets[] = { 0, state->len - MAPPED_READAHEAD_SIZE };
+    PrefetchMapped(state, offsets, state->len > MAPPED_READAHEAD_SIZE ? 2 : 1);
+
+    fz_stream *stm = NULL;
+    fz_try(ctx) {
+        stm = fz_open_mapped(ctx, state);
+    }
+    fz_catch(ctx) {
+        // fz_new_stream has already released the state
+        stm = NULL;
+    }
+    return stm;
 }
 
 fz_stream *fz_open_file2(fz_context *ctx, const WCHAR *filePath)
@@ -192,6 +408,12 @@ fz_stream *fz_open_file2(fz_context *ctx, const WCHAR *filePath)
         if (file)
             return file;
     }
+    // map larger files, so that objects can be read without seeking and copying
+    if (gEnableFileMapping && fileSize >= MAX_MEMORY_FILE_SIZE) {
+        file = fz_open_mapped_file(ctx, filePath);
+        if (file)
+            return file;
+    }
 
     fz_try(ctx) {
         file = fz_open_file_w(ctx, filePath);
@@ -222,28 +444,64 @@ unsigned char *fz_extract_stream_data(fz_stream *stream, size_t *cbCount)
     return data;
 }
 
-void fz_stream_fingerprint(fz_stream *file, unsigned char digest[16])
+// hashes the data in chunks so that large files don't have to be loaded into
+// memory at once; if access is given, it's only held while reading a chunk
+// (so that other threads can continue using the stream in the meantime)
+// returns false if *cancel has been set before the whole stream was read
+bool fz_stream_fingerprint(fz_stream *file, unsigned char digest[16], CRITICAL_SECTION *access=NULL, bool *cancel=NULL)
 {
-    int fileLen = -1;
-    fz_buffer *buffer = NULL;
+    fz_md5 md5;
+    fz_md5_init(&md5);
 
-    fz_try(file->ctx) {
-        fz_seek(file, 0, 2);
-        fileLen = fz_tell(file);
-        fz_seek(file, 0, 0);
-        buffer = fz_read_all(file, fileLen);
-    }
-    fz_catch(file->ctx) {
-        fz_warn(file->ctx, "couldn't read stream data, using a NULL fingerprint instead");
-        ZeroMemory(digest, 16);
-        return;
+    bool ok = true;
+    unsigned char *chunk = (unsigned char *)malloc(FINGERPRINT_CHUNK_SIZE);
+    for (int offset = 0; chunk; ) {
+        if (cancel && *cancel) {
+            free(chunk);
+            return false;
+        }
+        int len = 0;
+        if (access)
+            EnterCriticalSection(access);
+        fz_try(file->ctx) {
+            fz_seek(file, offset, 0);
+            len = fz_read(file, chunk, FINGERPRINT_CHUNK_SIZE);
+        }
+        fz_catch(file->ctx) {
+            fz_warn(file->ctx, "couldn't read stream data, using a NULL fingerprint instead");
+            ok = false;
+        }
+        if (access)
+            LeaveCriticalSection(access);
+        if (!ok || 0 == len)
+            break;
+        fz_md5_update(&md5, chunk, len);
+        offset += len;
     }
-    CrashIf(NULL == buffer);
-    CrashIf(fileLen != buffer->len);
 
-    CalcMD5Digest(buffer->data, buffer->len, digest);
+    if (chunk && ok)
+        fz_md5_final(&md5, digest);
+    else
+        ZeroMemory(digest, 16);
+    free(chunk);
+    return true;
+}
 
-    fz_drop_buffer(file->ctx, buffer);
+// combines a file's fingerprint with the user annotations rendered on top of it
+static void fz_content_fingerprint(unsigned char fileDigest[16], Vec<PageAnnotation>& userAnnots, unsigned char digest[16])
+{
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    fz_md5_update(&md5, fileDigest, 16);
+    for (size_t i = 0; i < userAnnots.Count(); i++) {
+        PageAnnotation& annot = userAnnots.At(i);
+        // hash the fields individually so that padding bytes are ignored
+        fz_md5_update(&md5, (unsigned char *)&annot.type, sizeof(annot.type));
+        fz_md5_update(&md5, (unsigned char *)&annot.pageNo, sizeof(annot.pageNo));
+        fz_md5_update(&md5, (unsigned char *)&annot.rect, sizeof(annot.rect));
+        fz_md5_update(&md5, (unsigned char *)&annot.color, sizeof(annot.color));
+    }
+    fz_md5_final(&md5, digest);
 }
 
 WCHAR *fz_text_page_to_str(fz_text_page *text, WCHAR *lineSep, RectI **coords_out=NULL)
@@ -624,6 +882,8 @@ struct FitzImagePos {
 struct ListInspectionData {
     Vec<FitzImagePos> *images;
     bool req_t3_fonts;
+    // memory required for decoding the list's images
+    // (cf. fz_display_list_size for the list itself)
     size_t mem_estimate;
     size_t path_len;
     size_t clip_path_len;
@@ -648,7 +908,6 @@ static void fz_inspection_handle_path(fz_device *dev, fz_path *path, bool clippi
         data->path_len += path->cmd_len + path->coord_len;
     else
         data->clip_path_len += path->cmd_len + path->coord_len;
-    data->mem_estimate += sizeof(fz_path) + path->cmd_cap + path->coord_cap * sizeof(float);
 }
 
 static void fz_inspection_handle_text(fz_device *dev, fz_text *text)
@@ -775,26 +1034,161 @@ public:
 extern "C" static void
 fz_lock_context_cs(void *user, int lock)
 {
-    // we use a single critical section for all locks,
-    // since that critical section (ctxAccess) should
-    // be guarding all fz_context access anyway and
-    // thus already be in place (in debug builds we
-    // crash if that assertion doesn't hold)
-    CRITICAL_SECTION *cs = (CRITICAL_SECTION *)user;
-    BOOL ok = TryEnterCriticalSection(cs);
-    if (!ok) {
-        CrashIf(true);
-        EnterCriticalSection(cs);
-    }
+    // each of MuPDF's FZ_LOCK_* gets its own critical section, since
+    // cloned contexts (cf. FitzContextPool) access the shared store and
+    // glyph cache without holding the document's ctxAccess
+    CRITICAL_SECTION *locks = (CRITICAL_SECTION *)user;
+    EnterCriticalSection(&locks[lock]);
 }
 
 extern "C" static void
 fz_unlock_context_cs(void *user, int lock)
 {
-    CRITICAL_SECTION *cs = (CRITICAL_SECTION *)user;
-    LeaveCriticalSection(cs);
+    CRITICAL_SECTION *locks = (CRITICAL_SECTION *)user;
+    LeaveCriticalSection(&locks[lock]);
 }
 
+// a pool of fz_context clones which allow rendering cached display lists
+// of the same document on several threads at once (the clones share the
+// store and glyph cache with the document's main context)
+class FitzContextPool {
+    CRITICAL_SECTION locks[FZ_LOCK_MAX];
+    CRITICAL_SECTION poolAccess;
+    Vec<fz_context *> idle;
+
+public:
+    fz_locks_context fz_locks_ctx;
+
+    FitzContextPool() {
+        for (int i = 0; i < FZ_LOCK_MAX; i++)
+            InitializeCriticalSection(&locks[i]);
+        InitializeCriticalSection(&poolAccess);
+        fz_locks_ctx.user = locks;
+        fz_locks_ctx.lock = fz_lock_context_cs;
+        fz_locks_ctx.unlock = fz_unlock_context_cs;
+    }
+    ~FitzContextPool() {
+        CrashIf(idle.Count() > 0);
+        DeleteCriticalSection(&poolAccess);
+        for (int i = 0; i < FZ_LOCK_MAX; i++)
+            DeleteCriticalSection(&locks[i]);
+    }
+
+    // returns NULL if no clone could be created (caller should then
+    // fall back to using ctx under the document's ctxAccess)
+    fz_context *Acquire(fz_context *ctx) {
+        ScopedCritSec scope(&poolAccess);
+        if (idle.Count() > 0)
+            return idle.Pop();
+        return fz_clone_context(ctx);
+    }
+    void Release(fz_context *clone) {
+        ScopedCritSec scope(&poolAccess);
+        idle.Append(clone);
+    }
+    // must be called before the main context is freed
+    void FreeAll() {
+        ScopedCritSec scope(&poolAccess);
+        for (size_t i = 0; i < idle.Count(); i++) {
+            fz_free_context(idle.At(i));
+        }
+        idle.Reset();
+    }
+};
+
+// the run cache of a document is also indexed by page, so that finding a
+// cached display list doesn't require comparing against all cached runs
+#define PAGE_RUN_BUCKETS    64
+
+template <typename PageRun, typename Page>
+class PageRunIndex {
+    PageRun *buckets[PAGE_RUN_BUCKETS];
+
+    static size_t GetBucketIdx(Page *page) {
+        return ((size_t)page / sizeof(void *)) % PAGE_RUN_BUCKETS;
+    }
+
+public:
+    PageRunIndex() { ZeroMemory(buckets, sizeof(buckets)); }
+
+    PageRun *Find(Page *page) {
+        for (PageRun *run = buckets[GetBucketIdx(page)]; run; run = run->next) {
+            if (run->page == page)
+                return run;
+        }
+        return NULL;
+    }
+    void Add(PageRun *run) {
+        ListInsert(&buckets[GetBucketIdx(run->page)], run);
+    }
+    void Remove(PageRun *run) {
+        ListRemove(&buckets[GetBucketIdx(run->page)], run);
+        run->next = NULL;
+    }
+};
+
+// builds the display lists of the pages next to the most recently
+// displayed one at a lower priority whenever the document isn't being
+// rendered otherwise, so that they're cached when the user continues
+// to scroll in either direction
+class PageRunPrefetcher : public ThreadBase {
+public:
+    class Builder {
+    public:
+        virtual ~Builder() { }
+        virtual void PrefetchPageRun(int pageNo) = 0;
+        virtual bool IsBusy() = 0;
+    };
+
+private:
+    Builder *builder;
+    HANDLE wakeUp;
+    CRITICAL_SECTION pendingAccess;
+    Vec<int> pending; // the last page is prefetched first
+
+public:
+    explicit PageRunPrefetcher(Builder *builder) :
+        ThreadBase("PageRunPrefetcher"), builder(builder) {
+        wakeUp = CreateEvent(NULL, FALSE, FALSE, NULL);
+        InitializeCriticalSection(&pendingAccess);
+    }
+    virtual ~PageRunPrefetcher() {
+        DeleteCriticalSection(&pendingAccess);
+        CloseHandle(wakeUp);
+    }
+
+    void Request(int pageNo) {
+        ScopedCritSec scope(&pendingAccess);
+        // older requests are obsolete
+        pending.Reset();
+        if (pageNo > 1)
+            pending.Append(pageNo - 1);
+        pending.Append(pageNo + 1);
+        SetEvent(wakeUp);
+    }
+    void Stop() {
+        RequestCancel();
+        SetEvent(wakeUp);
+        Join();
+    }
+
+    virtual void Run() {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+        while (!WasCancelRequested()) {
+            int pageNo = 0;
+            EnterCriticalSection(&pendingAccess);
+            bool hasPending = pending.Count() > 0;
+            if (hasPending && !builder->IsBusy())
+                pageNo = pending.Pop();
+            LeaveCriticalSection(&pendingAccess);
+            if (pageNo)
+                builder->PrefetchPageRun(pageNo);
+            else
+                WaitForSingleObject(wakeUp, hasPending ? 100 : INFINITE);
+        }
+    }
+};
+
 static Vec<PageAnnotation> fz_get_user_page_annots(Vec<PageAnnotation>& userAnnots, int pageNo)
 {
     Vec<PageAnnotation> result;
@@ -1153,17 +1547,19 @@ struct PdfPageRun {
     size_t path_len;
     size_t clip_path_len;
     int refs;
+    PdfPageRun *next; // for PageRunIndex
 
     PdfPageRun(pdf_page *page, fz_display_list *list, ListInspectionData& data) :
-        page(page), list(list), size_est(data.mem_estimate), req_t3_fonts(data.req_t3_fonts),
-        path_len(data.path_len), clip_path_len(data.clip_path_len), refs(1) { }
+        page(page), list(list), size_est(fz_display_list_size(list) + data.mem_estimate),
+        req_t3_fonts(data.req_t3_fonts), path_len(data.path_len),
+        clip_path_len(data.clip_path_len), refs(1), next(NULL) { }
 };
 
 class PdfTocItem;
 class PdfLink;
 class PdfImage;
 
-class PdfEngineImpl : public PdfEngine {
+class PdfEngineImpl : public PdfEngine, public PageRunPrefetcher::Builder {
     friend PdfEngine;
     friend PdfLink;
     friend PdfImage;
@@ -1216,6 +1612,8 @@ public:
     virtual const WCHAR *GetDefaultFileExt() const { return L".pdf"; }
 
     virtual bool BenchLoadPage(int pageNo) { return GetPdfPage(pageNo) != NULL; }
+    virtual bool BenchBuildPageRun(int pageNo);
+    virtual void BenchGetCacheStats(Vec<EngineCacheStats>& stats);
 
     virtual Vec<PageElement *> *GetElements(int pageNo);
     virtual PageElement *GetElementAtPos(int pageNo, PointD pt);
@@ -1232,6 +1630,10 @@ public:
 
     virtual bool IsPasswordProtected() const { return isProtected; }
     virtual char *GetDecryptionKey() const;
+    virtual bool GetContentFingerprint(unsigned char digest[16], bool *cancel=NULL);
+
+    virtual void PrefetchPageRun(int pageNo);
+    virtual bool IsBusy() { return runningPages > 0; }
 
 protected:
     WCHAR *_fileName;
@@ -1242,7 +1644,7 @@ protected:
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION ctxAccess;
     fz_context *    ctx;
-    fz_locks_context fz_locks_ctx;
+    FitzContextPool ctxPool;
     pdf_document *  _doc;
 
     CRITICAL_SECTION pagesAccess;
@@ -1255,6 +1657,10 @@ protected:
     bool            LoadFromStream(fz_stream *stm, PasswordUI *pwdUI=NULL);
     bool            FinishLoading();
 
+    // computed on demand by GetContentFingerprint
+    unsigned char   fileDigest[16];
+    bool            hasFileDigest;
+
     pdf_page      * GetPdfPage(int pageNo, bool failIfBusy=false);
     int             GetPageNo(pdf_page *page);
     fz_matrix       viewctm(int pageNo, float zoom, int rotation) {
@@ -1273,8 +1679,13 @@ protected:
                                     RenderTarget target=Target_View, bool cacheRun=false);
 
     Vec<PdfPageRun*>runCache; // ordered most recently used first
+    PageRunIndex<PdfPageRun, pdf_page> runIndex;
+    size_t          runCacheSize;
+    PageRunPrefetcher *prefetcher;
+    LONG            runningPages;
     PdfPageRun    * CreatePageRun(pdf_page *page, fz_display_list *list);
     PdfPageRun    * GetPageRun(pdf_page *page, bool tryOnly=false);
+    void            RequestPrefetch(int pageNo);
     bool            RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm,
                             RenderTarget target=Target_View,
                             const fz_rect *cliprect=NULL, bool cacheRun=true,
@@ -1381,15 +1792,13 @@ PdfEngineImpl::PdfEngineImpl() : _fileName(NULL), _doc(NULL),
     _pages(NULL), _pageObjs(NULL), _mediaboxes(NULL), _info(NULL),
     outline(NULL), attachments(NULL), _pagelabels(NULL),
     _decryptionKey(NULL), isProtected(false),
-    pageAnnots(NULL), imageRects(NULL)
+    pageAnnots(NULL), imageRects(NULL),
+    runCacheSize(0), prefetcher(NULL), runningPages(0), hasFileDigest(false)
 {
     InitializeCriticalSection(&pagesAccess);
     InitializeCriticalSection(&ctxAccess);
 
-    fz_locks_ctx.user = &ctxAccess;
-    fz_locks_ctx.lock = fz_lock_context_cs;
-    fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(NULL, &fz_locks_ctx, MAX_CONTEXT_MEMORY);
+    ctx = NewFitzContext(&ctxPool.fz_locks_ctx);
 
     if (ctx)
         pdf_install_load_system_font_funcs(ctx);
@@ -1397,6 +1806,11 @@ PdfEngineImpl::PdfEngineImpl() : _fileName(NULL), _doc(NULL),
 
 PdfEngineImpl::~PdfEngineImpl()
 {
+    if (prefetcher) {
+        prefetcher->Stop();
+        delete prefetcher;
+    }
+
     EnterCriticalSection(&pagesAccess);
     EnterCriticalSection(&ctxAccess);
 
@@ -1437,6 +1851,7 @@ PdfEngineImpl::~PdfEngineImpl()
 
     pdf_close_document(_doc);
     _doc = NULL;
+    ctxPool.FreeAll();
     fz_free_context(ctx);
     ctx = NULL;
 
@@ -1902,27 +2317,8 @@ PdfPageRun *PdfEngineImpl::GetPageRun(pdf_page *page, bool tryOnly)
 
     ScopedCritSec scope(&pagesAccess);
 
-    for (size_t i = 0; i < runCache.Count(); i++) {
-        if (runCache.At(i)->page == page) {
-            result = runCache.At(i);
-            break;
-        }
-    }
+    result = runIndex.Find(page);
     if (!result && !tryOnly) {
-        size_t mem = 0;
-        for (size_t i = 0; i < runCache.Count(); i++) {
-            // drop page runs that take up too much memory due to huge images
-            // (except for the very recently used ones)
-            if (i >= 2 && mem + runCache.At(i)->size_est >= MAX_PAGE_RUN_MEMORY)
-                DropPageRun(runCache.At(i--), true);
-            else
-                mem += runCache.At(i)->size_est;
-        }
-        if (runCache.Count() >= MAX_PAGE_RUN_CACHE) {
-            assert(runCache.Count() == MAX_PAGE_RUN_CACHE);
-            DropPageRun(runCache.Last(), true);
-        }
-
         ScopedCritSec scope2(&ctxAccess);
 
         fz_display_list *list = NULL;
@@ -1943,6 +2339,14 @@ PdfPageRun *PdfEngineImpl::GetPageRun(pdf_page *page, bool tryOnly)
         if (list) {
             result = CreatePageRun(page, list);
             runCache.InsertAt(0, result);
+            runIndex.Add(result);
+            runCacheSize += result->size_est;
+            // drop page runs that take up too much memory (e.g. due to huge images)
+            // except for the very recently used ones
+            while (runCache.Count() > MIN_PAGE_RUN_CACHE &&
+                   (runCacheSize > gMaxPageRunMemory || runCache.Count() > MAX_PAGE_RUN_CACHE)) {
+                DropPageRun(runCache.Last(), true);
+            }
         }
     }
     else if (result && result != runCache.At(0)) {
@@ -1956,29 +2360,89 @@ PdfPageRun *PdfEngineImpl::GetPageRun(pdf_page *page, bool tryOnly)
     return result;
 }
 
+void PdfEngineImpl::RequestPrefetch(int pageNo)
+{
+    // don't use pagesAccess here, as the prefetcher might hold it for a while
+    if (!prefetcher) {
+        PageRunPrefetcher *newPrefetcher = new PageRunPrefetcher(this);
+        if (InterlockedCompareExchangePointer((void **)&prefetcher, newPrefetcher, NULL))
+            delete newPrefetcher;
+        else
+            newPrefetcher->Start();
+    }
+    prefetcher->Request(pageNo);
+}
+
+void PdfEngineImpl::PrefetchPageRun(int pageNo)
+{
+    if (pageNo < 1 || pageNo > PageCount())
+        return;
+    ScopedCritSec scope(&pagesAccess);
+    // don't prefetch if the cache is already full (prefetched
+    // page runs would just push out the ones still displayed)
+    if (runCacheSize > gMaxPageRunMemory)
+        return;
+    pdf_page *page = GetPdfPage(pageNo);
+    PdfPageRun *run = page ? GetPageRun(page) : NULL;
+    if (run)
+        DropPageRun(run);
+}
+
+bool PdfEngineImpl::BenchBuildPageRun(int pageNo)
+{
+    ScopedCritSec scope(&pagesAccess);
+    pdf_page *page = GetPdfPage(pageNo);
+    PdfPageRun *run = page ? GetPageRun(page) : NULL;
+    if (run)
+        DropPageRun(run);
+    return run != NULL;
+}
+
+void PdfEngineImpl::BenchGetCacheStats(Vec<EngineCacheStats>& stats)
+{
+    ScopedCritSec scope(&ctxAccess);
+    GetFitzCacheStats(ctx, stats);
+}
+
 bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm, RenderTarget target, const fz_rect *cliprect, bool cacheRun, FitzAbortCookie *cookie)
 {
     bool ok = true;
 
+    // prevent prefetching from competing for ctxAccess
+    InterlockedIncrement(&runningPages);
+
+    // devices created on a clone from ctxPool can replay a cached display list
+    // without blocking other threads (the display list is read-only)
+    bool isClone = dev->ctx != ctx;
+
     PdfPageRun *run;
     if (Target_View == target && (run = GetPageRun(page, !cacheRun)) != NULL) {
         EnterCriticalSection(&ctxAccess);
         Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page));
-        fz_try(ctx) {
-            fz_rect pagerect;
-            fz_begin_page(dev, pdf_bound_page(_doc, page, &pagerect), ctm);
+        fz_rect pagerect;
+        pdf_bound_page(_doc, page, &pagerect);
+        if (isClone)
+            LeaveCriticalSection(&ctxAccess);
+        fz_context *runCtx = dev->ctx;
+        fz_try(runCtx) {
+            fz_begin_page(dev, &pagerect, ctm);
             fz_run_page_transparency(pageAnnots, dev, cliprect, false, page->transparency);
             fz_run_display_list(run->list, dev, ctm, cliprect, cookie ? &cookie->cookie : NULL);
             fz_run_page_transparency(pageAnnots, dev, cliprect, true, page->transparency);
             fz_run_user_page_annots(pageAnnots, dev, ctm, cliprect, cookie ? &cookie->cookie : NULL);
             fz_end_page(dev);
         }
-        fz_catch(ctx) {
+        fz_catch(runCtx) {
             ok = false;
         }
-        LeaveCriticalSection(&ctxAccess);
+        if (!isClone)
+            LeaveCriticalSection(&ctxAccess);
         DropPageRun(run);
     }
+    else if (isClone) {
+        // cloned contexts are only meant for replaying display lists
+        ok = false;
+    }
     else {
         ScopedCritSec scope(&ctxAccess);
         char *targetName = target == Target_Print ? "Print" :
@@ -1998,10 +2462,16 @@ bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm
         }
     }
 
-    EnterCriticalSection(&ctxAccess);
-    fz_free_device(dev);
-    LeaveCriticalSection(&ctxAccess);
+    if (isClone) {
+        fz_free_device(dev);
+    }
+    else {
+        EnterCriticalSection(&ctxAccess);
+        fz_free_device(dev);
+        LeaveCriticalSection(&ctxAccess);
+    }
 
+    InterlockedDecrement(&runningPages);
     return ok && !(cookie && cookie->cookie.abort);
 }
 
@@ -2011,7 +2481,10 @@ void PdfEngineImpl::DropPageRun(PdfPageRun *run, bool forceRemove)
     run->refs--;
 
     if (0 == run->refs || forceRemove) {
-        runCache.Remove(run);
+        if (runCache.Remove(run)) {
+            runIndex.Remove(run);
+            runCacheSize -= run->size_est;
+        }
         if (0 == run->refs) {
             EnterCriticalSection(&ctxAccess);
             fz_drop_display_list(ctx, run->list);
@@ -2240,41 +2713,60 @@ RenderedBitmap *PdfEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
         return new RenderedBitmap(hbmp, SizeI(w, h));
     }
 
-    fz_pixmap *image = NULL;
-    EnterCriticalSection(&ctxAccess);
-    fz_try(ctx) {
-        fz_colorspace *colorspace = fz_device_rgb(ctx);
-        image = fz_new_pixmap_with_bbox(ctx, colorspace, &bbox);
-        fz_clear_pixmap_with_value(ctx, image, 0xFF); // initialize white background
-    }
-    fz_catch(ctx) {
-        LeaveCriticalSection(&ctxAccess);
-        return NULL;
+    // cached display lists are rasterized on a clone of ctx, so that several
+    // pages (or tiles) can be rendered in parallel (cf. RunPage)
+    PdfPageRun *run = Target_View == target ? GetPageRun(page) : NULL;
+    if (run)
+        RequestPrefetch(pageNo);
+    fz_context *renderCtx = run ? ctxPool.Acquire(ctx) : NULL;
+    bool isClone = renderCtx != NULL;
+    if (!isClone) {
+        renderCtx = ctx;
+        EnterCriticalSection(&ctxAccess);
     }
 
+    fz_pixmap *image = NULL;
     fz_device *dev = NULL;
-    fz_try(ctx) {
-        dev = fz_new_draw_device(ctx, image);
-    }
-    fz_catch(ctx) {
-        fz_drop_pixmap(ctx, image);
+    fz_var(image);
+    fz_try(renderCtx) {
+        // render directly into a GDI compatible format (cf. new_rendered_fz_pixmap)
+        fz_colorspace *colorspace = fz_device_bgr(renderCtx);
+        image = fz_new_pixmap_with_bbox(renderCtx, colorspace, &bbox);
+        fz_clear_pixmap_with_value(renderCtx, image, 0xFF); // initialize white background
+        dev = fz_new_draw_device(renderCtx, image);
+    }
+    fz_catch(renderCtx) {
+        fz_drop_pixmap(renderCtx, image);
+        image = NULL;
+    }
+    if (!isClone)
         LeaveCriticalSection(&ctxAccess);
+    if (!image) {
+        if (isClone)
+            ctxPool.Release(renderCtx);
+        if (run)
+            DropPageRun(run);
         return NULL;
     }
-    LeaveCriticalSection(&ctxAccess);
 
     FitzAbortCookie *cookie = NULL;
     if (cookie_out)
         *cookie_out = cookie = new FitzAbortCookie();
     fz_rect cliprect;
     bool ok = RunPage(page, dev, &ctm, target, fz_rect_from_irect(&cliprect, &bbox), true, cookie);
+    if (run)
+        DropPageRun(run);
 
-    ScopedCritSec scope(&ctxAccess);
-
+    if (!isClone)
+        EnterCriticalSection(&ctxAccess);
     RenderedBitmap *bitmap = NULL;
     if (ok)
-        bitmap = new_rendered_fz_pixmap(ctx, image);
-    fz_drop_pixmap(ctx, image);
+        bitmap = new_rendered_fz_pixmap(renderCtx, image);
+    fz_drop_pixmap(renderCtx, image);
+    if (isClone)
+        ctxPool.Release(renderCtx);
+    else
+        LeaveCriticalSection(&ctxAccess);
     return bitmap;
 }
 
@@ -2767,6 +3259,30 @@ void PdfEngineImpl::UpdateUserAnnotations(Vec<PageAnnotation> *list)
         userAnnots.Reset();
 }
 
+bool PdfEngineImpl::GetContentFingerprint(unsigned char digest[16], bool *cancel)
+{
+    EnterCriticalSection(&ctxAccess);
+    bool needsDigest = !hasFileDigest;
+    LeaveCriticalSection(&ctxAccess);
+    if (needsDigest) {
+        // don't block rendering while reading through large files
+        unsigned char newDigest[16];
+        if (!fz_stream_fingerprint(_doc->file, newDigest, &ctxAccess, cancel))
+            return false;
+        ScopedCritSec scope(&ctxAccess);
+        memcpy(fileDigest, newDigest, 16);
+        hasFileDigest = true;
+    }
+
+    ScopedCritSec scope(&ctxAccess);
+    // fz_stream_fingerprint returns a NULL fingerprint on failure
+    static const unsigned char nullDigest[16] = { 0 };
+    if (memeq(fileDigest, nullDigest, 16))
+        return false;
+    fz_content_fingerprint(fileDigest, userAnnots, digest);
+    return true;
+}
+
 char *PdfEngineImpl::GetDecryptionKey() const
 {
     if (!_decryptionKey)
@@ -3434,15 +3950,17 @@ struct XpsPageRun {
     fz_display_list *list;
     size_t size_est;
     int refs;
+    XpsPageRun *next; // for PageRunIndex
 
     XpsPageRun(xps_page *page, fz_display_list *list, ListInspectionData& data) :
-        page(page), list(list), size_est(data.mem_estimate), refs(1) { }
+        page(page), list(list), size_est(fz_display_list_size(list) + data.mem_estimate),
+        refs(1), next(NULL) { }
 };
 
 class XpsTocItem;
 class XpsImage;
 
-class XpsEngineImpl : public XpsEngine {
+class XpsEngineImpl : public XpsEngine, public PageRunPrefetcher::Builder {
     friend XpsEngine;
     friend XpsImage;
 
@@ -3486,6 +4004,8 @@ public:
     virtual const WCHAR *GetDefaultFileExt() const { return L".xps"; }
 
     virtual bool BenchLoadPage(int pageNo) { return GetXpsPage(pageNo) != NULL; }
+    virtual bool BenchBuildPageRun(int pageNo);
+    virtual void BenchGetCacheStats(Vec<EngineCacheStats>& stats);
 
     virtual Vec<PageElement *> *GetElements(int pageNo);
     virtual PageElement *GetElementAtPos(int pageNo, PointD pt);
@@ -3494,6 +4014,11 @@ public:
     virtual bool HasTocTree() const { return _outline != NULL; }
     virtual DocTocItem *GetTocTree();
 
+    virtual bool GetContentFingerprint(unsigned char digest[16], bool *cancel=NULL);
+
+    virtual void PrefetchPageRun(int pageNo);
+    virtual bool IsBusy() { return runningPages > 0; }
+
     fz_rect FindDestRect(const char *target);
 
 protected:
@@ -3503,7 +4028,7 @@ protected:
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION ctxAccess;
     fz_context *    ctx;
-    fz_locks_context fz_locks_ctx;
+    FitzContextPool ctxPool;
     xps_document *  _doc;
 
     CRITICAL_SECTION _pagesAccess;
@@ -3514,6 +4039,10 @@ protected:
     bool            Load(fz_stream *stm);
     bool            LoadFromStream(fz_stream *stm);
 
+    // cf. PdfEngineImpl::GetContentFingerprint
+    unsigned char   fileDigest[16];
+    bool            hasFileDigest;
+
     xps_page      * GetXpsPage(int pageNo, bool failIfBusy=false);
     int             GetPageNo(xps_page *page);
     fz_matrix       viewctm(int pageNo, float zoom, int rotation) {
@@ -3531,8 +4060,13 @@ protected:
                                     RectI **coords_out=NULL, bool cacheRun=false);
 
     Vec<XpsPageRun*>runCache; // ordered most recently used first
+    PageRunIndex<XpsPageRun, xps_page> runIndex;
+    size_t          runCacheSize;
+    PageRunPrefetcher *prefetcher;
+    LONG            runningPages;
     XpsPageRun    * CreatePageRun(xps_page *page, fz_display_list *list);
     XpsPageRun    * GetPageRun(xps_page *page, bool tryOnly=false);
+    void            RequestPrefetch(int pageNo);
     bool            RunPage(xps_page *page, fz_device *dev, const fz_matrix *ctm,
                             const fz_rect *cliprect=NULL, bool cacheRun=true,
                             FitzAbortCookie *cookie=NULL);
@@ -3624,19 +4158,22 @@ public:
 };
 
 XpsEngineImpl::XpsEngineImpl() : _fileName(NULL), _doc(NULL), _pages(NULL), _mediaboxes(NULL),
-    _outline(NULL), _info(NULL), imageRects(NULL)
+    _outline(NULL), _info(NULL), imageRects(NULL),
+    runCacheSize(0), prefetcher(NULL), runningPages(0), hasFileDigest(false)
 {
     InitializeCriticalSection(&_pagesAccess);
     InitializeCriticalSection(&ctxAccess);
 
-    fz_locks_ctx.user = &ctxAccess;
-    fz_locks_ctx.lock = fz_lock_context_cs;
-    fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(NULL, &fz_locks_ctx, MAX_CONTEXT_MEMORY);
+    ctx = NewFitzContext(&ctxPool.fz_locks_ctx);
 }
 
 XpsEngineImpl::~XpsEngineImpl()
 {
+    if (prefetcher) {
+        prefetcher->Stop();
+        delete prefetcher;
+    }
+
     EnterCriticalSection(&_pagesAccess);
     EnterCriticalSection(&ctxAccess);
 
@@ -3662,6 +4199,7 @@ XpsEngineImpl::~XpsEngineImpl()
 
     xps_close_document(_doc);
     _doc = NULL;
+    ctxPool.FreeAll();
     fz_free_context(ctx);
     ctx = NULL;
 
@@ -3857,29 +4395,8 @@ XpsPageRun *XpsEngineImpl::GetPageRun(xps_page *page, bool tryOnly)
 {
     ScopedCritSec scope(&_pagesAccess);
 
-    XpsPageRun *result = NULL;
-
-    for (size_t i = 0; i < runCache.Count(); i++) {
-        if (runCache.At(i)->page == page) {
-            result = runCache.At(i);
-            break;
-        }
-    }
+    XpsPageRun *result = runIndex.Find(page);
     if (!result && !tryOnly) {
-        size_t mem = 0;
-        for (size_t i = 0; i < runCache.Count(); i++) {
-            // drop page runs that take up too much memory due to huge images
-            // (except for the very recently used ones)
-            if (i >= 2 && mem + runCache.At(i)->size_est >= MAX_PAGE_RUN_MEMORY)
-                DropPageRun(runCache.At(i--), true);
-            else
-                mem += runCache.At(i)->size_est;
-        }
-        if (runCache.Count() >= MAX_PAGE_RUN_CACHE) {
-            assert(runCache.Count() == MAX_PAGE_RUN_CACHE);
-            DropPageRun(runCache.Last(), true);
-        }
-
         ScopedCritSec ctxScope(&ctxAccess);
 
         fz_display_list *list = NULL;
@@ -3900,6 +4417,13 @@ XpsPageRun *XpsEngineImpl::GetPageRun(xps_page *page, bool tryOnly)
         if (list) {
             result = CreatePageRun(page, list);
             runCache.InsertAt(0, result);
+            runIndex.Add(result);
+            runCacheSize += result->size_est;
+            // cf. PdfEngineImpl::GetPageRun
+            while (runCache.Count() > MIN_PAGE_RUN_CACHE &&
+                   (runCacheSize > gMaxPageRunMemory || runCache.Count() > MAX_PAGE_RUN_CACHE)) {
+                DropPageRun(runCache.Last(), true);
+            }
         }
     }
     else if (result && result != runCache.At(0)) {
@@ -3913,29 +4437,85 @@ XpsPageRun *XpsEngineImpl::GetPageRun(xps_page *page, bool tryOnly)
     return result;
 }
 
+void XpsEngineImpl::RequestPrefetch(int pageNo)
+{
+    // cf. PdfEngineImpl::RequestPrefetch
+    if (!prefetcher) {
+        PageRunPrefetcher *newPrefetcher = new PageRunPrefetcher(this);
+        if (InterlockedCompareExchangePointer((void **)&prefetcher, newPrefetcher, NULL))
+            delete newPrefetcher;
+        else
+            newPrefetcher->Start();
+    }
+    prefetcher->Request(pageNo);
+}
+
+void XpsEngineImpl::PrefetchPageRun(int pageNo)
+{
+    if (pageNo < 1 || pageNo > PageCount())
+        return;
+    ScopedCritSec scope(&_pagesAccess);
+    if (runCacheSize > gMaxPageRunMemory)
+        return;
+    xps_page *page = GetXpsPage(pageNo);
+    XpsPageRun *run = page ? GetPageRun(page) : NULL;
+    if (run)
+        DropPageRun(run);
+}
+
+bool XpsEngineImpl::BenchBuildPageRun(int pageNo)
+{
+    ScopedCritSec scope(&_pagesAccess);
+    xps_page *page = GetXpsPage(pageNo);
+    XpsPageRun *run = page ? GetPageRun(page) : NULL;
+    if (run)
+        DropPageRun(run);
+    return run != NULL;
+}
+
+void XpsEngineImpl::BenchGetCacheStats(Vec<EngineCacheStats>& stats)
+{
+    ScopedCritSec scope(&ctxAccess);
+    GetFitzCacheStats(ctx, stats);
+}
+
 bool XpsEngineImpl::RunPage(xps_page *page, fz_device *dev, const fz_matrix *ctm, const fz_rect *cliprect, bool cacheRun, FitzAbortCookie *cookie)
 {
     bool ok = true;
 
+    // cf. PdfEngineImpl::RunPage
+    InterlockedIncrement(&runningPages);
+
+    // cf. PdfEngineImpl::RunPage
+    bool isClone = dev->ctx != ctx;
+
     XpsPageRun *run = GetPageRun(page, !cacheRun);
     if (run) {
         EnterCriticalSection(&ctxAccess);
         Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page));
-        fz_try(ctx) {
-            fz_rect pagerect;
-            fz_begin_page(dev, xps_bound_page(_doc, page, &pagerect), ctm);
+        fz_rect pagerect;
+        xps_bound_page(_doc, page, &pagerect);
+        if (isClone)
+            LeaveCriticalSection(&ctxAccess);
+        fz_context *runCtx = dev->ctx;
+        fz_try(runCtx) {
+            fz_begin_page(dev, &pagerect, ctm);
             fz_run_page_transparency(pageAnnots, dev, cliprect, false);
             fz_run_display_list(run->list, dev, ctm, cliprect, cookie ? &cookie->cookie : NULL);
             fz_run_page_transparency(pageAnnots, dev, cliprect, true);
             fz_run_user_page_annots(pageAnnots, dev, ctm, cliprect, cookie ? &cookie->cookie : NULL);
             fz_end_page(dev);
         }
-        fz_catch(ctx) {
+        fz_catch(runCtx) {
             ok = false;
         }
-        LeaveCriticalSection(&ctxAccess);
+        if (!isClone)
+            LeaveCriticalSection(&ctxAccess);
         DropPageRun(run);
     }
+    else if (isClone) {
+        ok = false;
+    }
     else {
         ScopedCritSec scope(&ctxAccess);
         Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page));
@@ -3953,10 +4533,16 @@ bool XpsEngineImpl::RunPage(xps_page *page, fz_device *dev, const fz_matrix *ctm
         }
     }
 
-    EnterCriticalSection(&ctxAccess);
-    fz_free_device(dev);
-    LeaveCriticalSection(&ctxAccess);
+    if (isClone) {
+        fz_free_device(dev);
+    }
+    else {
+        EnterCriticalSection(&ctxAccess);
+        fz_free_device(dev);
+        LeaveCriticalSection(&ctxAccess);
+    }
 
+    InterlockedDecrement(&runningPages);
     return ok && !(cookie && cookie->cookie.abort);
 }
 
@@ -3966,7 +4552,10 @@ void XpsEngineImpl::DropPageRun(XpsPageRun *run, bool forceRemove)
     run->refs--;
 
     if (0 == run->refs || forceRemove) {
-        runCache.Remove(run);
+        if (runCache.Remove(run)) {
+            runIndex.Remove(run);
+            runCacheSize -= run->size_est;
+        }
         if (0 == run->refs) {
             ScopedCritSec ctxScope(&ctxAccess);
             fz_drop_display_list(ctx, run->list);
@@ -4147,41 +4736,60 @@ RenderedBitmap *XpsEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
         return new RenderedBitmap(hbmp, SizeI(w, h));
     }
 
-    fz_pixmap *image = NULL;
-    EnterCriticalSection(&ctxAccess);
-    fz_try(ctx) {
-        fz_colorspace *colorspace = fz_device_rgb(ctx);
-        image = fz_new_pixmap_with_bbox(ctx, colorspace, &bbox);
-        fz_clear_pixmap_with_value(ctx, image, 0xFF); // initialize white background
-    }
-    fz_catch(ctx) {
-        LeaveCriticalSection(&ctxAccess);
-        return NULL;
+    // cached display lists are rasterized on a clone of ctx, so that several
+    // pages (or tiles) can be rendered in parallel (cf. RunPage)
+    XpsPageRun *run = GetPageRun(page);
+    if (run && Target_View == target)
+        RequestPrefetch(pageNo);
+    fz_context *renderCtx = run ? ctxPool.Acquire(ctx) : NULL;
+    bool isClone = renderCtx != NULL;
+    if (!isClone) {
+        renderCtx = ctx;
+        EnterCriticalSection(&ctxAccess);
     }
 
+    fz_pixmap *image = NULL;
     fz_device *dev = NULL;
-    fz_try(ctx) {
-        dev = fz_new_draw_device(ctx, image);
-    }
-    fz_catch(ctx) {
-        fz_drop_pixmap(ctx, image);
+    fz_var(image);
+    fz_try(renderCtx) {
+        // render directly into a GDI compatible format (cf. new_rendered_fz_pixmap)
+        fz_colorspace *colorspace = fz_device_bgr(renderCtx);
+        image = fz_new_pixmap_with_bbox(renderCtx, colorspace, &bbox);
+        fz_clear_pixmap_with_value(renderCtx, image, 0xFF); // initialize white background
+        dev = fz_new_draw_device(renderCtx, image);
+    }
+    fz_catch(renderCtx) {
+        fz_drop_pixmap(renderCtx, image);
+        image = NULL;
+    }
+    if (!isClone)
         LeaveCriticalSection(&ctxAccess);
+    if (!image) {
+        if (isClone)
+            ctxPool.Release(renderCtx);
+        if (run)
+            DropPageRun(run);
         return NULL;
     }
-    LeaveCriticalSection(&ctxAccess);
 
     FitzAbortCookie *cookie = NULL;
     if (cookie_out)
         *cookie_out = cookie = new FitzAbortCookie();
     fz_rect cliprect;
     bool ok = RunPage(page, dev, &ctm, fz_rect_from_irect(&cliprect, &bbox), true, cookie);
+    if (run)
+        DropPageRun(run);
 
-    ScopedCritSec scope(&ctxAccess);
-
+    if (!isClone)
+        EnterCriticalSection(&ctxAccess);
     RenderedBitmap *bitmap = NULL;
     if (ok)
-        bitmap = new_rendered_fz_pixmap(ctx, image);
-    fz_drop_pixmap(ctx, image);
+        bitmap = new_rendered_fz_pixmap(renderCtx, image);
+    fz_drop_pixmap(renderCtx, image);
+    if (isClone)
+        ctxPool.Release(renderCtx);
+    else
+        LeaveCriticalSection(&ctxAccess);
     return bitmap;
 }
 
@@ -4298,6 +4906,33 @@ bool XpsEngineImpl::SupportsAnnotation(bool forSaving) const
     return !forSaving; // for now
 }
 
+bool XpsEngineImpl::GetContentFingerprint(unsigned char digest[16], bool *cancel)
+{
+    // documents loaded from a directory don't have a single stream
+    if (!_doc->file)
+        return false;
+
+    EnterCriticalSection(&ctxAccess);
+    bool needsDigest = !hasFileDigest;
+    LeaveCriticalSection(&ctxAccess);
+    if (needsDigest) {
+        // don't block rendering while reading through large files
+        unsigned char newDigest[16];
+        if (!fz_stream_fingerprint(_doc->file, newDigest, &ctxAccess, cancel))
+            return false;
+        ScopedCritSec scope(&ctxAccess);
+        memcpy(fileDigest, newDigest, 16);
+        hasFileDigest = true;
+    }
+
+    ScopedCritSec scope(&ctxAccess);
+    static const unsigned char nullDigest[16] = { 0 };
+    if (memeq(fileDigest, nullDigest, 16))
+        return false;
+    fz_content_fingerprint(fileDigest, userAnnots, digest);
+    return true;
+}
+
 void XpsEngineImpl::UpdateUserAnnotations(Vec<PageAnnotation> *list)
 {
     // TODO: use a new critical section to avoid blocking the UI thread
@@ -29,5 +29,17 @@ public:
 
 void CalcMD5Digest(const unsigned char *data, size_t byteCount, unsigned char digest[16]);
 void DebugGdiPlusDevice(bool enable);
+// maximum amount of memory used for caching display lists per document
+// (0 restores the default)
+void SetPageRunCacheSize(size_t maxBytes);
+// allows comparing the SIMD and scalar rendering code paths (returns false
+// if the SIMD code paths aren't supported by this CPU)
+bool DebugSimdPainters(bool enable);
+// allows comparing the image scaler's approximate fast paths
+// with its general code path (enabled by default)
+void DebugFastPaths(bool enable);
+// allows comparing reading larger files through a file descriptor
+// with reading them from a memory mapping (enabled by default)
+void DebugFileMapping(bool enable);
 
 #endif
@@ -38,6 +38,23 @@ struct PdfsyncPoint {
     UINT page, x, y;
 };
 
+// entry of an index into <lines> or <points> sorted by two keys
+// (e.g. page and y coordinate) and then by position in the sync file
+struct PdfsyncIndexEntry {
+    UINT key1, key2;
+    UINT ix;
+};
+
+// parser state at the beginning of a sheet ('s' line), so that after a change
+// only the part of the sync file following the first changed sheet is reparsed
+struct PdfsyncCheckpoint {
+    size_t offset;  // offset of the 's' line in the sync file
+    uint32_t hash;  // hash of the sync file data since the previous checkpoint
+    UINT page;
+    size_t srcfiles, lines, points, files, sheets;
+    size_t stackStart, stackLen; // file stack (in <checkpointStacks>)
+};
+
 // Synchronizer based on .pdfsync file generated with the pdfsync tex package
 class Pdfsync : public Synchronizer
 {
@@ -53,6 +70,7 @@ public:
 
 private:
     int RebuildIndex();
+    void BuildLookupIndices();
     UINT SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<size_t>& records);
 
     PdfEngine *engine;          // needed for converting between coordinate systems
@@ -61,6 +79,12 @@ private:
     Vec<PdfsyncPoint> points;   // record-to-point mapping
     Vec<PdfsyncFileIndex> fileIndex; // start and end of entries for a file in <lines>
     Vec<size_t> sheetIndex;     // start of entries for a sheet in <points>
+
+    Vec<PdfsyncIndexEntry> pointsByPos;    // <points> sorted by page and y coordinate
+    Vec<PdfsyncIndexEntry> pointsByRecord; // <points> sorted by record
+    Vec<PdfsyncIndexEntry> linesBySource;  // <lines> sorted by file and line number
+    Vec<PdfsyncCheckpoint> checkpoints;
+    Vec<size_t> checkpointStacks;
 };
 
 // Synchronizer based on .synctex file generated with SyncTex
@@ -102,7 +126,7 @@ bool Synchronizer::IsIndexDiscarded() const
     // has the synchronization file been changed on disk?
     struct _stat newstamp;
     if (_wstat(syncfilepath, &newstamp) == 0 &&
-        difftime(newstamp.st_mtime, syncfileTimestamp.st_mtime) > 0) {
+        (newstamp.st_mtime != syncfileTimestamp.st_mtime || newstamp.st_size != syncfileTimestamp.st_size)) {
         // update time stamp
         memcpy((void *)&syncfileTimestamp, &newstamp, sizeof(syncfileTimestamp));
         return true; // the file has changed!
@@ -199,6 +223,13 @@ static char *Advance0Line(char *line, char *end)
     return line < end ? line : NULL;
 }
 
+template <typename T>
+static void TruncateVec(Vec<T>& v, size_t count)
+{
+    if (v.Count() > count)
+        v.RemoveAt(count, v.Count() - count);
+}
+
 // see http://itexmac.sourceforge.net/pdfsync.html for the specification
 int Pdfsync::RebuildIndex()
 {
@@ -215,31 +246,70 @@ int Pdfsync::RebuildIndex()
 
     // replace star by spaces (TeX uses stars instead of spaces in filenames)
     str::TransChars(line, "*/", " \\");
-    ScopedMem<WCHAR> jobName(str::conv::FromAnsi(line));
-    jobName.Set(str::Join(jobName, L".tex"));
-    jobName.Set(PrependDir(jobName));
-
-    line = Advance0Line(line, dataEnd);
-    UINT versionNumber = 0;
-    if (!line || !str::Parse(line, "version %u", &versionNumber) || versionNumber != 1)
-        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
 
-    // reset synchronizer database
-    srcfiles.Reset();
-    lines.Reset();
-    points.Reset();
-    fileIndex.Reset();
-    sheetIndex.Reset();
+    // LaTeX rewrites the whole sync file, but usually only the sheets following
+    // the first edit differ, so continue parsing after the last unchanged checkpoint
+    size_t unchanged = 0, prevOffset = 0;
+    for (; unchanged < checkpoints.Count(); unchanged++) {
+        PdfsyncCheckpoint& cp = checkpoints.At(unchanged);
+        if (cp.offset > len || MurmurHash2(data + prevOffset, cp.offset - prevOffset) != cp.hash)
+            break;
+        prevOffset = cp.offset;
+    }
 
     Vec<size_t> filestack;
     UINT page = 1;
-    sheetIndex.Append(0);
-
-    // add the initial tex file to the source file stack
-    filestack.Push(srcfiles.Count());
-    srcfiles.Append(jobName.StealData());
     PdfsyncFileIndex findex = { 0 };
-    fileIndex.Append(findex);
+
+    if (unchanged > 0) {
+        // restore the parser state at the last unchanged checkpoint (which
+        // is recreated when its 's' line is parsed once more below)
+        PdfsyncCheckpoint cp = checkpoints.At(unchanged - 1);
+        while (srcfiles.Count() > cp.srcfiles)
+            free(srcfiles.Pop());
+        TruncateVec(lines, cp.lines);
+        TruncateVec(points, cp.points);
+        TruncateVec(fileIndex, cp.files);
+        TruncateVec(sheetIndex, cp.sheets);
+        filestack.Append(checkpointStacks.LendData() + cp.stackStart, cp.stackLen);
+        TruncateVec(checkpointStacks, cp.stackStart);
+        TruncateVec(checkpoints, unchanged - 1);
+        // files which haven't been closed yet get their end when they are
+        for (size_t i = 0; i < filestack.Count(); i++) {
+            fileIndex.At(filestack.At(i)).end = fileIndex.At(filestack.At(i)).start;
+        }
+        page = cp.page;
+        prevOffset = unchanged > 1 ? checkpoints.Last().offset : 0;
+        // Advance0Line continues with the 's' line right after this line break
+        line = data + cp.offset - 1;
+    }
+    else {
+        ScopedMem<WCHAR> jobName(str::conv::FromAnsi(line));
+        jobName.Set(str::Join(jobName, L".tex"));
+        jobName.Set(PrependDir(jobName));
+
+        line = Advance0Line(line, dataEnd);
+        UINT versionNumber = 0;
+        if (!line || !str::Parse(line, "version %u", &versionNumber) || versionNumber != 1)
+            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+
+        // reset synchronizer database
+        srcfiles.Reset();
+        lines.Reset();
+        points.Reset();
+        fileIndex.Reset();
+        sheetIndex.Reset();
+        checkpoints.Reset();
+        checkpointStacks.Reset();
+        prevOffset = 0;
+
+        sheetIndex.Append(0);
+
+        // add the initial tex file to the source file stack
+        filestack.Push(srcfiles.Count());
+        srcfiles.Append(jobName.StealData());
+        fileIndex.Append(findex);
+    }
 
     PdfsyncLine psline;
     PdfsyncPoint pspoint;
@@ -262,6 +332,22 @@ int Pdfsync::RebuildIndex()
             break;
 
         case 's':
+            {
+                PdfsyncCheckpoint cp;
+                cp.offset = line - data;
+                cp.hash = MurmurHash2(data + prevOffset, cp.offset - prevOffset);
+                cp.page = page;
+                cp.srcfiles = srcfiles.Count();
+                cp.lines = lines.Count();
+                cp.points = points.Count();
+                cp.files = fileIndex.Count();
+                cp.sheets = sheetIndex.Count();
+                cp.stackStart = checkpointStacks.Count();
+                cp.stackLen = filestack.Count();
+                checkpointStacks.Append(filestack.LendData(), filestack.Count());
+                checkpoints.Append(cp);
+                prevOffset = cp.offset;
+            }
             if (str::Parse(line, "s %u", &page))
                 sheetIndex.Append(points.Count());
             // else dbg("Bad 's' line in the pdfsync file");
@@ -318,11 +404,61 @@ int Pdfsync::RebuildIndex()
     fileIndex.At(0).end = lines.Count();
     assert(filestack.Count() == 1);
 
+    BuildLookupIndices();
+
     return Synchronizer::RebuildIndex();
 }
 
+static int cmpIndexEntries(const void *a, const void *b)
+{
+    const PdfsyncIndexEntry *e1 = (const PdfsyncIndexEntry *)a, *e2 = (const PdfsyncIndexEntry *)b;
+    if (e1->key1 != e2->key1)
+        return e1->key1 < e2->key1 ? -1 : 1;
+    if (e1->key2 != e2->key2)
+        return e1->key2 < e2->key2 ? -1 : 1;
+    return e1->ix < e2->ix ? -1 : e1->ix > e2->ix ? 1 : 0;
+}
+
+// returns the position of the first entry with keys not less than key1 and key2
+static size_t LowerBound(Vec<PdfsyncIndexEntry>& index, UINT key1, UINT key2)
+{
+    size_t lo = 0, hi = index.Count();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        PdfsyncIndexEntry& e = index.At(mid);
+        if (e.key1 < key1 || e.key1 == key1 && e.key2 < key2)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void Pdfsync::BuildLookupIndices()
+{
+    pointsByPos.Reset();
+    pointsByRecord.Reset();
+    linesBySource.Reset();
+
+    for (size_t i = 0; i < points.Count(); i++) {
+        PdfsyncIndexEntry byPos = { points.At(i).page, points.At(i).y, (UINT)i };
+        pointsByPos.Append(byPos);
+        PdfsyncIndexEntry byRecord = { points.At(i).record, 0, (UINT)i };
+        pointsByRecord.Append(byRecord);
+    }
+    for (size_t i = 0; i < lines.Count(); i++) {
+        PdfsyncIndexEntry bySource = { (UINT)lines.At(i).file, lines.At(i).line, (UINT)i };
+        linesBySource.Append(bySource);
+    }
+    pointsByPos.Sort(cmpIndexEntries);
+    pointsByRecord.Sort(cmpIndexEntries);
+    linesBySource.Sort(cmpIndexEntries);
+}
+
 // convert a coordinate from the sync file into a PDF coordinate
 #define SYNC_TO_PDF_COORDINATE(c)  (c/65781.76)
+// convert a PDF coordinate into a (lower bound for a) coordinate from the sync file
+#define PDF_TO_SYNC_COORDINATE(c)  (UINT)((c) <= 0 ? 0 : (c) * 65781.76)
 
 static int cmpLineRecords(const void *a, const void *b)
 {
@@ -345,27 +481,38 @@ int Pdfsync::DocToSource(UINT pageNo, PointI pt, ScopedMem<WCHAR>& filename, UIN
 
     // distance to the closest pdf location (in the range <PDFSYNC_EPSILON_SQUARE)
     UINT closest_xydist = UINT_MAX;
-    UINT selected_record = UINT_MAX;
+    UINT selected_record = UINT_MAX, selected_ix = UINT_MAX;
     // If no record is found within a distance^2 of PDFSYNC_EPSILON_SQUARE
     // (selected_record == -1) then we pick up the record that is closest
     // vertically to the hit-point.
     UINT closest_ydist = UINT_MAX; // vertical distance between the hit point and the vertically-closest record
     UINT closest_xdist = UINT_MAX; // horizontal distance between the hit point and the vertically-closest record
-    UINT closest_ydist_record = UINT_MAX; // vertically-closest record
-
-    // read all the sections of 'p' declarations for this pdf sheet
-    for (size_t i = sheetIndex.At(pageNo); i < points.Count() && points.At(i).page == pageNo; i++) {
-        // check whether it is closer than the closest point found so far
-        UINT dx = abs(pt.x - (int)SYNC_TO_PDF_COORDINATE(points.At(i).x));
-        UINT dy = abs(pt.y - (int)SYNC_TO_PDF_COORDINATE(points.At(i).y));
+    UINT closest_ydist_record = UINT_MAX, closest_ydist_ix = UINT_MAX; // vertically-closest record
+
+    // only points at most sqrt(PDFSYNC_EPSILON_SQUARE) (or PDFSYNC_EPSILON_Y)
+    // above or below the hit-point can be close enough; among points at the same
+    // distance, the one declared first in the sync file wins
+    int maxDy = max((int)ceil(sqrt((double)PDFSYNC_EPSILON_SQUARE)), PDFSYNC_EPSILON_Y) + 1;
+    for (size_t i = LowerBound(pointsByPos, pageNo, PDF_TO_SYNC_COORDINATE(pt.y - maxDy)); i < pointsByPos.Count(); i++) {
+        PdfsyncIndexEntry& e = pointsByPos.At(i);
+        if (e.key1 != pageNo || (int)SYNC_TO_PDF_COORDINATE(e.key2) > pt.y + maxDy)
+            break;
+        PdfsyncPoint& point = points.At(e.ix);
+        UINT dx = abs(pt.x - (int)SYNC_TO_PDF_COORDINATE(point.x));
+        UINT dy = abs(pt.y - (int)SYNC_TO_PDF_COORDINATE(point.y));
         UINT dist = dx * dx + dy * dy;
-        if (dist < PDFSYNC_EPSILON_SQUARE && dist < closest_xydist) {
-            selected_record = points.At(i).record;
-            closest_xydist = dist;
+        if (dist < PDFSYNC_EPSILON_SQUARE) {
+            if (dist < closest_xydist || dist == closest_xydist && e.ix < selected_ix) {
+                selected_record = point.record;
+                selected_ix = e.ix;
+                closest_xydist = dist;
+            }
         }
-        else if ((closest_xydist == UINT_MAX) && dy < PDFSYNC_EPSILON_Y &&
-                 (dy < closest_ydist || (dy == closest_ydist && dx < closest_xdist))) {
-            closest_ydist_record = points.At(i).record;
+        else if (dy < PDFSYNC_EPSILON_Y &&
+                 (dy < closest_ydist || (dy == closest_ydist && (dx < closest_xdist ||
+                                                                 dx == closest_xdist && e.ix < closest_ydist_ix)))) {
+            closest_ydist_record = point.record;
+            closest_ydist_ix = e.ix;
             closest_ydist = dy;
             closest_xdist = dx;
         }
@@ -414,33 +561,37 @@ UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<
     if (!srcfilepath)
         return PDFSYNCERR_OUTOFMEMORY;
 
-    // find the source file entry
+    // find the source file entry (comparing paths before
+    // comparing files, as path::IsSame has to open both files)
     size_t isrc;
     for (isrc = 0; isrc < srcfiles.Count(); isrc++)
-        if (path::IsSame(srcfilepath, srcfiles.At(isrc)))
+        if (str::EqI(srcfilepath, srcfiles.At(isrc)))
             break;
+    if (isrc == srcfiles.Count()) {
+        for (isrc = 0; isrc < srcfiles.Count(); isrc++)
+            if (path::IsSame(srcfilepath, srcfiles.At(isrc)))
+                break;
+    }
     if (isrc == srcfiles.Count())
         return PDFSYNCERR_UNKNOWN_SOURCEFILE;
 
     if (fileIndex.At(isrc).start == fileIndex.At(isrc).end)
         return PDFSYNCERR_NORECORD_IN_SOURCEFILE; // there is not any record declaration for that particular source file
 
-    // look for sections belonging to the specified file
-    // starting with the first section that is declared within the scope of the file.
-    UINT min_distance = EPSILON_LINE; // distance to the closest record
+    // look for the closest line (at a distance of less than EPSILON_LINE) and
+    // among equally close lines for the one declared first in the sync file
     size_t lineIx = (size_t)-1; // closest record-line index
-
-    for (size_t isec = fileIndex.At(isrc).start; isec < fileIndex.At(isrc).end; isec++) {
-        // does this section belong to the desired file?
-        if (lines.At(isec).file != isrc)
-            continue;
-
-        UINT d = abs((int)lines.At(isec).line - (int)line);
-        if (d < min_distance) {
-            min_distance = d;
-            lineIx = isec;
-            if (0 == d)
-                break; // We have found a record for the requested line!
+    for (UINT d = 0; d < EPSILON_LINE && lineIx == (size_t)-1; d++) {
+        for (int dir = -1; dir <= 1; dir += 2) {
+            if (dir < 0 ? d > line : 0 == d)
+                continue;
+            UINT candidate = dir < 0 ? line - d : line + d;
+            size_t i = LowerBound(linesBySource, (UINT)isrc, candidate);
+            if (i == linesBySource.Count())
+                continue;
+            PdfsyncIndexEntry& e = linesBySource.At(i);
+            if (e.key1 == isrc && e.key2 == candidate && e.ix < lineIx)
+                lineIx = e.ix;
         }
     }
     if (lineIx == (size_t)-1)
@@ -453,6 +604,12 @@ UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<
     return PDFSYNCERR_SUCCESS;
 }
 
+static int cmpUINT(const void *a, const void *b)
+{
+    UINT u1 = *(const UINT *)a, u2 = *(const UINT *)b;
+    return u1 < u2 ? -1 : u1 > u2 ? 1 : 0;
+}
+
 int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT *page, Vec<RectI> &rects)
 {
     if (IsIndexDiscarded())
@@ -466,17 +623,27 @@ int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT *pa
 
     rects.Reset();
 
+    // collect the points for all found records (in the order they're declared in)
+    Vec<UINT> found_points;
+    for (size_t i = 0; i < found_records.Count(); i++) {
+        UINT record = (UINT)found_records.At(i);
+        for (size_t j = LowerBound(pointsByRecord, record, 0); j < pointsByRecord.Count() && pointsByRecord.At(j).key1 == record; j++) {
+            if (!found_points.Contains(pointsByRecord.At(j).ix))
+                found_points.Append(pointsByRecord.At(j).ix);
+        }
+    }
+    found_points.Sort(cmpUINT);
+
     // records have been found for the desired source position:
     // we now find the page and positions in the PDF corresponding to these found records
     UINT firstPage = UINT_MAX;
-    for (size_t i = 0; i < points.Count(); i++) {
-        if (!found_records.Contains(points.At(i).record))
-            continue;
-        if (firstPage != UINT_MAX && firstPage != points.At(i).page)
+    for (size_t i = 0; i < found_points.Count(); i++) {
+        PdfsyncPoint& point = points.At(found_points.At(i));
+        if (firstPage != UINT_MAX && firstPage != point.page)
             continue;
-        firstPage = *page = points.At(i).page;
-        RectD rc(SYNC_TO_PDF_COORDINATE(points.At(i).x),
-                 SYNC_TO_PDF_COORDINATE(points.At(i).y),
+        firstPage = *page = point.page;
+        RectD rc(SYNC_TO_PDF_COORDINATE(point.x),
+                 SYNC_TO_PDF_COORDINATE(point.y),
                  MARK_SIZE, MARK_SIZE);
         // PdfSync coordinates are y-inversed
         RectD mbox = engine->PageMediabox(firstPage);
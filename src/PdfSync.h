@@ -46,7 +46,7 @@ public:
 
 private:
     bool indexDiscarded; // true if the index needs to be recomputed (needs to be set to true when a change to the pdfsync file is detected)
-    struct _stat syncfileTimestamp; // time stamp of sync file when index was last built
+    struct _stat syncfileTimestamp; // time stamp and size of sync file when index was last built
 
 protected:
     bool IsIndexDiscarded() const;
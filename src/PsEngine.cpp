@@ -300,6 +300,13 @@ public:
     virtual bool BenchLoadPage(int pageNo) {
         return pdfEngine ? pdfEngine->BenchLoadPage(pageNo) : false;
     }
+    virtual bool BenchBuildPageRun(int pageNo) {
+        return pdfEngine ? pdfEngine->BenchBuildPageRun(pageNo) : false;
+    }
+    virtual void BenchGetCacheStats(Vec<EngineCacheStats>& stats) {
+        if (pdfEngine)
+            pdfEngine->BenchGetCacheStats(stats);
+    }
 
     virtual Vec<PageElement *> *GetElements(int pageNo) {
         return pdfEngine ? pdfEngine->GetElements(pageNo) : NULL;
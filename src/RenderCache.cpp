@@ -3,6 +3,7 @@
 
 #include "BaseUtil.h"
 #include "RenderCache.h"
+#include "DiskTileCache.h"
 #include "TextSelection.h"
 #include "WinUtil.h"
 
@@ -15,34 +16,51 @@
 #undef SHOW_TILE_LAYOUT
 
 RenderCache::RenderCache()
-    : cacheCount(0), requestCount(0),
+    : useCounter(0), cacheBytes(0), diskCache(NULL),
       maxTileSize(GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN)),
       isRemoteSession(GetSystemMetrics(SM_REMOTESESSION))
 {
     textColor = WIN_COL_BLACK;
     backgroundColor = WIN_COL_WHITE;
+    maxCacheBytes = (size_t)maxTileSize.dx * maxTileSize.dy * 4 * DEFAULT_CACHE_SCREENS;
 
     InitializeCriticalSection(&cacheAccess);
-    InitializeCriticalSection(&requestAccess);
+    ZeroMemory(buckets, sizeof(buckets));
+    ZeroMemory(&stats, sizeof(stats));
 
-    startRendering = CreateEvent(NULL, FALSE, FALSE, NULL);
-    renderThread = CreateThread(NULL, 0, RenderCacheThread, this, 0, 0);
-    assert(NULL != renderThread);
+    scheduler = new RenderScheduler(this);
 }
 
 RenderCache::~RenderCache()
 {
-    EnterCriticalSection(&requestAccess);
-    EnterCriticalSection(&cacheAccess);
-
-    CloseHandle(renderThread);
-    CloseHandle(startRendering);
-    assert(!curReq && 0 == requestCount && 0 == cacheCount);
+    // stops the rendering threads
+    delete scheduler;
 
+    EnterCriticalSection(&cacheAccess);
+    assert(0 == cache.Count());
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
-    LeaveCriticalSection(&requestAccess);
-    DeleteCriticalSection(&requestAccess);
+
+    delete diskCache;
+}
+
+// cached bitmaps are indexed by document and page, so that Find doesn't
+// have to compare against all cached tiles when painting a single one
+static size_t GetBucketIdx(DisplayModel *dm, int pageNo)
+{
+    return ((size_t)dm / sizeof(void *) * 31 + pageNo) % BITMAP_CACHE_BUCKETS;
+}
+
+static void LinkToBucket(BitmapCacheEntry **buckets, BitmapCacheEntry *entry)
+{
+    ListInsert(&buckets[GetBucketIdx(entry->dm, entry->pageNo)], entry);
+}
+
+static void UnlinkFromBucket(BitmapCacheEntry **buckets, BitmapCacheEntry *entry)
+{
+    bool found = ListRemove(&buckets[GetBucketIdx(entry->dm, entry->pageNo)], entry);
+    CrashIf(!found);
+    entry->next = NULL;
 }
 
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
@@ -52,11 +70,11 @@ BitmapCacheEntry *RenderCache::Find(DisplayModel *dm, int pageNo, int rotation,
 {
     ScopedCritSec scope(&cacheAccess);
     rotation = NormalizeRotation(rotation);
-    for (int i = 0; i < cacheCount; i++) {
-        BitmapCacheEntry *entry = cache[i];
+    for (BitmapCacheEntry *entry = buckets[GetBucketIdx(dm, pageNo)]; entry; entry = entry->next) {
         if ((dm == entry->dm) && (pageNo == entry->pageNo) && (rotation == entry->rotation) &&
             (INVALID_ZOOM == zoom || zoom == entry->zoom) && (!tile || entry->tile == *tile)) {
             entry->refs++;
+            entry->lastUsed = ++useCounter;
             return entry;
         }
     }
@@ -81,42 +99,90 @@ void RenderCache::DropCacheEntry(BitmapCacheEntry *entry)
     }
 }
 
+void RenderCache::InsertCacheEntry(BitmapCacheEntry *entry)
+{
+    entry->lastUsed = ++useCounter;
+    cache.Append(entry);
+    LinkToBucket(buckets, entry);
+    cacheBytes += entry->bytes;
+}
+
+void RenderCache::RemoveCacheEntry(size_t idx)
+{
+    BitmapCacheEntry *entry = cache.At(idx);
+    UnlinkFromBucket(buckets, entry);
+    cache.RemoveAt(idx);
+    CrashIf(cacheBytes < entry->bytes);
+    cacheBytes -= entry->bytes;
+    DropCacheEntry(entry);
+}
+
+// drops the least recently used bitmap of an invisible page of <dm>
+// (or else of any invisible page) and returns false if there's none
+// (or if <dm> is NULL, the least recently used bitmap overall)
+bool RenderCache::EvictCacheEntry(DisplayModel *dm)
+{
+    int sameDm = -1, otherDm = -1, any = -1;
+    for (size_t i = 0; i < cache.Count(); i++) {
+        BitmapCacheEntry *entry = cache.At(i);
+        if (-1 == any || entry->lastUsed < cache.At(any)->lastUsed)
+            any = (int)i;
+        if (!dm || entry->dm->PageVisibleNearby(entry->pageNo))
+            continue;
+        if (entry->dm == dm && (-1 == sameDm || entry->lastUsed < cache.At(sameDm)->lastUsed))
+            sameDm = (int)i;
+        else if (entry->dm != dm && (-1 == otherDm || entry->lastUsed < cache.At(otherDm)->lastUsed))
+            otherDm = (int)i;
+    }
+
+    int idx = sameDm != -1 ? sameDm : otherDm != -1 ? otherDm : !dm ? any : -1;
+    if (-1 == idx)
+        return false;
+    RemoveCacheEntry(idx);
+    stats.evictions++;
+    return true;
+}
+
 void RenderCache::Add(PageRenderRequest &req, RenderedBitmap *bitmap)
 {
     ScopedCritSec scope(&cacheAccess);
     assert(req.dm);
 
     req.rotation = NormalizeRotation(req.rotation);
-    assert(cacheCount <= MAX_BITMAPS_CACHED);
+    assert(cache.Count() <= MAX_BITMAPS_CACHED);
 
     /* It's possible there still is a cached bitmap with different zoom/rotation */
     FreePage(req.dm, req.pageNo, &req.tile);
 
-    if (cacheCount >= MAX_BITMAPS_CACHED) {
-        // free an invisible page of the same DisplayModel ...
-        for (int i = 0; i < cacheCount; i++) {
-            if (cache[i]->dm == req.dm && !req.dm->PageVisibleNearby(cache[i]->pageNo)) {
-                DropCacheEntry(cache[i]);
-                cacheCount--;
-                memmove(&cache[i], &cache[i + 1], (cacheCount - i) * sizeof(cache[0]));
-                break;
-            }
-        }
-        // ... or just the oldest cached page
-        if (cacheCount >= MAX_BITMAPS_CACHED) {
-            DropCacheEntry(cache[0]);
-            cacheCount--;
-            memmove(&cache[0], &cache[1], cacheCount * sizeof(cache[0]));
-        }
-    }
-
     // Copy the PageRenderRequest as it will be reused
-    cache[cacheCount] = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bitmap);
-    CrashIf(!cache[cacheCount]);
-    if (!cache[cacheCount])
+    BitmapCacheEntry *entry = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bitmap);
+    CrashIf(!entry);
+    if (!entry) {
         delete bitmap;
-    else
-        cacheCount++;
+        return;
+    }
+
+    // stay within the memory budget by dropping bitmaps of invisible pages
+    // (bitmaps of visible pages are only dropped if there are too many, as
+    // they would have to be rerendered immediately)
+    while (cache.Count() > 0 && cacheBytes + entry->bytes > maxCacheBytes) {
+        if (!EvictCacheEntry(req.dm))
+            break;
+    }
+    if (cache.Count() >= MAX_BITMAPS_CACHED && !EvictCacheEntry(req.dm))
+        EvictCacheEntry(NULL);
+
+    InsertCacheEntry(entry);
+}
+
+BitmapCacheStats RenderCache::GetStats()
+{
+    ScopedCritSec scope(&cacheAccess);
+    BitmapCacheStats result = stats;
+    result.count = cache.Count();
+    result.bytes = cacheBytes;
+    result.maxBytes = maxCacheBytes;
+    return result;
 }
 
 static RectD GetTileRect(RectD pagerect, TilePosition tile)
@@ -158,7 +224,7 @@ static bool IsTileVisible(DisplayModel *dm, int pageNo, TilePosition tile, float
     if (!dm) return false;
     PageInfo *pageInfo = dm->GetPageInfo(pageNo);
     if (!dm->engine || !pageInfo) return false;
-    RectI tileOnScreen = GetTileOnScreen(dm->engine, pageNo, dm->Rotation(), dm->ZoomReal(), tile, pageInfo->pageOnScreen);
+    RectI tileOnScreen = GetTileOnScreen(dm->engine, pageNo, dm->Rotation(), dm->ZoomReal(), tile, dm->GetPageOnScreen(pageNo));
     // consider nearby tiles visible depending on the fuzz factor
     tileOnScreen.x -= (int)(tileOnScreen.dx * fuzz * 0.5);
     tileOnScreen.dx = (int)(tileOnScreen.dx * (fuzz + 1));
@@ -173,11 +239,9 @@ static bool IsTileVisible(DisplayModel *dm, int pageNo, TilePosition tile, float
 void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
 {
     ScopedCritSec scope(&cacheAccess);
-    int cacheCountTmp = cacheCount;
-    int curPos = 0;
 
-    for (int i = 0; i < cacheCountTmp; i++) {
-        BitmapCacheEntry* entry = cache[i];
+    for (size_t i = cache.Count(); i > 0; i--) {
+        BitmapCacheEntry* entry = cache.At(i - 1);
         bool shouldFree;
         if (dm && pageNo != INVALID_PAGE_NO) {
             // a specific page
@@ -191,7 +255,7 @@ void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
             }
         } else if (dm) {
             // all pages of this DisplayModel
-            shouldFree = (cache[i]->dm == dm);
+            shouldFree = (entry->dm == dm);
         } else {
             // all invisible pages resp. page tiles
             shouldFree = !entry->dm->PageVisibleNearby(entry->pageNo);
@@ -199,16 +263,8 @@ void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
                 shouldFree = !IsTileVisible(entry->dm, entry->pageNo, entry->tile, 2.0);
         }
 
-        if (shouldFree) {
-            DropCacheEntry(entry);
-            cache[i] = NULL;
-            cacheCount--;
-        }
-
-        if (curPos != i)
-            cache[curPos] = cache[i];
-        if (!shouldFree)
-            curPos++;
+        if (shouldFree)
+            RemoveCacheEntry(i - 1);
     }
 }
 
@@ -217,13 +273,18 @@ void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
 void RenderCache::KeepForDisplayModel(DisplayModel *oldDm, DisplayModel *newDm)
 {
     ScopedCritSec scope(&cacheAccess);
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == oldDm) {
-            if (oldDm->PageVisible(cache[i]->pageNo))
-                cache[i]->dm = newDm;
+    for (size_t i = 0; i < cache.Count(); i++) {
+        BitmapCacheEntry *entry = cache.At(i);
+        if (entry->dm == oldDm) {
+            if (oldDm->PageVisible(entry->pageNo)) {
+                // the bucket index depends on the DisplayModel
+                UnlinkFromBucket(buckets, entry);
+                entry->dm = newDm;
+                LinkToBucket(buckets, entry);
+            }
             // make sure that the page is rerendered eventually
-            cache[i]->zoom = INVALID_ZOOM;
-            cache[i]->outOfDate = true;
+            entry->zoom = INVALID_ZOOM;
+            entry->outOfDate = true;
         }
     }
 }
@@ -231,20 +292,19 @@ void RenderCache::KeepForDisplayModel(DisplayModel *oldDm, DisplayModel *newDm)
 // marks all tiles containing rect of pageNo as out of date
 void RenderCache::Invalidate(DisplayModel *dm, int pageNo, RectD rect)
 {
-    ScopedCritSec scopeReq(&requestAccess);
+    ScopedCritSec scopeReq(scheduler->Access());
 
     ClearQueueForDisplayModel(dm, pageNo);
-    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo)
-        AbortCurrentRequest();
+    AbortCurrentRequests(dm, pageNo);
 
     ScopedCritSec scopeCache(&cacheAccess);
 
     RectD mediabox = dm->engine->PageMediabox(pageNo);
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == dm && cache[i]->pageNo == pageNo &&
-            !GetTileRect(mediabox, cache[i]->tile).Intersect(rect).IsEmpty()) {
-            cache[i]->zoom = INVALID_ZOOM;
-            cache[i]->outOfDate = true;
+    for (BitmapCacheEntry *entry = buckets[GetBucketIdx(dm, pageNo)]; entry; entry = entry->next) {
+        if (entry->dm == dm && entry->pageNo == pageNo &&
+            !GetTileRect(mediabox, entry->tile).Intersect(rect).IsEmpty()) {
+            entry->zoom = INVALID_ZOOM;
+            entry->outOfDate = true;
         }
     }
 }
@@ -283,10 +343,10 @@ USHORT RenderCache::GetMaxTileRes(DisplayModel *dm, int pageNo, int rotation)
 {
     ScopedCritSec scope(&cacheAccess);
     USHORT maxRes = 0;
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == dm && cache[i]->pageNo == pageNo &&
-            cache[i]->rotation == rotation) {
-            maxRes = max(cache[i]->tile.res, maxRes);
+    for (BitmapCacheEntry *entry = buckets[GetBucketIdx(dm, pageNo)]; entry; entry = entry->next) {
+        if (entry->dm == dm && entry->pageNo == pageNo &&
+            entry->rotation == rotation) {
+            maxRes = max(entry->tile.res, maxRes);
         }
     }
     return maxRes;
@@ -298,7 +358,7 @@ bool RenderCache::ReduceTileSize()
     if (maxTileSize.dx < 200 || maxTileSize.dy < 200)
         return false;
 
-    ScopedCritSec scope1(&requestAccess);
+    ScopedCritSec scope1(scheduler->Access());
     ScopedCritSec scope2(&cacheAccess);
 
     if (maxTileSize.dx > maxTileSize.dy)
@@ -307,11 +367,11 @@ bool RenderCache::ReduceTileSize()
         maxTileSize.dy /= 2;
 
     // invalidate all rendered bitmaps and all requests
-    while (cacheCount > 0)
-        FreeForDisplayModel(cache[0]->dm);
-    while (requestCount > 0)
-        ClearQueueForDisplayModel(requests[0].dm);
-    AbortCurrentRequest();
+    while (cache.Count() > 0)
+        FreeForDisplayModel(cache.At(0)->dm);
+    while (scheduler->QueuedCount() > 0)
+        ClearQueueForDisplayModel(scheduler->QueuedAt(0)->dm);
+    AbortCurrentRequests();
 
     return true;
 }
@@ -324,19 +384,21 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo)
     if (tile.res > 1)
         return;
 
-    RequestRendering(dm, pageNo, tile);
+    // pages which aren't visible yet are only prefetched
+    RenderPriority priority = dm->PageVisible(pageNo) ? Priority_Visible : Priority_Prefetch;
+    RequestRendering(dm, pageNo, tile, true, priority);
     // render both tiles of the first row when splitting a page in four
     // (which always happens on larger displays for Fit Width)
     if (tile.res == 1 && !IsRenderQueueFull()) {
         tile.col = 1;
-        RequestRendering(dm, pageNo, tile, false);
+        RequestRendering(dm, pageNo, tile, false, priority);
     }
 }
 
 /* Render a bitmap for page <pageNo> in <dm>. */
-void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition tile, bool clearQueueForPage)
+void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition tile, bool clearQueueForPage, RenderPriority priority)
 {
-    ScopedCritSec scope(&requestAccess);
+    ScopedCritSec scope(scheduler->Access());
     assert(dm);
     if (!dm || dm->dontRenderFlag)
         return;
@@ -344,39 +406,39 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
     int rotation = NormalizeRotation(dm->Rotation());
     float zoom = dm->ZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
+    PageRenderRequest *curReq = scheduler->FindCurrent(dm, pageNo, tile);
+    if (curReq) {
         if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
             /* we're already rendering exactly the same page */
             return;
         }
         /* Currently rendered page is for the same page but with different zoom
         or rotation, so abort it */
-        AbortCurrentRequest();
+        if (curReq->abortCookie)
+            curReq->abortCookie->Abort();
+        curReq->abort = true;
     }
 
     // clear requests for tiles of different resolution and invisible tiles
     if (clearQueueForPage)
         ClearQueueForDisplayModel(dm, pageNo, &tile);
 
-    for (int i = 0; i < requestCount; i++) {
-        PageRenderRequest* req = &(requests[i]);
-        if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile)) {
-            if ((req->zoom == zoom) && (req->rotation == rotation)) {
-                /* Request with exactly the same parameters already queued for
-                   rendering. Move it to the top of the queue so that it'll
-                   be rendered faster. */
-                PageRenderRequest tmp;
-                tmp = requests[requestCount-1];
-                requests[requestCount-1] = *req;
-                *req = tmp;
-            } else {
-                /* There was a request queued for the same page but with different
-                   zoom or rotation, so only replace this request */
-                req->zoom = zoom;
-                req->rotation = rotation;
-            }
-            return;
+    PageRenderRequest *req = scheduler->FindQueued(dm, pageNo, tile);
+    if (req) {
+        if ((req->zoom == zoom) && (req->rotation == rotation)) {
+            /* Request with exactly the same parameters already queued for
+               rendering. Move it to the top of the queue so that it'll
+               be rendered faster. */
+            req = scheduler->Promote(req);
+        } else {
+            /* There was a request queued for the same page but with different
+               zoom or rotation, so only replace this request */
+            req->zoom = zoom;
+            req->rotation = rotation;
         }
+        // a prefetched page might have become visible in the meantime
+        req->priority = min(req->priority, priority);
+        return;
     }
 
     if (Exists(dm, pageNo, rotation, zoom, &tile)) {
@@ -385,18 +447,19 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
         return;
     }
 
-    Render(dm, pageNo, rotation, zoom, &tile);
+    Render(dm, pageNo, rotation, zoom, &tile, NULL, NULL, priority);
 }
 
 void RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom, RectD pageRect, RenderingCallback& callback)
 {
-    bool ok = Render(dm, pageNo, rotation, zoom, NULL, &pageRect, &callback);
+    bool ok = Render(dm, pageNo, rotation, zoom, NULL, &pageRect, &callback, Priority_Preview);
     if (!ok)
         callback.Callback();
 }
 
 bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
-                         TilePosition *tile, RectD *pageRect, RenderingCallback *renderCb)
+                         TilePosition *tile, RectD *pageRect, RenderingCallback *renderCb,
+                         RenderPriority priority)
 {
     assert(dm);
     if (!dm || dm->dontRenderFlag)
@@ -406,90 +469,41 @@ bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
     if (!tile && !(pageRect && renderCb))
         return false;
 
-    ScopedCritSec scope(&requestAccess);
-    PageRenderRequest* newRequest;
-
-    /* add request to the queue */
-    if (requestCount == MAX_PAGE_REQUESTS) {
-        /* queue is full -> remove the oldest items on the queue */
-        if (requests[0].renderCb)
-            requests[0].renderCb->Callback();
-        memmove(&(requests[0]), &(requests[1]), sizeof(PageRenderRequest) * (MAX_PAGE_REQUESTS - 1));
-        newRequest = &(requests[MAX_PAGE_REQUESTS-1]);
-    } else {
-        newRequest = &(requests[requestCount]);
-        requestCount++;
-    }
-    assert(requestCount <= MAX_PAGE_REQUESTS);
-
-    newRequest->dm = dm;
-    newRequest->pageNo = pageNo;
-    newRequest->rotation = rotation;
-    newRequest->zoom = zoom;
+    PageRenderRequest newRequest;
+    newRequest.dm = dm;
+    newRequest.pageNo = pageNo;
+    newRequest.rotation = rotation;
+    newRequest.zoom = zoom;
     if (tile) {
-        newRequest->pageRect = GetTileRectUser(dm->engine, pageNo, rotation, zoom, *tile);
-        newRequest->tile = *tile;
+        newRequest.pageRect = GetTileRectUser(dm->engine, pageNo, rotation, zoom, *tile);
+        newRequest.tile = *tile;
     }
     else if (pageRect) {
-        newRequest->pageRect = *pageRect;
+        newRequest.pageRect = *pageRect;
         // can't cache bitmaps that aren't for a given tile
         assert(renderCb);
     }
     else
         assert(0);
-    newRequest->abort = false;
-    newRequest->abortCookie = NULL;
-    newRequest->timestamp = GetTickCount();
-    newRequest->renderCb = renderCb;
+    newRequest.priority = priority;
+    newRequest.renderCb = renderCb;
 
-    SetEvent(startRendering);
-
-    return true;
+    return scheduler->Queue(newRequest);
 }
 
 UINT RenderCache::GetRenderDelay(DisplayModel *dm, int pageNo, TilePosition tile)
 {
-    ScopedCritSec scope(&requestAccess);
-
-    if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile)
-        return GetTickCount() - curReq->timestamp;
+    ScopedCritSec scope(scheduler->Access());
 
-    for (int i = 0; i < requestCount; i++)
-        if (requests[i].pageNo == pageNo && requests[i].dm == dm && requests[i].tile == tile)
-            return GetTickCount() - requests[i].timestamp;
+    PageRenderRequest *req = scheduler->FindCurrent(dm, pageNo, tile);
+    if (!req)
+        req = scheduler->FindQueued(dm, pageNo, tile);
+    if (req)
+        return GetTickCount() - req->timestamp;
 
     return RENDER_DELAY_UNDEFINED;
 }
 
-bool RenderCache::GetNextRequest(PageRenderRequest *req)
-{
-    ScopedCritSec scope(&requestAccess);
-
-    if (requestCount == 0)
-        return false;
-
-    assert(requestCount > 0);
-    assert(requestCount <= MAX_PAGE_REQUESTS);
-    requestCount--;
-    *req = requests[requestCount];
-    curReq = req;
-    assert(requestCount >= 0);
-    assert(!req->abort);
-
-    return true;
-}
-
-bool RenderCache::ClearCurrentRequest()
-{
-    ScopedCritSec scope(&requestAccess);
-    if (curReq)
-        delete curReq->abortCookie;
-    curReq = NULL;
-
-    bool isQueueEmpty = requestCount == 0;
-    return isQueueEmpty;
-}
-
 /* Wait until rendering of a page beloging to <dm> has finished. */
 /* TODO: this might take some time, would be good to show a dialog to let the
    user know he has to wait until we finish */
@@ -498,16 +512,16 @@ void RenderCache::CancelRendering(DisplayModel *dm)
     ClearQueueForDisplayModel(dm);
 
     for (;;) {
-        EnterCriticalSection(&requestAccess);
-        if (!curReq || (curReq->dm != dm)) {
+        EnterCriticalSection(scheduler->Access());
+        if (!scheduler->IsRendering(dm)) {
             // to be on the safe side
             ClearQueueForDisplayModel(dm);
-            LeaveCriticalSection(&requestAccess);
+            LeaveCriticalSection(scheduler->Access());
             return;
         }
 
-        AbortCurrentRequest();
-        LeaveCriticalSection(&requestAccess);
+        AbortCurrentRequests(dm);
+        LeaveCriticalSection(scheduler->Access());
 
         /* TODO: busy loop is not good, but I don't have a better idea */
         Sleep(50);
@@ -516,85 +530,71 @@ void RenderCache::CancelRendering(DisplayModel *dm)
 
 void RenderCache::ClearQueueForDisplayModel(DisplayModel *dm, int pageNo, TilePosition *tile)
 {
-    ScopedCritSec scope(&requestAccess);
-    int reqCount = requestCount;
-    int curPos = 0;
-    for (int i = 0; i < reqCount; i++) {
-        PageRenderRequest *req = &(requests[i]);
+    ScopedCritSec scope(scheduler->Access());
+    for (int i = scheduler->QueuedCount() - 1; i >= 0; i--) {
+        PageRenderRequest *req = scheduler->QueuedAt(i);
         bool shouldRemove = req->dm == dm && (pageNo == INVALID_PAGE_NO || req->pageNo == pageNo) &&
             (!tile || req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5));
-        if (i != curPos)
-            requests[curPos] = requests[i];
-        if (shouldRemove) {
-            if (req->renderCb)
-                req->renderCb->Callback();
-            requestCount--;
-        } else
-            curPos++;
+        if (shouldRemove)
+            scheduler->RemoveQueued(i);
     }
 }
 
-void RenderCache::AbortCurrentRequest()
+// called by the RenderScheduler on one of its threads
+void RenderCache::RenderRequest(PageRenderRequest& req)
 {
-    ScopedCritSec scope(&requestAccess);
-    if (!curReq)
+    if (!req.dm->PageVisibleNearby(req.pageNo) && !req.renderCb)
         return;
-    if (curReq->abortCookie)
-        curReq->abortCookie->Abort();
-    curReq->abort = true;
-}
-
-DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data)
-{
-    RenderCache *cache = (RenderCache *)data;
-    PageRenderRequest   req;
-    RenderedBitmap *    bmp;
-
-    for (;;) {
-        if (cache->ClearCurrentRequest()) {
-            DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
-            // Is it not a page render request?
-            if (WAIT_OBJECT_0 != waitResult)
-                continue;
-        }
-
-        if (!cache->GetNextRequest(&req))
-            continue;
-        if (!req.dm->PageVisibleNearby(req.pageNo) && !req.renderCb)
-            continue;
-        if (req.dm->dontRenderFlag) {
-            if (req.renderCb)
-                req.renderCb->Callback();
-            continue;
-        }
+    if (req.dm->dontRenderFlag) {
+        if (req.renderCb)
+            req.renderCb->Callback();
+        return;
+    }
 
-        // make sure that we have extracted page text for
-        // all rendered pages to allow text selection and
-        // searching without any further delays
-        if (!req.dm->textCache->HasData(req.pageNo))
-            req.dm->textCache->GetData(req.pageNo);
+    // make sure that we have extracted page text for
+    // all rendered pages to allow text selection and
+    // searching without any further delays
+    req.dm->textCache->ExtractPage(req.pageNo, req.dm->engine);
+
+    // tiles of documents opened before might not have to be rendered at all
+    DiskTileKey diskKey;
+    // (the disk cache is bypassed until the document's fingerprint is ready)
+    bool useDiskCache = diskCache && !req.renderCb &&
+                        req.dm->GetContentFingerprint(diskKey.fingerprint);
+    RenderedBitmap *bmp = NULL;
+    if (useDiskCache) {
+        diskKey.pageNo = req.pageNo;
+        diskKey.rotation = req.rotation;
+        diskKey.zoom = req.zoom;
+        diskKey.pageRect = req.pageRect;
+        bmp = diskCache->Load(diskKey);
+    }
 
-        CrashIf(req.abortCookie != NULL);
+    CrashIf(req.abortCookie != NULL);
+    if (!bmp) {
         bmp = req.dm->engine->RenderBitmap(req.pageNo, req.zoom, req.rotation, &req.pageRect, Target_View, &req.abortCookie);
-        if (req.abort) {
-            delete bmp;
-            if (req.renderCb)
-                req.renderCb->Callback();
-            continue;
-        }
+        // colors are replaced after loading, so that changing them doesn't invalidate the cache
+        if (bmp && useDiskCache && !req.abort)
+            diskCache->Save(diskKey, bmp);
+    }
+    if (req.abort) {
+        delete bmp;
+        if (req.renderCb)
+            req.renderCb->Callback();
+        return;
+    }
 
-        if (req.renderCb) {
-            // the callback must free the RenderedBitmap
-            req.renderCb->Callback(bmp);
-            req.renderCb = (RenderingCallback *)1; // will crash if accessed again, which should not happen
-        }
-        else {
-            // don't replace colors for individual images
-            if (bmp && !req.dm->engine->IsImageCollection())
-                UpdateBitmapColors(bmp->GetBitmap(), cache->textColor, cache->backgroundColor);
-            cache->Add(req, bmp);
-            req.dm->RepaintDisplay();
-        }
+    if (req.renderCb) {
+        // the callback must free the RenderedBitmap
+        req.renderCb->Callback(bmp);
+        req.renderCb = (RenderingCallback *)1; // will crash if accessed again, which should not happen
+    }
+    else {
+        // don't replace colors for individual images
+        if (bmp && !req.dm->engine->IsImageCollection())
+            UpdateBitmapColors(bmp->GetBitmap(), textColor, backgroundColor);
+        Add(req, bmp);
+        req.dm->RepaintDisplay();
     }
 }
 
@@ -607,6 +607,13 @@ UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
     BitmapCacheEntry *entry = Find(dm, pageNo, dm->Rotation(), dm->ZoomReal(), &tile);
     UINT renderDelay = 0;
 
+    EnterCriticalSection(&cacheAccess);
+    if (entry)
+        stats.hits++;
+    else
+        stats.misses++;
+    LeaveCriticalSection(&cacheAccess);
+
     if (!entry) {
         if (!isRemoteSession) {
             if (renderedReplacement)
@@ -682,6 +689,7 @@ UINT RenderCache::Paint(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
     int rotation = dm->Rotation();
     float zoom = dm->ZoomReal();
     USHORT targetRes = GetTileRes(dm, pageNo);
+    RectI pageOnScreen = dm->GetPageOnScreen(pageNo);
     USHORT maxRes = GetMaxTileRes(dm, pageNo, rotation);
     if (maxRes < targetRes)
         maxRes = targetRes;
@@ -694,13 +702,13 @@ UINT RenderCache::Paint(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
     while (queue.Count() > 0) {
         TilePosition tile = queue.At(0);
         queue.RemoveAt(0);
-        RectI tileOnScreen = GetTileOnScreen(dm->engine, pageNo, rotation, zoom, tile, pageInfo->pageOnScreen);
+        RectI tileOnScreen = GetTileOnScreen(dm->engine, pageNo, rotation, zoom, tile, pageOnScreen);
         if (tileOnScreen.IsEmpty()) {
             // display an error message when only empty tiles should be drawn (i.e. on page loading errors)
             renderDelayMin = min(RENDER_DELAY_FAILED, renderDelayMin);
             continue;
         }
-        tileOnScreen = pageInfo->pageOnScreen.Intersect(tileOnScreen);
+        tileOnScreen = pageOnScreen.Intersect(tileOnScreen);
         RectI isect = bounds.Intersect(tileOnScreen);
         if (isect.IsEmpty())
             continue;
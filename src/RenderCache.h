@@ -5,28 +5,12 @@
 #define RenderCache_h
 
 #include "DisplayModel.h"
+#include "RenderScheduler.h"
+
+class DiskTileCache;
 
 #define RENDER_DELAY_UNDEFINED ((UINT)-1)
 #define RENDER_DELAY_FAILED    ((UINT)-2)
-#define INVALID_TILE_RES       ((USHORT)-1)
-
-class RenderingCallback {
-public:
-    virtual void Callback(RenderedBitmap *bmp=NULL) = 0;
-    virtual ~RenderingCallback() { }
-};
-
-/* A page is split into tiles of at most TILE_MAX_W x TILE_MAX_H pixels.
-   A given tile starts at (col / 2^res * page_width, row / 2^res * page_height). */
-struct TilePosition {
-    USHORT res, row, col;
-
-    explicit TilePosition(USHORT res=INVALID_TILE_RES, USHORT row=-1, USHORT col=-1) :
-        res(res), row(row), col(col) { }
-    bool operator==(const TilePosition& other) const {
-        return res == other.res && row == other.row && col == other.col;
-    }
-};
 
 /* We keep a cache of rendered bitmaps. BitmapCacheEntry keeps data
    that uniquely identifies rendered page (dm, pageNo, rotation, zoom)
@@ -43,50 +27,50 @@ struct BitmapCacheEntry {
     bool             outOfDate;
     int              refs;
 
+    // approximate amount of (GDI) memory used by bitmap
+    size_t           bytes;
+    // value of RenderCache::useCounter at the most recent access
+    ULONG            lastUsed;
+    // next entry in the same hash bucket
+    BitmapCacheEntry *next;
+
     BitmapCacheEntry(DisplayModel *dm, int pageNo, int rotation, float zoom, TilePosition tile, RenderedBitmap *bitmap) :
-        dm(dm), pageNo(pageNo), rotation(rotation), zoom(zoom), tile(tile), bitmap(bitmap), outOfDate(false), refs(1) { }
+        dm(dm), pageNo(pageNo), rotation(rotation), zoom(zoom), tile(tile), bitmap(bitmap), outOfDate(false), refs(1),
+        bytes(bitmap ? (size_t)bitmap->Size().dx * bitmap->Size().dy * 4 : 0), lastUsed(0), next(NULL) { }
     ~BitmapCacheEntry() { delete bitmap; }
 };
 
-/* Even though this looks a lot like a BitmapCacheEntry, we keep it
-   separate for clarity in the code (PageRenderRequests are reused,
-   while BitmapCacheEntries are ref-counted) */
-struct PageRenderRequest {
-    DisplayModel *      dm;
-    int                 pageNo;
-    int                 rotation;
-    float               zoom;
-    TilePosition        tile;
-
-    RectD               pageRect; // calculated from TilePosition
-    bool                abort;
-    AbortCookie *       abortCookie;
-    DWORD               timestamp;
-    // owned by the PageRenderRequest (use it before reusing the request)
-    // on rendering success, the callback gets handed the RenderedBitmap
-    RenderingCallback * renderCb;
+struct BitmapCacheStats {
+    size_t  hits;       // tiles painted from the cache
+    size_t  misses;     // tiles which had to be (re)rendered
+    size_t  evictions;  // bitmaps dropped in order to stay within maxBytes
+    size_t  count;      // currently cached bitmaps
+    size_t  bytes;      // memory currently used by the cached bitmaps
+    size_t  maxBytes;
 };
 
-#define MAX_PAGE_REQUESTS 8
-
-// keep this value reasonably low, else we'll run
-// out of GDI memory when caching many larger bitmaps
-#define MAX_BITMAPS_CACHED 64
+// the number of cached bitmaps is mainly limited by RenderCache::maxCacheBytes,
+// this only prevents running out of GDI handles for many small thumbnails
+#define MAX_BITMAPS_CACHED 256
+// the default cache size is the memory needed for this many screens
+// (keep this value reasonably low, else we'll run out of GDI memory)
+#define DEFAULT_CACHE_SCREENS 12
+// number of hash buckets for finding cached bitmaps by (dm, pageNo)
+#define BITMAP_CACHE_BUCKETS 256
 
-class RenderCache
+class RenderCache : public RenderRequestHandler
 {
 private:
-    BitmapCacheEntry *  cache[MAX_BITMAPS_CACHED];
-    int                 cacheCount;
-    // make sure to never ask for requestAccess in a cacheAccess
+    Vec<BitmapCacheEntry *> cache;
+    BitmapCacheEntry *  buckets[BITMAP_CACHE_BUCKETS];
+    ULONG               useCounter;
+    size_t              cacheBytes;
+    BitmapCacheStats    stats;
+    // make sure to never ask for scheduler->Access() in a cacheAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION    cacheAccess;
 
-    PageRenderRequest   requests[MAX_PAGE_REQUESTS];
-    int                 requestCount;
-    PageRenderRequest * curReq;
-    CRITICAL_SECTION    requestAccess;
-    HANDLE              renderThread;
+    RenderScheduler *   scheduler;
 
     SizeI               maxTileSize;
     bool                isRemoteSession;
@@ -94,6 +78,11 @@ private:
 public:
     COLORREF            textColor;
     COLORREF            backgroundColor;
+    // rendered bitmaps are evicted (least recently used first) when
+    // they'd take up more memory than this
+    size_t              maxCacheBytes;
+    // optionally persists rendered tiles across sessions (owned by RenderCache)
+    DiskTileCache *     diskCache;
 
     RenderCache();
     ~RenderCache();
@@ -112,13 +101,11 @@ public:
     // painted, 0 if something has been painted and RENDER_DELAY_FAILED on failure
     UINT    Paint(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
                   PageInfo *pageInfo, bool *renderOutOfDateCue);
+    BitmapCacheStats GetStats();
 
 protected:
-    /* Interface for page rendering thread */
-    HANDLE  startRendering;
-
-    bool    ClearCurrentRequest();
-    bool    GetNextRequest(PageRenderRequest *req);
+    /* Interface for page rendering threads */
+    virtual void RenderRequest(PageRenderRequest& req);
     void    Add(PageRenderRequest &req, RenderedBitmap *bitmap);
 
 private:
@@ -126,23 +113,25 @@ private:
     USHORT  GetMaxTileRes(DisplayModel *dm, int pageNo, int rotation);
     bool    ReduceTileSize();
 
-    bool    IsRenderQueueFull() const {
-                return requestCount == MAX_PAGE_REQUESTS;
-            }
+    bool    IsRenderQueueFull() { return scheduler->IsQueueFull(); }
     UINT    GetRenderDelay(DisplayModel *dm, int pageNo, TilePosition tile);
-    void    RequestRendering(DisplayModel *dm, int pageNo, TilePosition tile, bool clearQueueForPage=true);
+    void    RequestRendering(DisplayModel *dm, int pageNo, TilePosition tile, bool clearQueueForPage=true,
+                             RenderPriority priority=Priority_Visible);
     bool    Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
                    TilePosition *tile=NULL, RectD *pageRect=NULL,
-                   RenderingCallback *callback=NULL);
+                   RenderingCallback *callback=NULL, RenderPriority priority=Priority_Visible);
     void    ClearQueueForDisplayModel(DisplayModel *dm, int pageNo=INVALID_PAGE_NO,
                                       TilePosition *tile=NULL);
-    void    AbortCurrentRequest();
-
-    static DWORD WINAPI RenderCacheThread(LPVOID data);
+    void    AbortCurrentRequests(DisplayModel *dm=NULL, int pageNo=INVALID_PAGE_NO) {
+                scheduler->AbortCurrent(dm, pageNo);
+            }
 
     BitmapCacheEntry *  Find(DisplayModel *dm, int pageNo, int rotation,
                              float zoom=INVALID_ZOOM, TilePosition *tile=NULL);
     void    DropCacheEntry(BitmapCacheEntry *entry);
+    void    InsertCacheEntry(BitmapCacheEntry *entry);
+    void    RemoveCacheEntry(size_t idx);
+    bool    EvictCacheEntry(DisplayModel *dm);
     void    FreePage(DisplayModel *dm=NULL, int pageNo=-1, TilePosition *tile=NULL);
     void    FreeNotVisible() { FreePage(); }
 
@@ -0,0 +1,257 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "BaseUtil.h"
+#include "RenderScheduler.h"
+
+RenderScheduler::RenderScheduler(RenderRequestHandler *handler, int threadCount)
+    : handler(handler), requestCount(0), threadCount(0)
+{
+    InitializeCriticalSection(&access);
+    ZeroMemory(curReqs, sizeof(curReqs));
+
+    if (threadCount <= 0) {
+        // render several tiles at once on multi-core machines
+        // (leaving one core for the UI thread)
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        threadCount = (int)si.dwNumberOfProcessors - 1;
+    }
+    threadCount = limitValue(threadCount, 1, MAX_RENDER_THREADS);
+
+    startRendering = CreateEvent(NULL, FALSE, FALSE, NULL);
+    stopRendering = CreateEvent(NULL, TRUE, FALSE, NULL);
+    for (int i = 0; i < threadCount; i++) {
+        threads[this->threadCount] = CreateThread(NULL, 0, RenderThread, this, 0, 0);
+        assert(NULL != threads[this->threadCount]);
+        if (threads[this->threadCount])
+            this->threadCount++;
+    }
+}
+
+RenderScheduler::~RenderScheduler()
+{
+    EnterCriticalSection(&access);
+    AbortCurrent();
+    SetEvent(stopRendering);
+    LeaveCriticalSection(&access);
+
+    WaitForMultipleObjects(threadCount, threads, TRUE, INFINITE);
+    for (int i = 0; i < threadCount; i++) {
+        CloseHandle(threads[i]);
+        assert(!curReqs[i]);
+    }
+    CloseHandle(startRendering);
+    CloseHandle(stopRendering);
+
+    // requests which never got rendered
+    while (requestCount > 0)
+        RemoveQueued(requestCount - 1);
+    DeleteCriticalSection(&access);
+}
+
+bool RenderScheduler::Queue(PageRenderRequest& req)
+{
+    ScopedCritSec scope(&access);
+    PageRenderRequest* newRequest;
+
+    /* add request to the queue */
+    if (requestCount == MAX_PAGE_REQUESTS) {
+        /* queue is full -> remove the oldest of the least urgent requests */
+        int ix = 0;
+        for (int i = 1; i < requestCount; i++) {
+            if (requests[i].priority > requests[ix].priority)
+                ix = i;
+        }
+        /* ... unless the new request is even less urgent */
+        if (requests[ix].priority < req.priority)
+            return false;
+        if (requests[ix].renderCb)
+            requests[ix].renderCb->Callback();
+        memmove(&(requests[ix]), &(requests[ix + 1]), sizeof(PageRenderRequest) * (MAX_PAGE_REQUESTS - ix - 1));
+        newRequest = &(requests[MAX_PAGE_REQUESTS-1]);
+    } else {
+        newRequest = &(requests[requestCount]);
+        requestCount++;
+    }
+    assert(requestCount <= MAX_PAGE_REQUESTS);
+
+    *newRequest = req;
+    newRequest->abort = false;
+    newRequest->abortCookie = NULL;
+    newRequest->timestamp = GetTickCount();
+
+    SetEvent(startRendering);
+
+    return true;
+}
+
+bool RenderScheduler::IsQueueFull()
+{
+    ScopedCritSec scope(&access);
+    return requestCount == MAX_PAGE_REQUESTS;
+}
+
+int RenderScheduler::QueuedCount()
+{
+    ScopedCritSec scope(&access);
+    return requestCount;
+}
+
+PageRenderRequest *RenderScheduler::QueuedAt(int idx)
+{
+    ScopedCritSec scope(&access);
+    assert(0 <= idx && idx < requestCount);
+    return &requests[idx];
+}
+
+void RenderScheduler::RemoveQueued(int idx)
+{
+    ScopedCritSec scope(&access);
+    assert(0 <= idx && idx < requestCount);
+    if (requests[idx].renderCb)
+        requests[idx].renderCb->Callback();
+    requestCount--;
+    memmove(&(requests[idx]), &(requests[idx + 1]), sizeof(PageRenderRequest) * (requestCount - idx));
+}
+
+PageRenderRequest *RenderScheduler::FindQueued(DisplayModel *dm, int pageNo, TilePosition tile)
+{
+    ScopedCritSec scope(&access);
+    for (int i = 0; i < requestCount; i++) {
+        PageRenderRequest *req = &requests[i];
+        if (req->pageNo == pageNo && req->dm == dm && req->tile == tile)
+            return req;
+    }
+    return NULL;
+}
+
+PageRenderRequest *RenderScheduler::Promote(PageRenderRequest *req)
+{
+    ScopedCritSec scope(&access);
+    assert(requests <= req && req < requests + requestCount);
+    PageRenderRequest tmp;
+    tmp = requests[requestCount-1];
+    requests[requestCount-1] = *req;
+    *req = tmp;
+    return &requests[requestCount-1];
+}
+
+bool RenderScheduler::GetNextRequest(PageRenderRequest *req)
+{
+    ScopedCritSec scope(&access);
+
+    if (requestCount == 0)
+        return false;
+
+    int slot = 0;
+    while (slot < threadCount && curReqs[slot])
+        slot++;
+    assert(slot < threadCount);
+    if (slot == threadCount)
+        return false;
+
+    assert(requestCount > 0);
+    assert(requestCount <= MAX_PAGE_REQUESTS);
+    // most urgent request first (most recently requested within a lane)
+    int ix = requestCount - 1;
+    for (int i = requestCount - 2; i >= 0; i--) {
+        if (requests[i].priority < requests[ix].priority)
+            ix = i;
+    }
+    *req = requests[ix];
+    requestCount--;
+    memmove(&(requests[ix]), &(requests[ix + 1]), sizeof(PageRenderRequest) * (requestCount - ix));
+    curReqs[slot] = req;
+    assert(requestCount >= 0);
+    assert(!req->abort);
+
+    // wake up another rendering thread for the remaining requests
+    if (requestCount > 0)
+        SetEvent(startRendering);
+
+    return true;
+}
+
+bool RenderScheduler::ClearCurrentRequest(PageRenderRequest *req)
+{
+    ScopedCritSec scope(&access);
+    for (int i = 0; i < threadCount; i++) {
+        if (curReqs[i] == req) {
+            delete req->abortCookie;
+            req->abortCookie = NULL;
+            curReqs[i] = NULL;
+        }
+    }
+
+    bool isQueueEmpty = requestCount == 0;
+    return isQueueEmpty;
+}
+
+PageRenderRequest *RenderScheduler::FindCurrent(DisplayModel *dm, int pageNo, TilePosition tile)
+{
+    ScopedCritSec scope(&access);
+    for (int i = 0; i < threadCount; i++) {
+        PageRenderRequest *req = curReqs[i];
+        if (req && req->pageNo == pageNo && req->dm == dm && req->tile == tile)
+            return req;
+    }
+    return NULL;
+}
+
+bool RenderScheduler::IsRendering(DisplayModel *dm)
+{
+    ScopedCritSec scope(&access);
+    for (int i = 0; i < threadCount; i++) {
+        if (curReqs[i] && curReqs[i]->dm == dm)
+            return true;
+    }
+    return false;
+}
+
+void RenderScheduler::AbortCurrent(DisplayModel *dm, int pageNo)
+{
+    ScopedCritSec scope(&access);
+    for (int i = 0; i < threadCount; i++) {
+        PageRenderRequest *req = curReqs[i];
+        if (!req || dm && req->dm != dm || pageNo != -1 && req->pageNo != pageNo)
+            continue;
+        if (req->abortCookie)
+            req->abortCookie->Abort();
+        req->abort = true;
+    }
+}
+
+bool RenderScheduler::IsIdle()
+{
+    ScopedCritSec scope(&access);
+    if (requestCount > 0)
+        return false;
+    for (int i = 0; i < threadCount; i++) {
+        if (curReqs[i])
+            return false;
+    }
+    return true;
+}
+
+DWORD WINAPI RenderScheduler::RenderThread(LPVOID data)
+{
+    RenderScheduler *scheduler = (RenderScheduler *)data;
+    PageRenderRequest req;
+    HANDLE events[2] = { scheduler->stopRendering, scheduler->startRendering };
+
+    for (;;) {
+        if (scheduler->ClearCurrentRequest(&req)) {
+            DWORD waitResult = WaitForMultipleObjects(dimof(events), events, FALSE, INFINITE);
+            // Is it not a page render request?
+            if (WAIT_OBJECT_0 + 1 != waitResult && WAIT_OBJECT_0 != waitResult)
+                continue;
+        }
+        if (WaitForSingleObject(scheduler->stopRendering, 0) == WAIT_OBJECT_0)
+            return 0;
+
+        if (!scheduler->GetNextRequest(&req))
+            continue;
+        scheduler->handler->RenderRequest(req);
+    }
+}
@@ -0,0 +1,127 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#ifndef RenderScheduler_h
+#define RenderScheduler_h
+
+#include "BaseEngine.h"
+
+class DisplayModel;
+
+#define INVALID_TILE_RES       ((USHORT)-1)
+
+class RenderingCallback {
+public:
+    virtual void Callback(RenderedBitmap *bmp=NULL) = 0;
+    virtual ~RenderingCallback() { }
+};
+
+/* A page is split into tiles of at most TILE_MAX_W x TILE_MAX_H pixels.
+   A given tile starts at (col / 2^res * page_width, row / 2^res * page_height). */
+struct TilePosition {
+    USHORT res, row, col;
+
+    explicit TilePosition(USHORT res=INVALID_TILE_RES, USHORT row=-1, USHORT col=-1) :
+        res(res), row(row), col(col) { }
+    bool operator==(const TilePosition& other) const {
+        return res == other.res && row == other.row && col == other.col;
+    }
+};
+
+/* Requests are rendered in the order of these lanes (and most recently
+   requested first within a lane) */
+enum RenderPriority {
+    Priority_Visible,  // tiles currently on screen
+    Priority_Prefetch, // neighbouring pages (cf. DisplayModel::RenderVisibleParts)
+    Priority_Preview,  // thumbnails and other callback-based renderings
+};
+
+/* Even though this looks a lot like a BitmapCacheEntry, we keep it
+   separate for clarity in the code (PageRenderRequests are reused,
+   while BitmapCacheEntries are ref-counted) */
+struct PageRenderRequest {
+    // RenderScheduler only uses dm for telling documents apart
+    // (it may be NULL when rendering without UI)
+    DisplayModel *      dm;
+    int                 pageNo;
+    int                 rotation;
+    float               zoom;
+    TilePosition        tile;
+    RenderPriority      priority;
+
+    RectD               pageRect; // calculated from TilePosition
+    bool                abort;
+    AbortCookie *       abortCookie;
+    DWORD               timestamp;
+    // owned by the PageRenderRequest (use it before reusing the request)
+    // on rendering success, the callback gets handed the RenderedBitmap
+    RenderingCallback * renderCb;
+};
+
+#define MAX_PAGE_REQUESTS 32
+// upper bound for the number of rendering threads (the destructor
+// waits for all of them at once, cf. WaitForMultipleObjects)
+#define MAX_RENDER_THREADS MAXIMUM_WAIT_OBJECTS
+
+class RenderRequestHandler {
+public:
+    // called on one of RenderScheduler's threads for every dequeued request
+    // (req.abort is set once the request has been aborted)
+    virtual void RenderRequest(PageRenderRequest& req) = 0;
+    virtual ~RenderRequestHandler() { }
+};
+
+/* RenderScheduler queues PageRenderRequests and hands them out to
+   a number of rendering threads, the most urgent ones first. What is
+   done with a request is up to the RenderRequestHandler (RenderCache
+   renders tiles for display while EngineDump just renders pages) */
+class RenderScheduler {
+    RenderRequestHandler *handler;
+
+    PageRenderRequest   requests[MAX_PAGE_REQUESTS];
+    int                 requestCount;
+    // requests currently being rendered (one slot per rendering thread)
+    PageRenderRequest * curReqs[MAX_RENDER_THREADS];
+    CRITICAL_SECTION    access;
+    HANDLE              startRendering;
+    HANDLE              stopRendering;
+    HANDLE              threads[MAX_RENDER_THREADS];
+    int                 threadCount;
+
+    bool    GetNextRequest(PageRenderRequest *req);
+    bool    ClearCurrentRequest(PageRenderRequest *req);
+
+    static DWORD WINAPI RenderThread(LPVOID data);
+
+public:
+    // uses one thread less than there are processors if threadCount is 0
+    explicit RenderScheduler(RenderRequestHandler *handler, int threadCount=0);
+    // aborts the current requests and waits for all threads to finish
+    ~RenderScheduler();
+
+    int     ThreadCount() const { return threadCount; }
+    // all methods lock this themselves, it's only needed
+    // for combining several calls (it may be entered recursively)
+    CRITICAL_SECTION *Access() { return &access; }
+
+    // adds a copy of req to the queue (removing the oldest of the least urgent
+    // requests if the queue is full, unless req is even less urgent)
+    bool    Queue(PageRenderRequest& req);
+    bool    IsQueueFull();
+    int     QueuedCount();
+    PageRenderRequest *QueuedAt(int idx);
+    // removes a queued request (calling its callback, if there's one)
+    void    RemoveQueued(int idx);
+    PageRenderRequest *FindQueued(DisplayModel *dm, int pageNo, TilePosition tile);
+    // moves a queued request to the top of its lane and returns its new position
+    PageRenderRequest *Promote(PageRenderRequest *req);
+
+    PageRenderRequest *FindCurrent(DisplayModel *dm, int pageNo, TilePosition tile);
+    bool    IsRendering(DisplayModel *dm);
+    // aborts all requests being rendered (optionally only those of a given page)
+    void    AbortCurrent(DisplayModel *dm=NULL, int pageNo=-1);
+    // returns true if nothing is queued or being rendered anymore
+    bool    IsIdle();
+};
+
+#endif
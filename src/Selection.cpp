@@ -9,6 +9,7 @@
 #include "SumatraPDF.h"
 #include "Toolbar.h"
 #include "Translations.h"
+#include "UITask.h"
 #include "uia/Provider.h"
 #include "WindowInfo.h"
 #include "WinUtil.h"
@@ -33,7 +34,7 @@ Vec<SelectionOnPage> *SelectionOnPage::FromRectangle(DisplayModel *dm, RectI rec
         if (!pageInfo || !pageInfo->shown)
             continue;
 
-        RectI intersect = rect.Intersect(pageInfo->pageOnScreen);
+        RectI intersect = rect.Intersect(dm->GetPageOnScreen(pageNo));
         if (intersect.IsEmpty())
             continue;
 
@@ -195,7 +196,7 @@ void ZoomToSelection(WindowInfo *win, float factor, bool scrollToFit, bool relat
         int page = win->dm->FirstVisiblePageNo();
         PageInfo *pageInfo = win->dm->GetPageInfo(page);
         if (pageInfo) {
-            RectI visible = pageInfo->pageOnScreen.Intersect(win->canvasRc);
+            RectI visible = win->dm->GetPageOnScreen(page).Intersect(win->canvasRc);
             pt = visible.TL();
 
             int pageNo = win->dm->GetPageNoByPoint(pt);
@@ -270,6 +271,177 @@ void CopySelectionToClipboard(WindowInfo *win)
     CloseClipboard();
 }
 
+// keeps the progress notification (and only that) responsive while
+// the UI thread waits for PageTextCache::ExtractPages to finish
+class ExtractTextProgress : public ProgressUpdateUI, public NotificationWndCallback {
+    WindowInfo *win;
+    NotificationWnd *wnd;
+    bool isCanceled;
+    int updates;
+
+public:
+    explicit ExtractTextProgress(WindowInfo *win) :
+        win(win), wnd(NULL), isCanceled(false), updates(0) { }
+    ~ExtractTextProgress() {
+        if (wnd)
+            win->notifications->RemoveNotification(wnd);
+    }
+
+    virtual void UpdateProgress(int current, int total) {
+        // the first update is reported right away, so only show
+        // the notification if the extraction takes a bit longer
+        if (!wnd && !isCanceled && updates++ > 0) {
+            wnd = new NotificationWnd(win->hwndCanvas, L"", _TR("Extracting text %d of %d..."), this);
+            win->notifications->Add(wnd);
+        }
+        if (!wnd)
+            return;
+        wnd->UpdateProgress(current, total);
+        MSG msg;
+        while (wnd && PeekMessage(&msg, wnd->hwnd(), 0, 0, PM_REMOVE)) {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+    }
+
+    virtual bool WasCanceled() {
+        return isCanceled;
+    }
+
+    // called when the extraction has been canceled
+    virtual void RemoveNotification(NotificationWnd *wnd) {
+        isCanceled = true;
+        this->wnd = NULL;
+        win->notifications->RemoveNotification(wnd);
+    }
+};
+
+// extracts the text of several pages at once on multi-core machines
+// (returns false if the user has canceled the extraction)
+bool ExtractTextWithProgress(WindowInfo *win, int startPage, int endPage)
+{
+    // ChmEngine doesn't extract any text (and is bound to the UI thread)
+    if (!win->IsDocLoaded() || win->IsChm())
+        return true;
+    ExtractTextProgress progress(win);
+    return win->dm->textCache->ExtractPages(startPage, endPage, 0, &progress);
+}
+
+static bool IsTextCached(DisplayModel *dm)
+{
+    for (int pageNo = 1; pageNo <= dm->PageCount(); pageNo++) {
+        if (!dm->textCache->HasData(pageNo))
+            return false;
+    }
+    return true;
+}
+
+static void SelectAllText(WindowInfo *win)
+{
+    int pageNo;
+    for (pageNo = 1; !win->dm->GetPageInfo(pageNo)->shown; pageNo++);
+    win->dm->textSelection->StartAt(pageNo, 0);
+    for (pageNo = win->dm->PageCount(); !win->dm->GetPageInfo(pageNo)->shown; pageNo--);
+    win->dm->textSelection->SelectUpTo(pageNo, -1);
+    win->selectionRect = RectI::FromXY(INT_MIN / 2, INT_MIN / 2, INT_MAX, INT_MAX);
+    UpdateTextSelection(win);
+}
+
+class SelectAllUpdateTask : public UITask {
+    NotificationWnd *wnd;
+    int current, total;
+    WindowInfo *win;
+
+public:
+    SelectAllUpdateTask(WindowInfo *win, NotificationWnd *wnd, int current, int total)
+        : win(win), wnd(wnd), current(current), total(total) { }
+
+    virtual void Execute() {
+        if (WindowInfoStillValid(win) && win->notifications->Contains(wnd))
+            wnd->UpdateProgress(current, total);
+    }
+};
+
+// extracts the text of all pages before selecting it, so that
+// the UI remains responsive for long documents
+class SelectAllThreadData : public ProgressUpdateUI, public NotificationWndCallback, public UITask {
+    WindowInfo *win;
+    NotificationWnd *wnd;
+    PageTextCache *textCache;
+    int pageCount;
+    bool isCanceled;
+    bool extracted;
+
+public:
+    HANDLE thread; // close the extraction thread handle after execution
+
+    explicit SelectAllThreadData(WindowInfo *win) :
+        win(win), textCache(win->dm->textCache), pageCount(win->dm->PageCount()),
+        isCanceled(false), extracted(false), thread(NULL) {
+        wnd = new NotificationWnd(win->hwndCanvas, L"", _TR("Extracting text %d of %d..."), this);
+        win->notifications->Add(wnd);
+    }
+
+    ~SelectAllThreadData() {
+        CloseHandle(thread);
+        RemoveNotification(wnd);
+    }
+
+    virtual void UpdateProgress(int current, int total) {
+        uitask::Post(new SelectAllUpdateTask(win, wnd, current, total));
+    }
+
+    virtual bool WasCanceled() {
+        return isCanceled || !WindowInfoStillValid(win) || win->selectAllCanceled;
+    }
+
+    // called when the extraction has been canceled
+    virtual void RemoveNotification(NotificationWnd *wnd) {
+        isCanceled = true;
+        this->wnd = NULL;
+        if (WindowInfoStillValid(win))
+            win->notifications->RemoveNotification(wnd);
+    }
+
+    static DWORD WINAPI SelectAllThread(LPVOID data)
+    {
+        SelectAllThreadData *threadData = (SelectAllThreadData *)data;
+        // wait for OnSelectAll to return so that we
+        // close the correct handle to the current thread
+        while (!threadData->win->selectAllThread)
+            Sleep(1);
+        threadData->thread = threadData->win->selectAllThread;
+        threadData->extracted = threadData->textCache->ExtractPages(1, threadData->pageCount, 0, threadData);
+        uitask::Post(threadData);
+        return 0;
+    }
+
+    virtual void Execute() {
+        if (!WindowInfoStillValid(win))
+            return;
+        // AbortSelectingAll resets selectAllThread when the document goes away
+        if (win->selectAllThread != thread)
+            return;
+        win->selectAllThread = NULL;
+        if (!extracted || isCanceled || !win->IsDocLoaded())
+            return;
+        SelectAllText(win);
+        win->showSelection = win->selectionOnPage != NULL;
+        win->RepaintAsync();
+    }
+};
+
+void AbortSelectingAll(WindowInfo *win)
+{
+    if (win->selectAllThread) {
+        win->selectAllCanceled = true;
+        WaitForSingleObject(win->selectAllThread, INFINITE);
+        // SelectAllThreadData::Execute closes the handle
+        win->selectAllThread = NULL;
+    }
+    win->selectAllCanceled = false;
+}
+
 void OnSelectAll(WindowInfo *win, bool textOnly)
 {
     if (!HasPermission(Perm_CopySelection))
@@ -287,13 +459,16 @@ void OnSelectAll(WindowInfo *win, bool textOnly)
     }
 
     if (textOnly) {
-        int pageNo;
-        for (pageNo = 1; !win->dm->GetPageInfo(pageNo)->shown; pageNo++);
-        win->dm->textSelection->StartAt(pageNo, 0);
-        for (pageNo = win->dm->PageCount(); !win->dm->GetPageInfo(pageNo)->shown; pageNo--);
-        win->dm->textSelection->SelectUpTo(pageNo, -1);
-        win->selectionRect = RectI::FromXY(INT_MIN / 2, INT_MIN / 2, INT_MAX, INT_MAX);
-        UpdateTextSelection(win);
+        if (win->selectAllThread)
+            return;
+        if (!IsTextCached(win->dm)) {
+            // the text is selected once it's been extracted on separate threads
+            SelectAllThreadData *threadData = new SelectAllThreadData(win);
+            win->selectAllThread = NULL;
+            win->selectAllThread = CreateThread(NULL, 0, SelectAllThreadData::SelectAllThread, threadData, 0, NULL);
+            return;
+        }
+        SelectAllText(win);
     }
     else {
         DeleteOldSelectionInfo(win, true);
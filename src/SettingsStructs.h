@@ -257,6 +257,22 @@ struct GlobalPrefs {
     // actual resolution of the main screen in DPI (if this value isn't
     // positive, the system's UI setting is used)
     int customScreenDPI;
+    // maximum amount of memory (in MB) used for caching rendered pages (if
+    // this value isn't positive, a default depending on the screen size is
+    // used)
+    int bitmapCacheSize;
+    // maximum amount of memory (in MB) used per document for caching
+    // parsed page contents (if this value isn't positive, a default of 40
+    // MB is used)
+    int displayListCacheSize;
+    // maximum amount of disk space (in MB) used for keeping rendered pages
+    // across sessions (if this value isn't positive, rendered pages aren't
+    // saved)
+    int tileCacheSize;
+    // maximum amount of memory (in MB) used per document for caching
+    // extracted text (if this value isn't positive, a default of 64 MB is
+    // used)
+    int textCacheSize;
     // default values for user added annotations in FixedPageUI documents
     // (preliminary and still subject to change)
     AnnotationDefaults annotationDefaults;
@@ -495,6 +511,10 @@ static const FieldInfo gGlobalPrefsFields[] = {
     { offsetof(GlobalPrefs, defaultPasswords),         Type_String,     NULL                                                                                                                  },
     { offsetof(GlobalPrefs, reloadModifiedDocuments),  Type_Bool,       true                                                                                                                  },
     { offsetof(GlobalPrefs, customScreenDPI),          Type_Int,        0                                                                                                                     },
+    { offsetof(GlobalPrefs, bitmapCacheSize),          Type_Int,        0                                                                                                                     },
+    { offsetof(GlobalPrefs, displayListCacheSize),     Type_Int,        0                                                                                                                     },
+    { offsetof(GlobalPrefs, tileCacheSize),            Type_Int,        0                                                                                                                     },
+    { offsetof(GlobalPrefs, textCacheSize),            Type_Int,        0                                                                                                                     },
     { offsetof(GlobalPrefs, annotationDefaults),       Type_Prerelease, (intptr_t)&gAnnotationDefaultsInfo                                                                                    },
     { (size_t)-1,                                      Type_Comment,    NULL                                                                                                                  },
     { offsetof(GlobalPrefs, rememberStatePerDocument), Type_Bool,       true                                                                                                                  },
@@ -522,7 +542,7 @@ static const FieldInfo gGlobalPrefsFields[] = {
     { offsetof(GlobalPrefs, timeOfLastUpdateCheck),    Type_Compact,    (intptr_t)&gFILETIMEInfo                                                                                              },
     { offsetof(GlobalPrefs, openCountWeek),            Type_Int,        0                                                                                                                     },
 };
-static const StructInfo gGlobalPrefsInfo = { sizeof(GlobalPrefs), 44, gGlobalPrefsFields, "\0\0MainWindowBackground\0EscToExit\0ReuseInstance\0FixedPageUI\0EbookUI\0ComicBookUI\0ChmUI\0ExternalViewers\0ShowMenubar\0ZoomLevels\0ZoomIncrement\0PrinterDefaults\0ForwardSearch\0DefaultPasswords\0ReloadModifiedDocuments\0CustomScreenDPI\0AnnotationDefaults\0\0RememberStatePerDocument\0UiLanguage\0ShowToolbar\0ShowFavorites\0AssociatedExtensions\0AssociateSilently\0CheckForUpdates\0VersionToSkip\0RememberOpenedFiles\0UseSysColors\0InverseSearchCmdLine\0EnableTeXEnhancements\0DefaultDisplayMode\0DefaultZoom\0WindowState\0WindowPos\0ShowToc\0SidebarDx\0TocDy\0ShowStartPage\0\0FileStates\0TimeOfLastUpdateCheck\0OpenCountWeek" };
+static const StructInfo gGlobalPrefsInfo = { sizeof(GlobalPrefs), 48, gGlobalPrefsFields, "\0\0MainWindowBackground\0EscToExit\0ReuseInstance\0FixedPageUI\0EbookUI\0ComicBookUI\0ChmUI\0ExternalViewers\0ShowMenubar\0ZoomLevels\0ZoomIncrement\0PrinterDefaults\0ForwardSearch\0DefaultPasswords\0ReloadModifiedDocuments\0CustomScreenDPI\0BitmapCacheSize\0DisplayListCacheSize\0TileCacheSize\0TextCacheSize\0AnnotationDefaults\0\0RememberStatePerDocument\0UiLanguage\0ShowToolbar\0ShowFavorites\0AssociatedExtensions\0AssociateSilently\0CheckForUpdates\0VersionToSkip\0RememberOpenedFiles\0UseSysColors\0InverseSearchCmdLine\0EnableTeXEnhancements\0DefaultDisplayMode\0DefaultZoom\0WindowState\0WindowPos\0ShowToc\0SidebarDx\0TocDy\0ShowStartPage\0\0FileStates\0TimeOfLastUpdateCheck\0OpenCountWeek" };
 
 #endif
 
@@ -13,6 +13,7 @@ using namespace Gdiplus;
 #include "PdfEngine.h"
 #include "resource.h"
 #include "SumatraPDF.h"
+#include "TextIndex.h"
 #include "Translations.h"
 #include "Version.h"
 #include "WindowInfo.h"
@@ -745,7 +746,7 @@ void DrawStartPage(WindowInfo& win, HDC hdc, FileHistory& fileHistory, COLORREF
 }
 
 // TODO: create in TEMP directory instead?
-static WCHAR *GetThumbnailPath(const WCHAR *filePath)
+static WCHAR *GetCacheFilePath(const WCHAR *filePath, const WCHAR *ext)
 {
     // create a fingerprint of a (normalized) path for the file name
     // I'd have liked to also include the file's last modification time
@@ -768,18 +769,22 @@ static WCHAR *GetThumbnailPath(const WCHAR *filePath)
         return NULL;
     ScopedMem<WCHAR> fname(str::conv::FromAnsi(fingerPrint));
 
-    return str::Format(L"%s\\%s.png", thumbsPath, fname);
+    return str::Format(L"%s\\%s%s", thumbsPath, fname, ext);
 }
 
-// removes thumbnails that don't belong to any frequently used item in file history
-void CleanUpThumbnailCache(FileHistory& fileHistory)
+static WCHAR *GetThumbnailPath(const WCHAR *filePath)
 {
-    ScopedMem<WCHAR> thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
-    if (!thumbsPath)
-        return;
-    ScopedMem<WCHAR> pattern(path::Join(thumbsPath, L"*.png"));
+    return GetCacheFilePath(filePath, L".png");
+}
 
-    WStrVec files;
+WCHAR *GetTextIndexPath(const WCHAR *filePath)
+{
+    return GetCacheFilePath(filePath, TEXT_INDEX_EXT);
+}
+
+static void CollectCacheFiles(const WCHAR *dir, const WCHAR *ext, WStrVec& files)
+{
+    ScopedMem<WCHAR> pattern(str::Join(dir, L"\\*", ext));
     WIN32_FIND_DATA fdata;
 
     HANDLE hfind = FindFirstFile(pattern, &fdata);
@@ -790,6 +795,21 @@ void CleanUpThumbnailCache(FileHistory& fileHistory)
             files.Append(str::Dup(fdata.cFileName));
     } while (FindNextFile(hfind, &fdata));
     FindClose(hfind);
+}
+
+// removes thumbnails and text indices that don't belong to any
+// frequently used item in file history
+void CleanUpThumbnailCache(FileHistory& fileHistory)
+{
+    ScopedMem<WCHAR> thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
+    if (!thumbsPath)
+        return;
+
+    WStrVec files;
+    CollectCacheFiles(thumbsPath, L".png", files);
+    CollectCacheFiles(thumbsPath, TEXT_INDEX_EXT, files);
+    if (files.Count() == 0)
+        return;
 
     Vec<DisplayState *> list;
     fileHistory.GetFrequencyOrder(list);
@@ -797,12 +817,16 @@ void CleanUpThumbnailCache(FileHistory& fileHistory)
         ScopedMem<WCHAR> bmpPath(GetThumbnailPath(list.At(i)->filePath));
         if (!bmpPath)
             continue;
-        int idx = files.Find(path::GetBaseName(bmpPath));
-        if (idx != -1) {
-            CrashIf(idx < 0 || files.Count() <= (size_t)idx);
-            WCHAR *fileName = files.At(idx);
-            files.RemoveAt(idx);
-            free(fileName);
+        ScopedMem<WCHAR> indexPath(GetTextIndexPath(list.At(i)->filePath));
+        const WCHAR *keep[] = { path::GetBaseName(bmpPath), path::GetBaseName(indexPath) };
+        for (size_t j = 0; j < dimof(keep); j++) {
+            int idx = files.Find(keep[j]);
+            if (idx != -1) {
+                CrashIf(idx < 0 || files.Count() <= (size_t)idx);
+                WCHAR *fileName = files.At(idx);
+                files.RemoveAt(idx);
+                free(fileName);
+            }
         }
     }
 
@@ -888,6 +912,10 @@ void SaveThumbnail(DisplayState& ds)
 
 void RemoveThumbnail(DisplayState& ds)
 {
+    ScopedMem<WCHAR> indexPath(GetTextIndexPath(ds.filePath));
+    if (indexPath)
+        file::Delete(indexPath);
+
     if (!HasThumbnail(ds))
         return;
 
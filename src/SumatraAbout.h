@@ -28,5 +28,7 @@ void    CleanUpThumbnailCache(FileHistory& fileHistory);
 bool    HasThumbnail(DisplayState& ds);
 void    SaveThumbnail(DisplayState& ds);
 void    RemoveThumbnail(DisplayState& ds);
+// path of the saved text index (cf. TextIndex) for a file in file history
+WCHAR * GetTextIndexPath(const WCHAR *filePath);
 
 #endif
@@ -46,6 +46,7 @@ using namespace Gdiplus;
 #include "SumatraWindow.h"
 #include "StressTesting.h"
 #include "TableOfContents.h"
+#include "TextIndex.h"
 #include "Timer.h"
 #include "ThreadUtil.h"
 #include "Toolbar.h"
@@ -919,6 +920,7 @@ static bool LoadDocIntoWindow(LoadArgs& args, PasswordUI *pwdUI, DisplayState *s
 
     DisplayModel *prevModel = win->dm;
     AbortFinding(args.win);
+    AbortSelectingAll(args.win);
     delete win->pdfsync;
     win->pdfsync = NULL;
 
@@ -943,8 +945,11 @@ static bool LoadDocIntoWindow(LoadArgs& args, PasswordUI *pwdUI, DisplayState *s
         }
     }
 
-    if (engine)
+    if (engine) {
         win->dm = new DisplayModel(engine, engineType, win);
+        if (gRenderCache.diskCache)
+            win->dm->StartFingerprinting();
+    }
     else
         win->dm = NULL;
 
@@ -1112,6 +1117,21 @@ Error:
     return true;
 }
 
+// indexes the document's text in the background so that searches can skip
+// pages without matches; the index of a document in file history is saved
+// alongside its thumbnail and reused when the document is reopened
+static void StartTextIndexing(WindowInfo *win)
+{
+    if (!win->IsDocLoaded() || IsStressTesting())
+        return;
+    ScopedMem<WCHAR> indexPath;
+    if (gGlobalPrefs->rememberOpenedFiles && HasPermission(Perm_DiskAccess) &&
+        gFileHistory.Find(win->loadedFilePath)) {
+        indexPath.Set(GetTextIndexPath(win->loadedFilePath));
+    }
+    win->dm->textIndex->StartBuilding(indexPath);
+}
+
 void ReloadDocument(WindowInfo *win, bool autorefresh)
 {
     if (!win->IsDocLoaded()) {
@@ -1147,6 +1167,8 @@ void ReloadDocument(WindowInfo *win, bool autorefresh)
         return;
     }
 
+    StartTextIndexing(win);
+
     if (gGlobalPrefs->showStartPage) {
         // refresh the thumbnail for this file
         DisplayState *state = gFileHistory.Find(ds->filePath);
@@ -1297,6 +1319,7 @@ static void DeleteWindowInfo(WindowInfo *win)
 
     AbortFinding(win);
     AbortPrinting(win);
+    AbortSelectingAll(win);
 
     if (win->uia_provider) {
         // tell UIA to release all objects cached in its store
@@ -1529,6 +1552,7 @@ static WindowInfo* LoadDocumentOld(LoadArgs& args)
             CreateThumbnailForFile(*win, *ds);
         prefs::Save();
     }
+    StartTextIndexing(win);
 
     // Add the file also to Windows' recently used documents (this doesn't
     // happen automatically on drag&drop, reopening from history, etc.)
@@ -1614,6 +1638,12 @@ void WindowInfo::CleanUp(DisplayModel *dm)
 
     gRenderCache.CancelRendering(dm);
     gRenderCache.FreeForDisplayModel(dm);
+
+    // also logged in release builds (e.g. for DebugView)
+    BitmapCacheStats stats = gRenderCache.GetStats();
+    dbglog::LogF("bitmap cache: %u hits, %u misses, %u evictions, %u bitmaps (%u of %u KB)",
+        (UINT)stats.hits, (UINT)stats.misses, (UINT)stats.evictions,
+        (UINT)stats.count, (UINT)(stats.bytes / 1024), (UINT)(stats.maxBytes / 1024));
 }
 
 static void UpdateCanvasScrollbars(DisplayModel *dm, HWND hwndCanvas, SizeI canvas)
@@ -2122,16 +2152,17 @@ static void DrawDocument(WindowInfo& win, HDC hdc, RECT *rcArea)
         if (!pageInfo->shown)
             continue;
 
-        RectI bounds = pageInfo->pageOnScreen.Intersect(screen);
+        RectI pageOnScreen = dm->GetPageOnScreen(pageNo);
+        RectI bounds = pageOnScreen.Intersect(screen);
         // don't paint the frame background for images
         if (!(dm->engine && dm->engine->IsImageCollection()))
-            PaintPageFrameAndShadow(hdc, bounds, pageInfo->pageOnScreen, win.presentation);
+            PaintPageFrameAndShadow(hdc, bounds, pageOnScreen, win.presentation);
 
         bool renderOutOfDateCue = false;
         UINT renderDelay = 0;
         if (!DoCachePageRendering(&win, pageNo)) {
             if (dm->engine)
-                dm->engine->RenderPage(hdc, pageInfo->pageOnScreen, pageNo, dm->ZoomReal(pageNo), dm->Rotation());
+                dm->engine->RenderPage(hdc, pageOnScreen, pageNo, dm->ZoomReal(pageNo), dm->Rotation());
         }
         else
             renderDelay = gRenderCache.Paint(hdc, bounds, dm, pageNo, pageInfo, &renderOutOfDateCue);
@@ -2628,6 +2659,7 @@ void OnMenuExit()
         }
         AbortFinding(win);
         AbortPrinting(win);
+        AbortSelectingAll(win);
     }
 
     prefs::Save();
@@ -2651,6 +2683,7 @@ void CloseDocumentInWindow(WindowInfo *win)
     SetSidebarVisibility(win, false, gGlobalPrefs->showFavorites);
     ClearTocBox(win);
     AbortFinding(win, true);
+    AbortSelectingAll(win);
     delete win->linkOnLastButtonDown;
     win->linkOnLastButtonDown = NULL;
     if (win->uia_provider)
@@ -386,6 +386,17 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
     gPolicyRestrictions = GetPolicies(i.restrictedUse);
     gRenderCache.textColor = i.textColor;
     gRenderCache.backgroundColor = i.backgroundColor;
+    if (gGlobalPrefs->bitmapCacheSize > 0)
+        gRenderCache.maxCacheBytes = (size_t)gGlobalPrefs->bitmapCacheSize * 1024 * 1024;
+    if (gGlobalPrefs->displayListCacheSize > 0)
+        SetPageRunCacheSize((size_t)gGlobalPrefs->displayListCacheSize * 1024 * 1024);
+    if (gGlobalPrefs->textCacheSize > 0)
+        SetTextCacheSize((size_t)gGlobalPrefs->textCacheSize * 1024 * 1024);
+    if (gGlobalPrefs->tileCacheSize > 0 && gGlobalPrefs->rememberOpenedFiles) {
+        ScopedMem<WCHAR> thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
+        ScopedMem<WCHAR> tilesPath(path::Join(thumbsPath, L"tiles"));
+        gRenderCache.diskCache = new DiskTileCache(tilesPath, (size_t)gGlobalPrefs->tileCacheSize * 1024 * 1024);
+    }
     DebugGdiPlusDevice(gUseGdiRenderer);
 
     if (i.inverseSearchCmdLine) {
@@ -0,0 +1,304 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "BaseUtil.h"
+#include "TextIndex.h"
+
+#include "BaseEngine.h"
+#include "FileUtil.h"
+#include "TextMatch.h"
+#include "TextSearch.h"
+#include "ThreadUtil.h"
+
+/*
+A saved index consists of a header followed by the filters of all pages:
+
+"STX1" | page count (uint32) | document size (uint64) | document modification time (FILETIME)
+then for every page: filter size in bits (uint32, 0 if not indexed) | filter bits
+
+The index is only used as long as the document's size and modification time
+still match. It is a filter for candidate pages only, so TextSearch::MatchLen
+still has to verify all matches (and apply its normalizations).
+*/
+
+#define INDEX_MAGIC         "STX1"
+#define INDEX_HEADER_LEN    24
+
+#define MIN_FILTER_BITS     256
+#define MAX_FILTER_BITS     65536
+// with two probes per trigram, a filter with 8 bits per trigram has
+// a false positive rate of less than 5%
+#define BITS_PER_TRIGRAM    8
+
+// indexes all remaining pages at the lowest priority
+class TextIndexBuilder : public ThreadBase {
+    TextIndex *index;
+    int pageCount;
+    ScopedMem<WCHAR> filePath;
+
+public:
+    TextIndexBuilder(TextIndex *index, int pageCount, const WCHAR *filePath) :
+        ThreadBase("TextIndexBuilder"), index(index), pageCount(pageCount),
+        filePath(str::Dup(filePath)) { }
+    virtual ~TextIndexBuilder() { }
+
+    virtual void Run() {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+        for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+            if (WasCancelRequested())
+                return;
+            index->IndexPage(pageNo);
+        }
+        if (filePath && index->IsComplete())
+            index->Save(filePath);
+    }
+};
+
+static inline uint32_t MixHash(uint32_t h)
+{
+    // cf. MurmurHash3's fmix32
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+void TextIndex::GetTrigrams(const WCHAR *text, Vec<uint32_t>& trigrams)
+{
+    // MatchLen never skips whitespace after a word character, so a run of
+    // word characters in the search text must appear on the page as well
+    WCHAR prev[2] = { 0 };
+    int runLen = 0;
+    for (const WCHAR *c = text; c && *c; c++) {
+        if (!isnoncjkwordchar(*c)) {
+            runLen = 0;
+            continue;
+        }
+        // same case folding as in TextSearch::MatchLen
+        WCHAR folded = textmatch::FoldCase(*c);
+        if (++runLen >= 3)
+            trigrams.Append(MixHash(MixHash(prev[0] | ((uint32_t)prev[1] << 16)) ^ folded));
+        prev[0] = prev[1];
+        prev[1] = folded;
+    }
+}
+
+static inline bool TestBit(const uint32_t *bits, uint32_t bit)
+{
+    return (bits[bit / 32] & (1u << (bit % 32))) != 0;
+}
+
+static inline bool MayContain(const uint32_t *filter, uint32_t trigram)
+{
+    uint32_t mask = filter[0] - 1;
+    return TestBit(filter + 1, trigram & mask) && TestBit(filter + 1, (trigram >> 16) & mask);
+}
+
+static uint32_t *BuildFilter(const WCHAR *text)
+{
+    Vec<uint32_t> trigrams;
+    TextIndex::GetTrigrams(text, trigrams);
+
+    uint32_t bits = MIN_FILTER_BITS;
+    while (bits < trigrams.Count() * BITS_PER_TRIGRAM && bits < MAX_FILTER_BITS)
+        bits *= 2;
+    uint32_t *filter = AllocArray<uint32_t>(1 + bits / 32);
+    if (!filter)
+        return NULL;
+    filter[0] = bits;
+    for (size_t i = 0; i < trigrams.Count(); i++) {
+        uint32_t t = trigrams.At(i);
+        filter[1 + (t & (bits - 1)) / 32] |= 1u << (t & (bits - 1)) % 32;
+        filter[1 + ((t >> 16) & (bits - 1)) / 32] |= 1u << ((t >> 16) & (bits - 1)) % 32;
+    }
+    return filter;
+}
+
+TextIndex::TextIndex(BaseEngine *engine, PageTextCache *textCache) :
+    engine(engine), textCache(textCache), indexedPages(0), builder(NULL)
+{
+    filters = AllocArray<uint32_t *>(engine->PageCount());
+    InitializeCriticalSection(&access);
+}
+
+TextIndex::~TextIndex()
+{
+    if (builder) {
+        builder->RequestCancel();
+        builder->Join();
+        delete builder;
+    }
+
+    for (int i = 0; i < engine->PageCount(); i++) {
+        free(filters[i]);
+    }
+    free(filters);
+    DeleteCriticalSection(&access);
+}
+
+void TextIndex::AddPage(int pageNo, const WCHAR *text)
+{
+    CrashIf(pageNo < 1 || pageNo > engine->PageCount());
+    if (IsIndexed(pageNo))
+        return;
+
+    uint32_t *filter = BuildFilter(text);
+    if (!filter)
+        return;
+
+    ScopedCritSec scope(&access);
+    if (filters[pageNo - 1]) {
+        // another thread has indexed the same page in the meantime
+        free(filter);
+        return;
+    }
+    filters[pageNo - 1] = filter;
+    indexedPages++;
+}
+
+void TextIndex::IndexPage(int pageNo)
+{
+    if (IsIndexed(pageNo))
+        return;
+    // don't fill the text cache with pages the user might never look at
+    if (textCache->HasData(pageNo)) {
+        ScopedMem<WCHAR> text(textCache->GetText(pageNo));
+        AddPage(pageNo, text ? text.Get() : L"");
+        return;
+    }
+    ScopedMem<WCHAR> text(engine->ExtractPageText(pageNo, L"\n"));
+    AddPage(pageNo, text ? text.Get() : L"");
+}
+
+bool TextIndex::IsIndexed(int pageNo)
+{
+    ScopedCritSec scope(&access);
+    return filters[pageNo - 1] != NULL;
+}
+
+bool TextIndex::IsComplete()
+{
+    ScopedCritSec scope(&access);
+    return indexedPages == engine->PageCount();
+}
+
+bool TextIndex::MayMatch(int pageNo, Vec<uint32_t>& trigrams)
+{
+    ScopedCritSec scope(&access);
+    const uint32_t *filter = filters[pageNo - 1];
+    if (!filter)
+        return true;
+    for (size_t i = 0; i < trigrams.Count(); i++) {
+        if (!MayContain(filter, trigrams.At(i)))
+            return false;
+    }
+    return true;
+}
+
+void TextIndex::StartBuilding(const WCHAR *filePath)
+{
+    CrashIf(builder);
+    if (builder)
+        return;
+    if (filePath && Load(filePath) && IsComplete())
+        return;
+    builder = new TextIndexBuilder(this, engine->PageCount(), filePath);
+    builder->Start();
+}
+
+static bool GetDocumentInfo(BaseEngine *engine, uint64_t *size, FILETIME *modified)
+{
+    const WCHAR *fileName = engine->FileName();
+    if (!fileName || !file::Exists(fileName))
+        return false;
+    int64 fileSize = file::GetSize(fileName);
+    if (fileSize < 0)
+        return false;
+    *size = (uint64_t)fileSize;
+    *modified = file::GetModificationTime(fileName);
+    return true;
+}
+
+bool TextIndex::Load(const WCHAR *filePath)
+{
+    uint64_t docSize;
+    FILETIME docModified;
+    if (!GetDocumentInfo(engine, &docSize, &docModified))
+        return false;
+
+    size_t len;
+    ScopedMem<char> data(file::ReadAll(filePath, &len));
+    if (!data || len < INDEX_HEADER_LEN || !str::StartsWith(data.Get(), INDEX_MAGIC))
+        return false;
+    if (*(uint32_t *)(data + 4) != (uint32_t)engine->PageCount() ||
+        *(uint64_t *)(data + 8) != docSize ||
+        memcmp(data + 16, &docModified, sizeof(FILETIME)) != 0) {
+        // the document has been modified since the index was saved
+        return false;
+    }
+
+    const char *end = data + len;
+    const char *curr = data + INDEX_HEADER_LEN;
+    Vec<uint32_t *> loaded;
+    for (int i = 0; i < engine->PageCount(); i++) {
+        if (curr + 4 > end)
+            break;
+        uint32_t bits = *(uint32_t *)curr;
+        if (0 == bits) {
+            loaded.Append(NULL);
+            curr += 4;
+            continue;
+        }
+        // the filter size must be a power of two
+        if (bits < MIN_FILTER_BITS || bits > MAX_FILTER_BITS || (bits & (bits - 1)) != 0 ||
+            curr + 4 + bits / 8 > end) {
+            break;
+        }
+        loaded.Append((uint32_t *)memdup(curr, 4 + bits / 8));
+        curr += 4 + bits / 8;
+    }
+    if (loaded.Count() != (size_t)engine->PageCount() || curr != end) {
+        FreeVecMembers(loaded);
+        return false;
+    }
+
+    ScopedCritSec scope(&access);
+    for (int i = 0; i < engine->PageCount(); i++) {
+        if (filters[i] || !loaded.At(i)) {
+            free(loaded.At(i));
+            continue;
+        }
+        filters[i] = loaded.At(i);
+        indexedPages++;
+    }
+    return true;
+}
+
+bool TextIndex::Save(const WCHAR *filePath)
+{
+    uint64_t docSize;
+    FILETIME docModified;
+    if (!GetDocumentInfo(engine, &docSize, &docModified))
+        return false;
+
+    str::Str<char> data;
+    data.Append(INDEX_MAGIC);
+    uint32_t pageCount = (uint32_t)engine->PageCount();
+    data.Append((const char *)&pageCount, 4);
+    data.Append((const char *)&docSize, 8);
+    data.Append((const char *)&docModified, sizeof(FILETIME));
+
+    EnterCriticalSection(&access);
+    for (int i = 0; i < engine->PageCount(); i++) {
+        if (filters[i])
+            data.Append((const char *)filters[i], 4 + filters[i][0] / 8);
+        else
+            data.Append("\0\0\0\0", 4);
+    }
+    LeaveCriticalSection(&access);
+
+    ScopedMem<WCHAR> dir(path::GetDir(filePath));
+    return dir::Create(dir) && file::WriteAll(filePath, data.Get(), data.Size());
+}
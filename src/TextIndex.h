@@ -0,0 +1,55 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#ifndef TextIndex_h
+#define TextIndex_h
+
+class BaseEngine;
+class PageTextCache;
+class TextIndexBuilder;
+
+#define TEXT_INDEX_EXT  L".idx"
+
+// allows text searches to skip pages which can't contain a match without
+// having to extract their text first: for every page, all trigrams of
+// (case folded) word characters are added to a Bloom filter, so that
+// there can be false positives but never false negatives
+class TextIndex {
+    BaseEngine *    engine;
+    PageTextCache * textCache;
+    // filters[i] is NULL for pages which haven't been indexed yet, else
+    // it starts with the filter's size (in bits) followed by the bits
+    uint32_t **     filters;
+    int             indexedPages;
+    CRITICAL_SECTION access;
+
+    TextIndexBuilder *builder;
+
+    bool    Load(const WCHAR *filePath);
+
+public:
+    TextIndex(BaseEngine *engine, PageTextCache *textCache);
+    ~TextIndex();
+
+    // adds a page's text (as returned by BaseEngine::ExtractPageText)
+    void    AddPage(int pageNo, const WCHAR *text);
+    // extracts the text of a page (unless it's already been indexed or cached)
+    void    IndexPage(int pageNo);
+    bool    IsIndexed(int pageNo);
+    bool    IsComplete();
+
+    // returns false if the page can't contain text for which GetTrigrams
+    // returned the given trigrams (true for pages not indexed yet)
+    bool    MayMatch(int pageNo, Vec<uint32_t>& trigrams);
+    // search text only matches if all of its word trigrams are present
+    // (cf. TextSearch::MatchLen)
+    static void GetTrigrams(const WCHAR *text, Vec<uint32_t>& trigrams);
+
+    // loads a previously saved index from filePath (if it's still up-to-date)
+    // and else indexes all remaining pages on a background thread, saving
+    // the complete index to filePath (if filePath isn't NULL)
+    void    StartBuilding(const WCHAR *filePath);
+    bool    Save(const WCHAR *filePath);
+};
+
+#endif
@@ -4,35 +4,52 @@
 #include "BaseUtil.h"
 #include "TextSearch.h"
 
-enum { SEARCH_PAGE, SKIP_PAGE };
+#include "TextIndex.h"
+#include "TextMatch.h"
 
-#define SkipWhitespace(c) for (; str::IsWs(*(c)); (c)++)
-// ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
-// cf. http://code.google.com/p/sumatrapdf/issues/detail?id=959
-#define isnoncjkwordchar(c) (iswordchar(c) && (unsigned short)(c) < 0x2E80)
+enum { SEARCH_PAGE, SKIP_PAGE };
 
-TextSearch::TextSearch(BaseEngine *engine, PageTextCache *textCache) :
+TextSearch::TextSearch(BaseEngine *engine, PageTextCache *textCache, TextIndex *textIndex) :
     TextSelection(engine, textCache),
-    findText(NULL), anchor(NULL), pageText(NULL),
+    findText(NULL), anchor(NULL), foldedAnchor(NULL), anchorLen(0),
+    pageText(NULL), foldedText(NULL), pageTextLen(0),
     caseSensitive(false), forward(true),
-    matchWordStart(false), matchWordEnd(false),
+    matchWordStart(false), matchWordEnd(false), textIndex(textIndex),
     findPage(0), findIndex(0), lastText(NULL)
 {
     findCache = AllocArray<BYTE>(this->engine->PageCount());
+    allResults.len = 0;
+    allResults.pages = NULL;
+    allResults.rects = NULL;
 }
 
 TextSearch::~TextSearch()
 {
     Clear();
     free(findCache);
+    free(allResults.pages);
+    free(allResults.rects);
 }
 
 void TextSearch::Reset()
 {
-    pageText = NULL;
+    str::ReplacePtr(&pageText, NULL);
+    str::ReplacePtr(&foldedText, NULL);
+    pageTextLen = 0;
     TextSelection::Reset();
 }
 
+void TextSearch::LoadPageText(int pageNo)
+{
+    str::ReplacePtr(&pageText, textCache->GetText(pageNo, &pageTextLen));
+    str::ReplacePtr(&foldedText, NULL);
+    if (pageText) {
+        foldedText = AllocArray<WCHAR>(pageTextLen + 1);
+        if (foldedText)
+            textmatch::FoldCase(foldedText, pageText, pageTextLen);
+    }
+}
+
 void TextSearch::SetText(const WCHAR *text)
 {
     // search text starting with a single space enables the 'Match word start'
@@ -67,6 +84,11 @@ void TextSearch::SetText(const WCHAR *text)
         anchor = NULL;
     else
         anchor = str::DupN(text, 1);
+    if (anchor) {
+        anchorLen = str::Len(anchor);
+        foldedAnchor = str::Dup(anchor);
+        textmatch::FoldCase(foldedAnchor, anchor, anchorLen);
+    }
 
     if (str::EndsWith(this->findText, L" "))
         this->findText[str::Len(this->findText) - 1] = '\0';
@@ -76,6 +98,10 @@ void TextSearch::SetText(const WCHAR *text)
 #endif
 
     memset(this->findCache, SEARCH_PAGE, this->engine->PageCount());
+
+    findTrigrams.Reset();
+    if (textIndex)
+        TextIndex::GetTrigrams(this->findText, findTrigrams);
 }
 
 void TextSearch::SetSensitive(bool sensitive)
@@ -107,7 +133,7 @@ void TextSearch::SetLastResult(TextSelection *sel)
 
     findPage = min(startPage, endPage);
     findIndex = (findPage == startPage ? startGlyph : endGlyph) + (int)str::Len(findText);
-    pageText = textCache->GetData(findPage);
+    LoadPageText(findPage);
     forward = true;
 }
 
@@ -115,43 +141,16 @@ void TextSearch::SetLastResult(TextSelection *sel)
 // (ignore all whitespace except after alphanumeric characters)
 int TextSearch::MatchLen(const WCHAR *start) const
 {
-    const WCHAR *match = findText, *end = start;
-
     if (matchWordStart && start > pageText && iswordchar(start[-1]) && iswordchar(start[0]))
         return -1;
 
-    if (!match)
+    if (!findText)
         return -1;
 
-    while (*match) {
-        if (!*end)
-            return -1;
-        if (caseSensitive ? *match == *end : CharLower((LPWSTR)LOWORD(*match)) == CharLower((LPWSTR)LOWORD(*end)))
-            /* characters are identical */;
-        else if (str::IsWs(*match) && str::IsWs(*end))
-            /* treat all whitespace as identical */;
-        // TODO: Adobe Reader seems to have a more extensive list of
-        //       normalizations - is there an easier way?
-        else if (*match == '-' && (0x2010 <= *end && *end <= 0x2014))
-            /* make HYPHEN-MINUS also match HYPHEN, NON-BREAKING HYPHEN,
-               FIGURE DASH, EN DASH and EM DASH (but not the other way around) */;
-        else if (*match == '\'' && (0x2018 <= *end && *end <= 0x201b))
-            /* make APOSTROPHE also match LEFT/RIGHT SINGLE QUOTATION MARK */;
-        else if (*match == '"' && (0x201c <= *end && *end <= 0x201f))
-            /* make QUOTATION MARK also match LEFT/RIGHT DOUBLE QUOTATION MARK */;
-        else
-            return -1;
-        match++;
-        end++;
-        // treat "??" and "? ?" differently, since '?' could have been a word
-        // character that's just missing an encoding (and '?' is the replacement
-        // character); cf. http://code.google.com/p/sumatrapdf/issues/detail?id=1574
-        if (*match && !isnoncjkwordchar(*(match - 1)) && (*(match - 1) != '?' || *match != '?') ||
-            str::IsWs(*(match - 1)) && str::IsWs(*(end - 1))) {
-            SkipWhitespace(match);
-            SkipWhitespace(end);
-        }
-    }
+    int len = textmatch::MatchLen(findText, start, caseSensitive);
+    if (len < 0)
+        return -1;
+    const WCHAR *end = start + len;
 
     if (matchWordEnd && end > pageText && iswordchar(end[-1]) && iswordchar(end[0]))
         return -1;
@@ -175,17 +174,25 @@ bool TextSearch::FindTextInPage(int pageNo)
         pageNo = findPage;
     findPage = pageNo;
 
+    // anchors are matched exactly, so search case folded text for a case folded anchor
+    const WCHAR *text = caseSensitive ? pageText : foldedText;
+    const WCHAR *find = caseSensitive ? anchor : foldedAnchor;
+    if (!text)
+        return false;
+
     const WCHAR *found;
     int length;
     do {
+        size_t offset = (size_t)max(findIndex, 0);
         if (!anchor)
             found = GetNextIndex(pageText, findIndex, forward);
         else if (forward)
-            found = (caseSensitive ? StrStr : StrStrI)(pageText + findIndex, anchor);
+            found = textmatch::FindNext(text, pageTextLen, offset, find, anchorLen);
         else
-            found = StrRStrI(pageText, pageText + findIndex, anchor);
+            found = textmatch::FindPrev(text, pageTextLen, offset, find, anchorLen);
         if (!found)
             return false;
+        found = pageText + (found - text);
         findIndex = (int)(found - pageText) + (forward ? 1 : 0);
         length = MatchLen(found);
     } while (length <= 0);
@@ -216,13 +223,20 @@ bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI *tracker)
             pageNo += forward ? 1 : -1;
             continue;
         }
+        // don't extract the text of pages which can't contain a match
+        if (textIndex && !textIndex->MayMatch(pageNo, findTrigrams)) {
+            findCache[pageNo - 1] = SKIP_PAGE;
+            pageNo += forward ? 1 : -1;
+            continue;
+        }
 
         Reset();
 
-        pageText = textCache->GetData(pageNo, &findIndex);
+        LoadPageText(pageNo);
+        if (pageText && textIndex)
+            textIndex->AddPage(pageNo, pageText);
         if (pageText) {
-            if (forward)
-                findIndex = 0;
+            findIndex = forward ? 0 : pageTextLen;
             if (FindTextInPage(pageNo))
                 return true;
             findCache[pageNo - 1] = SKIP_PAGE;
@@ -264,3 +278,33 @@ TextSel *TextSearch::FindNext(ProgressUpdateUI *tracker)
         return &result;
     return NULL;
 }
+
+TextSel *TextSearch::FindAll(const WCHAR *text, ProgressUpdateUI *tracker)
+{
+    free(allResults.pages);
+    free(allResults.rects);
+    allResults.len = 0;
+    allResults.pages = NULL;
+    allResults.rects = NULL;
+
+    bool wasForward = forward;
+    SetDirection(FIND_FORWARD);
+    SetText(text);
+
+    Vec<int> pages;
+    Vec<RectI> rects;
+    bool found = FindStartingAtPage(1, tracker);
+    while (found) {
+        pages.Append(result.pages, result.len);
+        rects.Append(result.rects, result.len);
+        found = FindTextInPage() || FindStartingAtPage(findPage + 1, tracker);
+    }
+    SetDirection(wasForward ? FIND_FORWARD : FIND_BACKWARD);
+
+    if ((tracker && tracker->WasCanceled()) || 0 == pages.Count())
+        return NULL;
+    allResults.len = (int)pages.Count();
+    allResults.pages = pages.StealData();
+    allResults.rects = rects.StealData();
+    return &allResults;
+}
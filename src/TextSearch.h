@@ -7,23 +7,21 @@
 #include <windows.h>
 #include "TextSelection.h"
 
+class TextIndex;
+
+// ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
+// cf. http://code.google.com/p/sumatrapdf/issues/detail?id=959
+#define isnoncjkwordchar(c) (iswordchar(c) && (unsigned short)(c) < 0x2E80)
+
 enum TextSearchDirection {
     FIND_BACKWARD = false,
     FIND_FORWARD  = true
 };
 
-class ProgressUpdateUI
-{
-public:
-    virtual void UpdateProgress(int current, int total) = 0;
-    virtual bool WasCanceled() = 0;
-    virtual ~ProgressUpdateUI() { }
-};
-
 class TextSearch : public TextSelection
 {
 public:
-    TextSearch(BaseEngine *engine, PageTextCache *textCache);
+    TextSearch(BaseEngine *engine, PageTextCache *textCache, TextIndex *textIndex=NULL);
     ~TextSearch();
 
     void SetSensitive(bool sensitive);
@@ -31,6 +29,8 @@ public:
     void SetLastResult(TextSelection *sel);
     TextSel *FindFirst(int page, const WCHAR *text, ProgressUpdateUI *tracker=NULL);
     TextSel *FindNext(ProgressUpdateUI *tracker=NULL);
+    // returns all matches in the whole document (in document order)
+    TextSel *FindAll(const WCHAR *text, ProgressUpdateUI *tracker=NULL);
 
     // note: the result might not be a valid page number!
     int GetCurrentPageNo() const { return findPage; }
@@ -38,6 +38,9 @@ public:
 protected:
     WCHAR *findText;
     WCHAR *anchor;
+    // case folded copy of anchor (for case insensitive searches)
+    WCHAR *foldedAnchor;
+    size_t anchorLen;
     int findPage;
     bool forward;
     bool caseSensitive;
@@ -46,6 +49,9 @@ protected:
     // combining them yields a 'Whole words' search
     bool matchWordStart;
     bool matchWordEnd;
+    // used for skipping pages which can't contain findText (can be NULL)
+    TextIndex *textIndex;
+    Vec<uint32_t> findTrigrams;
 
     void SetText(const WCHAR *text);
     bool FindTextInPage(int pageNo = 0);
@@ -56,17 +62,25 @@ protected:
     {
         str::ReplacePtr(&findText, NULL);
         str::ReplacePtr(&anchor, NULL);
+        str::ReplacePtr(&foldedAnchor, NULL);
         str::ReplacePtr(&lastText, NULL);
         Reset();
     }
     void Reset();
 
 private:
-    const WCHAR *pageText;
+    void LoadPageText(int pageNo);
+
+    // a copy of the current page's text (cf. PageTextCache::GetText)
+    WCHAR *pageText;
+    // pageText case folded (for case insensitive searches)
+    WCHAR *foldedText;
+    int pageTextLen;
     int findIndex;
 
     WCHAR *lastText;
     BYTE *findCache;
+    TextSel allResults;
 };
 
 #endif
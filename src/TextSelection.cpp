@@ -4,16 +4,228 @@
 #include "BaseUtil.h"
 #include "TextSelection.h"
 
-PageTextCache::PageTextCache(BaseEngine *engine) : engine(engine)
+#include "ThreadUtil.h"
+
+/*
+Pages are cached in a compact form, since the text of every visited page is
+kept and a RectI per glyph takes eight times the space of an ASCII character:
+
+* the text is stored as UTF-8 unless UTF-16 is shorter
+* the glyph boxes are delta encoded line by line: for every glyph there's
+  a flags byte (cf. GLYPH_*) followed by zigzag encoded varints for the
+  differences to the previous box, where x is predicted to follow right
+  after the previous box; the first glyph of every line is encoded relative
+  to an empty box, so that decoding a range only has to start at its line
+
+Glyph boxes already are integral, so the encoding is lossless.
+*/
+
+#define GLYPH_X         0x08 // else a small x difference is in the upper four bits
+#define GLYPH_Y         0x01
+#define GLYPH_DX        0x02
+#define GLYPH_DY        0x04
+// an empty box (as used for line breaks) which doesn't change the previous box
+#define GLYPH_EMPTY     0xF8
+
+struct CompactPageText {
+    int         len;
+    bool        isUtf8;
+    char *      text;
+    size_t      textBytes;
+    BYTE *      coords;
+    size_t      coordsBytes;
+    // index of the first glyph and its offset into coords for every line
+    int         lineCount;
+    int *       lineGlyphs;
+    uint32_t *  lineOffsets;
+    unsigned int lastUsed;
+
+    size_t Size() const {
+        return sizeof(*this) + textBytes + coordsBytes + lineCount * (sizeof(int) + sizeof(uint32_t));
+    }
+};
+
+static inline uint32_t ZigZag(int value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int UnZigZag(uint32_t value)
+{
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+static void AppendVarint(Vec<BYTE>& out, uint32_t value)
+{
+    for (; value >= 0x80; value >>= 7) {
+        out.Append((BYTE)(value | 0x80));
+    }
+    out.Append((BYTE)value);
+}
+
+static inline uint32_t ReadVarint(const BYTE *& data)
+{
+    uint32_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+        BYTE b = *data++;
+        value |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return value;
+    }
+}
+
+static void EncodeGlyph(Vec<BYTE>& out, const RectI& rc, RectI& prev)
+{
+    if (!rc.x && !rc.y && !rc.dx && !rc.dy) {
+        out.Append(GLYPH_EMPTY);
+        return;
+    }
+    uint32_t x = ZigZag(rc.x - (prev.x + prev.dx));
+    BYTE flags = x < 16 ? (BYTE)(x << 4) : GLYPH_X;
+    if (rc.y != prev.y)
+        flags |= GLYPH_Y;
+    if (rc.dx != prev.dx)
+        flags |= GLYPH_DX;
+    if (rc.dy != prev.dy)
+        flags |= GLYPH_DY;
+    out.Append(flags);
+    if ((flags & GLYPH_X))
+        AppendVarint(out, x);
+    if ((flags & GLYPH_Y))
+        AppendVarint(out, ZigZag(rc.y - prev.y));
+    if ((flags & GLYPH_DX))
+        AppendVarint(out, ZigZag(rc.dx - prev.dx));
+    if ((flags & GLYPH_DY))
+        AppendVarint(out, ZigZag(rc.dy - prev.dy));
+    prev = rc;
+}
+
+static inline RectI DecodeGlyph(const BYTE *& data, RectI& prev)
+{
+    BYTE flags = *data++;
+    if (GLYPH_EMPTY == flags)
+        return RectI();
+    RectI rc;
+    rc.x = prev.x + prev.dx + UnZigZag((flags & GLYPH_X) ? ReadVarint(data) : flags >> 4);
+    rc.y = prev.y + ((flags & GLYPH_Y) ? UnZigZag(ReadVarint(data)) : 0);
+    rc.dx = prev.dx + ((flags & GLYPH_DX) ? UnZigZag(ReadVarint(data)) : 0);
+    rc.dy = prev.dy + ((flags & GLYPH_DY) ? UnZigZag(ReadVarint(data)) : 0);
+    prev = rc;
+    return rc;
+}
+
+static void FreeCompactPage(CompactPageText *page)
+{
+    if (!page)
+        return;
+    free(page->text);
+    free(page->coords);
+    free(page->lineGlyphs);
+    free(page->lineOffsets);
+    free(page);
+}
+
+static CompactPageText *NewCompactPage(const WCHAR *text, const RectI *coords)
+{
+    CompactPageText *page = AllocStruct<CompactPageText>();
+    if (!page)
+        return NULL;
+    page->len = text ? (int)str::Len(text) : 0;
+    if (0 == page->len)
+        return page;
+
+    // UTF-8 only round-trips for text without (unpaired) surrogates
+    bool hasSurrogates = false;
+    for (int i = 0; i < page->len && !hasSurrogates; i++) {
+        hasSurrogates = 0xD800 <= text[i] && text[i] <= 0xDFFF;
+    }
+    if (!hasSurrogates) {
+        page->text = str::conv::ToUtf8(text, page->len);
+        page->textBytes = str::Len(page->text);
+        page->isUtf8 = page->text && page->textBytes < page->len * sizeof(WCHAR);
+    }
+    if (!page->isUtf8) {
+        free(page->text);
+        page->textBytes = page->len * sizeof(WCHAR);
+        page->text = (char *)memdup(text, page->textBytes);
+    }
+
+    Vec<BYTE> data;
+    Vec<int> lineGlyphs;
+    Vec<uint32_t> lineOffsets;
+    RectI prev;
+    for (int i = 0; i < page->len; i++) {
+        if (0 == i || '\n' == text[i - 1]) {
+            lineGlyphs.Append(i);
+            lineOffsets.Append((uint32_t)data.Count());
+            prev = RectI();
+        }
+        EncodeGlyph(data, coords ? coords[i] : RectI(), prev);
+    }
+    page->coordsBytes = data.Count();
+    page->coords = data.StealData();
+    page->lineCount = (int)lineGlyphs.Count();
+    page->lineGlyphs = lineGlyphs.StealData();
+    page->lineOffsets = lineOffsets.StealData();
+
+    if (!page->text || !page->coords || !page->lineGlyphs || !page->lineOffsets) {
+        FreeCompactPage(page);
+        return NULL;
+    }
+    return page;
+}
+
+static WCHAR *DecodeText(CompactPageText *page)
 {
-    int count = engine->PageCount();
-    coords = AllocArray<RectI *>(count);
-    text = AllocArray<WCHAR *>(count);
-    lens = AllocArray<int>(count);
-#ifdef DEBUG
-    debug_size = count * (sizeof(RectI *) + sizeof(WCHAR *) + sizeof(int));
-#endif
+    if (0 == page->len)
+        return str::Dup(L"");
+    if (page->isUtf8)
+        return str::conv::FromUtf8(page->text, page->textBytes);
+    return str::DupN((const WCHAR *)page->text, page->len);
+}
 
+static void DecodeCoords(CompactPageText *page, int glyph, int count, RectI *coordsOut)
+{
+    // find the line containing the first requested glyph
+    int line = 0;
+    for (int lo = 0, hi = page->lineCount - 1; lo <= hi; ) {
+        int mid = (lo + hi) / 2;
+        if (page->lineGlyphs[mid] <= glyph) {
+            line = mid;
+            lo = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+
+    const BYTE *data = page->coords + page->lineOffsets[line];
+    RectI prev;
+    for (int i = page->lineGlyphs[line]; i < glyph + count; i++) {
+        if (line + 1 < page->lineCount && page->lineGlyphs[line + 1] == i) {
+            line++;
+            CrashIf(data != page->coords + page->lineOffsets[line]);
+            prev = RectI();
+        }
+        RectI rc = DecodeGlyph(data, prev);
+        if (i >= glyph)
+            coordsOut[i - glyph] = rc;
+    }
+}
+
+static size_t gMaxTextCacheBytes = DEFAULT_TEXT_CACHE_BYTES;
+
+void SetTextCacheSize(size_t maxBytes)
+{
+    gMaxTextCacheBytes = maxBytes > 0 ? maxBytes : DEFAULT_TEXT_CACHE_BYTES;
+}
+
+PageTextCache::PageTextCache(BaseEngine *engine, size_t maxBytes) :
+    engine(engine), maxBytes(maxBytes > 0 ? maxBytes : gMaxTextCacheBytes), useCount(0)
+{
+    pages = AllocArray<CompactPageText *>(engine->PageCount());
+    ZeroMemory(&stats, sizeof(stats));
+    ZeroMemory(decodedPageNos, sizeof(decodedPageNos));
+    ZeroMemory(decodedCoords, sizeof(decodedCoords));
     InitializeCriticalSection(&access);
 }
 
@@ -22,13 +234,12 @@ PageTextCache::~PageTextCache()
     EnterCriticalSection(&access);
 
     for (int i = 0; i < engine->PageCount(); i++) {
-        free(coords[i]);
-        free(text[i]);
+        FreeCompactPage(pages[i]);
+    }
+    free(pages);
+    for (int i = 0; i < DECODED_PAGES_CACHED; i++) {
+        free(decodedCoords[i]);
     }
-
-    free(coords);
-    free(text);
-    free(lens);
 
     LeaveCriticalSection(&access);
     DeleteCriticalSection(&access);
@@ -37,32 +248,234 @@ PageTextCache::~PageTextCache()
 bool PageTextCache::HasData(int pageNo)
 {
     CrashIf(pageNo < 1 || pageNo > engine->PageCount());
-    return text[pageNo - 1] != NULL;
+    return pages[pageNo - 1] != NULL;
 }
 
-const WCHAR *PageTextCache::GetData(int pageNo, int *lenOut, RectI **coordsOut)
+void PageTextCache::ExtractPage(int pageNo, BaseEngine *engine)
 {
+    if (HasData(pageNo))
+        return;
+
+    // don't hold the lock while extracting, so that several pages
+    // can be extracted at once (e.g. by ExtractPages and the render threads)
+    RectI *coords = NULL;
+    ScopedMem<WCHAR> text(engine->ExtractPageText(pageNo, L"\n", &coords));
+    CompactPageText *page = NewCompactPage(text, coords);
+    free(coords);
+    if (!page)
+        return;
+
     ScopedCritSec scope(&access);
+    if (pages[pageNo - 1]) {
+        // another thread has extracted the same page in the meantime
+        FreeCompactPage(page);
+        return;
+    }
+    pages[pageNo - 1] = page;
+    page->lastUsed = ++useCount;
+    stats.pages++;
+    stats.chars += page->len;
+    stats.bytes += page->Size();
+    stats.uncompactedBytes += (page->len + 1) * (sizeof(WCHAR) + sizeof(RectI));
+    EvictPages(pageNo);
+}
 
-    if (!text[pageNo - 1]) {
-        text[pageNo - 1] = engine->ExtractPageText(pageNo, L"\n", &coords[pageNo - 1]);
-        if (!text[pageNo - 1]) {
-            text[pageNo - 1] = str::Dup(L"");
-            lens[pageNo - 1] = 0;
+// must be called within the access critical section
+void PageTextCache::EvictPages(int keepPageNo)
+{
+    while (stats.bytes > maxBytes && stats.pages > 1) {
+        int oldest = -1;
+        for (int i = 0; i < engine->PageCount(); i++) {
+            if (pages[i] && i != keepPageNo - 1 && (-1 == oldest || pages[i]->lastUsed < pages[oldest]->lastUsed))
+                oldest = i;
         }
-        else {
-            lens[pageNo - 1] = (int)str::Len(text[pageNo - 1]);
+        CompactPageText *page = pages[oldest];
+        stats.pages--;
+        stats.chars -= page->len;
+        stats.bytes -= page->Size();
+        stats.uncompactedBytes -= (page->len + 1) * (sizeof(WCHAR) + sizeof(RectI));
+        stats.evictions++;
+        FreeCompactPage(page);
+        pages[oldest] = NULL;
+        for (int i = 0; i < DECODED_PAGES_CACHED; i++) {
+            if (decodedPageNos[i] == oldest + 1) {
+                free(decodedCoords[i]);
+                decodedCoords[i] = NULL;
+                decodedPageNos[i] = 0;
+            }
         }
-#ifdef DEBUG
-        debug_size += (lens[pageNo - 1] + 1) * (sizeof(WCHAR) + sizeof(RectI));
-#endif
     }
+}
 
+// returns with the access critical section held (the caller has to leave it)
+// unless the page couldn't be extracted
+CompactPageText *PageTextCache::LockPage(int pageNo)
+{
+    // try again if the page is evicted right after having been extracted
+    for (int tries = 0; tries < 2; tries++) {
+        ExtractPage(pageNo, engine);
+        EnterCriticalSection(&access);
+        CompactPageText *page = pages[pageNo - 1];
+        if (page) {
+            page->lastUsed = ++useCount;
+            return page;
+        }
+        LeaveCriticalSection(&access);
+    }
+    return NULL;
+}
+
+WCHAR *PageTextCache::GetText(int pageNo, int *lenOut)
+{
     if (lenOut)
-        *lenOut = lens[pageNo - 1];
-    if (coordsOut)
-        *coordsOut = coords[pageNo - 1];
-    return text[pageNo - 1];
+        *lenOut = 0;
+    CompactPageText *page = LockPage(pageNo);
+    if (!page)
+        return NULL;
+    WCHAR *text = DecodeText(page);
+    if (lenOut && text)
+        *lenOut = page->len;
+    LeaveCriticalSection(&access);
+    return text;
+}
+
+int PageTextCache::GetTextLen(int pageNo)
+{
+    CompactPageText *page = LockPage(pageNo);
+    if (!page)
+        return 0;
+    int len = page->len;
+    LeaveCriticalSection(&access);
+    return len;
+}
+
+RectI *PageTextCache::GetCoords(int pageNo, int glyph, int count)
+{
+    CompactPageText *page = LockPage(pageNo);
+    if (!page)
+        return NULL;
+    CrashIf(glyph < 0 || count < 0 || glyph + count > page->len);
+    RectI *coords = AllocArray<RectI>(max(count, 1));
+    if (coords && count > 0) {
+        // only requests for all of a page's glyph boxes are worth keeping
+        const RectI *decoded = GetDecodedCoords(pageNo, page, 0 == glyph && count == page->len);
+        if (decoded)
+            memcpy(coords, decoded + glyph, count * sizeof(RectI));
+        else
+            DecodeCoords(page, glyph, count, coords);
+    }
+    LeaveCriticalSection(&access);
+    return coords;
+}
+
+// must be called within the access critical section
+const RectI *PageTextCache::GetDecodedCoords(int pageNo, CompactPageText *page, bool decode)
+{
+    int ix;
+    for (ix = 0; ix < DECODED_PAGES_CACHED && decodedPageNos[ix] != pageNo; ix++);
+    if (DECODED_PAGES_CACHED == ix) {
+        if (!decode)
+            return NULL;
+        RectI *coords = AllocArray<RectI>(page->len);
+        if (!coords)
+            return NULL;
+        DecodeCoords(page, 0, page->len, coords);
+        // replace the least recently used page
+        ix = DECODED_PAGES_CACHED - 1;
+        free(decodedCoords[ix]);
+        decodedPageNos[ix] = pageNo;
+        decodedCoords[ix] = coords;
+    }
+    // move the page to the front
+    for (; ix > 0; ix--) {
+        Swap(decodedPageNos[ix], decodedPageNos[ix - 1]);
+        Swap(decodedCoords[ix], decodedCoords[ix - 1]);
+    }
+    return decodedCoords[0];
+}
+
+PageTextCacheStats PageTextCache::GetStats()
+{
+    ScopedCritSec scope(&access);
+    PageTextCacheStats result = stats;
+    result.maxBytes = maxBytes;
+    return result;
+}
+
+// extracts pages for PageTextCache::ExtractPages until none are left
+// (all but the first thread use their own engine clone, since most engines
+// only allow one thread at a time to access a document)
+class PageTextExtractor : public ThreadBase {
+    PageTextCache *cache;
+    BaseEngine *engine;
+    bool useClone;
+    LONG *nextPageNo;
+    int endPage;
+    LONG *donePages;
+
+public:
+    PageTextExtractor(PageTextCache *cache, BaseEngine *engine, bool useClone,
+                      LONG *nextPageNo, int endPage, LONG *donePages) :
+        ThreadBase("PageTextExtractor"), cache(cache), engine(engine), useClone(useClone),
+        nextPageNo(nextPageNo), endPage(endPage), donePages(donePages) { }
+    virtual ~PageTextExtractor() { }
+
+    virtual void Run() {
+        BaseEngine *clone = useClone ? engine->Clone() : NULL;
+        if (useClone && !clone)
+            return;
+        int pageNo;
+        while (!WasCancelRequested() && (pageNo = InterlockedIncrement(nextPageNo)) <= endPage) {
+            cache->ExtractPage(pageNo, clone ? clone : engine);
+            InterlockedIncrement(donePages);
+        }
+        delete clone;
+    }
+};
+
+bool PageTextCache::ExtractPages(int startPage, int endPage, int maxThreads, ProgressUpdateUI *tracker)
+{
+    CrashIf(startPage < 1 || endPage > engine->PageCount());
+    // only start threads for the pages which haven't been cached yet
+    while (startPage <= endPage && HasData(startPage))
+        startPage++;
+    while (endPage >= startPage && HasData(endPage))
+        endPage--;
+    if (startPage > endPage)
+        return true;
+
+    if (maxThreads <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        maxThreads = (int)si.dwNumberOfProcessors;
+    }
+    int threadCount = limitValue(min(maxThreads, endPage - startPage + 1), 1, MAX_TEXT_EXTRACTION_THREADS);
+
+    LONG nextPageNo = startPage - 1, donePages = 0;
+    Vec<PageTextExtractor *> workers;
+    for (int i = 0; i < threadCount; i++) {
+        workers.Append(new PageTextExtractor(this, engine, i > 0, &nextPageNo, endPage, &donePages));
+        workers.Last()->Start();
+    }
+
+    // progress is reported and cancellation checked on the calling thread only
+    bool canceled = false;
+    for (size_t i = 0; i < workers.Count(); ) {
+        if (tracker && !canceled) {
+            tracker->UpdateProgress(donePages, endPage - startPage + 1);
+            if (tracker->WasCanceled()) {
+                for (size_t j = 0; j < workers.Count(); j++) {
+                    workers.At(j)->RequestCancel();
+                }
+                canceled = true;
+            }
+        }
+        if (workers.At(i)->Join(tracker ? 100 : INFINITE))
+            i++;
+    }
+    DeleteVecMembers(workers);
+
+    return !canceled;
 }
 
 TextSelection::TextSelection(BaseEngine *engine, PageTextCache *textCache) :
@@ -93,9 +506,10 @@ void TextSelection::Reset()
 // glyph following it, which will be the first glyph (not) to be selected)
 int TextSelection::FindClosestGlyph(int pageNo, double x, double y)
 {
-    int textLen;
-    RectI *coords;
-    textCache->GetData(pageNo, &textLen, &coords);
+    int textLen = textCache->GetTextLen(pageNo);
+    ScopedMem<RectI> coords(textCache->GetCoords(pageNo, 0, textLen));
+    if (!coords)
+        return 0;
     PointD pt = PointD(x, y);
 
     unsigned int maxDist = UINT_MAX;
@@ -143,12 +557,16 @@ int TextSelection::FindClosestGlyph(int pageNo, double x, double y)
 
 void TextSelection::FillResultRects(int pageNo, int glyph, int length, WStrVec *lines)
 {
-    int len;
-    RectI *coords;
-    const WCHAR *text = textCache->GetData(pageNo, &len, &coords);
+    int len = textCache->GetTextLen(pageNo);
     CrashIf(len < glyph + length);
+    // also decode the glyph following the range (for cutting the right edge)
+    int count = min(length + 1, len - glyph);
+    ScopedMem<RectI> coords(textCache->GetCoords(pageNo, glyph, count));
+    ScopedMem<WCHAR> text(lines ? textCache->GetText(pageNo) : NULL);
+    if (!coords || (lines && !text))
+        return;
     RectI mediabox = engine->PageMediabox(pageNo).Round();
-    RectI *c = &coords[glyph], *end = c + length;
+    RectI *c = coords, *end = c + length;
     while (c < end) {
         // skip line breaks
         for (; c < end && !c->x && !c->dx; c++);
@@ -163,12 +581,12 @@ void TextSelection::FillResultRects(int pageNo, int glyph, int length, WStrVec *
             continue;
 
         if (lines) {
-            lines->Push(str::DupN(text + (c0 - coords), c - c0));
+            lines->Push(str::DupN(text + glyph + (c0 - coords), c - c0));
             continue;
         }
 
         // cut the right edge, if it overlaps the next character
-        if (c < coords + len && (c->x || c->dx) && bbox.x < c->x && bbox.x + bbox.dx > c->x)
+        if (c < coords + count && (c->x || c->dx) && bbox.x < c->x && bbox.x + bbox.dx > c->x)
             bbox.dx = c->x - bbox.x;
 
         result.len++;
@@ -185,30 +603,30 @@ void TextSelection::FillResultRects(int pageNo, int glyph, int length, WStrVec *
 
 bool TextSelection::IsOverGlyph(int pageNo, double x, double y)
 {
-    int textLen;
-    RectI *coords;
-    textCache->GetData(pageNo, &textLen, &coords);
-
+    int textLen = textCache->GetTextLen(pageNo);
     int glyphIx = FindClosestGlyph(pageNo, x, y);
+    // only the boxes of the closest glyph and the one before it are needed
+    int first = max(glyphIx - 1, 0);
+    ScopedMem<RectI> coords(textCache->GetCoords(pageNo, first, min(glyphIx + 1, textLen) - first));
+    if (!coords)
+        return false;
+
     PointI pt = PointD(x, y).Convert<int>();
     // when over the right half of a glyph, FindClosestGlyph returns the
     // index of the next glyph, in which case glyphIx must be decremented
-    if (glyphIx == textLen || !coords[glyphIx].Contains(pt))
+    if (glyphIx == textLen || !coords[glyphIx - first].Contains(pt))
         glyphIx--;
     if (-1 == glyphIx)
         return false;
-    return coords[glyphIx].Contains(pt);
+    return coords[glyphIx - first].Contains(pt);
 }
 
 void TextSelection::StartAt(int pageNo, int glyphIx)
 {
     startPage = pageNo;
     startGlyph = glyphIx;
-    if (glyphIx < 0) {
-        int textLen;
-        textCache->GetData(pageNo, &textLen);
-        startGlyph += textLen + 1;
-    }
+    if (glyphIx < 0)
+        startGlyph += textCache->GetTextLen(pageNo) + 1;
 }
 
 void TextSelection::SelectUpTo(int pageNo, int glyphIx)
@@ -218,11 +636,8 @@ void TextSelection::SelectUpTo(int pageNo, int glyphIx)
 
     endPage = pageNo;
     endGlyph = glyphIx;
-    if (glyphIx < 0) {
-        int textLen;
-        textCache->GetData(pageNo, &textLen);
-        endGlyph = textLen + glyphIx + 1;
-    }
+    if (glyphIx < 0)
+        endGlyph = textCache->GetTextLen(pageNo) + glyphIx + 1;
 
     result.len = 0;
     int fromPage = min(startPage, endPage), toPage = max(startPage, endPage);
@@ -232,8 +647,7 @@ void TextSelection::SelectUpTo(int pageNo, int glyphIx)
         Swap(fromGlyph, toGlyph);
 
     for (int page = fromPage; page <= toPage; page++) {
-        int textLen;
-        textCache->GetData(page, &textLen);
+        int textLen = textCache->GetTextLen(page);
 
         int glyph = page == fromPage ? fromGlyph : 0;
         int length = (page == toPage ? toGlyph : textLen) - glyph;
@@ -246,7 +660,9 @@ void TextSelection::SelectWordAt(int pageNo, double x, double y)
 {
     int ix = FindClosestGlyph(pageNo, x, y);
     int textLen;
-    const WCHAR *text = textCache->GetData(pageNo, &textLen);
+    ScopedMem<WCHAR> text(textCache->GetText(pageNo, &textLen));
+    if (!text)
+        return;
 
     for (; ix > 0; ix--)
         if (!iswordchar(text[ix - 1]))
@@ -274,8 +690,7 @@ WCHAR *TextSelection::ExtractText(WCHAR *lineSep)
     GetGlyphRange(&fromPage, &fromGlyph, &toPage, &toGlyph);
 
     for (int page = fromPage; page <= toPage; page++) {
-        int textLen;
-        textCache->GetData(page, &textLen);
+        int textLen = textCache->GetTextLen(page);
         int glyph = page == fromPage ? fromGlyph : 0;
         int length = (page == toPage ? toGlyph : textLen) - glyph;
         if (length > 0)
@@ -12,23 +12,78 @@ class WStrVec;
 
 inline unsigned int distSq(int x, int y) { return x * x + y * y; }
 
+class ProgressUpdateUI
+{
+public:
+    virtual void UpdateProgress(int current, int total) = 0;
+    virtual bool WasCanceled() = 0;
+    virtual ~ProgressUpdateUI() { }
+};
+
+// the number of engine clones used at most by PageTextCache::ExtractPages
+#define MAX_TEXT_EXTRACTION_THREADS 4
+// the size of all cached pages' compact text and glyph boxes (the least
+// recently used pages are extracted again after having been evicted)
+#define DEFAULT_TEXT_CACHE_BYTES    (64 * 1024 * 1024)
+// the number of pages for which all glyph boxes are kept decoded
+#define DECODED_PAGES_CACHED        2
+
+// maximum amount of memory used per document for caching extracted text
+// (0 restores the default)
+void SetTextCacheSize(size_t maxBytes);
+
+struct PageTextCacheStats {
+    int     pages;
+    int     chars;
+    int     evictions;
+    // size of the compact representation of all cached pages
+    size_t  bytes;
+    size_t  maxBytes;
+    // size the cached pages would take as plain WCHARs and RectIs
+    size_t  uncompactedBytes;
+};
+
+struct CompactPageText;
+
 class PageTextCache {
     BaseEngine* engine;
-    RectI    ** coords;
-    WCHAR    ** text;
-    int       * lens;
-#ifdef DEBUG
-    size_t      debug_size;
-#endif
+    CompactPageText ** pages;
+    size_t      maxBytes;
+    PageTextCacheStats stats;
+    // incremented on every access for finding the least recently used page
+    unsigned int useCount;
+    // the glyph boxes of the most recently hit tested pages (most recent first),
+    // since e.g. FindClosestGlyph needs all of them on every mouse move
+    int         decodedPageNos[DECODED_PAGES_CACHED];
+    RectI *     decodedCoords[DECODED_PAGES_CACHED];
 
     CRITICAL_SECTION access;
 
+    CompactPageText *LockPage(int pageNo);
+    void    EvictPages(int keepPageNo);
+    const RectI *GetDecodedCoords(int pageNo, CompactPageText *page, bool decode);
+
 public:
-    explicit PageTextCache(BaseEngine *engine);
+    // uses the size set with SetTextCacheSize if maxBytes is 0
+    explicit PageTextCache(BaseEngine *engine, size_t maxBytes=0);
     ~PageTextCache();
 
     bool HasData(int pageNo);
-    const WCHAR *GetData(int pageNo, int *lenOut=NULL, RectI **coordsOut=NULL);
+    // returns a copy of a page's text (caller must free the result)
+    WCHAR * GetText(int pageNo, int *lenOut=NULL);
+    int     GetTextLen(int pageNo);
+    // returns the bounding boxes of the glyphs [glyph, glyph + count)
+    // of a page's text (caller must free the result)
+    RectI * GetCoords(int pageNo, int glyph, int count);
+    PageTextCacheStats GetStats();
+
+    // extracts the text of a page with the given engine (which may be
+    // a clone of this cache's engine) unless it's already been cached
+    void ExtractPage(int pageNo, BaseEngine *engine);
+    // extracts the text of all pages between startPage and endPage which
+    // haven't been cached yet with up to maxThreads threads in parallel
+    // (0 for one thread per processor); returns false if tracker canceled
+    bool ExtractPages(int startPage, int endPage, int maxThreads=0, ProgressUpdateUI *tracker=NULL);
 };
 
 struct TextSel {
@@ -29,6 +29,7 @@ WindowInfo::WindowInfo(HWND hwnd) :
     hwndSidebarSplitter(NULL), hwndFavSplitter(NULL),
     hwndInfotip(NULL), infotipVisible(false),
     findThread(NULL), findCanceled(false), printThread(NULL), printCanceled(false),
+    selectAllThread(NULL), selectAllCanceled(false),
     showSelection(false), mouseAction(MA_IDLE), dragStartPending(false),
     prevZoomVirtual(INVALID_ZOOM), prevDisplayMode(DM_AUTOMATIC),
     loadedFilePath(NULL), currPageNo(0),
@@ -214,6 +215,11 @@ void WindowInfo::SaveDownload(const WCHAR *url, const unsigned char *data, size_
     LinkSaver(*this, path::GetBaseName(plainUrl)).SaveEmbedded(data, len);
 }
 
+bool WindowInfo::ExtractPagesText(int startPage, int endPage)
+{
+    return ExtractTextWithProgress(this, startPage, endPage);
+}
+
 BaseEngine *LinkHandler::engine() const
 {
     if (!owner || !owner->dm)
@@ -335,8 +341,7 @@ void LinkHandler::ScrollTo(PageDestination *dest)
         if (DEST_USE_DEFAULT == rect.x)
             scroll.x = -1;
         if (DEST_USE_DEFAULT == rect.y) {
-            PageInfo *pageInfo = dm->GetPageInfo(dm->CurrentPageNo());
-            scroll.y = -(pageInfo->pageOnScreen.y - dm->GetWindowMargin()->top);
+            scroll.y = -(dm->GetPageOnScreen(dm->CurrentPageNo()).y - dm->GetWindowMargin()->top);
             scroll.y = max(scroll.y, 0); // Adobe Reader never shows the previous page
         }
     }
@@ -173,6 +173,9 @@ public:
     HANDLE          findThread;
     bool            findCanceled;
 
+    HANDLE          selectAllThread;
+    bool            selectAllCanceled;
+
     LinkHandler *   linkHandler;
     PageElement *   linkOnLastButtonDown;
     const WCHAR *   url;
@@ -232,6 +235,7 @@ public:
     virtual void UpdateScrollbars(SizeI canvas);
     virtual void RequestRendering(int pageNo);
     virtual void CleanUp(DisplayModel *dm);
+    virtual bool ExtractPagesText(int startPage, int endPage);
 };
 
 class LinkHandler {
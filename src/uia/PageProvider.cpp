@@ -142,10 +142,11 @@ HRESULT STDMETHODCALLTYPE SumatraUIAutomationPageProvider::get_BoundingRectangle
     RECT canvasRect;
     GetWindowRect(canvasHwnd, &canvasRect);
 
-    pRetVal->left   = canvasRect.left + page->pageOnScreen.x;
-    pRetVal->top    = canvasRect.top + page->pageOnScreen.y;
-    pRetVal->width  = page->pageOnScreen.dx;
-    pRetVal->height = page->pageOnScreen.dy;
+    RectI pageOnScreen = dm->GetPageOnScreen(pageNum);
+    pRetVal->left   = canvasRect.left + pageOnScreen.x;
+    pRetVal->top    = canvasRect.top + pageOnScreen.y;
+    pRetVal->width  = pageOnScreen.dx;
+    pRetVal->height = pageOnScreen.dy;
 
     return S_OK;
 }
@@ -221,7 +222,7 @@ HRESULT STDMETHODCALLTYPE SumatraUIAutomationPageProvider::get_Value(BSTR *pRetV
     if (released)
         return E_FAIL;
 
-    const WCHAR * pageContent = dm->textCache->GetData(pageNum);
+    ScopedMem<WCHAR> pageContent(dm->textCache->GetText(pageNum));
     if (!pageContent) {
         *pRetVal = NULL;
         return S_OK;
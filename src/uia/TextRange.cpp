@@ -96,9 +96,7 @@ int SumatraUIAutomationTextRange::GetPageGlyphCount(int pageNum)
     AssertCrash(document->IsDocumentLoaded());
     AssertCrash(pageNum > 0);
 
-    int pageLen;
-    document->GetDM()->textCache->GetData(pageNum, &pageLen);
-    return pageLen;
+    return document->GetDM()->textCache->GetTextLen(pageNum);
 }
 
 int SumatraUIAutomationTextRange::GetPageCount()
@@ -130,7 +128,9 @@ int SumatraUIAutomationTextRange::FindPreviousWordEndpoint(int pageno, int idx,
 {
     // based on TextSelection::SelectWordAt
     int textLen;
-    const WCHAR *pageText = document->GetDM()->textCache->GetData(pageno, &textLen);
+    ScopedMem<WCHAR> pageText(document->GetDM()->textCache->GetText(pageno, &textLen));
+    if (!pageText)
+        return idx;
     
     if (dontReturnInitial) {
         for (; idx > 0; idx--)
@@ -151,7 +151,9 @@ int SumatraUIAutomationTextRange::FindPreviousWordEndpoint(int pageno, int idx,
 int SumatraUIAutomationTextRange::FindNextWordEndpoint(int pageno, int idx, bool dontReturnInitial)
 {
     int textLen;
-    const WCHAR *pageText = document->GetDM()->textCache->GetData(pageno, &textLen);
+    ScopedMem<WCHAR> pageText(document->GetDM()->textCache->GetText(pageno, &textLen));
+    if (!pageText)
+        return idx;
 
     if (dontReturnInitial) {
         for (; idx < textLen; idx++)
@@ -172,7 +174,9 @@ int SumatraUIAutomationTextRange::FindNextWordEndpoint(int pageno, int idx, bool
 int SumatraUIAutomationTextRange::FindPreviousLineEndpoint(int pageno, int idx, bool dontReturnInitial)
 {
     int textLen;
-    const WCHAR *pageText = document->GetDM()->textCache->GetData(pageno, &textLen);
+    ScopedMem<WCHAR> pageText(document->GetDM()->textCache->GetText(pageno, &textLen));
+    if (!pageText)
+        return idx;
     
     if (dontReturnInitial)
     {
@@ -194,7 +198,9 @@ int SumatraUIAutomationTextRange::FindPreviousLineEndpoint(int pageno, int idx,
 int SumatraUIAutomationTextRange::FindNextLineEndpoint(int pageno, int idx, bool dontReturnInitial)
 {
     int textLen;
-    const WCHAR *pageText = document->GetDM()->textCache->GetData(pageno, &textLen);
+    ScopedMem<WCHAR> pageText(document->GetDM()->textCache->GetText(pageno, &textLen));
+    if (!pageText)
+        return idx;
     
     if (dontReturnInitial) {
         for (; idx < textLen; idx++)
@@ -440,6 +446,10 @@ HRESULT STDMETHODCALLTYPE SumatraUIAutomationTextRange::GetText(int maxLength, B
         return S_OK;
     }
 
+    // e.g. the document range spans all pages
+    if (startPage < endPage && !document->GetDM()->ExtractPagesText(startPage, endPage))
+        return E_ABORT;
+
     TextSelection selection(document->GetDM()->engine, document->GetDM()->textCache);
     selection.StartAt(startPage, startGlyph);
     selection.SelectUpTo(endPage, endGlyph);
@@ -16,7 +16,7 @@ using namespace Gdiplus;
 
 namespace fitz {
 
-static Bitmap *ImageFromJpegData(fz_context *ctx, const char *data, int len)
+static Bitmap *ImageFromJpegData(fz_context *ctx, const char *data, int len, int l2factor)
 {
     int w = 0, h = 0, xres = 0, yres = 0;
     fz_colorspace *cs = NULL;
@@ -28,7 +28,7 @@ static Bitmap *ImageFromJpegData(fz_context *ctx, const char *data, int len)
     fz_try(ctx) {
         fz_load_jpeg_info(ctx, (unsigned char *)data, len, &w, &h, &xres, &yres, &cs);
         stm = fz_open_memory(ctx, (unsigned char *)data, len);
-        stm = fz_open_dctd(stm, -1, 0, NULL);
+        stm = fz_open_dctd(stm, -1, l2factor, NULL);
     }
     fz_catch(ctx) {
         fz_drop_colorspace(ctx, cs);
@@ -44,6 +44,9 @@ static Bitmap *ImageFromJpegData(fz_context *ctx, const char *data, int len)
         fz_drop_colorspace(ctx, cs);
         return NULL;
     }
+    // libjpeg-turbo rounds the scaled dimensions up
+    w = (w + (1 << l2factor) - 1) >> l2factor;
+    h = (h + (1 << l2factor) - 1) >> l2factor;
 
     Bitmap bmp(w, h, fmt);
     bmp.SetResolution(xres, yres);
@@ -142,7 +145,7 @@ static Bitmap *ImageFromJp2Data(fz_context *ctx, const char *data, int len)
     return bmp.Clone(0, 0, w, h, PixelFormat32bppARGB);
 }
 
-Bitmap *ImageFromData(const char *data, size_t len)
+Bitmap *ImageFromData(const char *data, size_t len, int l2factor)
 {
     if (len > INT_MAX || len < 12)
         return NULL;
@@ -153,7 +156,7 @@ Bitmap *ImageFromData(const char *data, size_t len)
 
     Bitmap *result = NULL;
     if (str::StartsWith(data, "\xFF\xD8"))
-        result = ImageFromJpegData(ctx, data, (int)len);
+        result = ImageFromJpegData(ctx, data, (int)len, limitValue(l2factor, 0, 3));
     else if (memeq(data, "\0\0\0\x0CjP  \x0D\x0A\x87\x0A", 12))
         result = ImageFromJp2Data(ctx, data, (int)len);
 
@@ -169,7 +172,7 @@ Bitmap *ImageFromData(const char *data, size_t len)
 #include "FzImgReader.h"
 
 namespace fitz {
-Gdiplus::Bitmap *ImageFromData(const char *data, size_t len) { return NULL; }
+Gdiplus::Bitmap *ImageFromData(const char *data, size_t len, int l2factor) { return NULL; }
 }
 
 #endif
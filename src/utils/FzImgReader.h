@@ -8,7 +8,9 @@
 
 namespace fitz {
 
-Gdiplus::Bitmap *ImageFromData(const char *data, size_t len);
+// JPEG images can be decoded at a reduced size of 1/2^l2factor
+// (libjpeg-turbo supports DCT scaling for l2factor up to 3)
+Gdiplus::Bitmap *ImageFromData(const char *data, size_t len, int l2factor=0);
 
 }
 
@@ -0,0 +1,193 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "PageLayout.h"
+
+namespace pagelayout {
+
+SizeI LayoutRows(RectI *pages, int count, int firstPageNo, const Options& opts, SizeI viewPort)
+{
+    /* calculate the position of each page on the canvas, given their sizes
+       and the number of columns. You can think of it as a simple table
+       layout i.e. rows with a fixed number of columns. */
+    int columns = opts.columns;
+    CrashIf(columns < 1 || columns > 2);
+    int columnMaxWidth[2] = { 0, 0 };
+    int pageInARow = 0;
+    int rowMaxPageDy = 0;
+    int currPosY = opts.marginTop;
+    for (int i = 0; i < count; i++) {
+        RectI& pos = pages[i];
+        if (rowMaxPageDy < pos.dy)
+            rowMaxPageDy = pos.dy;
+        pos.y = currPosY;
+
+        if (opts.showCover && firstPageNo + i == 1 && columns - pageInARow > 1)
+            pageInARow++;
+        CrashIf(pageInARow >= dimof(columnMaxWidth));
+        if (columnMaxWidth[pageInARow] < pos.dx)
+            columnMaxWidth[pageInARow] = pos.dx;
+
+        pageInARow++;
+        if (pageInARow == columns) {
+            /* starting next row */
+            currPosY += rowMaxPageDy + opts.spacing.dy;
+            rowMaxPageDy = 0;
+            pageInARow = 0;
+        }
+    }
+
+    if (pageInARow != 0) {
+        /* this is a partial row */
+        currPosY += rowMaxPageDy + opts.spacing.dy;
+    }
+    int canvasDy = currPosY + opts.marginBottom - opts.spacing.dy;
+
+    if (columns == 2 && opts.pageCount == 1) {
+        /* don't center a single page over two columns */
+        if (opts.showCover)
+            columnMaxWidth[0] = columnMaxWidth[1];
+        else
+            columnMaxWidth[1] = columnMaxWidth[0];
+    }
+    int canvasDx = opts.marginLeft + columnMaxWidth[0] + (columns == 2 ? opts.spacing.dx + columnMaxWidth[1] : 0) + opts.marginRight;
+
+    /* since pages can be smaller than the drawing area, center them in x axis */
+    int offX = 0, mirrorDx = canvasDx;
+    if (canvasDx < viewPort.dx) {
+        offX = (viewPort.dx - canvasDx) / 2;
+        mirrorDx = viewPort.dx;
+    }
+
+    pageInARow = 0;
+    int pageOffX = offX + opts.marginLeft;
+    for (int i = 0; i < count; i++) {
+        RectI& pos = pages[i];
+        // leave first spot empty in cover page mode
+        if (opts.showCover && firstPageNo + i == 1) {
+            CrashIf(pageInARow >= dimof(columnMaxWidth));
+            pageOffX += columnMaxWidth[pageInARow] + opts.spacing.dx;
+            ++pageInARow;
+        }
+        CrashIf(pageInARow >= dimof(columnMaxWidth));
+        // center pages in a single column but right/left align them when using two columns
+        if (1 == columns)
+            pos.x = pageOffX + (columnMaxWidth[0] - pos.dx) / 2;
+        else if (0 == pageInARow)
+            pos.x = pageOffX + columnMaxWidth[0] - pos.dx;
+        else
+            pos.x = pageOffX;
+        // center the cover page over the first two spots in non-continuous mode
+        if (opts.showCover && firstPageNo + i == 1 && !opts.continuous)
+            pos.x = offX + opts.marginLeft + (columnMaxWidth[0] + opts.spacing.dx + columnMaxWidth[1] - pos.dx) / 2;
+        // mirror the page layout when displaying a Right-to-Left document
+        if (opts.r2l && columns > 1)
+            pos.x = mirrorDx - pos.x - pos.dx;
+
+        pageOffX += columnMaxWidth[pageInARow] + opts.spacing.dx;
+        ++pageInARow;
+        if (pageInARow == columns) {
+            pageOffX = offX + opts.marginLeft;
+            pageInARow = 0;
+        }
+    }
+
+    /* if pages are smaller than drawing area in y axis, y-center them */
+    if (canvasDy < viewPort.dy) {
+        int offY = opts.marginTop + (viewPort.dy - canvasDy) / 2;
+        for (int i = 0; i < count; i++) {
+            pages[i].y += offY;
+        }
+    }
+
+    return SizeI(canvasDx, canvasDy);
+}
+
+// returns the index of the first page with a top greater than y
+// (or equal to y, if orEqual is set) or count if there's none
+static int FindFirstBelow(const RectI *pages, int count, int y, bool orEqual)
+{
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (pages[mid].y > y || orEqual && pages[mid].y == y)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+bool FindRows(const RectI *pages, int count, int y, int dy, int *first, int *last)
+{
+    // rows end before the next one starts, so the first row which could
+    // intersect the band is the last one starting at or above y
+    int start = FindFirstBelow(pages, count, y, false);
+    if (start > 0)
+        start = FindFirstBelow(pages, start - 1, pages[start - 1].y, true);
+    int end = FindFirstBelow(pages, count, y + max(dy, 1) - 1, false);
+    if (start >= end)
+        return false;
+    *first = start;
+    *last = end - 1;
+    return true;
+}
+
+int FindPageAt(const RectI *pages, int count, PointI pt)
+{
+    // pages also contain the points on their bottom edge, which might
+    // be the top edge of the following row's pages (without spacing)
+    int first, last;
+    if (!FindRows(pages, count, pt.y - 1, 2, &first, &last))
+        return -1;
+    for (int i = first; i <= last; i++) {
+        if (pages[i].Contains(pt))
+            return i;
+    }
+    return -1;
+}
+
+static double DistSq(const RectI& page, PointI pt)
+{
+    double dx = pt.x - page.x - page.dx / 2;
+    double dy = pt.y - page.y - page.dy / 2;
+    return dx * dx + dy * dy;
+}
+
+int FindClosestPage(const RectI *pages, int count, PointI pt)
+{
+    int found = FindPageAt(pages, count, pt);
+    if (found >= 0 || count <= 0)
+        return found;
+
+    // the centers of a row's pages lie between the row's top and the next row's top,
+    // so search outwards from pt.y until rows are further away than the closest center
+    int split = FindFirstBelow(pages, count, pt.y, false);
+    double minDist = 0;
+    for (int i = split - 1; i >= 0; i--) {
+        if (found >= 0 && i + 1 < split && pages[i].y != pages[i + 1].y) {
+            double rowDist = (double)pt.y - pages[i + 1].y;
+            if (rowDist * rowDist > minDist)
+                break;
+        }
+        double dist = DistSq(pages[i], pt);
+        if (found < 0 || dist <= minDist) {
+            found = i;
+            minDist = dist;
+        }
+    }
+    for (int i = split; i < count; i++) {
+        double rowDist = (double)pages[i].y - pt.y;
+        if (found >= 0 && rowDist * rowDist > minDist)
+            break;
+        double dist = DistSq(pages[i], pt);
+        if (found < 0 || dist < minDist) {
+            found = i;
+            minDist = dist;
+        }
+    }
+    return found;
+}
+
+}
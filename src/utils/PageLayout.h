@@ -0,0 +1,48 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#ifndef PageLayout_h
+#define PageLayout_h
+
+// platform-neutral core of DisplayModel's layout (so that it can be tested and
+// benchmarked without a window or a document): pages are laid out in rows of
+// one or two columns from top to bottom, so that all pages of a row share the
+// same top and no page reaches into the following row. This allows finding the
+// pages at a given position through a binary search over the rows' tops.
+namespace pagelayout {
+
+struct Options {
+    // number of pages per row (1 or 2)
+    int     columns;
+    // whether the first page is displayed alone in the second column
+    bool    showCover;
+    // whether all pages are laid out (or just the ones of a single row)
+    bool    continuous;
+    // whether the columns are mirrored for Right-to-Left documents
+    bool    r2l;
+    // total number of pages in the document
+    int     pageCount;
+    int     marginTop, marginRight, marginBottom, marginLeft;
+    // spacing between columns (dx) and rows (dy)
+    SizeI   spacing;
+};
+
+// lays out count pages (the first of which is page firstPageNo) with the sizes
+// given in pages[i].dx/dy by setting pages[i].x/y; pages are centered in viewPort
+// if they don't fill it; returns the size needed for all pages (which is smaller
+// than viewPort in either direction in which they've been centered)
+SizeI   LayoutRows(RectI *pages, int count, int firstPageNo, const Options& opts, SizeI viewPort);
+
+// returns the range of pages (as indices into pages) of all rows which intersect
+// the band from y to y + dy (the first row might end right above y) or false
+// if there aren't any
+bool    FindRows(const RectI *pages, int count, int y, int dy, int *first, int *last);
+// returns the index of the page containing pt or -1 if there's none
+int     FindPageAt(const RectI *pages, int count, PointI pt);
+// returns the index of the page containing pt or whose center is closest
+// to pt (the one with the lower index for ties) or -1 if count is 0
+int     FindClosestPage(const RectI *pages, int count, PointI pt);
+
+}
+
+#endif
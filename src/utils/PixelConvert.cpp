@@ -0,0 +1,78 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "PixelConvert.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HAS_SSE2
+#endif
+
+namespace pixelconvert {
+
+// the hash table from colors to palette indices is at most half full
+#define PALETTE_HASH_BITS 9
+
+int ToPalette(const unsigned char *src, int w, int h, int srcStride,
+              unsigned char *dst, int dstStride, uint32_t palette[256])
+{
+    short slots[1 << PALETTE_HASH_BITS];
+    for (size_t i = 0; i < sizeof(slots) / sizeof(slots[0]); i++) {
+        slots[i] = -1;
+    }
+    int paletteSize = 0;
+    // most pixels have the same color as their left neighbor
+    uint32_t lastColor = 0;
+    int lastIndex = -1;
+
+    for (int y = 0; y < h; y++) {
+        const uint32_t *row = (const uint32_t *)(src + (size_t)y * srcStride);
+        unsigned char *out = dst + (size_t)y * dstStride;
+        for (int x = 0; x < w; x++) {
+            uint32_t c = row[x] & 0x00FFFFFF;
+            if (c != lastColor || lastIndex < 0) {
+                uint32_t slot = (c * 0x9E3779B1) >> (32 - PALETTE_HASH_BITS);
+                while (slots[slot] >= 0 && palette[slots[slot]] != c) {
+                    slot = (slot + 1) & ((1 << PALETTE_HASH_BITS) - 1);
+                }
+                if (slots[slot] < 0) {
+                    if (256 == paletteSize)
+                        return -1;
+                    palette[paletteSize] = c;
+                    slots[slot] = (short)paletteSize++;
+                }
+                lastColor = c;
+                lastIndex = slots[slot];
+            }
+            out[x] = (unsigned char)lastIndex;
+        }
+    }
+
+    return paletteSize;
+}
+
+void SwapRedBlue(const unsigned char *src, unsigned char *dst, size_t count)
+{
+    size_t i = 0;
+
+#ifdef HAS_SSE2
+    __m128i maskRB = _mm_set1_epi32(0x00FF00FF);
+    __m128i maskGA = _mm_set1_epi32((int)0xFF00FF00);
+    for (; i + 4 <= count; i += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        __m128i rb = _mm_and_si128(px, maskRB);
+        rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_or_si128(_mm_and_si128(px, maskGA), rb));
+    }
+#endif
+
+    for (; i < count; i++) {
+        unsigned char c0 = src[i * 4], c2 = src[i * 4 + 2];
+        dst[i * 4] = c2;
+        dst[i * 4 + 1] = src[i * 4 + 1];
+        dst[i * 4 + 2] = c0;
+        dst[i * 4 + 3] = src[i * 4 + 3];
+    }
+}
+
+}
@@ -0,0 +1,32 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#ifndef PixelConvert_h
+#define PixelConvert_h
+
+// platform-neutral conversions of 32-bit pixel data (e.g. as rendered by
+// fitz) into the formats used for GDI bitmaps (so that they can be tested
+// and benchmarked without creating any bitmaps)
+// Note: this only depends on the C runtime
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace pixelconvert {
+
+// maps w x h 32-bit pixels (with srcStride bytes per row) to 8-bit indices
+// (with dstStride bytes per row) into a palette of at most 256 colors (the
+// fourth component is ignored and cleared in the palette, so that BGRX pixels
+// result in RGBQUADs); returns the number of palette colors or -1 as soon as
+// a 257th color is found (in which case dst and palette are incomplete)
+int     ToPalette(const unsigned char *src, int w, int h, int srcStride,
+                  unsigned char *dst, int dstStride, uint32_t palette[256]);
+
+// swaps the first and the third component of count 32-bit pixels (i.e.
+// converts RGBA to BGRA and back); src and dst may be the same (uses SSE2
+// where available)
+void    SwapRedBlue(const unsigned char *src, unsigned char *dst, size_t count);
+
+}
+
+#endif
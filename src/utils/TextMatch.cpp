@@ -0,0 +1,241 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+#include "TextMatch.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HAS_SSE2
+#endif
+
+namespace textmatch {
+
+// CJK ideographs start at U+2E80, so the word character table can be smaller
+#define WORD_CHAR_TABLE_SIZE 0x2E80
+
+// wchar_t is UTF-32 on most platforms other than Windows
+#if WCHAR_MAX > 0xFFFF
+#define Fold(fold, c) ((uint32_t)(c) <= 0xFFFF ? (fold)[c] : (c))
+#else
+#define Fold(fold, c) (fold)[c]
+#endif
+
+static struct MatchTables {
+    wchar_t       fold[65536];
+    uint32_t    wordChars[WORD_CHAR_TABLE_SIZE / 32];
+
+    // filled before any thread could start searching
+    MatchTables() {
+        for (int i = 0; i < 65536; i++) {
+            fold[i] = (wchar_t)i;
+        }
+#ifdef _WIN32
+        // CharLowerBuff converts the same as CharLower one character at a time
+        CharLowerBuffW(fold + 1, 65535);
+#else
+        for (int i = 1; i < 65536; i++) {
+            wint_t lower = towlower((wint_t)i);
+            // (the table can't hold a lower case form outside the BMP)
+            fold[i] = lower <= 0xFFFF ? (wchar_t)lower : (wchar_t)i;
+        }
+#endif
+        memset(wordChars, 0, sizeof(wordChars));
+        for (int i = 1; i < WORD_CHAR_TABLE_SIZE; i++) {
+#ifdef _WIN32
+            bool isWordChar = IsCharAlphaNumericW((wchar_t)i) != 0;
+#else
+            bool isWordChar = iswalnum((wint_t)i) != 0;
+#endif
+            if (isWordChar)
+                wordChars[i / 32] |= 1u << (i % 32);
+        }
+    }
+} gTables;
+
+wchar_t FoldCase(wchar_t c)
+{
+    return Fold(gTables.fold, c);
+}
+
+void FoldCase(wchar_t *dst, const wchar_t *src, size_t len)
+{
+    const wchar_t *fold = gTables.fold;
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = Fold(fold, src[i]);
+    }
+}
+
+bool IsNonCjkWordChar(wchar_t c)
+{
+    return (uint32_t)c < WORD_CHAR_TABLE_SIZE && (gTables.wordChars[c / 32] & (1u << (c % 32))) != 0;
+}
+
+static inline bool IsMatchAt(const wchar_t *text, const wchar_t *find, size_t findLen)
+{
+    return memcmp(text, find, findLen * sizeof(wchar_t)) == 0;
+}
+
+// Horspool's algorithm (with a skip table indexed by the characters' low byte)
+// is used wherever SSE2 isn't available and for the few remaining positions
+static const wchar_t *FindNextHorspool(const wchar_t *text, size_t pos, size_t lastPos, const wchar_t *find, size_t findLen)
+{
+    size_t skip[256];
+    for (int i = 0; i < 256; i++) {
+        skip[i] = findLen;
+    }
+    for (size_t i = 0; i + 1 < findLen; i++) {
+        skip[find[i] & 0xFF] = findLen - 1 - i;
+    }
+    wchar_t last = find[findLen - 1];
+    while (pos <= lastPos) {
+        wchar_t c = text[pos + findLen - 1];
+        if (c == last && IsMatchAt(text + pos, find, findLen - 1))
+            return text + pos;
+        pos += skip[c & 0xFF];
+    }
+    return NULL;
+}
+
+static const wchar_t *FindPrevHorspool(const wchar_t *text, size_t pos, const wchar_t *find, size_t findLen)
+{
+    size_t skip[256];
+    for (int i = 0; i < 256; i++) {
+        skip[i] = findLen;
+    }
+    for (size_t i = findLen - 1; i > 0; i--) {
+        skip[find[i] & 0xFF] = i;
+    }
+    wchar_t first = find[0];
+    for (;;) {
+        wchar_t c = text[pos];
+        if (c == first && IsMatchAt(text + pos + 1, find + 1, findLen - 1))
+            return text + pos;
+        if (pos < skip[c & 0xFF])
+            return NULL;
+        pos -= skip[c & 0xFF];
+    }
+}
+
+#ifdef HAS_SSE2
+// a vector holds eight UTF-16 or four UTF-32 characters
+#if WCHAR_MAX > 0xFFFF
+#define VEC_CHARS 4
+#define VecSet(c) _mm_set1_epi32((int)(c))
+#define VecCmpEq(a, b) _mm_cmpeq_epi32(a, b)
+#else
+#define VEC_CHARS 8
+#define VecSet(c) _mm_set1_epi16((short)(c))
+#define VecCmpEq(a, b) _mm_cmpeq_epi16(a, b)
+#endif
+// number of bits per character in a candidate mask
+#define MASK_BITS (16 / VEC_CHARS)
+
+// compares the first and the last character of find at VEC_CHARS positions
+// at once and returns a mask with MASK_BITS bits set for every candidate position
+static inline int CandidateMask(const wchar_t *c, __m128i first, __m128i last, size_t findLen)
+{
+    __m128i head = _mm_loadu_si128((const __m128i *)c);
+    __m128i tail = _mm_loadu_si128((const __m128i *)(c + findLen - 1));
+    return _mm_movemask_epi8(_mm_and_si128(VecCmpEq(head, first), VecCmpEq(tail, last)));
+}
+#endif
+
+const wchar_t *FindNext(const wchar_t *text, size_t textLen, size_t offset, const wchar_t *find, size_t findLen)
+{
+    if (0 == findLen || offset > textLen || textLen - offset < findLen)
+        return NULL;
+    size_t pos = offset, lastPos = textLen - findLen;
+
+#ifdef HAS_SSE2
+    __m128i first = VecSet(find[0]);
+    __m128i last = VecSet(find[findLen - 1]);
+    for (; pos + VEC_CHARS - 1 <= lastPos; pos += VEC_CHARS) {
+        int mask = CandidateMask(text + pos, first, last, findLen);
+        for (int i = 0; mask; i++, mask >>= MASK_BITS) {
+            if ((mask & 1) && IsMatchAt(text + pos + i, find, findLen))
+                return text + pos + i;
+        }
+    }
+    if (pos > lastPos)
+        return NULL;
+#endif
+
+    return FindNextHorspool(text, pos, lastPos, find, findLen);
+}
+
+const wchar_t *FindPrev(const wchar_t *text, size_t textLen, size_t offset, const wchar_t *find, size_t findLen)
+{
+    if (0 == findLen || 0 == offset || textLen < findLen)
+        return NULL;
+    // the last position at which a match may start
+    size_t pos = offset - 1 < textLen - findLen ? offset - 1 : textLen - findLen;
+
+#ifdef HAS_SSE2
+    __m128i first = VecSet(find[0]);
+    __m128i last = VecSet(find[findLen - 1]);
+    for (; pos >= VEC_CHARS; pos -= VEC_CHARS) {
+        const wchar_t *c = text + pos - (VEC_CHARS - 1);
+        int mask = CandidateMask(c, first, last, findLen);
+        for (int i = VEC_CHARS - 1; mask; i--, mask = (mask << MASK_BITS) & 0xFFFF) {
+            if ((mask & 0x8000) && IsMatchAt(c + i, find, findLen))
+                return c + i;
+        }
+    }
+#endif
+
+    return FindPrevHorspool(text, pos, find, findLen);
+}
+
+static inline bool IsWs(wchar_t c)
+{
+    return iswspace(c) != 0;
+}
+
+#define SkipWhitespace(c) for (; IsWs(*(c)); (c)++)
+
+int MatchLen(const wchar_t *find, const wchar_t *start, bool caseSensitive)
+{
+    const wchar_t *match = find, *end = start;
+    const wchar_t *fold = gTables.fold;
+
+    while (*match) {
+        if (!*end)
+            return -1;
+        if (*match == *end || (!caseSensitive && Fold(fold, *match) == Fold(fold, *end)))
+            /* characters are identical */;
+        else if (IsWs(*match) && IsWs(*end))
+            /* treat all whitespace as identical */;
+        // TODO: Adobe Reader seems to have a more extensive list of
+        //       normalizations - is there an easier way?
+        else if (*match == '-' && (0x2010 <= *end && *end <= 0x2014))
+            /* make HYPHEN-MINUS also match HYPHEN, NON-BREAKING HYPHEN,
+               FIGURE DASH, EN DASH and EM DASH (but not the other way around) */;
+        else if (*match == '\'' && (0x2018 <= *end && *end <= 0x201b))
+            /* make APOSTROPHE also match LEFT/RIGHT SINGLE QUOTATION MARK */;
+        else if (*match == '"' && (0x201c <= *end && *end <= 0x201f))
+            /* make QUOTATION MARK also match LEFT/RIGHT DOUBLE QUOTATION MARK */;
+        else
+            return -1;
+        match++;
+        end++;
+        // treat "??" and "? ?" differently, since '?' could have been a word
+        // character that's just missing an encoding (and '?' is the replacement
+        // character); cf. http://code.google.com/p/sumatrapdf/issues/detail?id=1574
+        if ((*match && !IsNonCjkWordChar(*(match - 1)) && (*(match - 1) != '?' || *match != '?')) ||
+            (IsWs(*(match - 1)) && IsWs(*(end - 1)))) {
+            SkipWhitespace(match);
+            SkipWhitespace(end);
+        }
+    }
+
+    return (int)(end - start);
+}
+
+}
@@ -0,0 +1,39 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#ifndef TextMatch_h
+#define TextMatch_h
+
+// platform-neutral core of TextSearch (so that it can be tested and benchmarked
+// without any document): all character classes needed for matching are looked up
+// in tables which are filled once at startup (using CharLower and IsCharAlphaNumeric
+// on Windows, towlower and iswalnum elsewhere)
+// Note: this only depends on the C runtime (and windows.h on Windows)
+
+#include <stddef.h>
+
+namespace textmatch {
+
+// returns the lower case form of a UTF-16 code unit (same as CharLower;
+// characters outside the BMP are returned unchanged)
+wchar_t FoldCase(wchar_t c);
+// folds len characters from src into dst (which may be the same as src)
+void    FoldCase(wchar_t *dst, const wchar_t *src, size_t len);
+// alphanumeric characters except for CJK ideographs (cf. isnoncjkwordchar)
+bool    IsNonCjkWordChar(wchar_t c);
+
+// returns the first occurrence of find (an exact match) which starts at
+// or after text + offset or NULL (uses SSE2 where available)
+const wchar_t *FindNext(const wchar_t *text, size_t textLen, size_t offset, const wchar_t *find, size_t findLen);
+// returns the last occurrence of find (an exact match) which starts
+// before text + offset or NULL (uses SSE2 where available)
+const wchar_t *FindPrev(const wchar_t *text, size_t textLen, size_t offset, const wchar_t *find, size_t findLen);
+
+// tries to match find at start with whitespace tolerance (ignoring all whitespace
+// except after alphanumeric characters) and with '-', '\'' and '"' also matching
+// their typographic variants; returns the length of the matched text or -1
+int     MatchLen(const wchar_t *find, const wchar_t *start, bool caseSensitive);
+
+}
+
+#endif
@@ -0,0 +1,118 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "PageLayout.h"
+
+// must be last due to assert() over-write
+#include "UtAssert.h"
+
+static pagelayout::Options GetOptions(int columns, bool showCover, int pageCount)
+{
+    pagelayout::Options opts;
+    opts.columns = columns;
+    opts.showCover = showCover;
+    opts.continuous = true;
+    opts.r2l = false;
+    opts.pageCount = pageCount;
+    opts.marginTop = opts.marginRight = opts.marginBottom = opts.marginLeft = 0;
+    opts.spacing = SizeI(10, 10);
+    return opts;
+}
+
+static void LayoutRowsTest()
+{
+    pagelayout::Options opts = GetOptions(1, false, 3);
+    opts.marginTop = 2; opts.marginRight = 4; opts.marginBottom = 6; opts.marginLeft = 8;
+    opts.spacing = SizeI(10, 20);
+    RectI pages[3] = { RectI(0, 0, 100, 200), RectI(0, 0, 50, 100), RectI(0, 0, 100, 200) };
+    SizeI canvas = pagelayout::LayoutRows(pages, 3, 1, opts, SizeI(1000, 100));
+    utassert(canvas == SizeI(112, 548));
+    // centered horizontally but not vertically
+    utassert(pages[0] == RectI(452, 2, 100, 200));
+    utassert(pages[1] == RectI(477, 222, 50, 100));
+    utassert(pages[2] == RectI(452, 342, 100, 200));
+
+    // the cover page is displayed alone in the second column
+    opts = GetOptions(2, true, 3);
+    RectI book[3] = { RectI(0, 0, 100, 150), RectI(0, 0, 100, 150), RectI(0, 0, 100, 150) };
+    canvas = pagelayout::LayoutRows(book, 3, 1, opts, SizeI(210, 50));
+    utassert(canvas == SizeI(210, 310));
+    utassert(book[0].x == 110 && book[0].y == 0);
+    utassert(book[1].x == 0 && book[1].y == 160);
+    utassert(book[2].x == 110 && book[2].y == 160);
+    opts.r2l = true;
+    pagelayout::LayoutRows(book, 3, 1, opts, SizeI(210, 50));
+    utassert(book[0].x == 0 && book[1].x == 110 && book[2].x == 0);
+}
+
+static void FindRowsTest()
+{
+    pagelayout::Options opts = GetOptions(1, false, 3);
+    opts.marginTop = 2; opts.spacing = SizeI(10, 20);
+    RectI pages[3] = { RectI(0, 0, 100, 200), RectI(0, 0, 50, 100), RectI(0, 0, 100, 200) };
+    pagelayout::LayoutRows(pages, 3, 1, opts, SizeI(100, 100));
+
+    int first, last;
+    utassert(!pagelayout::FindRows(pages, 3, 0, 2, &first, &last));
+    utassert(pagelayout::FindRows(pages, 3, 2, 1, &first, &last) && 0 == first && 0 == last);
+    utassert(pagelayout::FindRows(pages, 3, 210, 20, &first, &last) && 0 == first && 1 == last);
+    utassert(pagelayout::FindRows(pages, 3, 400, 1000, &first, &last) && 2 == first && 2 == last);
+    utassert(!pagelayout::FindRows(pages, 0, 0, 1000, &first, &last));
+
+    utassert(0 == pagelayout::FindPageAt(pages, 3, PointI(0, 2)));
+    utassert(1 == pagelayout::FindPageAt(pages, 3, PointI(25, 322)));
+    utassert(-1 == pagelayout::FindPageAt(pages, 3, PointI(25, 323)));
+    utassert(-1 == pagelayout::FindPageAt(pages, 3, PointI(76, 250)));
+    utassert(1 == pagelayout::FindClosestPage(pages, 3, PointI(75, 330)));
+    utassert(2 == pagelayout::FindClosestPage(pages, 3, PointI(75, 10000)));
+    utassert(-1 == pagelayout::FindClosestPage(pages, 0, PointI()));
+
+    // rows of two pages share the same top
+    opts = GetOptions(2, false, 3);
+    RectI book[3] = { RectI(0, 0, 100, 150), RectI(0, 0, 100, 50), RectI(0, 0, 100, 150) };
+    pagelayout::LayoutRows(book, 3, 1, opts, SizeI(210, 50));
+    utassert(pagelayout::FindRows(book, 3, 100, 1, &first, &last) && 0 == first && 1 == last);
+    utassert(pagelayout::FindRows(book, 3, 200, 1, &first, &last) && 2 == first && 2 == last);
+    // the page with the lower index wins for ties
+    utassert(0 == pagelayout::FindClosestPage(book, 3, PointI(105, 50)));
+}
+
+static void FindManyPagesTest()
+{
+    // compare the binary searches to a linear search for many pages of varying size
+    const int count = 20000;
+    ScopedMem<RectI> pages(AllocArray<RectI>(count));
+    uint32_t seed = 1;
+    for (int i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        pages[i] = RectI(0, 0, 50 + (seed >> 16) % 100, 50 + (seed >> 8) % 100);
+    }
+    pagelayout::Options opts = GetOptions(2, true, count);
+    SizeI canvas = pagelayout::LayoutRows(pages, count, 1, opts, SizeI(200, 200));
+
+    for (int n = 0; n < 1000; n++) {
+        seed = seed * 1103515245 + 12345;
+        PointI pt((seed >> 8) % (canvas.dx + 20) - 10, (int)((seed >> 4) % (canvas.dy + 20)) - 10);
+        int found = -1, closest = -1;
+        double minDist = 0;
+        for (int i = 0; i < count && found < 0; i++) {
+            if (pages[i].Contains(pt))
+                found = i;
+            double dx = pt.x - pages[i].x - pages[i].dx / 2, dy = pt.y - pages[i].y - pages[i].dy / 2;
+            if (closest < 0 || dx * dx + dy * dy < minDist) {
+                closest = i;
+                minDist = dx * dx + dy * dy;
+            }
+        }
+        utassert(pagelayout::FindPageAt(pages, count, pt) == found);
+        utassert(pagelayout::FindClosestPage(pages, count, pt) == (found >= 0 ? found : closest));
+    }
+}
+
+void PageLayoutTest()
+{
+    LayoutRowsTest();
+    FindRowsTest();
+    FindManyPagesTest();
+}
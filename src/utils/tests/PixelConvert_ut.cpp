@@ -0,0 +1,66 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "PixelConvert.h"
+
+// must be last due to assert() over-write
+#include "UtAssert.h"
+
+static void ToPaletteTest()
+{
+    // 3 x 2 pixels in rows of 16 bytes (with the fourth component varying)
+    const unsigned char pixels[] = {
+        1, 2, 3, 255,   1, 2, 3, 0,     4, 5, 6, 255,   99, 99, 99, 99,
+        4, 5, 6, 255,   7, 8, 9, 255,   1, 2, 3, 128,   99, 99, 99, 99,
+    };
+    unsigned char indices[2 * 4] = { 0 };
+    uint32_t palette[256];
+    utassert(3 == pixelconvert::ToPalette(pixels, 3, 2, 16, indices, 4, palette));
+    const unsigned char expected[] = { 0, 0, 1, 0, 1, 2, 0, 0 };
+    utassert(memeq(indices, expected, sizeof(expected)));
+    utassert(palette[0] == 0x030201 && palette[1] == 0x060504 && palette[2] == 0x090807);
+
+    // exactly 256 colors still fit into a palette, 257 don't
+    size_t w = 257;
+    ScopedMem<uint32_t> many(AllocArray<uint32_t>(w));
+    ScopedMem<unsigned char> manyIndices(AllocArray<unsigned char>(w));
+    for (size_t i = 0; i < w; i++) {
+        // colors which only differ in the upper bits of the blue component
+        many[i] = 0xFF000000 | (uint32_t)((i % 256) << 16) | (uint32_t)(i / 256);
+    }
+    utassert(256 == pixelconvert::ToPalette((unsigned char *)many.Get(), 256, 1, 256 * 4, manyIndices, 256, palette));
+    for (size_t i = 0; i < 256; i++) {
+        utassert(manyIndices[i] == i && palette[i] == (many[i] & 0xFFFFFF));
+    }
+    utassert(-1 == pixelconvert::ToPalette((unsigned char *)many.Get(), (int)w, 1, (int)w * 4, manyIndices, (int)w, palette));
+}
+
+static void SwapRedBlueTest()
+{
+    // odd sizes and offsets exercise both the SSE2 and the remaining pixels
+    unsigned char src[4 * 11], dst[4 * 11];
+    for (size_t i = 0; i < dimof(src); i++) {
+        src[i] = (unsigned char)(i * 7 + 3);
+    }
+    for (size_t count = 0; count <= 10; count++) {
+        memset(dst, 0, sizeof(dst));
+        pixelconvert::SwapRedBlue(src + 4, dst, count);
+        for (size_t i = 0; i < count * 4; i += 4) {
+            utassert(dst[i] == src[4 + i + 2] && dst[i + 1] == src[4 + i + 1] &&
+                     dst[i + 2] == src[4 + i] && dst[i + 3] == src[4 + i + 3]);
+        }
+        utassert(count == 10 || 0 == dst[count * 4]);
+    }
+    // swapping twice in place restores the original pixels
+    memcpy(dst, src, sizeof(src));
+    pixelconvert::SwapRedBlue(dst, dst, 11);
+    pixelconvert::SwapRedBlue(dst, dst, 11);
+    utassert(memeq(dst, src, sizeof(src)));
+}
+
+void PixelConvertTest()
+{
+    ToPaletteTest();
+    SwapRedBlueTest();
+}
@@ -0,0 +1,117 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "TextMatch.h"
+
+// must be last due to assert() over-write
+#include "UtAssert.h"
+
+static const WCHAR *FindNextSlow(const WCHAR *text, size_t textLen, size_t offset, const WCHAR *find, size_t findLen)
+{
+    for (size_t i = offset; i + findLen <= textLen; i++) {
+        if (memcmp(text + i, find, findLen * sizeof(WCHAR)) == 0)
+            return text + i;
+    }
+    return NULL;
+}
+
+static const WCHAR *FindPrevSlow(const WCHAR *text, size_t textLen, size_t offset, const WCHAR *find, size_t findLen)
+{
+    if (findLen > textLen)
+        return NULL;
+    for (size_t i = min(offset, textLen - findLen + 1); i > 0; i--) {
+        if (memcmp(text + i - 1, find, findLen * sizeof(WCHAR)) == 0)
+            return text + i - 1;
+    }
+    return NULL;
+}
+
+static void FindTest()
+{
+    const WCHAR *text = L"abcabcabd";
+    utassert(textmatch::FindNext(text, 9, 0, L"abc", 3) == text);
+    utassert(textmatch::FindNext(text, 9, 1, L"abc", 3) == text + 3);
+    utassert(textmatch::FindNext(text, 9, 4, L"abc", 3) == NULL);
+    utassert(textmatch::FindNext(text, 9, 0, L"abd", 3) == text + 6);
+    utassert(textmatch::FindNext(text, 9, 10, L"a", 1) == NULL);
+    utassert(textmatch::FindPrev(text, 9, 9, L"abc", 3) == text + 3);
+    utassert(textmatch::FindPrev(text, 9, 3, L"abc", 3) == text);
+    utassert(textmatch::FindPrev(text, 9, 0, L"abc", 3) == NULL);
+    // matches may extend beyond the offset
+    utassert(textmatch::FindPrev(text, 9, 7, L"abd", 3) == text + 6);
+    utassert(textmatch::FindPrev(text, 9, 6, L"abd", 3) == NULL);
+
+    // matches at every position within a vector (of eight UTF-16 resp.
+    // four UTF-32 characters) and at every distance from the text's end
+    WCHAR buf[40];
+    for (size_t textLen = 16; textLen <= 32; textLen += 16) {
+        for (size_t findLen = 1; findLen <= 3; findLen++) {
+            for (size_t pos = 0; pos < 16 && pos + findLen <= textLen; pos++) {
+                for (size_t i = 0; i < textLen; i++) {
+                    buf[i] = 'x';
+                }
+                memcpy(buf + pos, L"abc", findLen * sizeof(WCHAR));
+                utassert(textmatch::FindNext(buf, textLen, 0, L"abc", findLen) == buf + pos);
+                utassert(textmatch::FindNext(buf, textLen, pos + 1, L"abc", findLen) == NULL);
+                utassert(textmatch::FindPrev(buf, textLen, textLen, L"abc", findLen) == buf + pos);
+                utassert(textmatch::FindPrev(buf, textLen, pos, L"abc", findLen) == NULL);
+            }
+        }
+    }
+
+    // compare against a naive search over a large synthetic text with
+    // a small alphabet (so that there are many partial matches) and
+    // characters sharing their low byte (cf. the Horspool skip table)
+    const WCHAR alphabet[] = { 'a', 'b', ' ', 0x161, 0x2061 };
+    size_t textLen = 64 * 1024;
+    ScopedMem<WCHAR> big(AllocArray<WCHAR>(textLen + 1));
+    unsigned int seed = 1;
+    for (size_t i = 0; i < textLen; i++) {
+        seed = seed * 1103515245 + 12345;
+        big[i] = alphabet[(seed >> 16) % dimof(alphabet)];
+    }
+    for (size_t findLen = 1; findLen <= 12; findLen++) {
+        for (size_t offset = 0; offset < textLen; offset += 997) {
+            const WCHAR *find = big + (offset * 7 + findLen) % (textLen - findLen);
+            utassert(textmatch::FindNext(big, textLen, offset, find, findLen) ==
+                     FindNextSlow(big, textLen, offset, find, findLen));
+            utassert(textmatch::FindPrev(big, textLen, offset, find, findLen) ==
+                     FindPrevSlow(big, textLen, offset, find, findLen));
+        }
+    }
+}
+
+static void MatchLenTest()
+{
+    utassert(textmatch::FoldCase('A') == 'a' && textmatch::FoldCase('a') == 'a');
+    utassert(textmatch::FoldCase('Z') == 'z' && textmatch::FoldCase('-') == '-');
+    WCHAR folded[6];
+    textmatch::FoldCase(folded, L"AbC.D", 6);
+    utassert(str::Eq(folded, L"abc.d"));
+    utassert(textmatch::IsNonCjkWordChar('x') && textmatch::IsNonCjkWordChar('7'));
+    utassert(!textmatch::IsNonCjkWordChar(' ') && !textmatch::IsNonCjkWordChar(0x4E00));
+
+    utassert(3 == textmatch::MatchLen(L"abc", L"ABCD", false));
+    utassert(-1 == textmatch::MatchLen(L"abc", L"ABCD", true));
+    utassert(-1 == textmatch::MatchLen(L"abc", L"ab", false));
+    // all whitespace matches, but it's only optional after non-word characters
+    utassert(5 == textmatch::MatchLen(L"a b c", L"a\tb\nc", false));
+    utassert(-1 == textmatch::MatchLen(L"a b", L"ab", false));
+    utassert(3 == textmatch::MatchLen(L"a, b", L"a,b", false));
+    utassert(4 == textmatch::MatchLen(L"a,b", L"a, b", false));
+    // typographic dashes and quotes are only matched by their ASCII variants
+    utassert(3 == textmatch::MatchLen(L"a-b", L"a\x2013" L"b", true));
+    utassert(-1 == textmatch::MatchLen(L"a\x2013" L"b", L"a-b", true));
+    utassert(3 == textmatch::MatchLen(L"'a'", L"\x2018" L"a\x2019", false));
+    utassert(3 == textmatch::MatchLen(L"\"a\"", L"\x201c" L"a\x201d", false));
+    // "??" must not match "? ?" (cf. TextMatch.cpp)
+    utassert(2 == textmatch::MatchLen(L"??", L"??", false));
+    utassert(-1 == textmatch::MatchLen(L"??", L"? ?", false));
+}
+
+void TextMatchTest()
+{
+    FindTest();
+    MatchLenTest();
+}
@@ -0,0 +1,226 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// synthetic benchmarks for the platform-neutral utils (which
+// don't need any document), e.g. for comparing code paths:
+//   bench_util.exe [iterations]
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "PixelConvert.h"
+#include "TextMatch.h"
+
+// the size of the synthetic text searched through
+#define BENCH_TEXT_LEN  (4 * 1024 * 1024)
+// the size of the synthetic page (about US Letter at 200 dpi)
+#define BENCH_PAGE_DX   1700
+#define BENCH_PAGE_DY   2200
+
+static double TimeInMs()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return now.QuadPart * 1000.0 / freq.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+#endif
+}
+
+// a deterministic generator, so that all runs measure the same work
+static unsigned int gSeed = 1;
+
+static unsigned int Rand()
+{
+    gSeed = gSeed * 1103515245 + 12345;
+    return gSeed >> 16;
+}
+
+// pseudo-words in mixed case with a few typographic characters
+// thrown in, broken into lines like extracted page text
+static wchar_t *GenerateText(size_t len)
+{
+    static const wchar_t extra[] = { 0xE4, 0xDF, 0x2013, 0x2019, 0x201C, 0x3042 };
+    wchar_t *text = (wchar_t *)malloc((len + 1) * sizeof(wchar_t));
+    if (!text)
+        return NULL;
+    size_t lineLen = 0;
+    for (size_t i = 0; i < len; i++, lineLen++) {
+        unsigned int r = Rand() % 100;
+        if (lineLen > 60 && r < 20) {
+            text[i] = '\n';
+            lineLen = 0;
+        }
+        else if (r < 16)
+            text[i] = ' ';
+        else if (r < 18)
+            text[i] = extra[Rand() % (sizeof(extra) / sizeof(extra[0]))];
+        else if (r < 25)
+            text[i] = (wchar_t)('A' + Rand() % 26);
+        else
+            text[i] = (wchar_t)('a' + Rand() % 26);
+    }
+    text[len] = '\0';
+    return text;
+}
+
+static void PrintResult(const char *name, const wchar_t *arg, double ms, size_t bytes, int iterations)
+{
+    printf("%-16s %-18ls %8.2f ms  %8.1f MB/s\n", name, arg, ms / iterations,
+           ms > 0 ? bytes * (double)iterations / (ms * 1000.0) : 0.0);
+}
+
+static void BenchFind(const wchar_t *text, size_t len, const wchar_t *find, int iterations)
+{
+    size_t findLen = wcslen(find);
+    double start = TimeInMs();
+    for (int i = 0; i < iterations; i++) {
+        for (const wchar_t *c = text; (c = textmatch::FindNext(text, len, c - text, find, findLen)) != NULL; c++) {
+        }
+    }
+    PrintResult("FindNext", find, TimeInMs() - start, len * sizeof(wchar_t), iterations);
+
+    start = TimeInMs();
+    for (int i = 0; i < iterations; i++) {
+        for (const wchar_t *c = text + len; (c = textmatch::FindPrev(text, len, c - text, find, findLen)) != NULL; ) {
+        }
+    }
+    PrintResult("FindPrev", find, TimeInMs() - start, len * sizeof(wchar_t), iterations);
+}
+
+// the same steps as a case-insensitive TextSearch (fold the text
+// once, find the anchor and then match the whole string there)
+static void BenchFindCaseInsensitive(const wchar_t *text, size_t len, const wchar_t *find, int iterations)
+{
+    wchar_t *folded = (wchar_t *)malloc(len * sizeof(wchar_t));
+    if (!folded)
+        return;
+    wchar_t anchor[32];
+    size_t anchorLen = 0;
+    for (; find[anchorLen] && find[anchorLen] != ' ' && anchorLen < 31; anchorLen++) {
+        anchor[anchorLen] = textmatch::FoldCase(find[anchorLen]);
+    }
+
+    double start = TimeInMs();
+    for (int i = 0; i < iterations; i++) {
+        textmatch::FoldCase(folded, text, len);
+        for (const wchar_t *c = folded; (c = textmatch::FindNext(folded, len, c - folded, anchor, anchorLen)) != NULL; c++) {
+            textmatch::MatchLen(find, text + (c - folded), false);
+        }
+    }
+    PrintResult("FoldCase+Match", find, TimeInMs() - start, len * sizeof(wchar_t), iterations);
+    free(folded);
+}
+
+// BGRX pixels of a text-like page (mostly white with anti-aliased dark runs),
+// optionally with a photo-like image (with far more than 256 colors) at the bottom
+static unsigned char *GeneratePage(int w, int h, bool photo)
+{
+    unsigned char *data = (unsigned char *)malloc((size_t)w * h * 4);
+    if (!data)
+        return NULL;
+    unsigned char shade = 255;
+    for (int y = 0; y < h; y++) {
+        unsigned char *row = data + (size_t)y * w * 4;
+        for (int x = 0; x < w; x++) {
+            if (photo && y >= h * 9 / 10) {
+                row[x * 4] = (unsigned char)(x + Rand() % 4);
+                row[x * 4 + 1] = (unsigned char)y;
+                row[x * 4 + 2] = (unsigned char)(x ^ y);
+            }
+            else {
+                // switch between white, black and a few gray levels
+                if (Rand() % 8 == 0)
+                    shade = (y / 20) % 3 == 0 ? 255 : Rand() % 4 == 0 ? (unsigned char)(Rand() % 16 * 17) : 255;
+                row[x * 4] = row[x * 4 + 1] = row[x * 4 + 2] = shade;
+            }
+            row[x * 4 + 3] = 0xFF;
+        }
+    }
+    return data;
+}
+
+static void BenchToPalette(const unsigned char *page, int w, int h, const wchar_t *desc, int iterations)
+{
+    unsigned char *indices = (unsigned char *)malloc((size_t)w * h);
+    if (!indices)
+        return;
+    uint32_t palette[256];
+    double start = TimeInMs();
+    for (int i = 0; i < iterations; i++) {
+        pixelconvert::ToPalette(page, w, h, w * 4, indices, w, palette);
+    }
+    PrintResult("ToPalette", desc, TimeInMs() - start, (size_t)w * h * 4, iterations);
+    free(indices);
+}
+
+// the plain loop SwapRedBlue falls back to where SSE2 isn't available
+static void SwapRedBlueScalar(const unsigned char *src, unsigned char *dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        unsigned char c0 = src[i * 4], c2 = src[i * 4 + 2];
+        dst[i * 4] = c2;
+        dst[i * 4 + 1] = src[i * 4 + 1];
+        dst[i * 4 + 2] = c0;
+        dst[i * 4 + 3] = src[i * 4 + 3];
+    }
+}
+
+static void BenchSwapRedBlue(unsigned char *page, int w, int h, int iterations)
+{
+    size_t count = (size_t)w * h;
+    double start = TimeInMs();
+    for (int i = 0; i < iterations; i++) {
+        pixelconvert::SwapRedBlue(page, page, count);
+    }
+    PrintResult("SwapRedBlue", L"", TimeInMs() - start, count * 4, iterations);
+
+    start = TimeInMs();
+    for (int i = 0; i < iterations; i++) {
+        SwapRedBlueScalar(page, page, count);
+    }
+    PrintResult("SwapRedBlue", L"(scalar)", TimeInMs() - start, count * 4, iterations);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 10;
+    if (iterations <= 0)
+        iterations = 1;
+    printf("Running benchmarks (%d iterations)\n", iterations);
+
+    wchar_t *text = GenerateText(BENCH_TEXT_LEN);
+    if (!text)
+        return 1;
+    BenchFind(text, BENCH_TEXT_LEN, L"e", iterations);
+    BenchFind(text, BENCH_TEXT_LEN, L"abc", iterations);
+    BenchFind(text, BENCH_TEXT_LEN, L"not to be found", iterations);
+    BenchFindCaseInsensitive(text, BENCH_TEXT_LEN, L"ab c", iterations);
+    BenchFindCaseInsensitive(text, BENCH_TEXT_LEN, L"quick brown fox", iterations);
+    free(text);
+
+    unsigned char *page = GeneratePage(BENCH_PAGE_DX, BENCH_PAGE_DY, false);
+    if (!page)
+        return 1;
+    BenchToPalette(page, BENCH_PAGE_DX, BENCH_PAGE_DY, L"(text)", iterations);
+    BenchSwapRedBlue(page, BENCH_PAGE_DX, BENCH_PAGE_DY, iterations);
+    free(page);
+    // ToPalette only gives up once it gets to the photo
+    page = GeneratePage(BENCH_PAGE_DX, BENCH_PAGE_DY, true);
+    if (!page)
+        return 1;
+    BenchToPalette(page, BENCH_PAGE_DX, BENCH_PAGE_DY, L"(photo)", iterations);
+    free(page);
+
+    return 0;
+}
@@ -12,6 +12,12 @@ extern void SumatraPDF_UnitTests();
 // in src/mui/SvgPath_ut.cpp
 extern void SvgPath_UnitTests();
 
+// in src/DrawPaint_ut.cpp
+extern void DrawPaint_UnitTests();
+
+// in src/DrawScale_ut.cpp
+extern void DrawScale_UnitTests();
+
 extern void BaseUtilTest();
 extern void BencTest();
 extern void ByteOrderTests();
@@ -22,12 +28,15 @@ extern void FileUtilTest();
 extern void HtmlPrettyPrintTest();
 extern void HtmlPullParser_UnitTests();
 extern void JsonTest();
+extern void PageLayoutTest();
+extern void PixelConvertTest();
 extern void SettingsUtilTest();
 extern void SigSlotTest();
 extern void SimpleLogTest();
 extern void SquareTreeTest();
 extern void StrFormatTest();
 extern void StrTest();
+extern void TextMatchTest();
 extern void TrivialHtmlParser_UnitTests();
 extern void VarintGobTest();
 extern void VecTest();
@@ -46,18 +55,23 @@ int main(int argc, char **argv)
     HtmlPrettyPrintTest();
     HtmlPullParser_UnitTests();
     JsonTest();
+    PageLayoutTest();
+    PixelConvertTest();
     SettingsUtilTest();
     SigSlotTest();
     SimpleLogTest();
     SquareTreeTest();
     StrFormatTest();
     StrTest();
+    TextMatchTest();
     TrivialHtmlParser_UnitTests();
     VarintGobTest();
     VecTest();
     WinUtilTest();
     SumatraPDF_UnitTests();
     SvgPath_UnitTests();
+    DrawPaint_UnitTests();
+    DrawScale_UnitTests();
     int res = utassert_print_results();
     return res;
 }